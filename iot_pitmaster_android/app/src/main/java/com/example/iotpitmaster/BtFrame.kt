@@ -0,0 +1,103 @@
+package com.example.iotpitmaster
+
+// Framing for the SPP byte stream, the same as bluetooth/bt_frame.hpp on the MCU:
+//   sync (0xa5) | length | sequence | payload (length bytes) | CRC-16 (LE)
+// The CRC is CRC-16/CCITT-FALSE over length, sequence and payload
+const val BT_FRAME_SYNC = 0xa5
+const val BT_FRAME_HEADER_SIZE = 3
+const val BT_FRAME_CRC_SIZE = 2
+const val BT_FRAME_MAX_PAYLOAD = 250
+const val BT_FRAME_OVERHEAD = BT_FRAME_HEADER_SIZE + BT_FRAME_CRC_SIZE
+const val BT_FRAME_MAX_SIZE = BT_FRAME_OVERHEAD + BT_FRAME_MAX_PAYLOAD
+
+private val crcTable = IntArray(256) { i ->
+    var crc = i shl 8
+    repeat(8) {
+        crc = if ((crc and 0x8000) != 0) (crc shl 1) xor 0x1021 else crc shl 1
+    }
+    crc and 0xffff
+}
+
+// CRC-16/CCITT-FALSE
+fun btCrc16(data: ByteArray, offset: Int, length: Int): Int {
+    var crc = 0xffff
+    for (i in offset until offset + length) {
+        crc = ((crc shl 8) xor crcTable[((crc shr 8) xor data[i].toInt()) and 0xff]) and 0xffff
+    }
+    return crc
+}
+
+// Wraps a payload in a frame
+fun btFrameEncode(sequence: Int, payload: ByteArray): ByteArray {
+    require(payload.size <= BT_FRAME_MAX_PAYLOAD) { "a frame holds up to $BT_FRAME_MAX_PAYLOAD bytes" }
+    val frame = ByteArray(payload.size + BT_FRAME_OVERHEAD)
+    frame[0] = BT_FRAME_SYNC.toByte()
+    frame[1] = payload.size.toByte()
+    frame[2] = sequence.toByte()
+    payload.copyInto(frame, BT_FRAME_HEADER_SIZE)
+    val crc = btCrc16(frame, 1, payload.size + 2)
+    frame[BT_FRAME_HEADER_SIZE + payload.size] = (crc and 0xff).toByte()
+    frame[BT_FRAME_HEADER_SIZE + payload.size + 1] = (crc shr 8).toByte()
+    return frame
+}
+
+// Splits the received byte stream into frame payloads
+// A read can end in the middle of a frame or hold several of them, so bytes are kept until a frame is whole
+class BtFrameParser {
+    private val buffer = ByteArray(BT_FRAME_MAX_SIZE * 2)
+    private var buffered = 0
+    var crcErrors = 0
+        private set
+
+    // Parses received bytes, calls onFrame(payload) for every good frame in them
+    fun feed(data: ByteArray, length: Int, onFrame: (ByteArray) -> Unit) {
+        var pos = 0
+        while (pos < length) {
+            val count = minOf(length - pos, buffer.size - buffered)
+            data.copyInto(buffer, buffered, pos, pos + count)
+            buffered += count
+            pos += count
+            parse(onFrame)
+        }
+    }
+
+    // Drops a frame split by a lost connection
+    fun reset() {
+        buffered = 0
+    }
+
+    private fun parse(onFrame: (ByteArray) -> Unit) {
+        var start = 0
+        while (start < buffered) {
+            // resync on the next sync byte
+            if ((buffer[start].toInt() and 0xff) != BT_FRAME_SYNC) {
+                start++
+                continue
+            }
+            if (buffered - start < BT_FRAME_HEADER_SIZE) {
+                break
+            }
+            val length = buffer[start + 1].toInt() and 0xff
+            if (length > BT_FRAME_MAX_PAYLOAD) {
+                start++
+                continue
+            }
+            val size = length + BT_FRAME_OVERHEAD
+            if (buffered - start < size) {
+                break
+            }
+            val crc = (buffer[start + size - 2].toInt() and 0xff) or
+                    ((buffer[start + size - 1].toInt() and 0xff) shl 8)
+            if (crc != btCrc16(buffer, start + 1, length + 2)) {
+                // a sync byte inside some other data, look for the next one
+                crcErrors++
+                start++
+                continue
+            }
+            onFrame(buffer.copyOfRange(start + BT_FRAME_HEADER_SIZE, start + BT_FRAME_HEADER_SIZE + length))
+            start += size
+        }
+        buffer.copyInto(buffer, 0, start, buffered)
+        buffered -= start
+    }
+}
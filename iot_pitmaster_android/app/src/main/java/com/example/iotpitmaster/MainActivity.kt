@@ -34,7 +34,6 @@ import kotlinx.coroutines.cancel
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.launch
 import java.io.IOException
-import java.nio.ByteBuffer
 import java.time.Duration
 import java.util.*
 import java.time.LocalTime
@@ -61,8 +60,20 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
         var m_isConnected: Boolean = false
         var m_address: String? = null
         var m_fragment: String? = "a"
+        private var m_sequence: Int = 0
+
+        //wrap a message in a frame and send it to the ESP
+        @Synchronized
+        fun sendMessage(message: ByteArray) {
+            val frame = btFrameEncode(m_sequence, message)
+            m_sequence = (m_sequence + 1) and 0xff
+            m_bluetoothSocket?.outputStream?.write(frame)
+        }
     }
 
+    private val frameParser = BtFrameParser()
+    private val telemetry = TelemetryDecoder()
+
     override fun onCreate(savedInstanceState: Bundle?) {
         super.onCreate(savedInstanceState)
         setContentView(R.layout.activity_main)
@@ -214,6 +225,8 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
                 Log.i("Bluetooth", "couldn't connect")
             } else {
                 m_isConnected = true
+                //the temperatures are shown by probe role, so ask which probe has which
+                sendMessage(byteArrayOf(MSG_PROBE_CONFIG_REQUEST.toByte()))
             }
         }
     }
@@ -236,6 +249,8 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
         m_bluetoothSocket!!.close()
         m_bluetoothSocket = null
         m_isConnected = false
+        frameParser.reset()
+        telemetry.reset()
     }
 
     override fun onResume() {
@@ -325,7 +340,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
                 val message = ByteArray(2)
                 message[0] = 0.toByte()
                 message[1] = 0.toByte()
-                m_bluetoothSocket?.outputStream?.write(message)
+                sendMessage(message)
 
             }
             R.id.nav_manual -> {
@@ -338,7 +353,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
                 val message = ByteArray(2)
                 message[0] = 0.toByte()
                 message[1] = 1.toByte()
-                m_bluetoothSocket?.outputStream?.write(message)
+                sendMessage(message)
 
             }
         }
@@ -437,7 +452,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
                     convertToProtocol(1, chamberTemperature, false)
                 }
                 Log.i("Temp", "" + message.toString())
-                m_bluetoothSocket?.outputStream?.write(message)
+                sendMessage(message)
             }
         }
     }
@@ -499,7 +514,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
                     convertToProtocol(2, cookTemperature, false)
                 }
                 Log.i("Temp", "" + message.toString())
-                m_bluetoothSocket?.outputStream?.write(message)
+                sendMessage(message)
             }
         }
     }
@@ -516,7 +531,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
             message[0] = 5.toByte()
             message[1] = 1.toByte()
 
-            m_bluetoothSocket?.outputStream?.write(message)
+            sendMessage(message)
         }
     }
 
@@ -532,7 +547,7 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
             message[0] = 6.toByte()
             message[1] = 1.toByte()
 
-            m_bluetoothSocket?.outputStream?.write(message)
+            sendMessage(message)
         }
     }
 
@@ -548,12 +563,12 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
             message[0] = 6.toByte()
             message[1] = 0.toByte()
 
-            m_bluetoothSocket?.outputStream?.write(message)
+            sendMessage(message)
         }
     }
 
     suspend fun readBluetoothData() {
-        val buffer = ByteArray(18)
+        val buffer = ByteArray(1024)
 
         // read the input stream every half second while the app is running
         while (true) {
@@ -568,9 +583,31 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
             //read the message
             try {
                 if (bluetoothSocketInputStream != null) {
-                    bluetoothSocketInputStream.read(buffer)
-                    Log.i("debug", "1")
-                    decodeAndPost(buffer)
+                    //a read can hold part of a frame or several of them
+                    val length = bluetoothSocketInputStream.read(buffer)
+                    if (length > 0) {
+                        frameParser.feed(buffer, length) { payload ->
+                            //status reports are keyframes and deltas, other messages aren't shown yet
+                            if (payload.isNotEmpty() && payload[0].toInt() == MSG_TELEMETRY) {
+                                val probes = telemetry.probes
+                                if (telemetry.decode(payload)) {
+                                    //a probe switched on or off may have a new role too
+                                    if (telemetry.probes != probes) {
+                                        sendMessage(byteArrayOf(MSG_PROBE_CONFIG_REQUEST.toByte()))
+                                    }
+                                    decodeAndPost()
+                                } else {
+                                    Log.i("Bluetooth", "dropped a status report")
+                                }
+                            } else if (payload.isNotEmpty() && payload[0].toInt() == MSG_PROBE_CONFIG) {
+                                if (telemetry.probeConfig(payload)) {
+                                    decodeAndPost()
+                                } else {
+                                    Log.i("Bluetooth", "dropped a probe setting")
+                                }
+                            }
+                        }
+                    }
                 }
             } catch (e: IOException) {
                 e.printStackTrace()
@@ -579,19 +616,15 @@ open class MainActivity : AppCompatActivity(), NavigationView.OnNavigationItemSe
     }
 
     @SuppressLint("SetTextI18n")
-    fun decodeAndPost(readMessage: ByteArray) {
-        readMessage.reverse(0,4)
-        readMessage.reverse(5,9)
-        readMessage.reverse(10,14)
-        val byteBuffer = ByteBuffer.wrap(readMessage)
-
-
-        val chamberTemp: Float = byteBuffer.getFloat(0)
-        val cookTempLeft : Float = byteBuffer.getFloat(5)
-        val cookTempRight : Float = byteBuffer.getFloat(10)
-        val blowFan : Int = byteBuffer.get(15).toInt()
-        val hopper : Int = byteBuffer.get(16).toInt()
-        val damper : Int = byteBuffer.get(17).toInt()
+    fun decodeAndPost() {
+        //the decoder holds the status as of the last report
+        //probes are shown by role, whichever slots the chamber and meat probes are in
+        val chamberTemp: Float = telemetry.chamberC()
+        val cookTempLeft : Float = telemetry.meatC(0)
+        val cookTempRight : Float = telemetry.meatC(1)
+        val blowFan : Int = telemetry.fanDuty
+        val hopper : Int = if ((telemetry.status and TELEMETRY_STATUS_HOPPER_ON) != 0) 1 else 0
+        val damper : Int = if ((telemetry.status and TELEMETRY_STATUS_DAMPER_OPEN) != 0) 1 else 0
 
         //send notification if the temperature is high
         if (chamberTemp > userChamberTemp + 20 || cookTempLeft > userCookTemp + 20 || cookTempRight > userCookTemp + 20) {
@@ -0,0 +1,170 @@
+package com.example.iotpitmaster
+
+// Status reports from the MCU, the same as pid_control/telemetry.hpp:
+//   MSG_TELEMETRY | header | [probe mask | int16 per probe in mask] | [fan] | [status] | [faults] | [fuel]
+// A keyframe carries every channel and names the active probes, a delta only what changed
+const val MSG_TELEMETRY = 7
+
+const val TELEMETRY_CH_PROBES = 0x01
+const val TELEMETRY_CH_FAN = 0x02
+const val TELEMETRY_CH_STATUS = 0x04
+const val TELEMETRY_CH_FAULTS = 0x08
+const val TELEMETRY_CH_FUEL = 0x10
+const val TELEMETRY_CH_ALL = 0x1f
+const val TELEMETRY_KEYFRAME = 0x80
+
+const val TELEMETRY_STATUS_CHAMBER_FAULT = 0x01
+const val TELEMETRY_STATUS_MEAT1_FAULT = 0x02
+const val TELEMETRY_STATUS_MEAT2_FAULT = 0x04
+const val TELEMETRY_STATUS_HOPPER_ON = 0x08
+const val TELEMETRY_STATUS_DAMPER_OPEN = 0x10
+
+const val TELEMETRY_PROBES = 8
+
+// Probe settings, the same as max31855/tc_sampler.hpp:
+//   MSG_PROBE_CONFIG | slot | role | rate Hz | alarm low int16 | alarm high int16
+// The MCU answers MSG_PROBE_CONFIG_REQUEST with one for every probe slot
+const val MSG_PROBE_CONFIG = 19
+const val MSG_PROBE_CONFIG_REQUEST = 20
+const val PROBE_CONFIG_SIZE = 8
+const val PROBE_ROLE_OFF = 0
+const val PROBE_ROLE_CHAMBER = 1
+const val PROBE_ROLE_MEAT = 2
+
+// the roles the board starts its probes in, until the MCU says otherwise
+private val BOARD_PROBE_ROLES = intArrayOf(PROBE_ROLE_CHAMBER, PROBE_ROLE_MEAT, PROBE_ROLE_MEAT)
+
+// Keeps the status as of the last report, deltas only hold the channels that changed
+class TelemetryDecoder {
+    // quarter degrees C by probe slot, 0 for a probe that is off
+    val tempQc = IntArray(TELEMETRY_PROBES)
+    // role by probe slot, from the MCU's MSG_PROBE_CONFIG replies
+    val roles = IntArray(TELEMETRY_PROBES) { slot -> BOARD_PROBE_ROLES.getOrElse(slot) { PROBE_ROLE_OFF } }
+    var probes = 0
+        private set
+    var faults = 0
+        private set
+    var fanDuty = 0
+        private set
+    var status = 0
+        private set
+    // tenths of a gram a minute
+    var fuelDgPerMin = 0
+        private set
+    // false until the first keyframe, a delta before it has nothing to apply to
+    var synced = false
+        private set
+
+    fun tempC(probe: Int): Float {
+        return tempQc[probe] * 0.25F
+    }
+
+    // The chamber as the MCU's controller holds it, the mean of the chamber probes that have not faulted
+    // With all of them faulted it is the mean of their readings, 0 with no chamber probe
+    fun chamberC(): Float {
+        val chamber = (0 until TELEMETRY_PROBES).filter { slot ->
+            (probes and (1 shl slot)) != 0 && roles[slot] == PROBE_ROLE_CHAMBER
+        }
+        val good = chamber.filter { slot -> (faults and (1 shl slot)) == 0 }
+        val used = if (good.isNotEmpty()) good else chamber
+        return if (used.isEmpty()) 0F else used.map { slot -> tempC(slot) }.average().toFloat()
+    }
+
+    // The nth meat probe in slot order, from 0, 0 if there are not that many
+    fun meatC(n: Int): Float {
+        val meat = (0 until TELEMETRY_PROBES).filter { slot ->
+            (probes and (1 shl slot)) != 0 && roles[slot] == PROBE_ROLE_MEAT
+        }
+        return if (n < meat.size) tempC(meat[n]) else 0F
+    }
+
+    // Takes a probe's role from a MSG_PROBE_CONFIG payload, returns false if it is malformed
+    fun probeConfig(payload: ByteArray): Boolean {
+        if (payload.size != PROBE_CONFIG_SIZE || payload[0].toInt() != MSG_PROBE_CONFIG) {
+            return false
+        }
+        val slot = payload[1].toInt() and 0xff
+        if (slot >= TELEMETRY_PROBES) {
+            return false
+        }
+        roles[slot] = payload[2].toInt() and 0xff
+        return true
+    }
+
+    // Drops the state of a lost connection, the MCU sends a keyframe to a phone that connects
+    // and the probe roles once the phone asks for them
+    fun reset() {
+        synced = false
+        for (slot in 0 until TELEMETRY_PROBES) {
+            roles[slot] = BOARD_PROBE_ROLES.getOrElse(slot) { PROBE_ROLE_OFF }
+        }
+    }
+
+    // Applies one MSG_TELEMETRY payload, returns false if it is malformed or a delta arrives before any keyframe
+    fun decode(payload: ByteArray): Boolean {
+        val len = payload.size
+        if (len < 2 || payload[0].toInt() != MSG_TELEMETRY) {
+            return false
+        }
+
+        val header = payload[1].toInt() and 0xff
+        val channels = header and TELEMETRY_CH_ALL
+        val keyframe = (header and TELEMETRY_KEYFRAME) != 0
+        if ((header and (TELEMETRY_CH_ALL or TELEMETRY_KEYFRAME).inv()) != 0 ||
+            (keyframe && channels != TELEMETRY_CH_ALL)) {
+            return false
+        }
+        if (!keyframe && !synced) {
+            return false
+        }
+
+        var pos = 2
+        var mask = 0
+        if ((channels and TELEMETRY_CH_PROBES) != 0) {
+            if (len < pos + 1) {
+                return false
+            }
+            mask = payload[pos++].toInt() and 0xff
+            // a delta only moves probes the last keyframe named
+            if (!keyframe && (mask and probes.inv()) != 0) {
+                return false
+            }
+        }
+        var expected = pos + 2 * Integer.bitCount(mask)
+        for (channel in intArrayOf(TELEMETRY_CH_FAN, TELEMETRY_CH_STATUS, TELEMETRY_CH_FAULTS, TELEMETRY_CH_FUEL)) {
+            if ((channels and channel) != 0) {
+                expected++
+            }
+        }
+        if (len != expected) {
+            return false
+        }
+
+        if (keyframe) {
+            probes = mask
+            tempQc.fill(0)
+        }
+        for (i in 0 until TELEMETRY_PROBES) {
+            if ((mask and (1 shl i)) != 0) {
+                // little-endian int16
+                tempQc[i] = ((payload[pos].toInt() and 0xff) or (payload[pos + 1].toInt() shl 8)).toShort().toInt()
+                pos += 2
+            }
+        }
+        if ((channels and TELEMETRY_CH_FAN) != 0) {
+            fanDuty = payload[pos++].toInt() and 0xff
+        }
+        if ((channels and TELEMETRY_CH_STATUS) != 0) {
+            status = payload[pos++].toInt() and 0xff
+        }
+        if ((channels and TELEMETRY_CH_FAULTS) != 0) {
+            faults = payload[pos++].toInt() and 0xff
+        }
+        if ((channels and TELEMETRY_CH_FUEL) != 0) {
+            fuelDgPerMin = payload[pos++].toInt() and 0xff
+        }
+
+        synced = synced || keyframe
+        return true
+    }
+}
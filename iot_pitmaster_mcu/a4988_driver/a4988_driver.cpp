@@ -5,15 +5,30 @@
  */
 #include "a4988_driver.hpp"
 
-#include <chrono>
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <thread>
 
 #include "driver/gpio.h"
+#include "driver/timer.h"
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+#include "hal/gpio_ll.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 #include "debug.hpp"
 
-using namespace std::chrono_literals;
+// A completed move, or a refused one whose on_done still has to be told
+struct move_done {
+    a4988_driver* driver {nullptr};
+    std::function<void(uint32_t)>* refused {nullptr}; // owned by the queue until the dispatcher calls it
+};
+
+// Completed and refused moves, posted by the step ISRs and move() and drained by the dispatcher thread
+static QueueHandle_t move_done_queue {nullptr};
+static std::once_flag move_dispatcher_started;
 
 // Sets all the gpio to default states
 // Default to enable off, and quarter step size
@@ -76,43 +91,294 @@ void a4988_driver::set_default_gpio_levels() {
     }
 }
 
-// Run the motor continuously
-void a4988_driver::run_motor_continuous() {
+// Sets up the hardware timer used for step pulses
+void a4988_driver::init_step_timer() {
+    std::call_once(move_dispatcher_started, []() {
+        move_done_queue = xQueueCreate(8, sizeof(move_done));
+        std::thread dispatcher(&a4988_driver::move_dispatcher);
+        dispatcher.detach();
+    });
+
+    if (this->m_gpio_step == GPIO_NUM_NC) {
+        std::cout << "Error: " << this->m_name << " step signal is not assigned to a valid GPIO.\n\n";
+        return;
+    }
+
+    // Counts up in microseconds and reloads to 0 on every alarm, so alarm values are intervals
+    const timer_config_t config = {
+        .alarm_en = TIMER_ALARM_DIS,
+        .counter_en = TIMER_PAUSE,
+        .intr_type = TIMER_INTR_LEVEL,
+        .counter_dir = TIMER_COUNT_UP,
+        .auto_reload = TIMER_AUTORELOAD_EN,
+        .divider = STEP_TIMER_DIVIDER,
+    };
+
+    if (timer_init(this->m_timer_group, this->m_timer_idx, &config) != ESP_OK ||
+            timer_isr_callback_add(this->m_timer_group, this->m_timer_idx, &a4988_driver::step_isr, this,
+                    ESP_INTR_FLAG_IRAM) != ESP_OK) {
+        std::cout << "Error: " << this->m_name << " step timer setup failed.\n\n";
+        return;
+    }
+    timer_enable_intr(this->m_timer_group, this->m_timer_idx);
+    this->m_timer_ready = true;
+}
+
+// Thread that hands completed moves from the ISR back to task context
+void a4988_driver::move_dispatcher() {
+    while (true) {
+        move_done done {};
+        if (xQueueReceive(move_done_queue, &done, portMAX_DELAY) != pdPASS)
+            continue;
+        if (done.refused != nullptr) {
+            (*done.refused)(0);
+            delete done.refused;
+        }
+        else if (done.driver != nullptr) {
+            done.driver->finish_move();
+        }
+    }
+}
+
+// Completes the move after the ISR stops the timer, runs on the dispatcher thread
+void a4988_driver::finish_move() {
+    std::promise<uint32_t> promise;
+    std::function<void(uint32_t)> callback;
+    const uint32_t steps = this->m_steps_done;
+    {
+        std::lock_guard<std::mutex> lock(this->m_move_lock);
+        // The translator moved a step of the mode for every pulse, counted clockwise modulo its table
+        const uint32_t turned = steps*a4988_microsteps_per_pulse(this->m_step_mode) % A4988_PHASE_MICROSTEPS;
+        this->m_phase = (this->m_phase + (this->m_dir_level == 1 ? turned : A4988_PHASE_MICROSTEPS - turned)) %
+                A4988_PHASE_MICROSTEPS;
+        promise = std::move(this->m_move_promise);
+        callback = std::move(this->m_move_callback);
+        this->m_stop_motor = false;
+        this->m_busy = false;
+        this->m_pm_lock.hold(false);
+    }
+
     if constexpr (DEBUG_A4988)
-        std::cout << this->m_name << ": Starting continuous motor run.\n\n";
-    while (!this->m_stop_motor) {
-        // Send a pulse to the a4988 to step
-        if (this->m_enabled) {
-            this->set_step(1);
-            std::this_thread::sleep_for(1ms); // running at 1000 HZ, set pulse for 1 ms
-
-            this->set_step(0);
-            std::this_thread::sleep_for(1ms); // running at 1000 HZ, set pulse for 1 ms
+        std::cout << this->m_name << ": Move finished after " << steps << " steps.\n\n";
+
+    promise.set_value(steps);
+    if (callback)
+        callback(steps);
+}
+
+// Period of the next step in timer ticks, advances the ramp
+// Integer form of the Austin step-delay recurrence, since the FPU can't be used in an ISR
+uint32_t IRAM_ATTR a4988_driver::next_step_period() {
+    const uint32_t next_step = this->m_steps_done;
+
+    if (next_step < this->m_accel_steps) {
+        this->m_ramp_n++;
+        this->m_period_q8 -= (2*this->m_period_q8) / (4*this->m_ramp_n + 1);
+    }
+    else if (next_step >= this->m_decel_start && this->m_ramp_n > this->m_ramp_n0) {
+        this->m_period_q8 += (2*this->m_period_q8) / (4*this->m_ramp_n - 1);
+        this->m_ramp_n--;
+    }
+
+    if (this->m_period_q8 < this->m_min_period_q8)
+        this->m_period_q8 = this->m_min_period_q8;
+    return this->m_period_q8 >> 8;
+}
+
+// Step timer alarm, runs in interrupt context
+// Each step takes two alarms: one raises STEP, the next lowers it and schedules the following step
+// It is an IRAM interrupt, so steps go on while the cook log writes flash, and only calls code that
+// is in IRAM: the timer *_in_isr calls, the GPIO register writes and the FreeRTOS queue
+bool IRAM_ATTR a4988_driver::step_isr(void* arg) {
+    a4988_driver* driver = static_cast<a4988_driver*>(arg);
+
+    if (!driver->m_pulse_high) {
+        // A stop decelerates from the speed reached like the end of a move, so the motor keeps up
+        if (driver->m_stop_motor && !driver->m_stopping) {
+            const uint32_t done = driver->m_steps_done;
+            driver->m_stopping = true;
+            driver->m_accel_steps = std::min(driver->m_accel_steps, done);
+            driver->m_decel_start = done;
+            driver->m_steps_target = std::min(driver->m_steps_target, done + (driver->m_ramp_n - driver->m_ramp_n0));
         }
-        // Case when the motor is not enabled, save energy
-        else {
-            std::this_thread::sleep_for(2ms);
+
+        // Move is complete or has ramped down after a stop, stop the timer and report back
+        if (driver->m_steps_done >= driver->m_steps_target) {
+            timer_group_set_counter_enable_in_isr(driver->m_timer_group, driver->m_timer_idx, TIMER_PAUSE);
+            BaseType_t task_woken = pdFALSE;
+            const move_done done {driver, nullptr};
+            xQueueSendFromISR(move_done_queue, &done, &task_woken);
+            return task_woken == pdTRUE;
         }
+
+        gpio_ll_set_level(&GPIO, driver->m_gpio_step, 1);
+        driver->m_pulse_high = true;
+        timer_group_set_alarm_value_in_isr(driver->m_timer_group, driver->m_timer_idx, STEP_PULSE_US);
     }
-    this->m_stop_motor = false;
+    else {
+        gpio_ll_set_level(&GPIO, driver->m_gpio_step, 0);
+        driver->m_pulse_high = false;
+        driver->m_steps_done = driver->m_steps_done + 1;
+        timer_group_set_alarm_value_in_isr(driver->m_timer_group, driver->m_timer_idx,
+                driver->next_step_period() - STEP_PULSE_US);
+    }
+
+    timer_group_enable_alarm_in_isr(driver->m_timer_group, driver->m_timer_idx);
+    return false;
 }
 
-// Run the motor for a certain amount of steps
-void a4988_driver::run_motor_steps(int num_steps) {
+// Starts a move without blocking, the future and on_done get the number of steps taken
+std::future<uint32_t> a4988_driver::move(const uint32_t num_steps, const step_profile& profile,
+        std::function<void(uint32_t)> on_done) {
+
+    std::unique_lock<std::mutex> lock(this->m_move_lock);
+
+    if (!this->m_timer_ready || this->m_busy || num_steps == 0) {
+        if (!this->m_timer_ready)
+            std::cout << "Error: " << this->m_name << " step timer is not set up.\n\n";
+        else if (this->m_busy)
+            std::cout << "Error: " << this->m_name << " is already moving.\n\n";
+        lock.unlock();
+
+        // on_done hears of it on the dispatcher thread like any finished move. move() may be called from
+        // an on_done on that thread, which is the only one draining the queue, so it never waits for
+        // room and calls on_done itself when the queue is full
+        std::promise<uint32_t> no_move;
+        no_move.set_value(0);
+        if (on_done) {
+            std::function<void(uint32_t)>* refused = new std::function<void(uint32_t)>(std::move(on_done));
+            const move_done done {this, refused};
+            if (xQueueSend(move_done_queue, &done, 0) != pdPASS) {
+                (*refused)(0);
+                delete refused;
+            }
+        }
+        return no_move.get_future();
+    }
+
     if constexpr (DEBUG_A4988)
         std::cout << this->m_name << ": Stepping " << num_steps << " times.\n\n";
 
-    for (int i = 0; i < num_steps; i++) {
+    // Plan the trapezoid, a short move that can't reach cruise becomes a triangle
+    const uint32_t max_rate = STEP_TIMER_TICKS_PER_S / STEP_MIN_PERIOD_US;
+    const uint32_t cruise_rate = std::clamp<uint32_t>(profile.cruise_rate, 1, max_rate);
+    const uint32_t start_rate = std::clamp<uint32_t>(profile.start_rate, 1, cruise_rate);
+
+    this->m_min_period_q8 = (STEP_TIMER_TICKS_PER_S / cruise_rate) << 8;
+    if (profile.accel == 0) {
+        this->m_period_q8 = this->m_min_period_q8;
+        this->m_accel_steps = 0;
+        this->m_ramp_n0 = 1;
+    }
+    else {
+        const uint64_t two_accel = 2ull*profile.accel;
+        this->m_period_q8 = (STEP_TIMER_TICKS_PER_S / start_rate) << 8;
+        this->m_ramp_n0 = std::max<uint64_t>(1, static_cast<uint64_t>(start_rate)*start_rate / two_accel);
+        const uint64_t ramp_steps = (static_cast<uint64_t>(cruise_rate)*cruise_rate -
+                static_cast<uint64_t>(start_rate)*start_rate) / two_accel;
+        this->m_accel_steps = static_cast<uint32_t>(std::min<uint64_t>(ramp_steps, num_steps / 2));
+    }
+    this->m_ramp_n = this->m_ramp_n0;
+    this->m_steps_target = num_steps;
+    this->m_decel_start = num_steps == STEP_CONTINUOUS ? STEP_CONTINUOUS : num_steps - this->m_accel_steps;
+    this->m_steps_done = 0;
+    this->m_pulse_high = false;
+    this->m_stopping = false;
+
+    this->m_move_promise = std::promise<uint32_t>();
+    std::future<uint32_t> done = this->m_move_promise.get_future();
+    this->m_move_callback = std::move(on_done);
+    this->m_stop_motor = false;
+    this->m_busy = true;
+    this->m_pm_lock.hold(true);
+
+    // First alarm raises STEP right away
+    gpio_set_level(this->m_gpio_step, 0);
+    timer_pause(this->m_timer_group, this->m_timer_idx);
+    timer_set_counter_value(this->m_timer_group, this->m_timer_idx, 0);
+    timer_set_alarm_value(this->m_timer_group, this->m_timer_idx, 1);
+    timer_set_alarm(this->m_timer_group, this->m_timer_idx, TIMER_ALARM_EN);
+    timer_start(this->m_timer_group, this->m_timer_idx);
+
+    return done;
+}
+
+// Run the motor continuously, until stop_motor() is called
+void a4988_driver::run_motor_continuous() {
+    if constexpr (DEBUG_A4988)
+        std::cout << this->m_name << ": Starting continuous motor run.\n\n";
+    this->move(STEP_CONTINUOUS).wait();
+}
+
+// Run the motor for a certain amount of steps, blocks until done
+void a4988_driver::run_motor_steps(const int num_steps) {
+    if (num_steps > 0)
+        this->move(static_cast<uint32_t>(num_steps)).wait();
+}
 
-        // Send a step pulse unless the motor is stopped in the middle of the process
-        if (this->m_stop_motor)
-            break;
+// MS1, MS2 and MS3 levels for each step mode, from the a4988 datasheet
+static constexpr int step_mode_levels[STEP_MODE_COUNT][3] = {
+    {0, 0, 0}, // full
+    {1, 0, 0}, // half
+    {0, 1, 0}, // quarter
+    {1, 1, 0}, // eighth
+    {1, 1, 1}, // sixteenth
+};
 
-        this->set_step(1);
-        std::this_thread::sleep_for(1ms); // running at 1000 HZ, set pulse for 1 ms
+// Coarsest mode with steps no bigger than max_step_deg whose steps the translator phase is on
+// and that covers a distance in whole steps
+step_mode a4988_step_mode_for(const uint32_t microsteps, const float max_step_deg, const uint32_t phase) {
+    for (int mode = STEP_MODE_FULL; mode < STEP_MODE_SIXTEENTH; mode++) {
+        const step_mode candidate = static_cast<step_mode>(mode);
+        const uint32_t per_pulse = a4988_microsteps_per_pulse(candidate);
+        // A little slack so a limit written as a step angle, like 1.8f, allows that step
+        if (a4988_step_deg(candidate) <= max_step_deg*1.001f && phase % per_pulse == 0 &&
+                microsteps % per_pulse == 0)
+            return candidate;
+    }
+    return STEP_MODE_SIXTEENTH;
+}
 
-        this->set_step(0);
-        std::this_thread::sleep_for(1ms); // running at 1000 HZ, set pulse for 1 ms
+const char* step_mode_name(const step_mode mode) {
+    switch (mode) {
+        case STEP_MODE_FULL: return "full";
+        case STEP_MODE_HALF: return "half";
+        case STEP_MODE_QUARTER: return "quarter";
+        case STEP_MODE_EIGHTH: return "eighth";
+        case STEP_MODE_SIXTEENTH: return "sixteenth";
+        default: return "unknown";
     }
-    this->m_stop_motor = false;
-}
\ No newline at end of file
+}
+
+// Sets the MS pins for a step mode, only between moves
+bool a4988_driver::set_step_mode(const step_mode mode) {
+    if (mode >= STEP_MODE_COUNT) {
+        std::cout << "Error: " << this->m_name << ": Not a step mode.\n\n";
+        return false;
+    }
+    if (this->m_busy) {
+        std::cout << "Error: " << this->m_name << ": The step mode can only change between moves.\n\n";
+        return false;
+    }
+    // Always written, the console can set the pins one at a time
+    this->set_ms1(step_mode_levels[mode][0]);
+    this->set_ms2(step_mode_levels[mode][1]);
+    this->set_ms3(step_mode_levels[mode][2]);
+    this->m_step_mode = mode;
+    if constexpr (DEBUG_A4988)
+        std::cout << this->m_name << ": Stepping in " << step_mode_name(mode) << " steps.\n\n";
+    return true;
+}
+
+// Turns the shaft a distance in sixteenth steps, in the coarsest mode whose steps are no bigger
+// than max_step_deg and that the translator is on a step of, blocks until done and returns the
+// sixteenth steps turned
+uint32_t a4988_driver::turn(const uint32_t microsteps, const float max_step_deg) {
+    if (microsteps == 0)
+        return 0;
+    const step_mode mode = a4988_step_mode_for(microsteps, max_step_deg, this->m_phase);
+    if (!this->set_step_mode(mode))
+        return 0;
+    const uint32_t per_pulse = a4988_microsteps_per_pulse(mode);
+    return this->move(microsteps/per_pulse).get()*per_pulse;
+}
@@ -7,12 +7,79 @@
 #define __A4988_DRIVER_HPP__
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <string>
 
 #include "driver/gpio.h"
+#include "driver/timer.h"
 
 #include "debug.hpp"
+#include "power.hpp"
+
+// Step timer runs at 1 MHz, so timer ticks are microseconds
+#define STEP_TIMER_DIVIDER (80)
+#define STEP_TIMER_TICKS_PER_S (1000000)
+// Time the step signal is held high, the a4988 needs at least 1 us
+#define STEP_PULSE_US (4)
+// Shortest step period the timer is asked to produce (20000 steps/s)
+#define STEP_MIN_PERIOD_US (50)
+// Step count that makes a move run until stop_motor() is called
+#define STEP_CONTINUOUS (UINT32_MAX)
+
+// Full steps per revolution of the motors, 1.8 degrees a step
+#define A4988_STEPS_PER_REV (200)
+// Sixteenth steps in a full step, distances are counted in the finest step the a4988 makes
+#define A4988_MICROSTEPS (16)
+// Sixteenth steps before the translator table repeats, four full steps
+#define A4988_PHASE_MICROSTEPS (4*A4988_MICROSTEPS)
+
+// Step modes, the sixteenth steps one step pulse moves is A4988_MICROSTEPS >> mode
+enum step_mode : uint8_t {
+    STEP_MODE_FULL = 0,
+    STEP_MODE_HALF,
+    STEP_MODE_QUARTER,
+    STEP_MODE_EIGHTH,
+    STEP_MODE_SIXTEENTH,
+    STEP_MODE_COUNT
+};
+
+// Sixteenth steps one step pulse moves in a mode
+inline constexpr uint32_t a4988_microsteps_per_pulse(const step_mode mode) {
+    return A4988_MICROSTEPS >> mode;
+}
+
+// Shaft angle of one step pulse in a mode
+inline constexpr float a4988_step_deg(const step_mode mode) {
+    return 360.0f*a4988_microsteps_per_pulse(mode)/(A4988_STEPS_PER_REV*A4988_MICROSTEPS);
+}
+
+// Sixteenth steps for a shaft angle, rounded
+inline constexpr uint32_t a4988_degrees_to_microsteps(const float degrees) {
+    return static_cast<uint32_t>(degrees*A4988_STEPS_PER_REV*A4988_MICROSTEPS/360.0f + 0.5f);
+}
+
+// Sixteenth steps for a number of revolutions, rounded
+inline constexpr uint32_t a4988_revs_to_microsteps(const float revs) {
+    return static_cast<uint32_t>(revs*A4988_STEPS_PER_REV*A4988_MICROSTEPS + 0.5f);
+}
+
+// Coarsest mode with steps no bigger than max_step_deg whose steps the translator phase is on
+// and that covers a distance in whole steps
+step_mode a4988_step_mode_for(uint32_t microsteps, float max_step_deg, uint32_t phase);
+
+const char* step_mode_name(step_mode mode);
+
+// Trapezoidal velocity profile for a move
+// Accelerates from start_rate to cruise_rate at accel, cruises, then decelerates the same way
+struct step_profile {
+    uint32_t start_rate {500}; // steps/s
+    uint32_t cruise_rate {2000}; // steps/s
+    uint32_t accel {8000}; // steps/s^2, 0 runs the whole move at cruise_rate
+};
 
 inline bool is_valid_signal(const gpio_num_t gpio, const int level) {
     if (gpio == GPIO_NUM_NC) {
@@ -56,12 +123,65 @@ class a4988_driver {
         // Atomic bool so it is thread safe
         std::atomic<bool> m_stop_motor {false};
 
+        // Hardware timer generating the step pulses
+        timer_group_t m_timer_group;
+        timer_idx_t m_timer_idx;
+        bool m_timer_ready {false};
+
+        // Profile used when a move does not give one
+        step_profile m_profile {};
+
+        // Mode the MS pins are set to, quarter steps from set_default_gpio_levels()
+        std::atomic<step_mode> m_step_mode {STEP_MODE_QUARTER};
+
+        // Sixteenth steps the translator is past its home state, clockwise, 0 from power up or ~reset
+        // A mode only steps between its own positions, so a coarser one can only start on one of them
+        std::atomic<uint32_t> m_phase {0};
+        std::atomic<int> m_dir_level {0};
+
+        // Move state shared with the step timer ISR, only written by move() while the timer is stopped
+        std::atomic<bool> m_busy {false};
+        volatile uint32_t m_steps_done {0};
+        uint32_t m_steps_target {0};
+        uint32_t m_accel_steps {0};
+        uint32_t m_decel_start {0};
+        uint32_t m_ramp_n0 {1};
+        uint32_t m_ramp_n {1};
+        uint32_t m_period_q8 {0}; // current step period in timer ticks, 8 fractional bits
+        uint32_t m_min_period_q8 {0}; // cruise step period in timer ticks, 8 fractional bits
+        bool m_pulse_high {false};
+        bool m_stopping {false}; // stop_motor() has turned the rest of the move into a ramp down
+
+        // Completion of the move in progress
+        std::mutex m_move_lock;
+        std::promise<uint32_t> m_move_promise;
+        std::function<void(uint32_t)> m_move_callback;
+
+        // Keeps the APB clock the step timer counts at full speed while moving
+        pm_lock m_pm_lock {ESP_PM_APB_FREQ_MAX, "stepper"};
+
+        // Sets up the hardware timer used for step pulses
+        void init_step_timer();
+
+        // Step timer alarm, runs in interrupt context
+        static bool step_isr(void* arg);
+
+        // Period of the next step in timer ticks, advances the ramp
+        uint32_t next_step_period();
+
+        // Completes the move after the ISR stops the timer, runs on the dispatcher thread
+        void finish_move();
+
+        // Thread that hands completed moves from the ISR back to task context
+        static void move_dispatcher();
+
     public:
 
         inline a4988_driver(const std::string name, const gpio_num_t not_en, const gpio_num_t ms1,
         const gpio_num_t ms2, const gpio_num_t ms3,
         const gpio_num_t not_rst, const gpio_num_t not_slp,
-        const gpio_num_t step, const gpio_num_t dir) {
+        const gpio_num_t step, const gpio_num_t dir,
+        const timer_group_t timer_group, const timer_idx_t timer_idx) {
 
             this->m_name = name;
             this->m_gpio_not_en = not_en;
@@ -72,24 +192,79 @@ class a4988_driver {
             this->m_gpio_not_slp = not_slp;
             this->m_gpio_step = step;
             this->m_gpio_dir = dir;
+            this->m_timer_group = timer_group;
+            this->m_timer_idx = timer_idx;
 
             this->set_default_gpio_levels();
+            this->init_step_timer();
         }
 
         // Sets all the gpio to default states
         void set_default_gpio_levels();
 
-        // Run the motor continuously
+        // Run the motor continuously, until stop_motor() is called
         void run_motor_continuous();
 
-        // Run the motor for a certain amount of steps
+        // Run the motor for a certain amount of steps, blocks until done
         void run_motor_steps(int num_steps);
 
-        // Stop the motor from continuously running
+        // Starts a move without blocking, the future and on_done get the number of steps taken
+        // on_done runs on the move dispatcher thread, not in the ISR, also when the move is refused,
+        // except for a refusal while the dispatcher is backed up, which calls it from inside move()
+        std::future<uint32_t> move(uint32_t num_steps, const step_profile& profile,
+                std::function<void(uint32_t)> on_done = nullptr);
+
+        inline std::future<uint32_t> move(uint32_t num_steps) {
+            return this->move(num_steps, this->m_profile);
+        }
+
+        // Sets the MS pins for a step mode, only between moves
+        bool set_step_mode(step_mode mode);
+
+        inline step_mode get_step_mode() {
+            return this->m_step_mode;
+        }
+
+        // Translator position in sixteenth steps past its home state, 0 to A4988_PHASE_MICROSTEPS - 1
+        inline uint32_t phase() {
+            return this->m_phase;
+        }
+
+        // Turns the shaft a distance in sixteenth steps, in the coarsest mode whose steps are no bigger
+        // than max_step_deg and that the translator is on a step of, blocks until done and returns the
+        // sixteenth steps turned
+        uint32_t turn(uint32_t microsteps, float max_step_deg);
+
+        inline uint32_t turn_degrees(const float degrees, const float max_step_deg) {
+            return this->turn(a4988_degrees_to_microsteps(degrees), max_step_deg);
+        }
+
+        inline uint32_t turn_revs(const float revs, const float max_step_deg) {
+            return this->turn(a4988_revs_to_microsteps(revs), max_step_deg);
+        }
+
+        // Ramps the move in progress down from the next step on and stops it, no step is lost
         inline void stop_motor() {
             this->m_stop_motor = true;
             if constexpr (DEBUG_A4988)
-                    std::cout << this->m_name << ": Stopping continuous motor run.\n\n";
+                    std::cout << this->m_name << ": Stopping motor run.\n\n";
+        }
+
+        inline bool is_moving() {
+            return this->m_busy;
+        }
+
+        // Steps taken so far by the current or last move
+        inline uint32_t steps_done() {
+            return this->m_steps_done;
+        }
+
+        inline void profile(const step_profile& profile) {
+            this->m_profile = profile;
+        }
+
+        inline step_profile profile() {
+            return this->m_profile;
         }
 
         // Sets ~enable
@@ -134,10 +309,12 @@ class a4988_driver {
             }
         }
 
-        // Sets ~reset
+        // Sets ~reset, low puts the translator back to its home state
         inline void set_not_rst(int level) {
             if (is_valid_signal(this->m_gpio_not_rst, level)) {
                 gpio_set_level(this->m_gpio_not_rst, level);
+                if (level == 0)
+                    this->m_phase = 0;
                 if constexpr (DEBUG_A4988)
                     std::cout << this->m_name << ": Set ~Reset signal to " << level << ".\n\n";
             }
@@ -167,6 +344,7 @@ class a4988_driver {
         inline void set_dir(int level) {
             if (is_valid_signal(this->m_gpio_dir, level)) {
                 gpio_set_level(this->m_gpio_dir, level);
+                this->m_dir_level = level;
                 if constexpr (DEBUG_A4988) {
                     if (level == 1)
                         std::cout << this->m_name << ": Set Direction signal to 1 (clockwise).\n\n";
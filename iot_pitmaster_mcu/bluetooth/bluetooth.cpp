@@ -6,28 +6,39 @@
  */
 #include "bluetooth.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <mutex>
 #include <string>
 
-#include "esp_bt.h"
-#include "esp_bt_device.h"
-#include "esp_bt_main.h"
 #include "esp_err.h"
-#include "esp_gap_bt_api.h"
-#include "esp_spp_api.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 
-#include "debug.hpp"
+#include "bt_frame.hpp"
+#include "bt_tx_queue.hpp"
 #include "pid_control.hpp"
-
-#define SPP_SERVER_NAME "SPP_SERVER"
-
-static const esp_spp_mode_t esp_spp_mode {ESP_SPP_MODE_CB};
-static const esp_spp_sec_t esp_spp_sec_mask {ESP_SPP_SEC_NONE};
-static const esp_spp_role_t esp_spp_role {ESP_SPP_ROLE_SLAVE};
-
-static uint32_t conn_handle {0};
+#include "spp_transport.hpp"
+#include "transport.hpp"
+
+// Frames waiting for the links, shared between the clients they go to
+static bt_frame_pool frame_pool;
+
+// One phone's connection, with its own received stream and transmit queue
+struct bt_client {
+    transport* link {nullptr}; // the transport it connected over, set before the handle
+    std::atomic<uint32_t> handle {0}; // 0 while the slot is free
+    std::atomic<uint32_t> order {0}; // when it connected, the earliest connected one has control
+    bt_frame_parser rx_parser; // only touched from the SPP callback
+    bt_tx_queue tx_queue {frame_pool};
+};
+
+static std::array<bt_client, BT_MAX_CLIENTS> clients;
+static std::atomic<uint32_t> connections_opened {0};
+// Every transport opens and closes links from its own task, a slot is claimed and freed under this
+static std::mutex client_slots_lock;
 
 pid_control* bt_pid_control_dest {nullptr};
 
@@ -35,137 +46,125 @@ void bt::set_bt_msg_dest(pid_control* bt_pid_control) {
     bt_pid_control_dest = bt_pid_control;
 }
 
-static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
-{
-    switch (event) {
-
-    // SPP is initialized
-    case ESP_SPP_INIT_EVT: {
-        std::cout << "SPP: Received ESP_SPP_INIT_EVT\n\n";
-        esp_bt_dev_set_device_name("IoT Pitmaster");
-        esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
-        esp_spp_start_srv(esp_spp_sec_mask, esp_spp_role, 0, SPP_SERVER_NAME);
-        break;
-    }
-
-    // SPP is uninitialized
-    case ESP_SPP_UNINIT_EVT: {
-        std::cout << "SPP: Received ESP_SPP_UNINIT_EVT\n\n";
-        break;
-    }
-
-    // Service Discovery Protocol (SDP) is complete
-    case ESP_SPP_DISCOVERY_COMP_EVT: {
-        std::cout << "SPP: Received ESP_SPP_DISCOVERY_COMP_EVT\n\n";
-        break;
-    }
-
-    // SPP client connection open
-    case ESP_SPP_OPEN_EVT: {
-        std::cout << "SPP: Received ESP_SPP_OPEN_EVT\n\n";
-        bt::set_bt_connected(true);
-        break;
+// The client on a transport's connection, nullptr if it is not one of ours
+static bt_client* find_client(const transport& link, const uint32_t handle) {
+    for (bt_client& client : clients) {
+        if (handle != 0 && client.handle == handle && client.link == &link)
+            return &client;
     }
+    return nullptr;
+}
 
-    // SPP connection is closed
-    case ESP_SPP_CLOSE_EVT: {
-        std::cout << "SPP: Received ESP_SPP_CLOSE_EVT\n\n";
-        bt::set_bt_connected(false);
-        conn_handle = 0;
-        break;
-    }
+// Writes the client's next queued frame if its link can take it, never waits on the radio
+static void tx_pump(bt_client& client) {
+    size_t len {0};
+    const uint8_t* frame = client.tx_queue.next(len);
+    // The transport copies the frame, the pool slot is only held until the write completes
+    if (frame != nullptr && !client.link->write(client.handle, frame, len))
+        client.tx_queue.write_done(false, false);
+}
 
-    // SPP server is started
-    case ESP_SPP_START_EVT: {
-        std::cout << "SPP: Received ESP_SPP_START_EVT\n\n";
-        break;
+// Queues a framed message for one client or all of them, returns false if any of them dropped it
+static bool send_frame(bt_shared_frame* frame, const bt_tx_class tx_class, const uint8_t client) {
+    bool queued {true};
+    for (uint8_t idx = 0; idx < BT_MAX_CLIENTS; idx++) {
+        if ((client != BT_ALL_CLIENTS && client != idx) || clients[idx].handle == 0)
+            continue;
+        queued = clients[idx].tx_queue.push(frame, tx_class) && queued;
+        tx_pump(clients[idx]);
     }
+    return queued;
+}
 
-    // SPP client initiates a connection
-    case ESP_SPP_CL_INIT_EVT: {
-        std::cout << "SPP: Received ESP_SPP_CL_INIT_EVT\n\n";
-        break;
+// Tells every phone whether it has control, after one connects or leaves
+static void send_control() {
+    const uint8_t owner = bt::control_owner();
+    uint8_t connected {0};
+    for (const bt_client& client : clients)
+        connected += client.handle != 0 ? 1 : 0;
+    for (uint8_t idx = 0; idx < BT_MAX_CLIENTS; idx++) {
+        if (clients[idx].handle == 0)
+            continue;
+        out_msg_control msg {MSG_CONTROL, idx == owner, connected};
+        bt::send_data(msg, BT_TX_RELIABLE, idx);
     }
+}
 
-    // SPP connection received data
-    case ESP_SPP_DATA_IND_EVT: {
-        std::string read_val(reinterpret_cast<char*>(param->data_ind.data), param->data_ind.len);
-
-        if constexpr (DEBUG_READ_BT) {
-            char hex_str[5*param->data_ind.len + 1];
-            int idx = 0;
-            for (auto& hex_char : read_val) {
-                snprintf(hex_str + idx, 6, "0x%02hhx ", hex_char);
-                idx += 5;
+// Takes the events of every transport, one transport at a time reports them in order
+class bt_link_sink : public transport_sink {
+
+    public:
+
+        // A phone connected, it gets a free client slot or is turned away
+        void on_open(transport& link, const uint32_t handle) override {
+            bt_client* client {nullptr};
+            {
+                std::lock_guard<std::mutex> lock(client_slots_lock);
+                for (bt_client& free : clients) {
+                    if (client == nullptr && free.handle == 0)
+                        client = &free;
+                }
+                if (client != nullptr) {
+                    client->rx_parser.reset();
+                    client->tx_queue.clear();
+                    client->link = &link;
+                    client->order = ++connections_opened;
+                    client->handle = handle;
+                }
+            }
+            if (client == nullptr) {
+                std::cout << "Error: already serving " << BT_MAX_CLIENTS << " phones, refusing another on " <<
+                        link.name() << ".\n\n";
+                link.disconnect(handle);
+                return;
             }
-            std::cout << "SPP: Received ESP_SPP_DATA_IND_EVT, length = " << std::to_string(param->data_ind.len) << "\n" <<
-                    "Received Bits: " << hex_str << "\n\n";
+            send_control();
         }
 
-        // Send only the character data
-        bt_pid_control_dest->handle_bt_msg(read_val.c_str());
-        break;
-    }
-
-    // SPP connection congestion status changed
-    case ESP_SPP_CONG_EVT: {
-        std::cout << "SPP: Received ESP_SPP_CONG_EVT\n\n";
-        break;
-    }
-
-    // SPP write operation completes
-    case ESP_SPP_WRITE_EVT: {
-        if constexpr (DEBUG_WRITE_BT)
-            std::cout << "SPP: Received ESP_SPP_WRITE_EVT, length = " << std::to_string(param->write.len) << "\n\n";
-        break;
-    }
-
-    // SPP Server connection open
-    case ESP_SPP_SRV_OPEN_EVT: {
-        conn_handle = param->start.handle;
-        bt::set_bt_connected(true);
-        std::cout << "SPP: Received ESP_SPP_SRV_OPEN_EVT\n\n";
-        break;
-    }
-
-    // SPP server stopped
-    case ESP_SPP_SRV_STOP_EVT: {
-        std::cout << "SPP: Received ESP_SPP_SRV_STOP_EVT\n\n";
-        break;
-    }
-
-    default: {
-        break;
-    }
-    }
-}
+        // Control passes to the phone that connected next
+        void on_close(transport& link, const uint32_t handle) override {
+            {
+                std::lock_guard<std::mutex> lock(client_slots_lock);
+                bt_client* client = find_client(link, handle);
+                if (client == nullptr)
+                    return;
+                client->handle = 0;
+                client->tx_queue.clear();
+            }
+            send_control();
+        }
 
-static void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
-{
-    switch (event) {
+        void on_data(transport& link, const uint32_t handle, const uint8_t* data, const size_t len) override {
+            bt_client* client = find_client(link, handle);
+            if (client == nullptr)
+                return;
+            const uint8_t idx = static_cast<uint8_t>(client - clients.data());
+
+            // A chunk can hold part of a frame or several of them
+            client->rx_parser.feed(data, len, [idx](uint8_t, const uint8_t* payload, uint8_t payload_len) {
+                if (bt_pid_control_dest != nullptr)
+                    bt_pid_control_dest->handle_bt_cmds(payload, payload_len, idx);
+            });
+        }
 
-    case ESP_BT_GAP_CONFIG_EIR_DATA_EVT: {
-        if constexpr (DEBUG_GAP_BT)
-            std::cout << "GAP: Received ESP_BT_GAP_CONFIG_EIR_DATA_EVT\n\n";
-        break;
-    }
+        void on_write_done(transport& link, const uint32_t handle, const bool ok, const bool congested) override {
+            bt_client* client = find_client(link, handle);
+            if (client == nullptr)
+                return;
+            client->tx_queue.write_done(ok, congested);
+            tx_pump(*client);
+        }
 
-    case ESP_BT_GAP_MODE_CHG_EVT: {
-        if constexpr (DEBUG_GAP_BT) {
-            const int mode = param->mode_chg.mode;
-            std::cout << "GAP: Received ESP_BT_GAP_MODE_CHG_EVT, mode: " << mode << "\n\n";
+        void on_congestion(transport& link, const uint32_t handle, const bool congested) override {
+            bt_client* client = find_client(link, handle);
+            if (client == nullptr)
+                return;
+            client->tx_queue.congestion(congested);
+            tx_pump(*client);
         }
-        break;
-    }
+};
 
-    default: {
-        if constexpr (DEBUG_GAP_BT)
-            std::cout << "GAP: Received event: #" << event << "\n\n";
-        break;
-    }
-    }
-    return;
-}
+static bt_link_sink link_sink;
 
 // Initialize Bluetooth
 bool bt::init_bluetooth() {
@@ -178,89 +177,135 @@ bool bt::init_bluetooth() {
     }
     ESP_ERROR_CHECK(ret);
 
-    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
+    // The app's link
+    static spp_transport spp;
+    return add_transport(spp);
+}
 
-    // Init Bluetooth controller
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
-        std::cout << "Error: initialize bluetooth controller failed\n\n";
+// Starts another link for phones or hosts to connect over, its connections share the client slots
+bool bt::add_transport(transport& link) {
+    if (!link.start(link_sink)) {
+        std::cout << "Error: starting the " << link.name() << " transport failed.\n\n";
         return false;
     }
+    return true;
+}
 
-    // Get the base MAC address
-    uint8_t base_mac_addr[6] = {0};
-    ret = esp_efuse_mac_get_default(base_mac_addr);
-    std::cout << "Using \"" << std::hex <<
-            "0x" << static_cast<int>(base_mac_addr[0]) << " 0x" << static_cast<int>(base_mac_addr[1]) <<
-            " 0x" << static_cast<int>(base_mac_addr[2]) << " 0x" << static_cast<int>(base_mac_addr[3]) <<
-            " 0x" << static_cast<int>(base_mac_addr[4]) << " 0x" << static_cast<int>(base_mac_addr[5]) <<
-            "\" as base MAC address\n\n" << std::dec;
-    esp_base_mac_addr_set(base_mac_addr);
-
-    // Get the Bluetooth MAC address
-    uint8_t bt_mac_addr[6] = {0};
-    ESP_ERROR_CHECK(esp_read_mac(bt_mac_addr, ESP_MAC_BT));
-    std::cout << "Using \"" << std::hex <<
-            "0x" << static_cast<int>(bt_mac_addr[0]) << " 0x" << static_cast<int>(bt_mac_addr[1]) <<
-            " 0x" << static_cast<int>(bt_mac_addr[2]) << " 0x" << static_cast<int>(bt_mac_addr[3]) <<
-            " 0x" << static_cast<int>(bt_mac_addr[4]) << " 0x" << static_cast<int>(bt_mac_addr[5]) <<
-            "\" as BT MAC address\n\n" << std::dec;
-
-    // Enable Bluetooth controller
-    if ((ret = esp_bt_controller_enable(ESP_BT_MODE_CLASSIC_BT)) != ESP_OK) {
-        std::cout << "Error: enable bluetooth controller failed.\n\n";
-        return false;
+// Whether any phone is connected, or the given client
+bool bt::is_bt_connected(const uint8_t client) {
+    if (client != BT_ALL_CLIENTS)
+        return client < BT_MAX_CLIENTS && clients[client].handle != 0;
+    for (const bt_client& connected : clients) {
+        if (connected.handle != 0)
+            return true;
     }
+    return false;
+}
 
-    // Set BT power, N0 and P3 are default
-    if ((ret = esp_bredr_tx_power_set(ESP_PWR_LVL_N0, ESP_PWR_LVL_P3))) {
-        std::cout << "Error: set BT power failed.\n\n";
-        return false;
-    }
+// Connections opened since boot, a change means a phone just connected
+uint32_t bt::connections() {
+    return connections_opened;
+}
 
-    // Init Bluedroid
-    if ((ret = esp_bluedroid_init()) != ESP_OK) {
-        std::cout << "Error: initialize bluedroid failed.\n\n";
-        return false;
+// The client whose commands change the cook, the earliest connected one, BT_ALL_CLIENTS if none is
+uint8_t bt::control_owner() {
+    uint8_t owner {BT_ALL_CLIENTS};
+    uint32_t owner_order {0};
+    for (uint8_t idx = 0; idx < BT_MAX_CLIENTS; idx++) {
+        const uint32_t order = clients[idx].order;
+        if (clients[idx].handle != 0 && (owner == BT_ALL_CLIENTS || order < owner_order)) {
+            owner = idx;
+            owner_order = order;
+        }
     }
+    return owner;
+}
 
-    // Enable Bluedroid
-    if ((ret = esp_bluedroid_enable()) != ESP_OK) {
-        std::cout << "Error: enable bluedroid failed.\n\n";
-        return false;
-    }
+// Queues one message in a frame for one client or all of them, returns false if it was dropped for any
+bool bt::write_uint8_p(uint8_t* p_data_packet, int len, bt_tx_class tx_class, uint8_t client) {
+    return write_uint8_p(p_data_packet, len, nullptr, 0, tx_class, client);
+}
 
-    // Register Generic Access Profile (GAP) callback function
-    if ((ret = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK) {
-        std::cout << "Error: GAP register failed.\n\n";
+// Queues one message given in two parts, such as a message type and data mapped from flash, without joining them first
+// The message is framed once however many phones it goes to
+bool bt::write_uint8_p(const uint8_t* p_head, int head_len, const uint8_t* p_body, int body_len, bt_tx_class tx_class,
+        uint8_t client) {
+    if (!is_bt_connected(client)) {
+        std::cout << "Unable to send BT message since there is no connection.\n\n";
         return false;
     }
-
-    // Register Serial Port Profile (SPP) callback function
-    if ((ret = esp_spp_register_callback(esp_spp_cb)) != ESP_OK) {
-        std::cout << "Error: SPP register failed.\n\n";
+    bt_shared_frame* frame = frame_pool.encode(p_head, head_len, p_body, body_len);
+    if (frame == nullptr) {
+        std::cout << "Error: unable to frame a " << head_len + body_len << " byte BT message.\n\n";
         return false;
     }
+    const bool queued = send_frame(frame, tx_class, client);
+    frame_pool.release(frame);
+    return queued;
+}
 
-    // Initialize Serial Port Profile (SPP)
-    if ((ret = esp_spp_init(esp_spp_mode)) != ESP_OK) {
-        std::cout << "Error: initialize SPP failed.\n\n";
-        return false;
+// Whether a message of this class is still waiting for any link
+bool bt::tx_waiting(bt_tx_class tx_class) {
+    for (bt_client& client : clients) {
+        if (client.handle != 0 && client.tx_queue.waiting(tx_class))
+            return true;
     }
+    return false;
+}
 
-    // Successfully initialized
-    return true;
+// BT_TX_LATEST messages some phone never got, evicted or failed, summed over the clients
+// A change means the phone's view is missing whatever that message carried
+uint32_t bt::tx_latest_lost() {
+    uint32_t lost {0};
+    for (bt_client& client : clients)
+        lost += client.tx_queue.stats().latest_lost;
+    return lost;
 }
 
-bool bt::write_uint8_p(uint8_t * p_data_packet, int len) {
-    if (is_bt_connected()) {
-        esp_err_t ret = esp_spp_write(conn_handle, len, p_data_packet);
-        if (ret == ESP_OK) {
-            return true;
-        }
+// Messages that can be queued for the client, or for every client, without dropping or replacing one
+size_t bt::tx_room(const uint8_t client) {
+    size_t room {BT_TX_QUEUE_DEPTH};
+    for (uint8_t idx = 0; idx < BT_MAX_CLIENTS; idx++) {
+        if ((client == BT_ALL_CLIENTS || client == idx) && clients[idx].handle != 0)
+            room = std::min(room, clients[idx].tx_queue.room());
     }
-    else {
-        std::cout << "Unable to send BT message since there is no connection.\n\n";
+    return room;
+}
+
+// Counters of the transmit queues, summed over the clients
+bt_tx_stats bt::tx_stats() {
+    bt_tx_stats total {};
+    for (bt_client& client : clients) {
+        const bt_tx_stats stats = client.tx_queue.stats();
+        total.queued += stats.queued;
+        total.sent += stats.sent;
+        total.sent_bytes += stats.sent_bytes;
+        total.coalesced += stats.coalesced;
+        total.evicted += stats.evicted;
+        total.dropped += stats.dropped;
+        total.latest_lost += stats.latest_lost;
+        total.write_errors += stats.write_errors;
+        total.congestion_events += stats.congestion_events;
+        total.max_depth = std::max(total.max_depth, stats.max_depth);
     }
-    return false;
-}
\ No newline at end of file
+    total.dropped += frame_pool.exhausted();
+    return total;
+}
+
+// Counters of the received frame streams, summed over the clients
+bt_rx_stats bt::rx_stats() {
+    bt_rx_stats total {};
+    for (const bt_client& client : clients) {
+        const bt_rx_stats& stats = client.rx_parser.stats();
+        total.bytes += stats.bytes;
+        total.frames += stats.frames;
+        total.zero_copy_frames += stats.zero_copy_frames;
+        total.sync_errors += stats.sync_errors;
+        total.length_errors += stats.length_errors;
+        total.crc_errors += stats.crc_errors;
+        total.overflows += stats.overflows;
+        total.sequence_gaps += stats.sequence_gaps;
+        total.duplicates += stats.duplicates;
+    }
+    return total;
+}
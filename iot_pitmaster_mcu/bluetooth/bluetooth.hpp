@@ -9,29 +9,59 @@
 
 #include <stdint.h>
 
+#include "bt_frame.hpp"
+#include "bt_tx_queue.hpp"
 #include "pid_control.hpp"
+#include "transport.hpp"
 
 namespace bt {
 
-// Initialize Bluetooth
+// Initialize Bluetooth, NVS and the SPP transport the app connects over
 bool init_bluetooth();
 
+// Starts another link for phones or hosts to connect over, its connections share the client slots
+// The framing, queues and control ownership are the same whatever the transport
+bool add_transport(transport& link);
+
 void set_bt_msg_dest(pid_control* bt_pid_control);
 
-inline bool bt_connected {false};
-inline void set_bt_connected(bool value) {
-    bt_connected = value;
-}
-inline bool is_bt_connected() {
-    return bt_connected;
-}
+// Whether any phone is connected, or the given client
+bool is_bt_connected(uint8_t client = BT_ALL_CLIENTS);
+
+// Connections opened since boot, a change means a phone just connected
+uint32_t connections();
+
+// The client whose commands change the cook, the earliest connected one, BT_ALL_CLIENTS if none is
+uint8_t control_owner();
+
+// Queues one message in a frame for one client or all of them, returns false if it was dropped for any
+// Never waits on the radio, the frame goes out when each link can take it
+bool write_uint8_p(uint8_t* p_data_packet, int len, bt_tx_class tx_class = BT_TX_RELIABLE,
+        uint8_t client = BT_ALL_CLIENTS);
 
-bool write_uint8_p(uint8_t* p_data_packet, int len);
+// Queues one message given in two parts, such as a message type and data mapped from flash, without joining them first
+bool write_uint8_p(const uint8_t* p_head, int head_len, const uint8_t* p_body, int body_len,
+        bt_tx_class tx_class = BT_TX_RELIABLE, uint8_t client = BT_ALL_CLIENTS);
 template <typename T>
-bool send_data(T& data_packet) {
-    return write_uint8_p((uint8_t*)&data_packet, sizeof(data_packet));
+bool send_data(T& data_packet, bt_tx_class tx_class = BT_TX_RELIABLE, uint8_t client = BT_ALL_CLIENTS) {
+    return write_uint8_p((uint8_t*)&data_packet, sizeof(data_packet), tx_class, client);
 }
 
+// Whether a message of this class is still waiting for any link
+bool tx_waiting(bt_tx_class tx_class);
+
+// BT_TX_LATEST messages some phone never got, evicted or failed, summed over the clients
+uint32_t tx_latest_lost();
+
+// Messages that can be queued for the client, or for every client, without dropping or replacing one
+size_t tx_room(uint8_t client = BT_ALL_CLIENTS);
+
+// Counters of the transmit queues, summed over the clients
+bt_tx_stats tx_stats();
+
+// Counters of the received frame streams, summed over the clients
+bt_rx_stats rx_stats();
+
 }
 
 #endif /* __BLUETOOTH_HPP__ */
\ No newline at end of file
@@ -0,0 +1,136 @@
+/**
+ * @file bt_frame.cpp
+ * @brief Framing for the SPP byte stream
+ * 
+ */
+#include "bt_frame.hpp"
+
+#include <array>
+
+// CRC-16/CCITT-FALSE lookup table, polynomial 0x1021
+static constexpr std::array<uint16_t, 256> crc16_table = []() {
+    std::array<uint16_t, 256> table {};
+    for (uint16_t i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        table[i] = crc;
+    }
+    return table;
+}();
+
+// CRC-16/CCITT-FALSE
+uint16_t bt_crc16(const uint8_t* data, const size_t len, uint16_t crc) {
+    for (size_t i = 0; i < len; i++)
+        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ data[i]) & 0xff];
+    return crc;
+}
+
+// Wraps a payload in a frame, returns the frame size or 0 if it does not fit
+size_t bt_frame_encode(const uint8_t sequence, const uint8_t* payload, const size_t len, uint8_t* out, const size_t out_size) {
+    return bt_frame_encode(sequence, payload, len, nullptr, 0, out, out_size);
+}
+
+// Wraps a payload given in two parts, such as a message type and data read straight from flash
+size_t bt_frame_encode(const uint8_t sequence, const uint8_t* head, const size_t head_len, const uint8_t* body,
+        const size_t body_len, uint8_t* out, const size_t out_size) {
+    const size_t len = head_len + body_len;
+    if (len > BT_FRAME_MAX_PAYLOAD || len + BT_FRAME_OVERHEAD > out_size)
+        return 0;
+
+    out[0] = BT_FRAME_SYNC;
+    out[1] = static_cast<uint8_t>(len);
+    out[2] = sequence;
+    if (head_len > 0)
+        std::memcpy(out + BT_FRAME_HEADER_SIZE, head, head_len);
+    if (body_len > 0)
+        std::memcpy(out + BT_FRAME_HEADER_SIZE + head_len, body, body_len);
+    const uint16_t crc = bt_crc16(out + 1, len + 2);
+    out[BT_FRAME_HEADER_SIZE + len] = crc & 0xff;
+    out[BT_FRAME_HEADER_SIZE + len + 1] = crc >> 8;
+    return len + BT_FRAME_OVERHEAD;
+}
+
+// Checks for a frame at the start of data, sets size to the frame size or the bytes to skip
+// The cheap checks come first so garbage never reaches the CRC
+bt_frame_parser::scan_result bt_frame_parser::scan(const uint8_t* data, const size_t avail, size_t& size) {
+    if (data[0] != BT_FRAME_SYNC) {
+        const void* sync = std::memchr(data + 1, BT_FRAME_SYNC, avail - 1);
+        size = sync ? static_cast<const uint8_t*>(sync) - data : avail;
+        this->m_stats.sync_errors++;
+        return SCAN_SKIP;
+    }
+    if (avail < 2)
+        return SCAN_NEED_MORE;
+
+    const size_t len = data[1];
+    if (len > BT_FRAME_MAX_PAYLOAD) {
+        this->m_stats.length_errors++;
+        size = 1;
+        return SCAN_SKIP;
+    }
+    if (avail < len + BT_FRAME_OVERHEAD)
+        return SCAN_NEED_MORE;
+
+    const uint16_t crc = data[BT_FRAME_HEADER_SIZE + len] | (data[BT_FRAME_HEADER_SIZE + len + 1] << 8);
+    if (bt_crc16(data + 1, len + 2) != crc) {
+        this->m_stats.crc_errors++;
+        size = 1;
+        return SCAN_SKIP;
+    }
+
+    size = len + BT_FRAME_OVERHEAD;
+    return SCAN_FRAME;
+}
+
+// Counts the sequence number, returns false for a repeat that should not be delivered
+bool bt_frame_parser::accept_sequence(const uint8_t sequence) {
+    if (this->m_last_sequence == sequence) {
+        this->m_stats.duplicates++;
+        return false;
+    }
+    if (this->m_last_sequence >= 0 && sequence != static_cast<uint8_t>(this->m_last_sequence + 1))
+        this->m_stats.sequence_gaps++;
+    this->m_last_sequence = sequence;
+    return true;
+}
+
+// Appends bytes to the ring, dropping the oldest ones if it is full
+void bt_frame_parser::push(const uint8_t* data, size_t len) {
+    // Only the newest bytes can still be part of a frame worth keeping
+    if (len > BT_RX_RING_SIZE) {
+        this->m_stats.overflows += len - BT_RX_RING_SIZE;
+        data += len - BT_RX_RING_SIZE;
+        len = BT_RX_RING_SIZE;
+    }
+    const size_t free_space = BT_RX_RING_SIZE - this->buffered();
+    if (len > free_space) {
+        this->m_stats.overflows += len - free_space;
+        this->m_head += len - free_space;
+    }
+
+    const size_t at = this->m_tail % BT_RX_RING_SIZE;
+    const size_t first = std::min(len, BT_RX_RING_SIZE - at);
+    std::memcpy(this->m_ring + at, data, first);
+    std::memcpy(this->m_ring, data + first, len - first);
+    this->m_tail += len;
+}
+
+// Contiguous view of up to len buffered bytes, copied to the scratch only if they wrap
+const uint8_t* bt_frame_parser::linear(const size_t len) {
+    const size_t at = this->m_head % BT_RX_RING_SIZE;
+    if (at + len <= BT_RX_RING_SIZE)
+        return this->m_ring + at;
+
+    const size_t first = BT_RX_RING_SIZE - at;
+    std::memcpy(this->m_scratch, this->m_ring + at, first);
+    std::memcpy(this->m_scratch + first, this->m_ring, len - first);
+    return this->m_scratch;
+}
+
+// Drops buffered bytes and sequence history, for a new connection
+void bt_frame_parser::reset() {
+    this->m_head = 0;
+    this->m_tail = 0;
+    this->m_last_sequence = -1;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file bt_frame.hpp
+ * @brief Framing for the SPP byte stream
+ * 
+ * RFCOMM delivers a byte stream, not messages, so every payload travels
+ * in a frame:
+ * 
+ *   sync (0xa5) | length | sequence | payload (length bytes) | CRC-16 (LE)
+ * 
+ * The CRC is CRC-16/CCITT-FALSE over length, sequence and payload. The
+ * parser takes whole frames straight out of the received chunk when it
+ * can, and only buffers the bytes of a frame that was split across
+ * chunks. It never allocates.
+ */
+#ifndef __BT_FRAME_HPP__
+#define __BT_FRAME_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define BT_FRAME_SYNC           (0xa5)
+#define BT_FRAME_HEADER_SIZE    (3) // sync, length, sequence
+#define BT_FRAME_CRC_SIZE       (2)
+#define BT_FRAME_MAX_PAYLOAD    (250)
+#define BT_FRAME_OVERHEAD       (BT_FRAME_HEADER_SIZE + BT_FRAME_CRC_SIZE)
+#define BT_FRAME_MAX_SIZE       (BT_FRAME_OVERHEAD + BT_FRAME_MAX_PAYLOAD)
+
+// Bytes held for frames split across chunks, a power of two that holds the largest frame
+#define BT_RX_RING_SIZE         (256)
+static_assert(BT_RX_RING_SIZE >= BT_FRAME_MAX_SIZE, "a split frame must fit in the ring");
+
+// CRC-16/CCITT-FALSE
+uint16_t bt_crc16(const uint8_t* data, size_t len, uint16_t crc = 0xffff);
+
+// Wraps a payload in a frame, returns the frame size or 0 if it does not fit
+size_t bt_frame_encode(uint8_t sequence, const uint8_t* payload, size_t len, uint8_t* out, size_t out_size);
+
+// Wraps a payload given in two parts, such as a message type and data read straight from flash
+size_t bt_frame_encode(uint8_t sequence, const uint8_t* head, size_t head_len, const uint8_t* body, size_t body_len,
+        uint8_t* out, size_t out_size);
+
+// Receive counters
+struct bt_rx_stats {
+    uint32_t bytes {0};
+    uint32_t frames {0};
+    uint32_t zero_copy_frames {0}; // taken straight from the received chunk
+    uint32_t sync_errors {0}; // runs of bytes skipped looking for a sync byte
+    uint32_t length_errors {0};
+    uint32_t crc_errors {0};
+    uint32_t overflows {0}; // bytes dropped because the ring was full
+    uint32_t sequence_gaps {0};
+    uint32_t duplicates {0}; // repeated sequence numbers, not delivered
+};
+
+class bt_frame_parser {
+
+    private:
+
+        enum scan_result : uint8_t {
+            SCAN_FRAME,
+            SCAN_SKIP,
+            SCAN_NEED_MORE
+        };
+
+        uint8_t m_ring[BT_RX_RING_SIZE];
+        uint32_t m_head {0}; // next byte to parse
+        uint32_t m_tail {0}; // next byte to write
+        uint8_t m_scratch[BT_FRAME_MAX_SIZE];
+        int16_t m_last_sequence {-1};
+        bt_rx_stats m_stats {};
+
+        // Checks for a frame at the start of data, sets size to the frame size or the bytes to skip
+        scan_result scan(const uint8_t* data, size_t avail, size_t& size);
+
+        // Counts the sequence number, returns false for a repeat that should not be delivered
+        bool accept_sequence(uint8_t sequence);
+
+        // Appends bytes to the ring, dropping the oldest ones if it is full
+        void push(const uint8_t* data, size_t len);
+
+        // Contiguous view of up to len buffered bytes, copied to the scratch only if they wrap
+        const uint8_t* linear(size_t len);
+
+        inline size_t buffered() const {
+            return this->m_tail - this->m_head;
+        }
+
+        template <typename F>
+        inline void deliver(const uint8_t* frame, F& on_frame) {
+            this->m_stats.frames++;
+            if (this->accept_sequence(frame[2]))
+                on_frame(frame[2], frame + BT_FRAME_HEADER_SIZE, frame[1]);
+        }
+
+    public:
+
+        bt_frame_parser() = default;
+
+        // Parses a received chunk, calls on_frame(sequence, payload, length) for every good frame in it
+        template <typename F>
+        void feed(const uint8_t* data, size_t len, F&& on_frame) {
+            this->m_stats.bytes += len;
+            size_t size {0};
+
+            // Nothing buffered, take whole frames straight from the chunk
+            if (this->buffered() == 0) {
+                while (len > 0) {
+                    const scan_result result = this->scan(data, len, size);
+                    if (result == SCAN_NEED_MORE)
+                        break;
+                    if (result == SCAN_FRAME) {
+                        this->m_stats.zero_copy_frames++;
+                        this->deliver(data, on_frame);
+                    }
+                    data += size;
+                    len -= size;
+                }
+                if (len == 0)
+                    return;
+            }
+
+            // Keep the rest and parse from the ring
+            this->push(data, len);
+            while (this->buffered() > 0) {
+                const size_t avail = std::min<size_t>(this->buffered(), BT_FRAME_MAX_SIZE);
+                const uint8_t* view = this->linear(avail);
+                const scan_result result = this->scan(view, avail, size);
+                if (result == SCAN_NEED_MORE)
+                    break;
+                if (result == SCAN_FRAME)
+                    this->deliver(view, on_frame);
+                this->m_head += size;
+            }
+        }
+
+        // Drops buffered bytes and sequence history, for a new connection
+        void reset();
+
+        inline const bt_rx_stats& stats() const {
+            return this->m_stats;
+        }
+};
+
+#endif /* __BT_FRAME_HPP__ */
@@ -0,0 +1,204 @@
+/**
+ * @file bt_tx_queue.cpp
+ * @brief Outgoing SPP frames, written one at a time as the link allows
+ *
+ */
+#include "bt_tx_queue.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// Frames a payload given in two parts into a free slot, the caller holds its only reference
+// Returns nullptr if it does not fit in a frame or every slot is taken
+bt_shared_frame* bt_frame_pool::encode(const uint8_t* head, const size_t head_len, const uint8_t* body,
+        const size_t body_len) {
+    for (bt_shared_frame& frame : this->m_frames) {
+        uint8_t free {0};
+        if (!frame.refs.compare_exchange_strong(free, 1, std::memory_order_acquire))
+            continue;
+        const size_t len = bt_frame_encode(this->m_sequence.fetch_add(1, std::memory_order_relaxed), head, head_len,
+                body, body_len, frame.data.data(), frame.data.size());
+        if (len == 0) {
+            this->release(&frame);
+            return nullptr;
+        }
+        frame.len = static_cast<uint8_t>(len);
+        return &frame;
+    }
+    this->m_exhausted++;
+    return nullptr;
+}
+
+// Slots held by some queue or sender
+size_t bt_frame_pool::in_use() {
+    return std::count_if(this->m_frames.begin(), this->m_frames.end(),
+            [](const bt_shared_frame& frame) {return frame.refs.load(std::memory_order_relaxed) != 0;});
+}
+
+// Index of the BT_TX_LATEST frame still waiting, or m_count if there is none
+size_t bt_tx_queue::find_waiting_latest() {
+    for (size_t idx = this->m_in_flight ? 1 : 0; idx < this->m_count; idx++) {
+        if (this->at(idx).tx_class == BT_TX_LATEST)
+            return idx;
+    }
+    return this->m_count;
+}
+
+// Removes one entry and lets go of its frame, the ones after it move up
+void bt_tx_queue::remove(const size_t idx) {
+    this->m_pool->release(this->at(idx).frame);
+    for (size_t later = idx; later + 1 < this->m_count; later++)
+        this->at(later) = this->at(later + 1);
+    this->m_count--;
+}
+
+// Queues a frame from the pool, taking a reference of its own, returns false if it was dropped
+bool bt_tx_queue::push(bt_shared_frame* frame, const bt_tx_class tx_class) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+
+    // A newer state replaces the one still waiting, keeping its place
+    if (tx_class == BT_TX_LATEST) {
+        const size_t idx = this->find_waiting_latest();
+        if (idx < this->m_count) {
+            entry& waiting = this->at(idx);
+            this->m_pool->retain(frame);
+            this->m_pool->release(waiting.frame);
+            waiting.frame = frame;
+            this->m_stats.coalesced++;
+            return true;
+        }
+    }
+
+    if (this->m_count == BT_TX_QUEUE_DEPTH) {
+        const size_t idx = this->find_waiting_latest();
+        if (tx_class == BT_TX_LATEST || idx == this->m_count) {
+            this->m_stats.dropped++;
+            std::cout << "Error: BT transmit queue is full, dropping a " << static_cast<int>(frame->len) <<
+                    " byte frame.\n\n";
+            return false;
+        }
+        this->remove(idx);
+        this->m_stats.evicted++;
+        this->m_stats.latest_lost++;
+    }
+
+    this->m_pool->retain(frame);
+    entry& added = this->at(this->m_count);
+    added.frame = frame;
+    added.tx_class = tx_class;
+    added.failures = 0;
+    this->m_count++;
+    this->m_stats.queued++;
+    this->m_stats.max_depth = std::max<uint32_t>(this->m_stats.max_depth, this->m_count);
+    return true;
+}
+
+// Frames a payload and queues it, returns false if it was dropped
+bool bt_tx_queue::push(const uint8_t* payload, const size_t len, const bt_tx_class tx_class) {
+    return this->push(payload, len, nullptr, 0, tx_class);
+}
+
+// Frames a payload given in two parts and queues it, the parts are copied only into the frame
+bool bt_tx_queue::push(const uint8_t* head, const size_t head_len, const uint8_t* body, const size_t body_len,
+        const bt_tx_class tx_class) {
+    bt_shared_frame* frame = this->m_pool->encode(head, head_len, body, body_len);
+    if (frame == nullptr) {
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        this->m_stats.dropped++;
+        std::cout << "Error: unable to frame a " << head_len + body_len << " byte BT message.\n\n";
+        return false;
+    }
+    const bool queued = this->push(frame, tx_class);
+    this->m_pool->release(frame);
+    return queued;
+}
+
+// Claims the next frame if the link can take it and returns it, nullptr if nothing can go
+// The frame stays valid until write_done()
+const uint8_t* bt_tx_queue::next(size_t& len) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (this->m_in_flight || this->m_congested || this->m_count == 0)
+        return nullptr;
+
+    const bt_shared_frame* head = this->at(0).frame;
+    this->m_in_flight = true;
+    len = head->len;
+    return head->data.data();
+}
+
+// The claimed frame finished writing, congested is the link state reported with it
+void bt_tx_queue::write_done(const bool ok, const bool congested) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_in_flight)
+        return;
+    this->m_in_flight = false;
+
+    if (congested && !this->m_congested)
+        this->m_stats.congestion_events++;
+    this->m_congested = congested;
+
+    entry& head = this->at(0);
+    if (ok) {
+        this->m_stats.sent++;
+        this->m_stats.sent_bytes += head.frame->len;
+    }
+    else {
+        this->m_stats.write_errors++;
+        // Periodic state is not worth a retry, the next one is on its way
+        if (head.tx_class == BT_TX_RELIABLE && ++head.failures < BT_TX_MAX_RETRIES)
+            return;
+        if (head.tx_class == BT_TX_LATEST)
+            this->m_stats.latest_lost++;
+        this->m_stats.dropped++;
+    }
+    this->m_pool->release(head.frame);
+    this->m_head = (this->m_head + 1) % BT_TX_QUEUE_DEPTH;
+    this->m_count--;
+}
+
+// The link reported a change in congestion
+void bt_tx_queue::congestion(const bool congested) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (congested && !this->m_congested)
+        this->m_stats.congestion_events++;
+    this->m_congested = congested;
+}
+
+// Drops every frame, for a link that went down or came up
+void bt_tx_queue::clear() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    for (size_t idx = 0; idx < this->m_count; idx++)
+        this->m_pool->release(this->at(idx).frame);
+    this->m_stats.dropped += this->m_count;
+    this->m_head = 0;
+    this->m_count = 0;
+    this->m_in_flight = false;
+    this->m_congested = false;
+}
+
+// Whether a frame of this class is queued and not yet being written
+bool bt_tx_queue::waiting(const bt_tx_class tx_class) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    for (size_t idx = this->m_in_flight ? 1 : 0; idx < this->m_count; idx++) {
+        if (this->at(idx).tx_class == tx_class)
+            return true;
+    }
+    return false;
+}
+
+size_t bt_tx_queue::size() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_count;
+}
+
+// Frames that can be pushed without dropping or evicting one
+size_t bt_tx_queue::room() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return BT_TX_QUEUE_DEPTH - this->m_count;
+}
+
+bt_tx_stats bt_tx_queue::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_stats;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file bt_tx_queue.hpp
+ * @brief Outgoing SPP frames, written one at a time as the link allows
+ *
+ * Callers only queue frames, they never wait on the radio. The SPP
+ * callback claims the next frame when the previous write completes or
+ * congestion clears. A BT_TX_LATEST frame still waiting is replaced by a
+ * newer one, so a congested link carries the latest state and not a
+ * backlog. BT_TX_RELIABLE frames are never replaced, push waiting
+ * BT_TX_LATEST frames out when the queue is full, and are retried when a
+ * write fails.
+ *
+ * Every phone has its own queue, but frames live in a shared pool and are
+ * reference counted, so a status report is framed once and each queue
+ * holds the same frame until its phone has been sent it.
+ */
+#ifndef __BT_TX_QUEUE_HPP__
+#define __BT_TX_QUEUE_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "bt_frame.hpp"
+
+// Phones served at once, and the client id that stands for all of them
+#define BT_MAX_CLIENTS      (3)
+#define BT_ALL_CLIENTS      (0xff)
+
+// Frames held per phone, including the one being written
+#define BT_TX_QUEUE_DEPTH   (8)
+
+// Frames in the pool, every queue full of frames of its own, and one being framed by each sending thread
+#define BT_FRAME_POOL_SIZE  (BT_TX_QUEUE_DEPTH*BT_MAX_CLIENTS + 4)
+
+// Failed writes of a BT_TX_RELIABLE frame before it is given up
+#define BT_TX_MAX_RETRIES   (3)
+
+enum bt_tx_class : uint8_t {
+    BT_TX_LATEST = 0, // periodic state, only the newest one matters
+    BT_TX_RELIABLE = 1 // acks and alarms
+};
+
+struct bt_tx_stats {
+    uint32_t queued {0};
+    uint32_t sent {0};
+    uint32_t sent_bytes {0};
+    uint32_t coalesced {0}; // replaced by a newer BT_TX_LATEST frame before going out
+    uint32_t evicted {0}; // BT_TX_LATEST frames pushed out to make room for a BT_TX_RELIABLE one
+    uint32_t dropped {0}; // no room, too long, out of retries, or the link went down
+    uint32_t latest_lost {0}; // BT_TX_LATEST frames evicted or whose write failed, the phone never got them
+    uint32_t write_errors {0};
+    uint32_t congestion_events {0};
+    uint32_t max_depth {0};
+};
+
+// One framed message, held by every queue it was pushed to
+struct bt_shared_frame {
+    std::array<uint8_t, BT_FRAME_MAX_SIZE> data;
+    uint8_t len {0};
+    std::atomic<uint8_t> refs {0};
+};
+
+class bt_frame_pool {
+
+    private:
+
+        std::array<bt_shared_frame, BT_FRAME_POOL_SIZE> m_frames {};
+        std::atomic<uint8_t> m_sequence {0};
+        std::atomic<uint32_t> m_exhausted {0};
+
+    public:
+
+        // Frames a payload given in two parts into a free slot, the caller holds its only reference
+        // Returns nullptr if it does not fit in a frame or every slot is taken
+        bt_shared_frame* encode(const uint8_t* head, size_t head_len, const uint8_t* body, size_t body_len);
+
+        inline void retain(bt_shared_frame* frame) {
+            frame->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Drops a reference, the slot is free again once the last one is gone
+        inline void release(bt_shared_frame* frame) {
+            frame->refs.fetch_sub(1, std::memory_order_acq_rel);
+        }
+
+        // Slots held by some queue or sender
+        size_t in_use();
+
+        // Frames that found no free slot
+        inline uint32_t exhausted() {
+            return this->m_exhausted;
+        }
+};
+
+class bt_tx_queue {
+
+    private:
+
+        struct entry {
+            bt_shared_frame* frame;
+            bt_tx_class tx_class;
+            uint8_t failures;
+        };
+
+        bt_frame_pool* m_pool;
+        std::mutex m_lock;
+        std::array<entry, BT_TX_QUEUE_DEPTH> m_entries {};
+        size_t m_head {0};
+        size_t m_count {0};
+        bool m_in_flight {false}; // the head entry is being written
+        bool m_congested {false};
+        bt_tx_stats m_stats {};
+
+        inline entry& at(const size_t idx) {
+            return this->m_entries[(this->m_head + idx) % BT_TX_QUEUE_DEPTH];
+        }
+
+        // Index of the BT_TX_LATEST frame still waiting, or m_count if there is none
+        size_t find_waiting_latest();
+
+        // Removes one entry and lets go of its frame, the ones after it move up
+        void remove(size_t idx);
+
+    public:
+
+        inline explicit bt_tx_queue(bt_frame_pool& pool) {
+            this->m_pool = &pool;
+        }
+
+        inline ~bt_tx_queue() {
+            this->clear();
+        }
+
+        bt_tx_queue(const bt_tx_queue&) = delete;
+        bt_tx_queue& operator=(const bt_tx_queue&) = delete;
+
+        // Queues a frame from the pool, taking a reference of its own, returns false if it was dropped
+        bool push(bt_shared_frame* frame, bt_tx_class tx_class);
+
+        // Frames a payload and queues it, returns false if it was dropped
+        bool push(const uint8_t* payload, size_t len, bt_tx_class tx_class);
+
+        // Frames a payload given in two parts and queues it, the parts are copied only into the frame
+        bool push(const uint8_t* head, size_t head_len, const uint8_t* body, size_t body_len, bt_tx_class tx_class);
+
+        // Claims the next frame if the link can take it and returns it, nullptr if nothing can go
+        // The frame stays valid until write_done()
+        const uint8_t* next(size_t& len);
+
+        // The claimed frame finished writing, congested is the link state reported with it
+        void write_done(bool ok, bool congested);
+
+        // The link reported a change in congestion
+        void congestion(bool congested);
+
+        // Drops every frame, for a link that went down or came up
+        void clear();
+
+        // Whether a frame of this class is queued and not yet being written
+        bool waiting(bt_tx_class tx_class);
+
+        size_t size();
+
+        // Frames that can be pushed without dropping or evicting one
+        size_t room();
+
+        bt_tx_stats stats();
+};
+
+#endif /* __BT_TX_QUEUE_HPP__ */
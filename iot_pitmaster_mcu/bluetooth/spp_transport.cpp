@@ -0,0 +1,248 @@
+/**
+ * @file spp_transport.cpp
+ * @author Mitchell Taylor, and example_spp_acceptor_demo.c by ESP-IDF
+ * @brief Classic Bluetooth SPP transport
+ * 
+ */
+#include "spp_transport.hpp"
+
+#include <iostream>
+#include <string>
+
+#include "esp_bt.h"
+#include "esp_bt_device.h"
+#include "esp_bt_main.h"
+#include "esp_err.h"
+#include "esp_gap_bt_api.h"
+#include "esp_spp_api.h"
+
+#include "debug.hpp"
+
+#define SPP_SERVER_NAME "SPP_SERVER"
+
+static const esp_spp_mode_t esp_spp_mode {ESP_SPP_MODE_CB};
+static const esp_spp_sec_t esp_spp_sec_mask {ESP_SPP_SEC_NONE};
+static const esp_spp_role_t esp_spp_role {ESP_SPP_ROLE_SLAVE};
+
+// Bluedroid calls back through plain functions, there is only one SPP server
+static spp_transport* spp_instance {nullptr};
+
+static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
+    switch (event) {
+
+    // SPP is initialized
+    case ESP_SPP_INIT_EVT: {
+        std::cout << "SPP: Received ESP_SPP_INIT_EVT\n\n";
+        esp_bt_dev_set_device_name("IoT Pitmaster");
+        esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
+        esp_spp_start_srv(esp_spp_sec_mask, esp_spp_role, 0, SPP_SERVER_NAME);
+        break;
+    }
+
+    // SPP is uninitialized
+    case ESP_SPP_UNINIT_EVT: {
+        std::cout << "SPP: Received ESP_SPP_UNINIT_EVT\n\n";
+        break;
+    }
+
+    // Service Discovery Protocol (SDP) is complete
+    case ESP_SPP_DISCOVERY_COMP_EVT: {
+        std::cout << "SPP: Received ESP_SPP_DISCOVERY_COMP_EVT\n\n";
+        break;
+    }
+
+    // SPP client connection open
+    case ESP_SPP_OPEN_EVT: {
+        std::cout << "SPP: Received ESP_SPP_OPEN_EVT\n\n";
+        break;
+    }
+
+    // SPP connection is closed
+    case ESP_SPP_CLOSE_EVT: {
+        std::cout << "SPP: Received ESP_SPP_CLOSE_EVT\n\n";
+        spp_instance->sink()->on_close(*spp_instance, param->close.handle);
+        break;
+    }
+
+    // SPP server is started
+    case ESP_SPP_START_EVT: {
+        std::cout << "SPP: Received ESP_SPP_START_EVT\n\n";
+        break;
+    }
+
+    // SPP client initiates a connection
+    case ESP_SPP_CL_INIT_EVT: {
+        std::cout << "SPP: Received ESP_SPP_CL_INIT_EVT\n\n";
+        break;
+    }
+
+    // SPP connection received data
+    case ESP_SPP_DATA_IND_EVT: {
+        if constexpr (DEBUG_READ_BT) {
+            char hex_str[5*param->data_ind.len + 1];
+            for (int idx = 0; idx < param->data_ind.len; idx++)
+                snprintf(hex_str + 5*idx, 6, "0x%02hhx ", param->data_ind.data[idx]);
+            std::cout << "SPP: Received ESP_SPP_DATA_IND_EVT, length = " << std::to_string(param->data_ind.len) << "\n" <<
+                    "Received Bits: " << hex_str << "\n\n";
+        }
+        spp_instance->sink()->on_data(*spp_instance, param->data_ind.handle, param->data_ind.data,
+                param->data_ind.len);
+        break;
+    }
+
+    // SPP connection congestion status changed
+    case ESP_SPP_CONG_EVT: {
+        std::cout << "SPP: Received ESP_SPP_CONG_EVT, congested = " << param->cong.cong << "\n\n";
+        spp_instance->sink()->on_congestion(*spp_instance, param->cong.handle, param->cong.cong);
+        break;
+    }
+
+    // SPP write operation completes
+    case ESP_SPP_WRITE_EVT: {
+        if constexpr (DEBUG_WRITE_BT)
+            std::cout << "SPP: Received ESP_SPP_WRITE_EVT, length = " << std::to_string(param->write.len) << "\n\n";
+        spp_instance->sink()->on_write_done(*spp_instance, param->write.handle, param->write.status == ESP_SPP_SUCCESS,
+                param->write.cong);
+        break;
+    }
+
+    // SPP Server connection open
+    case ESP_SPP_SRV_OPEN_EVT: {
+        std::cout << "SPP: Received ESP_SPP_SRV_OPEN_EVT\n\n";
+        spp_instance->sink()->on_open(*spp_instance, param->srv_open.handle);
+        break;
+    }
+
+    // SPP server stopped
+    case ESP_SPP_SRV_STOP_EVT: {
+        std::cout << "SPP: Received ESP_SPP_SRV_STOP_EVT\n\n";
+        break;
+    }
+
+    default: {
+        break;
+    }
+    }
+}
+
+static void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
+{
+    switch (event) {
+
+    case ESP_BT_GAP_CONFIG_EIR_DATA_EVT: {
+        if constexpr (DEBUG_GAP_BT)
+            std::cout << "GAP: Received ESP_BT_GAP_CONFIG_EIR_DATA_EVT\n\n";
+        break;
+    }
+
+    case ESP_BT_GAP_MODE_CHG_EVT: {
+        if constexpr (DEBUG_GAP_BT) {
+            const int mode = param->mode_chg.mode;
+            std::cout << "GAP: Received ESP_BT_GAP_MODE_CHG_EVT, mode: " << mode << "\n\n";
+        }
+        break;
+    }
+
+    default: {
+        if constexpr (DEBUG_GAP_BT)
+            std::cout << "GAP: Received event: #" << event << "\n\n";
+        break;
+    }
+    }
+    return;
+}
+
+// Brings up the Bluetooth controller, Bluedroid and the SPP server
+bool spp_transport::start(transport_sink& sink) {
+    if (spp_instance != nullptr) {
+        std::cout << "Error: the SPP transport is already started.\n\n";
+        return false;
+    }
+    this->m_sink = &sink;
+    spp_instance = this;
+
+    esp_err_t ret {ESP_OK};
+    ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
+
+    // Init Bluetooth controller
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
+        std::cout << "Error: initialize bluetooth controller failed\n\n";
+        return false;
+    }
+
+    // Get the base MAC address
+    uint8_t base_mac_addr[6] = {0};
+    ret = esp_efuse_mac_get_default(base_mac_addr);
+    std::cout << "Using \"" << std::hex <<
+            "0x" << static_cast<int>(base_mac_addr[0]) << " 0x" << static_cast<int>(base_mac_addr[1]) <<
+            " 0x" << static_cast<int>(base_mac_addr[2]) << " 0x" << static_cast<int>(base_mac_addr[3]) <<
+            " 0x" << static_cast<int>(base_mac_addr[4]) << " 0x" << static_cast<int>(base_mac_addr[5]) <<
+            "\" as base MAC address\n\n" << std::dec;
+    esp_base_mac_addr_set(base_mac_addr);
+
+    // Get the Bluetooth MAC address
+    uint8_t bt_mac_addr[6] = {0};
+    ESP_ERROR_CHECK(esp_read_mac(bt_mac_addr, ESP_MAC_BT));
+    std::cout << "Using \"" << std::hex <<
+            "0x" << static_cast<int>(bt_mac_addr[0]) << " 0x" << static_cast<int>(bt_mac_addr[1]) <<
+            " 0x" << static_cast<int>(bt_mac_addr[2]) << " 0x" << static_cast<int>(bt_mac_addr[3]) <<
+            " 0x" << static_cast<int>(bt_mac_addr[4]) << " 0x" << static_cast<int>(bt_mac_addr[5]) <<
+            "\" as BT MAC address\n\n" << std::dec;
+
+    // Enable Bluetooth controller
+    if ((ret = esp_bt_controller_enable(ESP_BT_MODE_CLASSIC_BT)) != ESP_OK) {
+        std::cout << "Error: enable bluetooth controller failed.\n\n";
+        return false;
+    }
+
+    // Set BT power, N0 and P3 are default
+    if ((ret = esp_bredr_tx_power_set(ESP_PWR_LVL_N0, ESP_PWR_LVL_P3))) {
+        std::cout << "Error: set BT power failed.\n\n";
+        return false;
+    }
+
+    // Init Bluedroid
+    if ((ret = esp_bluedroid_init()) != ESP_OK) {
+        std::cout << "Error: initialize bluedroid failed.\n\n";
+        return false;
+    }
+
+    // Enable Bluedroid
+    if ((ret = esp_bluedroid_enable()) != ESP_OK) {
+        std::cout << "Error: enable bluedroid failed.\n\n";
+        return false;
+    }
+
+    // Register Generic Access Profile (GAP) callback function
+    if ((ret = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK) {
+        std::cout << "Error: GAP register failed.\n\n";
+        return false;
+    }
+
+    // Register Serial Port Profile (SPP) callback function
+    if ((ret = esp_spp_register_callback(esp_spp_cb)) != ESP_OK) {
+        std::cout << "Error: SPP register failed.\n\n";
+        return false;
+    }
+
+    // Initialize Serial Port Profile (SPP)
+    if ((ret = esp_spp_init(esp_spp_mode)) != ESP_OK) {
+        std::cout << "Error: initialize SPP failed.\n\n";
+        return false;
+    }
+
+    // Successfully initialized
+    return true;
+}
+
+// Starts writing one frame, Bluedroid copies it before this returns
+bool spp_transport::write(const uint32_t handle, const uint8_t* data, const size_t len) {
+    return esp_spp_write(handle, static_cast<int>(len), const_cast<uint8_t*>(data)) == ESP_OK;
+}
+
+// Closes a connection, ESP_SPP_CLOSE_EVT follows
+void spp_transport::disconnect(const uint32_t handle) {
+    esp_spp_disconnect(handle);
+}
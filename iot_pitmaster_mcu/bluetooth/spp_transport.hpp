@@ -0,0 +1,41 @@
+/**
+ * @file spp_transport.hpp
+ * @brief Classic Bluetooth SPP transport
+ * 
+ * The SPP server the Android app connects to. Bluedroid delivers every
+ * event from its BTC task, one at a time, and a connection's handle is
+ * the one SPP gives it. Only one can be started, Bluedroid takes plain
+ * function callbacks.
+ */
+#ifndef __SPP_TRANSPORT_HPP__
+#define __SPP_TRANSPORT_HPP__
+
+#include "transport.hpp"
+
+class spp_transport : public transport {
+
+    private:
+
+        transport_sink* m_sink {nullptr};
+
+    public:
+
+        inline const char* name() const override {
+            return "SPP";
+        }
+
+        // Brings up the Bluetooth controller, Bluedroid and the SPP server
+        bool start(transport_sink& sink) override;
+
+        // Starts writing one frame, Bluedroid copies it before this returns
+        bool write(uint32_t handle, const uint8_t* data, size_t len) override;
+
+        // Closes a connection, ESP_SPP_CLOSE_EVT follows
+        void disconnect(uint32_t handle) override;
+
+        inline transport_sink* sink() const {
+            return this->m_sink;
+        }
+};
+
+#endif /* __SPP_TRANSPORT_HPP__ */
@@ -0,0 +1,69 @@
+/**
+ * @file transport.hpp
+ * @brief Byte-stream links that carry the framed messages to and from the app
+ *
+ * A transport accepts connections and moves bytes, nothing more: the
+ * framing, the per-phone queues and the control ownership in
+ * bluetooth.cpp sit on top of it and are the same for every transport.
+ * SPP is the one the app uses, uart_transport carries the same frames
+ * over a wire, and the host build adds a socket transport so the whole
+ * protocol can be driven from Linux.
+ *
+ * Each transport reports its events to the sink one at a time, from its
+ * own task, the way Bluedroid delivers SPP callbacks. A connection is
+ * named by a handle that is unique within its transport and never 0.
+ * At most one write is outstanding per connection, the next one starts
+ * after on_write_done.
+ */
+#ifndef __TRANSPORT_HPP__
+#define __TRANSPORT_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+class transport;
+
+// Receives a transport's events
+class transport_sink {
+
+    public:
+
+        virtual ~transport_sink() = default;
+
+        // A connection opened
+        virtual void on_open(transport& link, uint32_t handle) = 0;
+
+        // A connection closed, its handle may be reused after this
+        virtual void on_close(transport& link, uint32_t handle) = 0;
+
+        // Bytes arrived, a chunk can hold part of a frame or several of them
+        virtual void on_data(transport& link, uint32_t handle, const uint8_t* data, size_t len) = 0;
+
+        // The last write finished, congested says the link wants a pause before the next one
+        virtual void on_write_done(transport& link, uint32_t handle, bool ok, bool congested) = 0;
+
+        // The link became congested or cleared
+        virtual void on_congestion(transport& link, uint32_t handle, bool congested) = 0;
+};
+
+class transport {
+
+    public:
+
+        virtual ~transport() = default;
+
+        // For the console and error messages
+        virtual const char* name() const = 0;
+
+        // Starts accepting connections, returns false if the link could not be brought up
+        virtual bool start(transport_sink& sink) = 0;
+
+        // Starts writing one frame, the data is copied before this returns
+        // Returns false if the write could not be started, on_write_done follows otherwise
+        virtual bool write(uint32_t handle, const uint8_t* data, size_t len) = 0;
+
+        // Closes a connection, on_close follows
+        virtual void disconnect(uint32_t handle) = 0;
+};
+
+#endif /* __TRANSPORT_HPP__ */
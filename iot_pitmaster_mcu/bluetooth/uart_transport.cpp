@@ -0,0 +1,66 @@
+/**
+ * @file uart_transport.cpp
+ * @brief The app protocol over a UART
+ * 
+ */
+#include "uart_transport.hpp"
+
+#include <iostream>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+
+// Installs the driver and starts the reader thread
+bool uart_transport::start(transport_sink& sink) {
+    uart_config_t config {};
+    config.baud_rate = this->m_baud;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    if (uart_param_config(this->m_port, &config) != ESP_OK ||
+            uart_set_pin(this->m_port, this->m_tx_pin, this->m_rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) {
+        std::cout << "Error: configuring UART " << static_cast<int>(this->m_port) << " failed.\n\n";
+        return false;
+    }
+    if (uart_driver_install(this->m_port, UART_LINK_RX_BUFFER, UART_LINK_TX_BUFFER, 0, nullptr, 0) != ESP_OK) {
+        std::cout << "Error: installing the UART " << static_cast<int>(this->m_port) << " driver failed.\n\n";
+        return false;
+    }
+    this->m_sink = &sink;
+    std::thread([this]() {this->run();}).detach();
+    return true;
+}
+
+// Reader thread: received bytes, opening the connection and write completions
+void uart_transport::run() {
+    uint8_t chunk[128];
+    while (true) {
+        const int len = uart_read_bytes(this->m_port, chunk, sizeof(chunk), pdMS_TO_TICKS(UART_LINK_POLL_MS));
+        if (len > 0) {
+            if (!this->m_open.exchange(true))
+                this->m_sink->on_open(*this, UART_LINK_HANDLE);
+            this->m_sink->on_data(*this, UART_LINK_HANDLE, chunk, static_cast<size_t>(len));
+        }
+        if (this->m_write_done.exchange(false))
+            this->m_sink->on_write_done(*this, UART_LINK_HANDLE, this->m_write_ok, false);
+    }
+}
+
+// Copies the frame into the driver's transmit buffer, waits only while that is full
+bool uart_transport::write(const uint32_t handle, const uint8_t* data, const size_t len) {
+    if (handle != UART_LINK_HANDLE || !this->m_open)
+        return false;
+    const int written = uart_write_bytes(this->m_port, reinterpret_cast<const char*>(data), len);
+    this->m_write_ok = written == static_cast<int>(len);
+    this->m_write_done = true;
+    return true;
+}
+
+// Closes the connection, the next bytes received open it again
+void uart_transport::disconnect(const uint32_t handle) {
+    if (handle != UART_LINK_HANDLE || !this->m_open.exchange(false))
+        return;
+    uart_flush_input(this->m_port);
+    this->m_sink->on_close(*this, UART_LINK_HANDLE);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file uart_transport.hpp
+ * @brief The app protocol over a UART
+ * 
+ * Carries the same frames as SPP over a wire, for a host tool on the
+ * USB port or a second board. A wire has no connect event, so the one
+ * connection opens when the first bytes arrive and stays open until
+ * disconnect(). Writes go into the driver's transmit buffer and
+ * complete from the reader thread, so events still come one at a time.
+ */
+#ifndef __UART_TRANSPORT_HPP__
+#define __UART_TRANSPORT_HPP__
+
+#include <atomic>
+#include <cstdint>
+
+#include "driver/uart.h"
+
+#include "transport.hpp"
+
+// The one connection's handle
+#define UART_LINK_HANDLE        (1)
+
+// Driver buffers, the receive one holds a few frames
+#define UART_LINK_RX_BUFFER     (1024)
+#define UART_LINK_TX_BUFFER     (1024)
+
+// Longest the reader waits for bytes before delivering write completions
+#define UART_LINK_POLL_MS       (10)
+
+class uart_transport : public transport {
+
+    private:
+
+        uart_port_t m_port;
+        int m_tx_pin;
+        int m_rx_pin;
+        int m_baud;
+        transport_sink* m_sink {nullptr};
+        std::atomic<bool> m_open {false};
+        std::atomic<bool> m_write_done {false};
+        std::atomic<bool> m_write_ok {false};
+
+        // Reader thread: received bytes, opening the connection and write completions
+        void run();
+
+    public:
+
+        // Pins as uart_set_pin() takes them, UART_PIN_NO_CHANGE keeps the port's default
+        inline uart_transport(const uart_port_t port, const int tx_pin, const int rx_pin, const int baud) {
+            this->m_port = port;
+            this->m_tx_pin = tx_pin;
+            this->m_rx_pin = rx_pin;
+            this->m_baud = baud;
+        }
+
+        inline const char* name() const override {
+            return "UART";
+        }
+
+        // Installs the driver and starts the reader thread
+        bool start(transport_sink& sink) override;
+
+        // Copies the frame into the driver's transmit buffer, waits only while that is full
+        bool write(uint32_t handle, const uint8_t* data, size_t len) override;
+
+        // Closes the connection, the next bytes received open it again
+        void disconnect(uint32_t handle) override;
+};
+
+#endif /* __UART_TRANSPORT_HPP__ */
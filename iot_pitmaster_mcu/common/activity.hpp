@@ -0,0 +1,129 @@
+/**
+ * @file activity.hpp
+ * @brief Where the CPU's time and wakeups go, task by task
+ *
+ * A task names itself once from its own thread, and from then on every
+ * sleep it takes through sys_clock, and every wait it marks, is counted:
+ * how often it woke, how long it stayed awake and how long it slept.
+ * Time is passed in, and sys_clock passes its own, so on the host the
+ * simulator's virtual clock drives the counts and a test can step it by
+ * hand. Whatever the tasks' awake time leaves of the time elapsed is
+ * time the chip could spend idle, or in light sleep in the power mode.
+ */
+#ifndef __ACTIVITY_HPP__
+#define __ACTIVITY_HPP__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// Most tasks that can be counted
+#define ACTIVITY_MAX_TASKS (8)
+
+// Counters for one task
+struct activity_stats {
+    const char* name {""};
+    uint32_t wakeups {0};
+    uint64_t awake_us {0};
+    uint64_t asleep_us {0};
+    uint32_t max_awake_us {0}; // longest stretch between a wakeup and the next sleep
+};
+
+class activity_monitor {
+
+    private:
+
+        struct task_slot {
+            const char* name {""};
+            std::atomic<uint32_t> wakeups {0};
+            std::atomic<uint64_t> awake_us {0};
+            std::atomic<uint64_t> asleep_us {0};
+            std::atomic<uint32_t> max_awake_us {0};
+            int64_t since_us {0}; // last wakeup or sleep, the task's own thread only
+        };
+
+        std::mutex m_add_lock;
+        std::array<task_slot, ACTIVITY_MAX_TASKS> m_tasks;
+        std::atomic<uint8_t> m_count {0};
+        std::atomic<int64_t> m_start_us {0};
+
+    public:
+
+        activity_monitor() = default;
+        activity_monitor(const activity_monitor&) = delete;
+        activity_monitor& operator=(const activity_monitor&) = delete;
+
+        // Adds a task that is awake at now_us, returns its index or -1 if full
+        inline int add_task(const char* name, const int64_t now_us) {
+            std::lock_guard<std::mutex> lock(this->m_add_lock);
+            const uint8_t idx = this->m_count.load(std::memory_order_relaxed);
+            if (idx >= ACTIVITY_MAX_TASKS)
+                return -1;
+            this->m_tasks[idx].name = name;
+            this->m_tasks[idx].since_us = now_us;
+            if (idx == 0)
+                this->m_start_us.store(now_us, std::memory_order_relaxed);
+            this->m_count.store(idx + 1, std::memory_order_release);
+            return idx;
+        }
+
+        // The task goes to sleep at now_us, from its own thread only
+        inline void sleeping(const int task, const int64_t now_us) {
+            if (task < 0 || task >= ACTIVITY_MAX_TASKS)
+                return;
+            task_slot& slot = this->m_tasks[task];
+            const uint32_t awake_us = static_cast<uint32_t>(std::max<int64_t>(now_us - slot.since_us, 0));
+            slot.awake_us.fetch_add(awake_us, std::memory_order_relaxed);
+            if (awake_us > slot.max_awake_us.load(std::memory_order_relaxed))
+                slot.max_awake_us.store(awake_us, std::memory_order_relaxed);
+            slot.since_us = now_us;
+        }
+
+        // The task woke up at now_us, from its own thread only
+        inline void woke(const int task, const int64_t now_us) {
+            if (task < 0 || task >= ACTIVITY_MAX_TASKS)
+                return;
+            task_slot& slot = this->m_tasks[task];
+            slot.asleep_us.fetch_add(static_cast<uint64_t>(std::max<int64_t>(now_us - slot.since_us, 0)),
+                    std::memory_order_relaxed);
+            slot.wakeups.fetch_add(1, std::memory_order_relaxed);
+            slot.since_us = now_us;
+        }
+
+        inline uint8_t count() const {
+            return this->m_count.load(std::memory_order_acquire);
+        }
+
+        inline activity_stats stats(const uint8_t idx) const {
+            activity_stats stats {};
+            if (idx >= this->count())
+                return stats;
+            const task_slot& slot = this->m_tasks[idx];
+            stats.name = slot.name;
+            stats.wakeups = slot.wakeups.load(std::memory_order_relaxed);
+            stats.awake_us = slot.awake_us.load(std::memory_order_relaxed);
+            stats.asleep_us = slot.asleep_us.load(std::memory_order_relaxed);
+            stats.max_awake_us = slot.max_awake_us.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        // When counting started, the first task added or the last reset
+        inline int64_t start_us() const {
+            return this->m_start_us.load(std::memory_order_relaxed);
+        }
+
+        // Clears the counters, a stretch a task is in the middle of still counts in full
+        inline void reset(const int64_t now_us) {
+            for (task_slot& slot : this->m_tasks) {
+                slot.wakeups = 0;
+                slot.awake_us = 0;
+                slot.asleep_us = 0;
+                slot.max_awake_us = 0;
+            }
+            this->m_start_us.store(now_us, std::memory_order_relaxed);
+        }
+};
+
+#endif /* __ACTIVITY_HPP__ */
@@ -0,0 +1,80 @@
+/**
+ * @file power.hpp
+ * @brief Power mode: frequency scaling and light sleep between control ticks
+ *
+ * In the power mode the CPU drops from POWER_MAX_CPU_MHZ to
+ * POWER_MIN_CPU_MHZ whenever no driver holds it up, and the chip goes
+ * into light sleep whenever every task is waiting, waking for the next
+ * tick on its own. The step timer and the fan PWM count the APB clock,
+ * so a motor holds it at full speed for a move and the fan for as long
+ * as it spins, which also keeps the chip out of light sleep meanwhile.
+ * Without CONFIG_PM_ENABLE the locks do nothing and the mode can't be
+ * turned on.
+ */
+#ifndef __POWER_HPP__
+#define __POWER_HPP__
+
+#include <atomic>
+#include <iostream>
+
+#include "esp_err.h"
+#include "esp_pm.h"
+
+// 1 starts the board in the power mode, for battery-powered units
+#define POWER_LOW_POWER (0)
+
+// CPU clock limits in the power mode
+#define POWER_MAX_CPU_MHZ (160)
+#define POWER_MIN_CPU_MHZ (80)
+
+// A power management lock held or not, taking it twice is the same as once
+class pm_lock {
+
+    private:
+
+        esp_pm_lock_handle_t m_handle {nullptr};
+        std::atomic<bool> m_held {false};
+
+    public:
+
+        inline pm_lock(const esp_pm_lock_type_t type, const char* name) {
+            // Fails without CONFIG_PM_ENABLE, the lock is then a no-op
+            if (esp_pm_lock_create(type, 0, name, &this->m_handle) != ESP_OK)
+                this->m_handle = nullptr;
+        }
+
+        pm_lock(const pm_lock&) = delete;
+        pm_lock& operator=(const pm_lock&) = delete;
+
+        inline void hold(const bool held) {
+            if (this->m_held.exchange(held) == held || this->m_handle == nullptr)
+                return;
+            if (held)
+                esp_pm_lock_acquire(this->m_handle);
+            else
+                esp_pm_lock_release(this->m_handle);
+        }
+
+        inline bool held() const {
+            return this->m_held;
+        }
+};
+
+namespace power {
+
+// Turns the power mode on or off, false if power management is not built in
+inline bool configure(const bool low_power) {
+    esp_pm_config_esp32_t config {};
+    config.max_freq_mhz = POWER_MAX_CPU_MHZ;
+    config.min_freq_mhz = low_power ? POWER_MIN_CPU_MHZ : POWER_MAX_CPU_MHZ;
+    config.light_sleep_enable = low_power;
+    if (esp_pm_configure(&config) != ESP_OK) {
+        std::cout << "Error: Power management is not enabled in this build.\n\n";
+        return false;
+    }
+    return true;
+}
+
+}
+
+#endif /* __POWER_HPP__ */
@@ -0,0 +1,92 @@
+/**
+ * @file q_format.hpp
+ * @brief Signed Q-format fixed-point numbers
+ *
+ * A q_format<F> is a 32-bit integer holding the value times 2^F, so a
+ * chip without an FPU does its arithmetic in integer instructions
+ * instead of soft-float calls. Products are taken in 64 bits and every
+ * result saturates at the ends of the range rather than wrapping, which
+ * is what a controller wants from an overflow. Converting from float is
+ * constexpr, so constants cost nothing at run time.
+ */
+#ifndef __Q_FORMAT_HPP__
+#define __Q_FORMAT_HPP__
+
+#include <cstdint>
+#include <limits>
+
+template <int FRAC_BITS>
+class q_format {
+
+    static_assert(FRAC_BITS > 0 && FRAC_BITS < 31, "q_format needs 1 to 30 fraction bits");
+
+    private:
+
+        static constexpr int64_t m_one = int64_t(1) << FRAC_BITS;
+
+        int32_t m_raw {0};
+
+        static constexpr int32_t saturate(const int64_t value) {
+            return value > std::numeric_limits<int32_t>::max() ? std::numeric_limits<int32_t>::max() :
+                    value < std::numeric_limits<int32_t>::min() ? std::numeric_limits<int32_t>::min() :
+                    static_cast<int32_t>(value);
+        }
+
+    public:
+
+        static constexpr int frac_bits = FRAC_BITS;
+
+        constexpr q_format() = default;
+
+        // Nearest value, saturated
+        constexpr explicit q_format(const float value) : m_raw(
+                value >= static_cast<float>(std::numeric_limits<int32_t>::max())/m_one ? std::numeric_limits<int32_t>::max() :
+                value <= static_cast<float>(std::numeric_limits<int32_t>::min())/m_one ? std::numeric_limits<int32_t>::min() :
+                static_cast<int32_t>(value*m_one + (value < 0 ? -0.5f : 0.5f))) {}
+
+        constexpr explicit q_format(const int value) : m_raw(saturate(static_cast<int64_t>(value)*m_one)) {}
+
+        static constexpr q_format from_raw(const int32_t raw) {
+            q_format q;
+            q.m_raw = raw;
+            return q;
+        }
+
+        constexpr int32_t raw() const {return this->m_raw;}
+
+        constexpr explicit operator float() const {return static_cast<float>(this->m_raw)/m_one;}
+
+        // Truncates toward minus infinity
+        constexpr explicit operator int() const {return this->m_raw >> FRAC_BITS;}
+
+        constexpr q_format operator-() const {return from_raw(saturate(-static_cast<int64_t>(this->m_raw)));}
+
+        constexpr q_format operator+(const q_format other) const {
+            return from_raw(saturate(static_cast<int64_t>(this->m_raw) + other.m_raw));
+        }
+
+        constexpr q_format operator-(const q_format other) const {
+            return from_raw(saturate(static_cast<int64_t>(this->m_raw) - other.m_raw));
+        }
+
+        // Rounds to nearest
+        constexpr q_format operator*(const q_format other) const {
+            return from_raw(saturate((static_cast<int64_t>(this->m_raw)*other.m_raw + (m_one >> 1)) >> FRAC_BITS));
+        }
+
+        q_format& operator+=(const q_format other) {return *this = *this + other;}
+        q_format& operator-=(const q_format other) {return *this = *this - other;}
+        q_format& operator*=(const q_format other) {return *this = *this*other;}
+
+        constexpr bool operator==(const q_format other) const {return this->m_raw == other.m_raw;}
+        constexpr bool operator!=(const q_format other) const {return this->m_raw != other.m_raw;}
+        constexpr bool operator<(const q_format other) const {return this->m_raw < other.m_raw;}
+        constexpr bool operator<=(const q_format other) const {return this->m_raw <= other.m_raw;}
+        constexpr bool operator>(const q_format other) const {return this->m_raw > other.m_raw;}
+        constexpr bool operator>=(const q_format other) const {return this->m_raw >= other.m_raw;}
+};
+
+// 16 integer bits cover any temperature or fan percent, 16 fraction bits any gain times a tick
+typedef q_format<16> q16_16;
+
+#endif /* __Q_FORMAT_HPP__ */
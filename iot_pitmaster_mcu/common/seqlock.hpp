@@ -0,0 +1,81 @@
+/**
+ * @file seqlock.hpp
+ * @brief Single-writer sequence lock
+ * 
+ * Readers never block the writer and never take a lock. A read that
+ * overlaps a write sees an odd or changed sequence number and retries,
+ * so every copy returned is one the writer published as a whole.
+ */
+#ifndef __SEQLOCK_HPP__
+#define __SEQLOCK_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+template <typename T>
+class seqlock {
+
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock can only hold trivially copyable types");
+
+    private:
+
+        // The value is stored as atomic words so a torn copy is a retry, not a data race
+        static constexpr size_t m_words = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+        std::atomic<uint32_t> m_sequence {0};
+        std::array<std::atomic<uint32_t>, m_words> m_data {};
+
+    public:
+
+        seqlock() {
+            this->store(T{});
+        }
+
+        explicit seqlock(const T& value) {
+            this->store(value);
+        }
+
+        seqlock(const seqlock&) = delete;
+        seqlock& operator=(const seqlock&) = delete;
+
+        // Publishes a new value, only one thread may write
+        void store(const T& value) {
+            std::array<uint32_t, m_words> words {};
+            std::memcpy(words.data(), &value, sizeof(T));
+
+            const uint32_t sequence = this->m_sequence.load(std::memory_order_relaxed);
+            this->m_sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < m_words; i++)
+                this->m_data[i].store(words[i], std::memory_order_relaxed);
+            this->m_sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        // Returns a consistent copy of the last published value
+        T load() const {
+            std::array<uint32_t, m_words> words {};
+            uint32_t before {0};
+            uint32_t after {0};
+            do {
+                before = this->m_sequence.load(std::memory_order_acquire);
+                for (size_t i = 0; i < m_words; i++)
+                    words[i] = this->m_data[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = this->m_sequence.load(std::memory_order_relaxed);
+            } while ((before & 1) || before != after);
+
+            T value;
+            std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+            return value;
+        }
+
+        // Number of values published so far
+        inline uint32_t version() const {
+            return this->m_sequence.load(std::memory_order_acquire) / 2;
+        }
+};
+
+#endif /* __SEQLOCK_HPP__ */
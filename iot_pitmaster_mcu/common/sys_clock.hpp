@@ -0,0 +1,67 @@
+/**
+ * @file sys_clock.hpp
+ * @brief Time source for the control loops
+ * 
+ * Firmware reads time and sleeps only through here. On the board this
+ * is esp_timer and the FreeRTOS tick; the host simulator supplies the
+ * same headers backed by a virtual clock, so the same loops run a long
+ * cook faster than real time. A task that names itself has its sleeps
+ * and wakeups counted in sys_clock::activity, see activity.hpp.
+ */
+#ifndef __SYS_CLOCK_HPP__
+#define __SYS_CLOCK_HPP__
+
+#include <chrono>
+#include <cstdint>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "activity.hpp"
+
+namespace sys_clock {
+
+// Sleeps and wakeups of every task that named itself
+inline activity_monitor activity;
+inline thread_local int activity_task {-1};
+
+// Microseconds since boot
+inline int64_t now_us() {
+    return esp_timer_get_time();
+}
+
+// Counts the calling thread's sleeps and wakeups under a name from here on, the name must outlive it
+inline void name_task(const char* name) {
+    if (activity_task < 0)
+        activity_task = activity.add_task(name, now_us());
+}
+
+// Marks a wait that does not go through sleep_until, such as one on a condition variable
+inline void waiting() {
+    activity.sleeping(activity_task, now_us());
+}
+
+inline void resumed() {
+    activity.woke(activity_task, now_us());
+}
+
+// Sleeps until now_us() reaches deadline_us, rounded up to the next tick
+inline void sleep_until(const int64_t deadline_us) {
+    const int64_t now = now_us();
+    const int64_t remaining_us = deadline_us - now;
+    if (remaining_us <= 0)
+        return;
+    constexpr int64_t tick_us = 1000 * portTICK_PERIOD_MS;
+    activity.sleeping(activity_task, now);
+    vTaskDelay(static_cast<TickType_t>((remaining_us + tick_us - 1) / tick_us));
+    activity.woke(activity_task, now_us());
+}
+
+inline void sleep_for(const std::chrono::microseconds duration) {
+    sleep_until(now_us() + duration.count());
+}
+
+}
+
+#endif /* __SYS_CLOCK_HPP__ */
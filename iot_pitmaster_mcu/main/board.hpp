@@ -0,0 +1,78 @@
+/**
+ * @file board.hpp
+ * @brief GPIO and bus wiring of the pitmaster board
+ * 
+ */
+#ifndef __BOARD_HPP__
+#define __BOARD_HPP__
+
+#include <cstddef>
+
+#include "driver/gpio.h"
+#include "driver/spi_common.h"
+#include "driver/uart.h"
+
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
+
+// Blowfan PWM GPIO
+constexpr gpio_num_t gpio_blowfan = GPIO_NUM_21;
+
+// Hopper Motor Driver GPIO
+constexpr gpio_num_t gpio_hopper_not_en = GPIO_NUM_18;
+constexpr gpio_num_t gpio_hopper_ms1 = GPIO_NUM_5;
+constexpr gpio_num_t gpio_hopper_ms2 = GPIO_NUM_17;
+constexpr gpio_num_t gpio_hopper_ms3 = GPIO_NUM_16;
+constexpr gpio_num_t gpio_hopper_not_rst = GPIO_NUM_4;
+constexpr gpio_num_t gpio_hopper_not_slp = GPIO_NUM_4;
+constexpr gpio_num_t gpio_hopper_step = GPIO_NUM_0;
+constexpr gpio_num_t gpio_hopper_dir = GPIO_NUM_2;
+
+// Damper Motor Driver GPIO
+constexpr gpio_num_t gpio_damper_not_en = GPIO_NUM_15;
+constexpr gpio_num_t gpio_damper_ms1 = GPIO_NUM_22;
+constexpr gpio_num_t gpio_damper_ms2 = GPIO_NUM_23;
+constexpr gpio_num_t gpio_damper_ms3 = GPIO_NUM_27;
+constexpr gpio_num_t gpio_damper_not_rst = GPIO_NUM_14;
+constexpr gpio_num_t gpio_damper_not_slp = GPIO_NUM_14;
+constexpr gpio_num_t gpio_damper_step = GPIO_NUM_12;
+constexpr gpio_num_t gpio_damper_dir = GPIO_NUM_13;
+
+// MAX31855 GPIO
+constexpr gpio_num_t gpio_clk = GPIO_NUM_19;
+constexpr gpio_num_t gpio_signal_out = GPIO_NUM_25;
+
+// MAX31855 probes in bus order, each starts in its role here until the app sets another
+struct board_probe {
+    gpio_num_t chip_select;
+    const char* name;
+    tc_role role;
+};
+
+constexpr board_probe board_probes[] = {
+    {GPIO_NUM_32, "Chamber1 Thermocouple", TC_ROLE_CHAMBER},
+    {GPIO_NUM_33, "Meat1 Thermocouple", TC_ROLE_MEAT},
+    {GPIO_NUM_26, "Meat2 Thermocouple", TC_ROLE_MEAT}
+};
+
+constexpr size_t board_probe_count = sizeof(board_probes)/sizeof(board_probes[0]);
+static_assert(board_probe_count <= TC_BUS_MAX_PROBES, "The thermocouple bus takes at most TC_BUS_MAX_PROBES probes");
+
+// Wired link for DEBUG_LINK_UART, the USB port, since every other output pin is taken
+constexpr uart_port_t link_uart = UART_NUM_0;
+constexpr int link_uart_baud = 115200;
+
+// SPI for Thermocouples
+constexpr spi_bus_config_t spi_bus_cfg = // configuring spi bus
+{
+    .mosi_io_num        = -1,
+    .miso_io_num        = gpio_signal_out,
+    .sclk_io_num        = gpio_clk,
+    .quadwp_io_num      = -1,
+    .quadhd_io_num      = -1,
+    .max_transfer_sz    = 4, // size of data transfer 32 bits
+    .flags              = SPICOMMON_BUSFLAG_MASTER | SPICOMMON_BUSFLAG_MISO | SPICOMMON_BUSFLAG_SCLK,
+    .intr_flags         = 0
+};
+
+#endif /* __BOARD_HPP__ */
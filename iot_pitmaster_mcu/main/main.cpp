@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "driver/gpio.h"
 #include "esp_system.h"
@@ -15,102 +16,92 @@
 #include "sdkconfig.h"
 
 #include "a4988_driver.hpp"
+#include "board.hpp"
 #include "bluetooth.hpp"
+#include "cook_log.hpp"
 #include "max31855.hpp"
 #include "pid_control.hpp"
+#include "pid_store.hpp"
+#include "power.hpp"
 #include "pwm.hpp"
+#include "sys_clock.hpp"
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
 #include "test.cpp"
+#include "uart_transport.hpp"
 
 using namespace std::chrono_literals;
 
-// Blowfan PWM GPIO
-constexpr gpio_num_t gpio_blowfan = GPIO_NUM_21;
-
-// Hopper Motor Driver GPIO
-constexpr gpio_num_t gpio_hopper_not_en = GPIO_NUM_18;
-constexpr gpio_num_t gpio_hopper_ms1 = GPIO_NUM_5;
-constexpr gpio_num_t gpio_hopper_ms2 = GPIO_NUM_17;
-constexpr gpio_num_t gpio_hopper_ms3 = GPIO_NUM_16;
-constexpr gpio_num_t gpio_hopper_not_rst = GPIO_NUM_4;
-constexpr gpio_num_t gpio_hopper_not_slp = GPIO_NUM_4;
-constexpr gpio_num_t gpio_hopper_step = GPIO_NUM_0;
-constexpr gpio_num_t gpio_hopper_dir = GPIO_NUM_2;
-
-// Damper Motor Driver GPIO
-constexpr gpio_num_t gpio_damper_not_en = GPIO_NUM_15;
-constexpr gpio_num_t gpio_damper_ms1 = GPIO_NUM_22;
-constexpr gpio_num_t gpio_damper_ms2 = GPIO_NUM_23;
-constexpr gpio_num_t gpio_damper_ms3 = GPIO_NUM_27;
-constexpr gpio_num_t gpio_damper_not_rst = GPIO_NUM_14;
-constexpr gpio_num_t gpio_damper_not_slp = GPIO_NUM_14;
-constexpr gpio_num_t gpio_damper_step = GPIO_NUM_12;
-constexpr gpio_num_t gpio_damper_dir = GPIO_NUM_13;
-
-// MAX31855 GPIO
-constexpr gpio_num_t gpio_clk = GPIO_NUM_19;
-constexpr gpio_num_t gpio_signal_out = GPIO_NUM_25;
-constexpr gpio_num_t gpio_chamber_chip_select = GPIO_NUM_32;
-constexpr gpio_num_t gpio_meat1_chip_select = GPIO_NUM_33;
-constexpr gpio_num_t gpio_meat2_chip_select = GPIO_NUM_26;
-
-// SPI for Thermocouples
-constexpr spi_bus_config_t spi_bus_cfg = // configuring spi bus
-{
-    .mosi_io_num        = -1,
-    .miso_io_num        = gpio_signal_out,
-    .sclk_io_num        = gpio_clk,
-    .quadwp_io_num      = -1,
-    .quadhd_io_num      = -1,
-    .max_transfer_sz    = 4, // size of data transfer 32 bits
-    .flags              = SPICOMMON_BUSFLAG_MASTER | SPICOMMON_BUSFLAG_MISO | SPICOMMON_BUSFLAG_SCLK,
-    .intr_flags         = 0
-};
-
 extern "C" void app_main(void)
 {
     std::cout << "Howdy world!\n";
 
+    // Frequency scaling and light sleep between ticks, see power.hpp
+    power::configure(POWER_LOW_POWER);
+
     // Initialize Bluetooth
     bt::init_bluetooth();
 
-    // Blowfan Motor Thread
+    // Blowfan Motor, driven by the LEDC peripheral
     pwm blowfan(gpio_blowfan, 0);
-    std::thread blowfan_thread = std::thread([&]() {blowfan.pwm_run();});
-    blowfan_thread.detach();
 
     // Hopper Auger Motor Object
     a4988_driver hopper_controller("Hopper Motor", gpio_hopper_not_en, gpio_hopper_ms1,
                                    gpio_hopper_ms2, gpio_hopper_ms3,
                                    gpio_hopper_not_rst, gpio_hopper_not_slp,
-                                   gpio_hopper_step, gpio_hopper_dir);
+                                   gpio_hopper_step, gpio_hopper_dir,
+                                   TIMER_GROUP_1, TIMER_0);
 
     // Damper Controller Motor Object
     a4988_driver damper_controller("Damper Motor", gpio_damper_not_en, gpio_damper_ms1,
                                    gpio_damper_ms2, gpio_damper_ms3,
                                    gpio_damper_not_rst, gpio_damper_not_slp,
-                                   gpio_damper_step, gpio_damper_dir);
-
-    // Create the ADC objects for the thermocouples
-    max31855 tc_chamber(gpio_clk, gpio_signal_out, gpio_chamber_chip_select);
-    tc_chamber.name("Chamber1 Thermocouple");
-    max31855 tc_meat1(gpio_clk, gpio_signal_out, gpio_meat1_chip_select);
-    tc_meat1.name("Meat1 Thermocouple");
-    max31855 tc_meat2(gpio_clk, gpio_signal_out, gpio_meat2_chip_select);
-    tc_meat2.name("Meat2 Thermocouple");
-
-    // Add the devices to the SPI bus
-    if (spi_bus_initialize(HSPI_HOST, &spi_bus_cfg, 0) == 0) {
-        spi_bus_add_device(HSPI_HOST, &tc_chamber.dev_cfg(), &tc_chamber.dev_handle());
-        spi_bus_add_device(HSPI_HOST, &tc_meat1.dev_cfg(), &tc_meat1.dev_handle());
-        spi_bus_add_device(HSPI_HOST, &tc_meat2.dev_cfg(), &tc_meat2.dev_handle());
+                                   gpio_damper_step, gpio_damper_dir,
+                                   TIMER_GROUP_1, TIMER_1);
+
+    // Create the ADC objects for the thermocouples, one per probe the board wires
+    std::vector<max31855> probes;
+    probes.reserve(board_probe_count);
+    for (const board_probe& wired : board_probes) {
+        probes.emplace_back(gpio_clk, gpio_signal_out, wired.chip_select);
+        probes.back().name(wired.name);
+    }
+
+    // Add the devices to the SPI bus, in board_probes order
+    tc_bus thermocouples(HSPI_HOST, spi_bus_cfg);
+    if (thermocouples.init()) {
+        for (max31855& probe : probes)
+            thermocouples.add_probe(probe);
+    }
+
+    // Thermocouple sampler thread, filters every probe in the background
+    tc_sampler thermocouple_sampler(thermocouples);
+    // The board's roles, the ones saved from the app replace them once the controller starts
+    for (uint8_t i = 0; i < thermocouples.count(); i++) {
+        tc_probe_config config {};
+        config.role = board_probes[i].role;
+        thermocouple_sampler.configure(i, config);
     }
+    std::thread sampler_thread = thermocouple_sampler.start();
+    sampler_thread.detach();
 
     // Wait a half second
     std::this_thread::sleep_for(500ms);
 
+    // Per-second history for the phone, too big for this task's stack
+    static history_log cook_history;
+
+    // Cook log in flash, kept through restarts, the control runs without it if the partition is missing
+    static cook_log flash_log;
+    flash_log.init(static_cast<uint32_t>(sys_clock::now_us()/1000000), esp_reset_reason());
+
+    // Gains and cook state in NVS, initialized with Bluetooth, so a reset mid-cook picks up where it stopped
+    static pid_store controller_store;
+    controller_store.init();
+
     // Object for PID/manual control algorithm
-    pid_control main_pid_control(blowfan, hopper_controller, damper_controller, 
-        tc_chamber, tc_meat1, tc_meat2);
+    pid_control main_pid_control(blowfan, hopper_controller, damper_controller, thermocouple_sampler, cook_history,
+                                 flash_log, controller_store);
 
     // Make sure Bluetooth messages get sent to the pid_control object just created
     bt::set_bt_msg_dest(&main_pid_control);
@@ -119,6 +110,14 @@ extern "C" void app_main(void)
     std::thread pid_control_thread = std::thread([&]() {main_pid_control.pid_control_run();});
     pid_control_thread.detach();
 
+    // A host on the USB port takes the place of the test console
+    if constexpr (DEBUG_LINK_UART) {
+        static uart_transport wired_link(link_uart, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, link_uart_baud);
+        bt::add_transport(wired_link);
+        while (true)
+            std::this_thread::sleep_for(1s);
+    }
+
     // Neverending test loop, use MobaXTerm to input
     test::debug_print_loop(main_pid_control);
 }
\ No newline at end of file
@@ -10,7 +10,6 @@
 #include "driver/spi_common.h"
 #include "driver/spi_master.h"
 
-#include <future>
 #include <string>
 
 // Struct that contains external temp and fault bit
@@ -56,10 +55,7 @@ class max31855 {
             this->m_signal_out = signal_out;
             this->m_chip_select = chip_select;
 
-            this->m_dev_cfg.spics_io_num = this->m_chip_select;      // Chip Select pin
-
-            gpio_set_direction(this->m_chip_select, GPIO_MODE_OUTPUT);
-            gpio_set_level(this->m_chip_select, 1);
+            this->m_dev_cfg.spics_io_num = this->m_chip_select;      // Chip Select pin, driven by the SPI peripheral
         }
 
         inline spi_device_interface_config_t& dev_cfg() {
@@ -78,8 +74,12 @@ class max31855 {
             return this->m_name;
         }
 
+        // Reads one frame on its own, use tc_bus to read every probe in one bus window
         max31855_data_t read();
-        std::future<max31855_data_t> async_read();
+
+        // Decodes a 32-bit frame received from the chip
+        max31855_data_t decode(const uint8_t* rx_data);
+
 };
 
 #endif /* __MAX31855_HPP__ */
\ No newline at end of file
@@ -0,0 +1,96 @@
+/**
+ * @file tc_bus.cpp
+ * @brief Thermocouple SPI Bus Manager
+ * 
+ */
+#include "tc_bus.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "esp_timer.h"
+
+#include "debug.hpp"
+
+// Initializes the SPI host, once for every probe
+bool tc_bus::init() {
+    if (spi_bus_initialize(this->m_host, &this->m_bus_cfg, 0) != ESP_OK) {
+        std::cout << "Error: initialize thermocouple SPI bus failed.\n\n";
+        return false;
+    }
+    this->m_ready = true;
+    return true;
+}
+
+// Adds a probe to the bus, probes are read in the order they are added
+bool tc_bus::add_probe(max31855& probe) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+
+    if (!this->m_ready || this->m_count >= TC_BUS_MAX_PROBES) {
+        std::cout << "Error: cannot add " << probe.name() << " to the thermocouple bus.\n\n";
+        return false;
+    }
+    if (spi_bus_add_device(this->m_host, &probe.dev_cfg(), &probe.dev_handle()) != ESP_OK) {
+        std::cout << "Error: add " << probe.name() << " to the thermocouple bus failed.\n\n";
+        return false;
+    }
+
+    spi_transaction_t& t = this->m_trans[this->m_count];
+    t = {};
+    t.flags = SPI_TRANS_USE_RXDATA;
+    t.length = 32;
+    t.rxlength = 32;
+
+    this->m_probes[this->m_count] = &probe;
+    this->m_count++;
+    return true;
+}
+
+// Reads the probes in the mask back-to-back in one bus window, the bus time is per probe read
+tc_sample_set tc_bus::acquire(const uint8_t mask) {
+    tc_sample_set samples;
+
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    samples.count = this->m_count;
+    samples.read = mask & static_cast<uint8_t>((1u << this->m_count) - 1);
+    samples.timestamp_us = esp_timer_get_time();
+
+    std::array<esp_err_t, TC_BUS_MAX_PROBES> ret {};
+    if (this->m_mode == TC_BUS_QUEUED) {
+        // Every probe gets one queued transaction, the driver runs them back-to-back
+        for (uint8_t i = 0; i < this->m_count; i++) {
+            if (samples.read & (1 << i))
+                ret[i] = spi_device_queue_trans(this->m_probes[i]->dev_handle(), &this->m_trans[i], portMAX_DELAY);
+        }
+        for (uint8_t i = 0; i < this->m_count; i++) {
+            spi_transaction_t* done {nullptr};
+            if ((samples.read & (1 << i)) && ret[i] == ESP_OK)
+                ret[i] = spi_device_get_trans_result(this->m_probes[i]->dev_handle(), &done, portMAX_DELAY);
+        }
+    }
+    else {
+        for (uint8_t i = 0; i < this->m_count; i++) {
+            if (samples.read & (1 << i))
+                ret[i] = spi_device_polling_transmit(this->m_probes[i]->dev_handle(), &this->m_trans[i]);
+        }
+    }
+
+    samples.window_us = static_cast<uint32_t>(esp_timer_get_time() - samples.timestamp_us);
+
+    // Decode outside the timed window, a failed transfer reports a fault
+    for (uint8_t i = 0; i < this->m_count; i++) {
+        if (!(samples.read & (1 << i)))
+            continue;
+        if (ret[i] == ESP_OK) {
+            samples.probes[i] = this->m_probes[i]->decode(this->m_trans[i].rx_data);
+        }
+        else {
+            std::cout << "Could not transmit SPI for " << this->m_probes[i]->name() << ".\n\n";
+            samples.probes[i] = {0, true};
+        }
+    }
+
+    this->m_windows++;
+    this->m_max_window_us = std::max(this->m_max_window_us, samples.window_us);
+    return samples;
+}
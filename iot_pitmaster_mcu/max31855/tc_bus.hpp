@@ -0,0 +1,92 @@
+/**
+ * @file tc_bus.hpp
+ * @brief Thermocouple SPI Bus Manager
+ * 
+ */
+#ifndef __TC_BUS_HPP__
+#define __TC_BUS_HPP__
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+#include "driver/spi_common.h"
+#include "driver/spi_master.h"
+
+#include "max31855.hpp"
+
+// Most probes that can share the thermocouple bus, a probe's slot is its bit in a probe mask
+#define TC_BUS_MAX_PROBES (8)
+#define TC_BUS_ALL_PROBES (0xff)
+
+// How a bus window talks to the probes
+enum tc_bus_mode : uint8_t {
+    TC_BUS_POLLING = 0, // busy-wait each transfer, no interrupts (default, a frame is only 8 us at 4 MHz)
+    TC_BUS_QUEUED = 1   // queue every probe up front and collect the results, one interrupt per frame
+};
+
+// Every probe read in one bus window
+struct tc_sample_set {
+    int64_t timestamp_us {0}; // esp_timer time the window opened
+    uint32_t window_us {0}; // time spent on the bus
+    uint8_t count {0};
+    uint8_t read {0}; // probes read in this window, the others are left as they were
+    std::array<max31855_data_t, TC_BUS_MAX_PROBES> probes {};
+};
+
+class tc_bus {
+
+    private:
+
+        spi_host_device_t m_host;
+        spi_bus_config_t m_bus_cfg;
+        tc_bus_mode m_mode;
+        bool m_ready {false};
+
+        std::array<max31855*, TC_BUS_MAX_PROBES> m_probes {};
+        uint8_t m_count {0};
+
+        // One transaction per probe, reused every window
+        std::array<spi_transaction_t, TC_BUS_MAX_PROBES> m_trans {};
+
+        // Serializes bus windows between the control loop and the console
+        std::mutex m_lock;
+
+        uint32_t m_windows {0};
+        uint32_t m_max_window_us {0};
+
+    public:
+
+        inline tc_bus(const spi_host_device_t host, const spi_bus_config_t& bus_cfg, const tc_bus_mode mode = TC_BUS_POLLING) {
+            this->m_host = host;
+            this->m_bus_cfg = bus_cfg;
+            this->m_mode = mode;
+        }
+
+        // Initializes the SPI host, once for every probe
+        bool init();
+
+        // Adds a probe to the bus, probes are read in the order they are added
+        bool add_probe(max31855& probe);
+
+        // Reads the probes in the mask back-to-back in one bus window, the bus time is per probe read
+        tc_sample_set acquire(uint8_t mask = TC_BUS_ALL_PROBES);
+
+        inline max31855* probe(const uint8_t idx) {
+            return idx < this->m_count ? this->m_probes[idx] : nullptr;
+        }
+
+        inline uint8_t count() {
+            return this->m_count;
+        }
+
+        inline uint32_t windows() {
+            return this->m_windows;
+        }
+
+        inline uint32_t max_window_us() {
+            return this->m_max_window_us;
+        }
+};
+
+#endif /* __TC_BUS_HPP__ */
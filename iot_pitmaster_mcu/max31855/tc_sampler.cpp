@@ -0,0 +1,160 @@
+/**
+ * @file tc_sampler.cpp
+ * @brief Background Thermocouple Sampler
+ * 
+ */
+#include "tc_sampler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "debug.hpp"
+#include "sys_clock.hpp"
+
+// Adds one raw sample to a probe's filter and returns the filtered value
+// Median of the last few good samples rejects glitches, then an IIR smooths the quarter-degree steps
+max31855_data_t tc_sampler::filter(probe_filter& state, const max31855_data_t& raw) {
+    state.history[state.next] = raw.thermocouple_C;
+    state.faults[state.next] = raw.fault;
+    state.next = (state.next + 1) % TC_SAMPLER_MEDIAN_WINDOW;
+    state.filled = std::min<uint8_t>(state.filled + 1, TC_SAMPLER_MEDIAN_WINDOW);
+
+    std::array<float, TC_SAMPLER_MEDIAN_WINDOW> good {};
+    uint8_t good_count {0};
+    for (uint8_t i = 0; i < state.filled; i++) {
+        if (!state.faults[i])
+            good[good_count++] = state.history[i];
+    }
+
+    // A probe only reports a fault once most of the window has faulted
+    if (good_count*2 <= state.filled) {
+        return {state.filtered, true};
+    }
+
+    std::nth_element(good.begin(), good.begin() + good_count / 2, good.begin() + good_count);
+    const float median = good[good_count / 2];
+
+    if (!state.primed) {
+        state.filtered = median;
+        state.primed = true;
+    }
+    else {
+        state.filtered += this->m_iir_alpha*(median - state.filtered);
+    }
+    return {state.filtered, false};
+}
+
+// Reads the probes that are due, filters and publishes the result
+// A probe that is off is never read, so the bus time grows with the probes in use
+void tc_sampler::sample_once() {
+    const tc_probe_table configs = this->m_config.load();
+    const int64_t now_us = sys_clock::now_us();
+    uint8_t active {0};
+    uint8_t due {0};
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        if (configs[i].role == TC_ROLE_OFF) {
+            // A probe switched back on starts with an empty filter
+            if (this->m_published.active & (1 << i))
+                this->m_filters[i] = {};
+            continue;
+        }
+        active |= 1 << i;
+        probe_filter& state = this->m_filters[i];
+        if (now_us >= state.next_read_us) {
+            due |= 1 << i;
+            // A probe that fell behind starts again from now rather than catching up
+            state.next_read_us = std::max(state.next_read_us + 1000000 / configs[i].rate_hz, now_us);
+        }
+    }
+
+    const tc_sample_set raw = this->m_bus->acquire(due);
+
+    tc_filtered_set& filtered = this->m_published;
+    filtered.timestamp_us = raw.timestamp_us;
+    filtered.windows = ++this->m_windows;
+    filtered.count = raw.count;
+    // A probe is reported once it has been read
+    filtered.active = active & (raw.read | filtered.active);
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        filtered.roles[i] = static_cast<tc_role>(configs[i].role);
+        if (raw.read & (1 << i))
+            filtered.probes[i] = this->filter(this->m_filters[i], raw.probes[i]);
+    }
+
+    this->m_latest.store(filtered);
+}
+
+// Sampling loop, runs at the configured rate forever
+void tc_sampler::run() {
+    sys_clock::name_task("Thermocouples");
+    int64_t next_wake_us = sys_clock::now_us();
+    while (true) {
+        this->sample_once();
+
+        // Absolute deadlines, so the bus time does not stretch the period
+        next_wake_us += 1000000 / this->m_rate_hz;
+        sys_clock::sleep_until(next_wake_us);
+    }
+}
+
+// Sets the sampling rate, clamped to TC_SAMPLER_MIN_HZ-TC_SAMPLER_MAX_HZ
+void tc_sampler::rate(const uint32_t rate_hz) {
+    this->m_rate_hz = std::clamp<uint32_t>(rate_hz, TC_SAMPLER_MIN_HZ, TC_SAMPLER_MAX_HZ);
+    if (this->m_rate_hz != rate_hz)
+        std::cout << "Thermocouple sample rate limited to " << this->m_rate_hz << " Hz.\n\n";
+}
+
+// Validates and applies one probe's settings, from the next bus window on
+bool tc_sampler::configure(const uint8_t probe, const tc_probe_config& config) {
+    // Only a slot with a probe on the bus can be given a role
+    if (probe >= TC_BUS_MAX_PROBES || (config.role != TC_ROLE_OFF && probe >= this->m_bus->count())) {
+        std::cout << "Error: there is no thermocouple probe " << static_cast<int>(probe) << ".\n\n";
+        return false;
+    }
+    if (config.role >= TC_ROLE_COUNT || config.rate_hz < TC_SAMPLER_MIN_HZ || config.rate_hz > TC_SAMPLER_MAX_HZ) {
+        std::cout << "Error: thermocouple probe " << static_cast<int>(probe) << " needs a known role and a rate of " <<
+                TC_SAMPLER_MIN_HZ << "-" << TC_SAMPLER_MAX_HZ << " Hz.\n\n";
+        return false;
+    }
+    if (config.alarm_low_C != TC_ALARM_OFF && config.alarm_high_C != TC_ALARM_OFF &&
+            config.alarm_low_C >= config.alarm_high_C) {
+        std::cout << "Error: the low alarm of thermocouple probe " << static_cast<int>(probe) <<
+                " must be below its high alarm.\n\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(this->m_config_lock);
+    tc_probe_table configs = this->m_config.load();
+    configs[probe] = config;
+    this->m_config.store(configs);
+    return true;
+}
+
+// Applies every probe's settings, e.g. the ones kept in NVS, false if any is invalid
+bool tc_sampler::configure(const tc_probe_table& configs) {
+    bool valid {true};
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++)
+        valid = this->configure(i, configs[i]) && valid;
+    return valid;
+}
+
+// The chamber reading the controller holds, the mean of the chamber probes that have not faulted
+// With all of them faulted it is a fault, holding the mean of their last good readings
+max31855_data_t tc_chamber_reading(const tc_filtered_set& set) {
+    float good_sum_C {0};
+    float held_sum_C {0};
+    uint8_t good {0};
+    uint8_t held {0};
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        if (!(set.active & (1 << i)) || set.roles[i] != TC_ROLE_CHAMBER)
+            continue;
+        if (!set.probes[i].fault) {
+            good_sum_C += set.probes[i].thermocouple_C;
+            good++;
+        }
+        held_sum_C += set.probes[i].thermocouple_C;
+        held++;
+    }
+    if (good > 0)
+        return {good_sum_C/good, false};
+    return {held > 0 ? held_sum_C/held : 0, true};
+}
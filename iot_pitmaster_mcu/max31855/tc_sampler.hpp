@@ -0,0 +1,145 @@
+/**
+ * @file tc_sampler.hpp
+ * @brief Background Thermocouple Sampler
+ * 
+ */
+#ifndef __TC_SAMPLER_HPP__
+#define __TC_SAMPLER_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include "seqlock.hpp"
+#include "tc_bus.hpp"
+
+// Default and allowed sampling rates for every probe
+// The MAX31855 finishes a conversion every ~100 ms, so above 10 Hz some reads repeat,
+// which the median still uses to reject single-frame glitches
+#define TC_SAMPLER_DEFAULT_HZ (20)
+#define TC_SAMPLER_MIN_HZ (1)
+#define TC_SAMPLER_MAX_HZ (50)
+// Raw samples the median filter looks at
+#define TC_SAMPLER_MEDIAN_WINDOW (5)
+// Weight of the newest median in the IIR low-pass (0-1]
+#define TC_SAMPLER_DEFAULT_IIR_ALPHA (0.2f)
+
+// An alarm threshold that is not set
+#define TC_ALARM_OFF (std::numeric_limits<int16_t>::min())
+
+// What a probe is for, a probe that is off is not read
+enum tc_role : uint8_t {
+    TC_ROLE_OFF = 0,
+    TC_ROLE_CHAMBER = 1, // the controller holds the mean of the chamber probes
+    TC_ROLE_MEAT = 2,
+    TC_ROLE_COUNT
+};
+
+// One probe's settings, kept in NVS and exchanged with the app as they are
+struct __attribute__ ((packed)) tc_probe_config {
+    uint8_t role {TC_ROLE_OFF}; // tc_role
+    uint8_t rate_hz {TC_SAMPLER_DEFAULT_HZ}; // read at most this often, never faster than the sampler
+    int16_t alarm_low_C {TC_ALARM_OFF}; // alarm below this, TC_ALARM_OFF for none
+    int16_t alarm_high_C {TC_ALARM_OFF}; // alarm above this, TC_ALARM_OFF for none
+};
+
+typedef std::array<tc_probe_config, TC_BUS_MAX_PROBES> tc_probe_table;
+
+// Filtered reading of every probe, published as one set
+struct tc_filtered_set {
+    int64_t timestamp_us {0}; // bus window time of the newest raw sample
+    uint32_t windows {0}; // bus windows that have gone into the filters
+    uint8_t count {0};
+    uint8_t active {0}; // probes with a role, a bit per slot
+    std::array<tc_role, TC_BUS_MAX_PROBES> roles {};
+    std::array<max31855_data_t, TC_BUS_MAX_PROBES> probes {};
+};
+
+// The chamber reading the controller holds, the mean of the chamber probes that have not faulted
+max31855_data_t tc_chamber_reading(const tc_filtered_set& set);
+
+class tc_sampler {
+
+    private:
+
+        tc_bus* m_bus;
+        std::atomic<uint32_t> m_rate_hz;
+        float m_iir_alpha;
+
+        // Filter state, only touched by the sampling thread
+        struct probe_filter {
+            std::array<float, TC_SAMPLER_MEDIAN_WINDOW> history {};
+            std::array<bool, TC_SAMPLER_MEDIAN_WINDOW> faults {};
+            uint8_t next {0};
+            uint8_t filled {0};
+            float filtered {0};
+            bool primed {false};
+            int64_t next_read_us {0};
+        };
+        std::array<probe_filter, TC_BUS_MAX_PROBES> m_filters {};
+        uint32_t m_windows {0};
+        tc_filtered_set m_published {};
+
+        // Probe settings, changed from the Bluetooth thread and console, read by the sampling thread
+        // The seqlock takes one writer at a time, so changes are made under m_config_lock
+        seqlock<tc_probe_table> m_config;
+        std::mutex m_config_lock;
+
+        // Latest filtered set, read without blocking by the control loop, telemetry and console
+        seqlock<tc_filtered_set> m_latest;
+
+        // Adds one raw sample to a probe's filter and returns the filtered value
+        max31855_data_t filter(probe_filter& state, const max31855_data_t& raw);
+
+    public:
+
+        inline tc_sampler(tc_bus& bus, const uint32_t rate_hz = TC_SAMPLER_DEFAULT_HZ,
+                const float iir_alpha = TC_SAMPLER_DEFAULT_IIR_ALPHA) {
+            this->m_bus = &bus;
+            this->m_rate_hz = rate_hz;
+            this->m_iir_alpha = iir_alpha;
+            this->rate(rate_hz);
+        }
+
+        // Reads every probe once, filters and publishes the result
+        void sample_once();
+
+        // Sampling loop, runs at the configured rate forever
+        void run();
+
+        // Creates the sampling thread
+        inline std::thread start() {
+            return std::thread([this]() {this->run();});
+        }
+
+        // Latest filtered set, never blocks
+        inline tc_filtered_set latest() const {
+            return this->m_latest.load();
+        }
+
+        // Sets the sampling rate, clamped to TC_SAMPLER_MIN_HZ-TC_SAMPLER_MAX_HZ
+        void rate(uint32_t rate_hz);
+
+        // Validates and applies one probe's settings, from the next bus window on
+        bool configure(uint8_t probe, const tc_probe_config& config);
+
+        // Applies every probe's settings, e.g. the ones kept in NVS, false if any is invalid
+        bool configure(const tc_probe_table& configs);
+
+        inline tc_probe_table configs() const {
+            return this->m_config.load();
+        }
+
+        inline uint32_t rate() {
+            return this->m_rate_hz;
+        }
+
+        inline tc_bus* bus() {
+            return this->m_bus;
+        }
+};
+
+#endif /* __TC_SAMPLER_HPP__ */
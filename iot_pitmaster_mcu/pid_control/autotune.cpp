@@ -0,0 +1,149 @@
+/**
+ * @file autotune.cpp
+ * @brief Relay-feedback PID autotune
+ *
+ */
+#include "autotune.hpp"
+
+#include <cmath>
+
+// Kp as a fraction of Ku, Ti and Td as fractions of Tu
+struct autotune_rule_factors {
+    float kp;
+    float ti;
+    float td;
+};
+
+static constexpr autotune_rule_factors rule_factors[AUTOTUNE_RULE_COUNT] {
+    {0.6f, 0.5f, 0.125f}, // AUTOTUNE_RULE_ZN_PID
+    {0.45f, 1/1.2f, 0}, // AUTOTUNE_RULE_ZN_PI
+    {1/2.2f, 2.2f, 1/6.3f}, // AUTOTUNE_RULE_TYREUS_LUYBEN
+    {0.7f, 0.4f, 0.15f}, // AUTOTUNE_RULE_PESSEN
+    {0.33f, 0.5f, 0.33f}, // AUTOTUNE_RULE_SOME_OVERSHOOT
+    {0.2f, 0.5f, 0.33f} // AUTOTUNE_RULE_NO_OVERSHOOT
+};
+
+// PID gains from the ultimate gain and period, false for an unknown rule or gains past PID_GAIN_MAX
+bool autotune_gains(const autotune_rule rule, const float ku, const float tu_s, pid_gains& gains) {
+    if (rule >= AUTOTUNE_RULE_COUNT || !(ku > 0) || !(tu_s > 0))
+        return false;
+    const autotune_rule_factors& factors = rule_factors[rule];
+    gains.kp = factors.kp*ku;
+    gains.ki = gains.kp/(factors.ti*tu_s);
+    gains.kd = gains.kp*factors.td*tu_s;
+    return gains.kp <= PID_GAIN_MAX && gains.ki <= PID_GAIN_MAX && gains.kd <= PID_GAIN_MAX;
+}
+
+// Starts a tune around the set point, the first output is high below it and low above it
+void relay_autotune::start(const float set_point_C, const autotune_rule rule, const float pv_C, const float t_s) {
+    this->m_result = {};
+    this->m_result.state = AUTOTUNE_RUNNING;
+    this->m_result.rule = rule;
+    this->m_set_point_C = set_point_C;
+    this->m_start_s = t_s;
+    this->m_last_s = t_s;
+    this->m_output_high = pv_C < set_point_C;
+    this->m_cycle_started = false;
+    this->m_measured = 0;
+}
+
+// Stops a running tune, the result says so
+void relay_autotune::abort() {
+    if (this->running())
+        this->m_result.state = AUTOTUNE_ABORTED;
+}
+
+// Ends the cycle that finished at t_s, true once enough of them agree
+bool relay_autotune::end_cycle(const float t_s) {
+    this->m_result.cycles++;
+    // The first cycles still carry the heat-up
+    if (this->m_result.cycles <= AUTOTUNE_SKIP_CYCLES)
+        return false;
+
+    const uint8_t slot = this->m_measured % AUTOTUNE_CYCLES;
+    this->m_periods_s[slot] = t_s - this->m_cycle_start_s;
+    this->m_amplitudes_C[slot] = (this->m_cycle_max_C - this->m_cycle_min_C)/2;
+    this->m_biases_pct[slot] = this->m_cycle_time_sum > 0 ? this->m_cycle_output_sum/this->m_cycle_time_sum : 0;
+    this->m_measured++;
+
+    // The app sees each cycle as it comes
+    const float d = (AUTOTUNE_HIGH_PCT - AUTOTUNE_LOW_PCT)/2;
+    const auto ultimate_gain = [d](const float amplitude_C) {
+        const float a2 = amplitude_C*amplitude_C - AUTOTUNE_HYSTERESIS_C*AUTOTUNE_HYSTERESIS_C;
+        return a2 > 0 ? 4*d/(static_cast<float>(M_PI)*std::sqrt(a2)) : 0.0f;
+    };
+    this->m_result.tu_s = this->m_periods_s[slot];
+    this->m_result.amplitude_C = this->m_amplitudes_C[slot];
+    this->m_result.bias_pct = this->m_biases_pct[slot];
+    this->m_result.ku = ultimate_gain(this->m_result.amplitude_C);
+
+    if (this->m_measured >= AUTOTUNE_CYCLES) {
+        float period_s {0};
+        float amplitude_C {0};
+        float bias_pct {0};
+        for (uint8_t i = 0; i < AUTOTUNE_CYCLES; i++) {
+            period_s += this->m_periods_s[i]/AUTOTUNE_CYCLES;
+            amplitude_C += this->m_amplitudes_C[i]/AUTOTUNE_CYCLES;
+            bias_pct += this->m_biases_pct[i]/AUTOTUNE_CYCLES;
+        }
+        bool steady {true};
+        for (uint8_t i = 0; i < AUTOTUNE_CYCLES; i++) {
+            steady = steady && std::fabs(this->m_periods_s[i] - period_s) <= AUTOTUNE_TOLERANCE*period_s &&
+                    std::fabs(this->m_amplitudes_C[i] - amplitude_C) <= AUTOTUNE_TOLERANCE*amplitude_C;
+        }
+        if (steady) {
+            this->m_result.tu_s = period_s;
+            this->m_result.amplitude_C = amplitude_C;
+            this->m_result.bias_pct = bias_pct;
+            this->m_result.ku = ultimate_gain(amplitude_C);
+            this->m_result.state = autotune_gains(this->m_result.rule, this->m_result.ku, period_s,
+                    this->m_result.gains) ? AUTOTUNE_DONE : AUTOTUNE_FAILED;
+            return true;
+        }
+    }
+
+    if (this->m_result.cycles >= AUTOTUNE_MAX_CYCLES) {
+        this->m_result.state = AUTOTUNE_FAILED;
+        return true;
+    }
+    return false;
+}
+
+// Takes a chamber reading and returns the fan duty percent, a cycle or the tune may end on it
+float relay_autotune::tick(const float pv_C, const float t_s) {
+    if (!this->running())
+        return AUTOTUNE_LOW_PCT;
+
+    // What the fan did since the last reading
+    const float dt = t_s - this->m_last_s;
+    this->m_last_s = t_s;
+    if (this->m_cycle_started) {
+        this->m_cycle_output_sum += (this->m_output_high ? AUTOTUNE_HIGH_PCT : AUTOTUNE_LOW_PCT)*dt;
+        this->m_cycle_time_sum += dt;
+        this->m_cycle_max_C = std::fmax(this->m_cycle_max_C, pv_C);
+        this->m_cycle_min_C = std::fmin(this->m_cycle_min_C, pv_C);
+    }
+
+    // A cooker that cannot reach or leave the set point never oscillates
+    if (t_s - this->m_start_s > AUTOTUNE_TIMEOUT_S) {
+        this->m_result.state = AUTOTUNE_FAILED;
+        return AUTOTUNE_LOW_PCT;
+    }
+
+    // A cycle runs from one switch to low output to the next
+    if (this->m_output_high && pv_C > this->m_set_point_C + AUTOTUNE_HYSTERESIS_C) {
+        this->m_output_high = false;
+        if (this->m_cycle_started && this->end_cycle(t_s))
+            return AUTOTUNE_LOW_PCT;
+        this->m_cycle_started = true;
+        this->m_cycle_start_s = t_s;
+        this->m_cycle_max_C = pv_C;
+        this->m_cycle_min_C = pv_C;
+        this->m_cycle_output_sum = 0;
+        this->m_cycle_time_sum = 0;
+    }
+    else if (!this->m_output_high && pv_C < this->m_set_point_C - AUTOTUNE_HYSTERESIS_C) {
+        this->m_output_high = true;
+    }
+    return this->m_output_high ? AUTOTUNE_HIGH_PCT : AUTOTUNE_LOW_PCT;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file autotune.hpp
+ * @brief Relay-feedback PID autotune
+ *
+ * The fan is switched between AUTOTUNE_HIGH_PCT and AUTOTUNE_LOW_PCT
+ * each time the chamber crosses the set point by more than the
+ * hysteresis, which makes the pit oscillate at its ultimate period. The
+ * peak-to-peak swing gives the ultimate gain, Ku = 4d/(pi*sqrt(a^2 - h^2))
+ * for a relay of amplitude d, oscillation amplitude a and hysteresis h.
+ * The first cycle carries the heat-up and is not measured; the tune
+ * ends once AUTOTUNE_CYCLES cycles in a row agree, and the gains come
+ * from Ku and Tu by the rule asked for. Times are passed in, so the
+ * class runs the same on the board and on the host.
+ */
+#ifndef __AUTOTUNE_HPP__
+#define __AUTOTUNE_HPP__
+
+#include <cstdint>
+
+#include "pid_store.hpp"
+
+// Relay output, fan duty percent
+#define AUTOTUNE_HIGH_PCT       (100.0f)
+#define AUTOTUNE_LOW_PCT        (0.0f)
+
+// Band around the set point the chamber must leave before the relay switches, rides over sensor noise
+#define AUTOTUNE_HYSTERESIS_C   (0.5f)
+
+// Cycles skipped, cycles that must agree, and how far apart they may be
+#define AUTOTUNE_SKIP_CYCLES    (1)
+#define AUTOTUNE_CYCLES         (3)
+#define AUTOTUNE_TOLERANCE      (0.15f)
+
+// Gives up after this many cycles or this long without agreement
+#define AUTOTUNE_MAX_CYCLES     (12)
+#define AUTOTUNE_TIMEOUT_S      (4*3600)
+
+// Tuning rules, from Ku and Tu
+enum autotune_rule : uint8_t {
+    AUTOTUNE_RULE_ZN_PID = 0, // Ziegler-Nichols classic, quick with a quarter-decay overshoot
+    AUTOTUNE_RULE_ZN_PI = 1, // Ziegler-Nichols without the derivative, for noisy probes
+    AUTOTUNE_RULE_TYREUS_LUYBEN = 2, // slow integral, little overshoot, suits lag-heavy cookers
+    AUTOTUNE_RULE_PESSEN = 3, // Pessen integral, fast disturbance rejection
+    AUTOTUNE_RULE_SOME_OVERSHOOT = 4,
+    AUTOTUNE_RULE_NO_OVERSHOOT = 5,
+    AUTOTUNE_RULE_COUNT
+};
+
+enum autotune_state : uint8_t {
+    AUTOTUNE_IDLE = 0,
+    AUTOTUNE_RUNNING = 1,
+    AUTOTUNE_DONE = 2, // gains computed
+    AUTOTUNE_FAILED = 3, // no steady oscillation in time, or gains out of range
+    AUTOTUNE_ABORTED = 4 // stopped by the app, a mode change or a new set point
+};
+
+struct autotune_result {
+    autotune_state state {AUTOTUNE_IDLE};
+    autotune_rule rule {AUTOTUNE_RULE_ZN_PID};
+    uint8_t cycles {0}; // completed, the skipped ones included
+    float ku {0}; // ultimate gain, fan percent per degree
+    float tu_s {0}; // ultimate period
+    float amplitude_C {0}; // half the peak-to-peak swing
+    float bias_pct {0}; // mean fan output over the measured cycles
+    pid_gains gains {};
+};
+
+class relay_autotune {
+
+    private:
+
+        autotune_result m_result {};
+        float m_set_point_C {0};
+        float m_start_s {0};
+        bool m_output_high {true};
+
+        // The cycle in progress, from the last switch to low output
+        bool m_cycle_started {false};
+        float m_cycle_start_s {0};
+        float m_cycle_max_C {0};
+        float m_cycle_min_C {0};
+        float m_cycle_output_sum {0};
+        float m_cycle_time_sum {0};
+        float m_last_s {0};
+
+        // The last measured cycles, oldest overwritten
+        float m_periods_s[AUTOTUNE_CYCLES] {};
+        float m_amplitudes_C[AUTOTUNE_CYCLES] {};
+        float m_biases_pct[AUTOTUNE_CYCLES] {};
+        uint8_t m_measured {0};
+
+        // Ends the cycle that finished at t_s, true once enough of them agree
+        bool end_cycle(float t_s);
+
+    public:
+
+        // Starts a tune around the set point, the first output is high below it and low above it
+        void start(float set_point_C, autotune_rule rule, float pv_C, float t_s);
+
+        // Stops a running tune, the result says so
+        void abort();
+
+        // Takes a chamber reading and returns the fan duty percent, a cycle or the tune may end on it
+        float tick(float pv_C, float t_s);
+
+        bool running() const {return this->m_result.state == AUTOTUNE_RUNNING;}
+        const autotune_result& result() const {return this->m_result;}
+};
+
+// PID gains from the ultimate gain and period, false for an unknown rule or gains past PID_GAIN_MAX
+bool autotune_gains(autotune_rule rule, float ku, float tu_s, pid_gains& gains);
+
+#endif /* __AUTOTUNE_HPP__ */
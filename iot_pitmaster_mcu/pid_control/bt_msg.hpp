@@ -0,0 +1,239 @@
+/**
+ * @file bt_msg.hpp
+ * @brief Messages exchanged with the Android app
+ * 
+ */
+#ifndef __BT_MSG_HPP__
+#define __BT_MSG_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "max31855.hpp"
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
+
+// The type of message being sent or received
+enum msg_type : uint8_t {
+    MSG_MODE = 0,
+    MSG_CHAMBER_TEMP = 1,
+    MSG_MEAT1_TEMP = 2,
+    MSG_MEAT2_TEMP = 3,
+    MSG_BLOWFAN = 4,
+    MSG_HOPPER = 5,
+    MSG_DAMPER = 6,
+    MSG_TELEMETRY = 7, // sent only, see telemetry.hpp
+    MSG_ALARM = 8, // sent only
+    MSG_HISTORY_REQUEST = 9, // received only
+    MSG_HISTORY = 10, // sent only, one history_log block, see history.hpp
+    MSG_HISTORY_END = 11, // sent only
+    MSG_LOG_REQUEST = 12, // received only
+    MSG_LOG = 13, // sent only, cook_log_record slots straight from flash, see cook_log.hpp
+    MSG_LOG_END = 14, // sent only
+    MSG_GAINS = 15, // received sets the PID gains, sent reports them
+    MSG_GAINS_REQUEST = 16, // received only, answered with MSG_GAINS
+    MSG_AUTOTUNE = 17, // received only, starts or stops a relay autotune
+    MSG_AUTOTUNE_STATUS = 18, // sent only, autotune progress and result
+    MSG_PROBE_CONFIG = 19, // received sets one probe's settings, sent reports them
+    MSG_PROBE_CONFIG_REQUEST = 20, // received only, answered with MSG_PROBE_CONFIG for every probe on the bus
+    MSG_CONTROL = 21, // sent only, whether this phone's commands change the cook
+    MSG_DAMPER_POSITION = 22 // received only, moves the damper to a position between closed and fully open
+};
+
+// Why the MCU raised an alarm
+enum alarm_code : uint8_t {
+    ALARM_OVER_TEMP = 1, // a probe passed the shutdown temperature, the MCU is shutting down
+    ALARM_PROBE_HIGH = 2, // a probe rose past its high alarm
+    ALARM_PROBE_LOW = 3 // a probe fell past its low alarm
+};
+
+// Basic message
+struct __attribute__ ((packed)) in_msg_basic {
+    msg_type type;
+};
+
+// MSG_MODE
+struct __attribute__ ((packed)) in_msg_mode {
+    msg_type type;
+    bool mode;
+};
+
+// MSG_CHAMBER_TEMP, MSG_MEAT1_TEMP, MSG_MEAT2_TEMP receive
+struct __attribute__ ((packed)) in_msg_temp_C {
+    msg_type type;
+    int16_t temp_C; // temp in Celsius
+};
+
+// MSG_BLOWFAN
+struct __attribute__ ((packed)) in_msg_blowfan {
+    msg_type type;
+    int8_t duty_cycle; // duty cycle (0-100)%;
+};
+
+// MSG_HOPPER
+struct __attribute__ ((packed)) in_msg_hopper {
+    msg_type type;
+    bool input_fuel; // true means input fuel
+};
+
+// MSG_DAMPER
+struct __attribute__ ((packed)) in_msg_damper {
+    msg_type type;
+    bool position_open; // open is true, closed is false
+};
+
+// MSG_DAMPER_POSITION
+struct __attribute__ ((packed)) in_msg_damper_position {
+    msg_type type;
+    uint8_t position_pct; // 0 closed to 100 fully open
+};
+
+// MSG_HISTORY_REQUEST, asks for the history between two MCU uptimes
+struct __attribute__ ((packed)) in_msg_history_request {
+    msg_type type;
+    uint32_t from_s;
+    uint32_t to_s;
+};
+
+// MSG_LOG_REQUEST, asks for the flash cook log from a boot on, 0 for all of it
+struct __attribute__ ((packed)) in_msg_log_request {
+    msg_type type;
+    uint16_t from_boot;
+};
+
+// MSG_GAINS receive, new PID gains, each from 0 to PID_GAIN_MAX
+struct __attribute__ ((packed)) in_msg_gains {
+    msg_type type;
+    float kp;
+    float ki;
+    float kd;
+};
+
+// MSG_AUTOTUNE, starts a tune around temp_C with an autotune_rule, or stops one
+struct __attribute__ ((packed)) in_msg_autotune {
+    msg_type type;
+    bool start; // false stops a running tune
+    uint8_t rule; // autotune_rule, see autotune.hpp
+    int16_t temp_C; // set point to tune around, in Celsius
+};
+
+// MSG_PROBE_CONFIG receive, new settings for one probe slot
+struct __attribute__ ((packed)) in_msg_probe_config {
+    msg_type type;
+    uint8_t probe; // slot, in bus order
+    tc_probe_config config;
+};
+
+// Size of a received command of the given type, 0 if the type is unknown
+constexpr size_t in_msg_size(const uint8_t type) {
+    switch (type) {
+    case MSG_MODE: return sizeof(in_msg_mode);
+    case MSG_CHAMBER_TEMP: return sizeof(in_msg_temp_C);
+    case MSG_MEAT1_TEMP: return sizeof(in_msg_temp_C);
+    case MSG_MEAT2_TEMP: return sizeof(in_msg_temp_C);
+    case MSG_BLOWFAN: return sizeof(in_msg_blowfan);
+    case MSG_HOPPER: return sizeof(in_msg_hopper);
+    case MSG_DAMPER: return sizeof(in_msg_damper);
+    case MSG_DAMPER_POSITION: return sizeof(in_msg_damper_position);
+    case MSG_HISTORY_REQUEST: return sizeof(in_msg_history_request);
+    case MSG_LOG_REQUEST: return sizeof(in_msg_log_request);
+    case MSG_GAINS: return sizeof(in_msg_gains);
+    case MSG_GAINS_REQUEST: return sizeof(in_msg_basic);
+    case MSG_AUTOTUNE: return sizeof(in_msg_autotune);
+    case MSG_PROBE_CONFIG: return sizeof(in_msg_probe_config);
+    case MSG_PROBE_CONFIG_REQUEST: return sizeof(in_msg_basic);
+    default: return 0;
+    }
+}
+
+// Whether a received command changes the cook, only the phone in control may send those
+// Requests that only read state back are answered for every phone
+constexpr bool in_msg_controls(const uint8_t type) {
+    switch (type) {
+    case MSG_HISTORY_REQUEST: return false;
+    case MSG_LOG_REQUEST: return false;
+    case MSG_GAINS_REQUEST: return false;
+    case MSG_PROBE_CONFIG_REQUEST: return false;
+    default: return true;
+    }
+}
+
+// Struct to send individual temperature data
+// MSG_CHAMBER_TEMP, MSG_MEAT1_TEMP, MSG_MEAT2_TEMP
+struct __attribute__ ((packed)) out_msg_temp_C {
+    msg_type type;
+    max31855_data_t temp_data_chamber;
+};
+
+// Struct to send all temperature and motor data
+struct __attribute__ ((packed)) out_msg_all_data {
+    max31855_data_t temp_data_chamber; // the chamber probes averaged, what the controller holds
+    uint8_t probes_active; // probe slots with a role, a bit per slot
+    uint8_t probe_roles[TC_BUS_MAX_PROBES]; // tc_role
+    max31855_data_t probes[TC_BUS_MAX_PROBES];
+    int8_t duty_cycle; // duty cycle (0-100)%;
+    bool input_fuel; // treat like bool, 1 means input fuel
+    bool position_open; // treat like bool, open is true, closed is false
+    uint8_t fuel_dg_per_min; // fuel the auger delivered over the last few minutes, tenths of a gram a minute
+};
+
+// MSG_ALARM, always delivered
+struct __attribute__ ((packed)) out_msg_alarm {
+    msg_type type;
+    alarm_code code;
+    int16_t temp_C; // the probe's temperature in Celsius, the hottest one for ALARM_OVER_TEMP
+    uint8_t probe; // slot
+};
+
+// MSG_HISTORY_END, follows the last MSG_HISTORY of a request
+struct __attribute__ ((packed)) out_msg_history_end {
+    msg_type type;
+    uint16_t blocks; // MSG_HISTORY messages sent for the request
+    uint32_t now_s; // MCU uptime
+};
+
+// MSG_GAINS send, the gains in use, after every MSG_GAINS or MSG_GAINS_REQUEST
+struct __attribute__ ((packed)) out_msg_gains {
+    msg_type type;
+    float kp;
+    float ki;
+    float kd;
+};
+
+// MSG_AUTOTUNE_STATUS, on start, after every relay cycle and at the end
+struct __attribute__ ((packed)) out_msg_autotune_status {
+    msg_type type;
+    uint8_t state; // autotune_state, see autotune.hpp
+    uint8_t rule;
+    uint8_t cycles;
+    float ku; // ultimate gain, fan percent per degree
+    float tu_s; // ultimate period
+    float amplitude_C;
+    float kp; // tuned gains once the state is done, applied already
+    float ki;
+    float kd;
+};
+
+// MSG_PROBE_CONFIG send, one probe slot's settings, after every MSG_PROBE_CONFIG or MSG_PROBE_CONFIG_REQUEST
+struct __attribute__ ((packed)) out_msg_probe_config {
+    msg_type type;
+    uint8_t probe;
+    tc_probe_config config;
+};
+
+// MSG_CONTROL, to every phone after any of them connects or leaves
+// The earliest connected phone has control, the others only watch
+struct __attribute__ ((packed)) out_msg_control {
+    msg_type type;
+    bool in_control; // commands from this phone change the cook, from the others they are refused
+    uint8_t phones; // connected, this one included
+};
+
+// MSG_LOG_END, follows the last MSG_LOG of a request
+struct __attribute__ ((packed)) out_msg_log_end {
+    msg_type type;
+    uint32_t records; // sent for the request
+    uint16_t boot; // the running boot
+};
+
+#endif /* __BT_MSG_HPP__ */
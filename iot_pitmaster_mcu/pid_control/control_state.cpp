@@ -0,0 +1,66 @@
+#include "control_state.hpp"
+
+// Posts a mode change, the latest one posted wins, any thread
+void shared_control_state::post_mode(const bool mode_auto) {
+    this->m_mode_auto.store(mode_auto, std::memory_order_relaxed);
+    this->m_mode_posted.store(true, std::memory_order_release);
+}
+
+// Posts a new set point, which starts the cook too, the latest one posted wins, any thread
+void shared_control_state::post_set_point(const float set_point_C) {
+    this->m_set_point_C.store(set_point_C, std::memory_order_relaxed);
+    this->m_set_point_posted.store(true, std::memory_order_release);
+}
+
+// Posts new PID gains, already validated, the latest ones posted win, any thread
+void shared_control_state::post_gains(const pid_gains& gains) {
+    std::lock_guard<std::mutex> lock(this->m_gains_lock);
+    this->m_gains = gains;
+    this->m_gains_posted.store(true, std::memory_order_release);
+}
+
+// Where the damper is now, damper thread only
+void shared_control_state::damper_moved(const uint8_t pct) {
+    this->m_damper_pct.store(pct, std::memory_order_relaxed);
+}
+
+// Applies the posted commands and publishes a snapshot if anything changed, control loop only
+// Commands are dropped after an emergency shutdown, new_set_point and new_gains say what was taken
+control_state shared_control_state::apply(bool& new_set_point, bool& new_gains) {
+    new_set_point = false;
+    new_gains = false;
+    bool changed = this->m_state.damper_pct != this->damper_pct();
+
+    // A value posted after the flag was taken is applied again next tick, never lost
+    if (this->m_mode_posted.exchange(false, std::memory_order_acquire)) {
+        const bool mode_auto = this->m_mode_auto.load(std::memory_order_relaxed);
+        if (!this->m_state.ignore_bt && mode_auto != this->m_state.mode_auto) {
+            this->m_state.mode_auto = mode_auto;
+            changed = true;
+        }
+    }
+    if (this->m_set_point_posted.exchange(false, std::memory_order_acquire) && !this->m_state.ignore_bt) {
+        this->m_state.set_point_C = this->m_set_point_C.load(std::memory_order_relaxed);
+        this->m_state.cook_started = true;
+        new_set_point = true;
+        changed = true;
+    }
+    if (this->m_gains_posted.exchange(false, std::memory_order_acquire) && !this->m_state.ignore_bt) {
+        std::lock_guard<std::mutex> lock(this->m_gains_lock);
+        this->m_state.gains = this->m_gains;
+        new_gains = true;
+        changed = true;
+    }
+
+    if (!changed)
+        return this->m_state;
+    return this->publish();
+}
+
+// Publishes the control loop's copy with the damper's latest position
+const control_state& shared_control_state::publish() {
+    this->m_state.damper_pct = this->damper_pct();
+    this->m_state.version++;
+    this->m_snapshot.store(this->m_state);
+    return this->m_state;
+}
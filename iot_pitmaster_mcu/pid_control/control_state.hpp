@@ -0,0 +1,100 @@
+/**
+ * @file control_state.hpp
+ * @brief Controller state shared between the control loops, the Bluetooth handler, the console and the damper
+ *
+ * The state lives in one snapshot published through a seqlock, so any
+ * thread gets a consistent copy without a lock and the control loops
+ * see one view for a whole tick. Every field has a single writer:
+ *  - Set point, mode and PID gains come in as commands. Any thread can
+ *    post them, and the control loop applies the latest one of each on
+ *    its next tick.
+ *  - The cook flags change only in the control loop, by update().
+ *  - The damper position is written only by the damper thread. The
+ *    control loop copies it into the snapshot.
+ * Only the control loop publishes, which makes it the seqlock's one writer.
+ */
+#ifndef __CONTROL_STATE_HPP__
+#define __CONTROL_STATE_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "pid_store.hpp"
+#include "seqlock.hpp"
+
+// One consistent view of the controller
+struct control_state {
+    float set_point_C {0};
+    bool mode_auto {true};
+    bool cook_started {false};
+    bool ignore_bt {false}; // emergency shutdown, commands from the app are refused
+    uint8_t damper_pct {0}; // 0 closed to 100 fully open
+    pid_gains gains {}; // the gains the PID runs with
+    uint32_t version {0}; // snapshots published so far
+};
+
+class shared_control_state {
+
+    private:
+
+        // Latest snapshot, read by any thread
+        seqlock<control_state> m_snapshot;
+
+        // The control loop's own copy, the next snapshot is made from it
+        control_state m_state {};
+
+        // Commands posted since the control loop last looked
+        std::atomic<bool> m_mode_posted {false};
+        std::atomic<bool> m_mode_auto {true};
+        std::atomic<bool> m_set_point_posted {false};
+        std::atomic<float> m_set_point_C {0};
+        std::atomic<bool> m_gains_posted {false};
+        std::mutex m_gains_lock; // three floats, posters take turns so a set is never mixed
+        pid_gains m_gains {};
+
+        // Written by the damper thread only
+        std::atomic<uint8_t> m_damper_pct {0};
+
+        // Publishes the control loop's copy with the damper's latest position
+        const control_state& publish();
+
+    public:
+
+        shared_control_state() = default;
+        shared_control_state(const shared_control_state&) = delete;
+        shared_control_state& operator=(const shared_control_state&) = delete;
+
+        // A consistent copy of the latest snapshot, never blocks, any thread
+        inline control_state load() const {
+            return this->m_snapshot.load();
+        }
+
+        // Posts a mode change, the latest one posted wins, any thread
+        void post_mode(bool mode_auto);
+
+        // Posts a new set point, which starts the cook too, the latest one posted wins, any thread
+        void post_set_point(float set_point_C);
+
+        // Posts new PID gains, already validated, the latest ones posted win, any thread
+        void post_gains(const pid_gains& gains);
+
+        // Where the damper is now, only the damper thread reports it
+        inline uint8_t damper_pct() const {
+            return this->m_damper_pct.load(std::memory_order_relaxed);
+        }
+        void damper_moved(uint8_t pct);
+
+        // Applies the posted commands and publishes a snapshot if anything changed, control loop only
+        // Commands are dropped after an emergency shutdown, new_set_point and new_gains say what was taken
+        control_state apply(bool& new_set_point, bool& new_gains);
+
+        // Changes the state and publishes it, control loop only, or before it starts
+        template <typename F>
+        control_state update(F change) {
+            change(this->m_state);
+            return this->publish();
+        }
+};
+
+#endif /* __CONTROL_STATE_HPP__ */
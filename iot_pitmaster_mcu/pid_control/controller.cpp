@@ -0,0 +1,115 @@
+/**
+ * @file controller.cpp
+ * @brief Control laws for the pit, picked at compile time
+ *
+ */
+#include "controller.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+// Ultimate period against set point, relay tunes of the simulated plant at each point
+struct period_point {
+    float set_point_C;
+    float scale;
+};
+
+static constexpr period_point period_schedule[] {
+    {80, 3.6f},
+    {110, 1.0f},
+    {160, 0.52f},
+    {200, 0.46f}
+};
+
+// Damper on fixed thresholds and fuel following the fan, what every law here shares
+controller_pit_command threshold_pit::pit_step(const controller_sample& sample) {
+    controller_pit_command command {};
+    const float pv_err = sample.set_point_C - sample.chamber_C;
+
+    // Need to heat up, open damper
+    if (pv_err > CONTROLLER_DAMPER_OPEN_ERR_C)
+        command.damper_pct = 100;
+    // Need to cool down, close damper
+    else if (pv_err <= CONTROLLER_DAMPER_CLOSE_ERR_C)
+        command.damper_pct = 0;
+
+    // The fire burns what the air lets it, so the fuel follows the air the fan adds
+    command.fuel_g_per_min = CONTROLLER_FUEL_IDLE_G_PER_MIN +
+            CONTROLLER_FUEL_PER_FAN_PCT*std::clamp(sample.fan_pct, 0.0f, 100.0f);
+    return command;
+}
+
+// The core's tuning for a set of gains, fan output 0-100%
+pid_tuning controller_tuning(const pid_gains& gains) {
+    pid_tuning tuning {};
+    tuning.kp = gains.kp;
+    tuning.ki = gains.ki;
+    tuning.kd = gains.kd;
+    tuning.d_filter_s = CONTROLLER_D_FILTER_S;
+    tuning.rate_per_s = CONTROLLER_RATE_PCT_PER_S;
+    // Tracking time follows Ti, with no integral there is nothing to wind up
+    if (gains.ki > 0 && gains.kp > 0)
+        tuning.tracking_s = CONTROLLER_TRACKING_TI*gains.kp/gains.ki;
+    return tuning;
+}
+
+// The original law, a PID on chamber temperature
+float pid_policy::fan_step(const controller_sample& sample, controller_pid& state) {
+    if (state.retune) {
+        state.core.configure(controller_tuning(state.gains), sample.dt);
+        state.retune = false;
+    }
+    state.core.retime(sample.dt);
+    return static_cast<float>(state.core.step(controller_value(sample.set_point_C), controller_value(sample.chamber_C)));
+}
+
+// Ultimate period at a set point over the one at CONTROLLER_SCHEDULE_REF_C
+float scheduled_pid_policy::period_scale(const float set_point_C) {
+    if (set_point_C <= period_schedule[0].set_point_C)
+        return period_schedule[0].scale;
+    for (size_t i = 1; i < std::size(period_schedule); i++) {
+        const period_point& lo = period_schedule[i - 1];
+        const period_point& hi = period_schedule[i];
+        if (set_point_C <= hi.set_point_C)
+            return lo.scale + (hi.scale - lo.scale)*(set_point_C - lo.set_point_C)/(hi.set_point_C - lo.set_point_C);
+    }
+    return period_schedule[std::size(period_schedule) - 1].scale;
+}
+
+// Ti and Td follow the ultimate period, Kp the ultimate gain, which hardly moves
+float scheduled_pid_policy::fan_step(const controller_sample& sample, controller_pid& state) {
+    if (state.retune || sample.set_point_C != this->m_tuned_set_point_C) {
+        const float scale = period_scale(sample.set_point_C);
+        pid_tuning tuning = controller_tuning(state.gains);
+        tuning.ki /= scale;
+        tuning.kd *= scale;
+        tuning.tracking_s *= scale;
+        state.core.configure(tuning, sample.dt);
+        state.retune = false;
+        this->m_tuned_set_point_C = sample.set_point_C;
+    }
+    state.core.retime(sample.dt);
+    return static_cast<float>(state.core.step(controller_value(sample.set_point_C), controller_value(sample.chamber_C)));
+}
+
+float feedforward_pid_policy::feedforward_pct(const float set_point_C) {
+    return std::fmax(0.0f, CONTROLLER_FF_PCT_PER_C*(set_point_C - CONTROLLER_FF_LEAK_C));
+}
+
+// The fan the set point needs at steady state, with the PID trimming around it
+float feedforward_pid_policy::fan_step(const controller_sample& sample, controller_pid& state) {
+    const float feedforward = std::fmin(feedforward_pct(sample.set_point_C), 100.0f);
+    if (state.retune || sample.set_point_C != this->m_tuned_set_point_C) {
+        // The core trims within what the feedforward leaves of 0-100%, so its anti-windup sees the real limits
+        pid_tuning tuning = controller_tuning(state.gains);
+        tuning.out_min = -feedforward;
+        tuning.out_max = 100 - feedforward;
+        state.core.configure(tuning, sample.dt);
+        state.retune = false;
+        this->m_tuned_set_point_C = sample.set_point_C;
+    }
+    state.core.retime(sample.dt);
+    return feedforward +
+            static_cast<float>(state.core.step(controller_value(sample.set_point_C), controller_value(sample.chamber_C)));
+}
@@ -0,0 +1,178 @@
+/**
+ * @file controller.hpp
+ * @brief Control laws for the pit, picked at compile time
+ *
+ * A controller policy turns the latest readings into fan, damper and
+ * fuel rate commands. pid_control holds the one named by CONTROLLER_POLICY by
+ * value and calls it directly, so the law is fixed when the firmware is
+ * built and the fan loop pays no virtual call. A policy provides
+ *
+ *   float fan_step(const controller_sample&, controller_pid&)
+ *       fan duty percent, run by the fan loop, clamped by the pwm
+ *   controller_pit_command pit_step(const controller_sample&)
+ *       damper and fuel, run by the pit loop
+ *   static constexpr const char* name
+ *
+ * and is_controller_policy checks that it does. Every law runs a pid<T>
+ * core, see pid.hpp, whose gains and state live in controller_pid, which
+ * is what NVS keeps, MSG_GAINS sets and the autotune tunes. The core
+ * works in controller_value, float or Q16.16 by CONTROLLER_FIXED_POINT,
+ * and holds the integral term itself, so a law that schedules Ki or moves
+ * the output limits reconfigures it without the output jumping.
+ */
+#ifndef __CONTROLLER_HPP__
+#define __CONTROLLER_HPP__
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "pid.hpp"
+#include "pid_store.hpp"
+
+// The control laws, CONTROLLER_POLICY picks one, the build may set it
+#define CONTROLLER_POLICY_PID           (0)
+#define CONTROLLER_POLICY_SCHEDULED     (1)
+#define CONTROLLER_POLICY_FEEDFORWARD   (2)
+#ifndef CONTROLLER_POLICY
+#define CONTROLLER_POLICY               (CONTROLLER_POLICY_PID)
+#endif
+
+// 1 runs the PID core in Q16.16 fixed point, for a chip without an FPU such as the ESP32-S2
+#ifndef CONTROLLER_FIXED_POINT
+#define CONTROLLER_FIXED_POINT          (0)
+#endif
+
+// PID core: derivative low-pass time constant, fan slew limit, and the
+// back-calculation tracking time as a fraction of Ti, 0 clamps the integrator instead
+#define CONTROLLER_D_FILTER_S           (2.0f)
+#define CONTROLLER_RATE_PCT_PER_S       (50.0f)
+#define CONTROLLER_TRACKING_TI          (1.0f)
+
+// Fuel rate while cooking, what the leak and the open damper burn plus what each percent of fan does
+#define CONTROLLER_FUEL_IDLE_G_PER_MIN  (2.0f)
+#define CONTROLLER_FUEL_PER_FAN_PCT     (0.25f)
+
+// Damper thresholds, degrees below the set point it opens at and closes at
+#define CONTROLLER_DAMPER_OPEN_ERR_C    (5)
+#define CONTROLLER_DAMPER_CLOSE_ERR_C   (0)
+
+// Damper position in a pit command that leaves it where it is
+#define CONTROLLER_DAMPER_HOLD          (-1)
+
+// Gain schedule: set point the stored gains are meant for
+#define CONTROLLER_SCHEDULE_REF_C       (110.0f)
+
+// Feedforward: fan percent per degree of set point above the point where the leak alone holds the pit
+#define CONTROLLER_FF_PCT_PER_C         (0.09f)
+#define CONTROLLER_FF_LEAK_C            (80.0f)
+
+#if CONTROLLER_FIXED_POINT
+typedef q16_16 controller_value;
+#else
+typedef float controller_value;
+#endif
+
+// The PID state shared by every law
+struct controller_pid {
+    pid_gains gains {};
+    pid<controller_value> core {};
+    bool retune {true}; // set when the gains change, the law reconfigures the core on its next step
+};
+
+// The core's tuning for a set of gains, fan output 0-100%
+pid_tuning controller_tuning(const pid_gains& gains);
+
+// What a law sees on each tick
+struct controller_sample {
+    float set_point_C;
+    float chamber_C;
+    uint8_t damper_pct; // 0 closed to 100 fully open
+    float dt; // seconds since the last tick at this rate
+    float fan_pct {0}; // duty the fan loop last set
+};
+
+struct controller_pit_command {
+    int8_t damper_pct {CONTROLLER_DAMPER_HOLD}; // 0-100%, a repeat of the last position costs nothing
+    float fuel_g_per_min {0}; // the fuel feeder spaces doses out for it
+};
+
+// Damper on fixed thresholds and fuel following the fan, what every law here shares
+class threshold_pit {
+
+    public:
+
+        controller_pit_command pit_step(const controller_sample& sample);
+};
+
+// The original law, a PID on chamber temperature
+class pid_policy : public threshold_pit {
+
+    public:
+
+        static constexpr const char* name {"pid"};
+
+        float fan_step(const controller_sample& sample, controller_pid& state);
+};
+
+// The PID with Ki and Kd following the set point
+// The cooker's ultimate period falls as it runs hotter, from relay tunes of the simulated plant
+class scheduled_pid_policy : public threshold_pit {
+
+    private:
+
+        float m_tuned_set_point_C {-1};
+
+    public:
+
+        static constexpr const char* name {"scheduled"};
+
+        // Ultimate period at a set point over the one at CONTROLLER_SCHEDULE_REF_C
+        static float period_scale(float set_point_C);
+
+        float fan_step(const controller_sample& sample, controller_pid& state);
+};
+
+// The fan the set point needs at steady state, with the PID trimming around it
+// The pit needs more air the hotter it runs, about linearly once the leak is no longer enough,
+// and the core's limits are what is left of 0-100% so it is only ever a trim
+class feedforward_pid_policy : public threshold_pit {
+
+    private:
+
+        float m_tuned_set_point_C {-1};
+
+    public:
+
+        static constexpr const char* name {"feedforward"};
+
+        static float feedforward_pct(float set_point_C);
+
+        float fan_step(const controller_sample& sample, controller_pid& state);
+};
+
+// Whether T has what pid_control calls on a policy
+template <typename T, typename = void>
+struct is_controller_policy : std::false_type {};
+
+template <typename T>
+struct is_controller_policy<T, std::void_t<
+        decltype(std::declval<float&>() = std::declval<T&>().fan_step(std::declval<const controller_sample&>(),
+                std::declval<controller_pid&>())),
+        decltype(std::declval<controller_pit_command&>() = std::declval<T&>().pit_step(
+                std::declval<const controller_sample&>())),
+        decltype(static_cast<const char*>(T::name))>> : std::true_type {};
+
+#if CONTROLLER_POLICY == CONTROLLER_POLICY_PID
+typedef pid_policy controller_policy;
+#elif CONTROLLER_POLICY == CONTROLLER_POLICY_SCHEDULED
+typedef scheduled_pid_policy controller_policy;
+#elif CONTROLLER_POLICY == CONTROLLER_POLICY_FEEDFORWARD
+typedef feedforward_pid_policy controller_policy;
+#else
+#error "Unknown CONTROLLER_POLICY"
+#endif
+
+static_assert(is_controller_policy<controller_policy>::value, "CONTROLLER_POLICY does not name a controller policy");
+
+#endif /* __CONTROLLER_HPP__ */
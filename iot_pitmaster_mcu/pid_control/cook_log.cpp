@@ -0,0 +1,266 @@
+/**
+ * @file cook_log.cpp
+ * @brief Append-only cook log in its own flash partition
+ *
+ */
+#include "cook_log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// CRC-8 lookup table, polynomial 0x07
+static constexpr std::array<uint8_t, 256> crc8_table = []() {
+    std::array<uint8_t, 256> table {};
+    for (uint16_t i = 0; i < 256; i++) {
+        uint8_t crc = static_cast<uint8_t>(i);
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        table[i] = crc;
+    }
+    return table;
+}();
+
+// CRC-8, polynomial 0x07
+uint8_t cook_log_crc8(const uint8_t* data, const size_t len) {
+    uint8_t crc {0};
+    for (size_t i = 0; i < len; i++)
+        crc = crc8_table[crc ^ data[i]];
+    return crc;
+}
+
+// Whether a record read from flash is whole
+bool cook_log_record_valid(const cook_log_record& record) {
+    if (record.type < COOK_LOG_SAMPLE || record.type > COOK_LOG_SHUTDOWN)
+        return false;
+    return record.crc == cook_log_crc8(reinterpret_cast<const uint8_t*>(&record), sizeof(record) - 1);
+}
+
+static bool header_valid(const cook_log_sector_header& header) {
+    return header.magic == COOK_LOG_MAGIC && header.version == COOK_LOG_VERSION &&
+            header.crc == cook_log_crc8(reinterpret_cast<const uint8_t*>(&header), sizeof(header) - 1);
+}
+
+static bool slot_blank(const uint8_t* slot) {
+    for (size_t i = 0; i < COOK_LOG_RECORD_SIZE; i++) {
+        if (slot[i] != 0xff)
+            return false;
+    }
+    return true;
+}
+
+// Whether the mapped sector holds a good header for seq
+bool cook_log::sector_valid(const uint32_t seq) const {
+    cook_log_sector_header header;
+    std::memcpy(&header, this->sector_map(seq), sizeof(header));
+    return header_valid(header) && header.seq == seq;
+}
+
+// Erases the sector for seq and writes its header
+bool cook_log::open_sector(const uint32_t seq) {
+    const size_t offset = this->sector_of(seq)*SPI_FLASH_SEC_SIZE;
+
+    // The erase count lives in the header about to be erased
+    cook_log_sector_header header;
+    std::memcpy(&header, this->m_map + offset, sizeof(header));
+    const uint32_t erase_count = header_valid(header) ? header.erase_count + 1 : 1;
+
+    if (esp_partition_erase_range(this->m_partition, offset, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+        this->m_stats.write_errors++;
+        std::cout << "Error: unable to erase cook log sector " << this->sector_of(seq) << ".\n\n";
+        return false;
+    }
+    this->m_stats.erases++;
+
+    header = {COOK_LOG_MAGIC, seq, erase_count, COOK_LOG_VERSION, 0xff, 0};
+    header.crc = cook_log_crc8(reinterpret_cast<const uint8_t*>(&header), sizeof(header) - 1);
+    if (esp_partition_write(this->m_partition, offset, &header, sizeof(header)) != ESP_OK) {
+        this->m_stats.write_errors++;
+        std::cout << "Error: unable to write the header of cook log sector " << this->sector_of(seq) << ".\n\n";
+        return false;
+    }
+
+    this->m_seq = seq;
+    this->m_slot = 1;
+    this->m_stats.max_erase_count = std::max(this->m_stats.max_erase_count, erase_count);
+    return true;
+}
+
+// Programs the pending records, they never cross a page
+void cook_log::write_pending() {
+    if (this->m_pending_count == 0)
+        return;
+    const size_t offset = this->sector_of(this->m_seq)*SPI_FLASH_SEC_SIZE +
+            (this->m_slot - this->m_pending_count)*COOK_LOG_RECORD_SIZE;
+    if (esp_partition_write(this->m_partition, offset, this->m_pending.data(),
+            this->m_pending_count*COOK_LOG_RECORD_SIZE) != ESP_OK) {
+        this->m_stats.write_errors++;
+        std::cout << "Error: unable to write " << this->m_pending_count << " cook log records.\n\n";
+    }
+    else {
+        this->m_stats.page_writes++;
+    }
+    this->m_pending_count = 0;
+}
+
+// Adds one record, the lock must be held
+void cook_log::append_locked(cook_log_record record) {
+    if (!this->ready())
+        return;
+    // A sector that could not be opened is tried again
+    if (this->m_slot == COOK_LOG_SECTOR_SLOTS && !this->open_sector(this->m_seq + 1))
+        return;
+
+    record.boot = this->m_boot;
+    record.crc = cook_log_crc8(reinterpret_cast<const uint8_t*>(&record), sizeof(record) - 1);
+    this->m_pending[this->m_pending_count++] = record;
+    this->m_slot++;
+    this->m_stats.appended++;
+
+    if (this->m_slot % COOK_LOG_PAGE_RECORDS == 0)
+        this->write_pending();
+    // Erasing stalls flash reads for tens of milliseconds, this happens once per sector
+    if (this->m_slot == COOK_LOG_SECTOR_SLOTS)
+        this->open_sector(this->m_seq + 1);
+}
+
+// Finds and maps the partition, picks up where the last boot stopped and logs this boot
+bool cook_log::init(const uint32_t t_s, const uint8_t reset_reason) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+
+    this->m_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            static_cast<esp_partition_subtype_t>(COOK_LOG_PARTITION_SUBTYPE), COOK_LOG_PARTITION_LABEL);
+    if (this->m_partition == nullptr) {
+        std::cout << "Error: no \"" << COOK_LOG_PARTITION_LABEL << "\" partition, the cook log is off.\n\n";
+        return false;
+    }
+    this->m_sectors = this->m_partition->size / SPI_FLASH_SEC_SIZE;
+    if (this->m_sectors < 2) {
+        std::cout << "Error: the cook log partition needs at least 2 sectors.\n\n";
+        return false;
+    }
+
+    const void* map {nullptr};
+    if (esp_partition_mmap(this->m_partition, 0, this->m_partition->size, SPI_FLASH_MMAP_DATA, &map,
+            &this->m_map_handle) != ESP_OK) {
+        std::cout << "Error: unable to map the cook log partition.\n\n";
+        return false;
+    }
+    this->m_map = static_cast<const uint8_t*>(map);
+    this->m_stats.sectors = this->m_sectors;
+
+    // The open sector is the one with the highest sequence number
+    uint32_t newest {0};
+    for (uint32_t sector = 0; sector < this->m_sectors; sector++) {
+        cook_log_sector_header header;
+        std::memcpy(&header, this->m_map + sector*SPI_FLASH_SEC_SIZE, sizeof(header));
+        if (!header_valid(header) || header.seq == 0 || this->sector_of(header.seq) != sector)
+            continue;
+        this->m_stats.max_erase_count = std::max(this->m_stats.max_erase_count, header.erase_count);
+        newest = std::max(newest, header.seq);
+    }
+
+    if (newest == 0) {
+        // Blank or foreign data, start over
+        std::cout << "Formatting the cook log partition.\n\n";
+        if (!this->open_sector(1)) {
+            this->m_map = nullptr;
+            return false;
+        }
+    }
+    else {
+        // Carries on after the last slot programmed, a torn record is left behind
+        this->m_seq = newest;
+        this->m_slot = COOK_LOG_SECTOR_SLOTS;
+        const uint8_t* sector = this->sector_map(newest);
+        while (this->m_slot > 1 && slot_blank(sector + (this->m_slot - 1)*COOK_LOG_RECORD_SIZE))
+            this->m_slot--;
+    }
+
+    // The last boot is in the open sector, or the one before it if the open one is new
+    uint16_t last_boot {0};
+    for (uint32_t seq = this->m_seq; seq >= this->first_seq() && seq + 1 >= this->m_seq && last_boot == 0; seq--) {
+        if (!this->sector_valid(seq))
+            continue;
+        const cook_log_record* slots = reinterpret_cast<const cook_log_record*>(this->sector_map(seq));
+        for (uint16_t slot = (seq == this->m_seq) ? this->m_slot : COOK_LOG_SECTOR_SLOTS; slot > 1; slot--) {
+            if (cook_log_record_valid(slots[slot - 1])) {
+                last_boot = slots[slot - 1].boot;
+                break;
+            }
+        }
+        if (seq == 1)
+            break;
+    }
+    this->m_boot = last_boot + 1;
+    this->m_stats.boot = this->m_boot;
+
+    this->append_locked({COOK_LOG_BOOT, 0, 0, t_s, {0, 0, 0}, reset_reason, 0});
+    return true;
+}
+
+// Adds a record, it reaches flash when its page fills or on flush()
+void cook_log::append(const cook_log_type type, const uint32_t t_s, const telemetry_sample& sample) {
+    cook_log_record record {type, sample.status, 0, t_s, {0, 0, 0}, sample.fan_duty, 0};
+    for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++)
+        record.temp_qc[i] = sample.logged_qc[i];
+
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    this->append_locked(record);
+}
+
+// Programs the records gathered so far, the page is finished by later writes
+void cook_log::flush() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->ready() || this->m_pending_count == 0)
+        return;
+    this->write_pending();
+    this->m_stats.flushes++;
+}
+
+// Cursor at the oldest record held
+cook_log_cursor cook_log::begin() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return {this->ready() ? this->first_seq() : 0, 1};
+}
+
+// Points records at up to max_records good records that follow each other in the map, and moves the cursor past them
+// Returns how many, 0 once the cursor reaches the last record programmed
+size_t cook_log::read(cook_log_cursor& cursor, const cook_log_record*& records, const size_t max_records) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->ready())
+        return 0;
+
+    // Sectors erased since the cursor was made are gone, carry on from the oldest one left
+    if (cursor.seq < this->first_seq() || cursor.seq > this->m_seq)
+        cursor = {this->first_seq(), 1};
+
+    const uint16_t programmed = this->m_slot - this->m_pending_count;
+    while (true) {
+        const uint16_t end = (cursor.seq == this->m_seq) ? programmed : COOK_LOG_SECTOR_SLOTS;
+        if (!this->sector_valid(cursor.seq))
+            cursor.slot = std::max(cursor.slot, end);
+
+        const cook_log_record* slots = reinterpret_cast<const cook_log_record*>(this->sector_map(cursor.seq));
+        while (cursor.slot < end && !cook_log_record_valid(slots[cursor.slot]))
+            cursor.slot++;
+        size_t count {0};
+        while (cursor.slot + count < end && count < max_records && cook_log_record_valid(slots[cursor.slot + count]))
+            count++;
+        if (count > 0) {
+            records = slots + cursor.slot;
+            cursor.slot += count;
+            return count;
+        }
+
+        if (cursor.seq == this->m_seq)
+            return 0;
+        cursor.seq++;
+        cursor.slot = 1;
+    }
+}
+
+cook_log_stats cook_log::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_stats;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file cook_log.hpp
+ * @brief Append-only cook log in its own flash partition
+ *
+ * The log outlives esp_restart(), so the minutes before an emergency
+ * shutdown are still there after the MCU comes back. The partition is a
+ * ring of 4 KB sectors, each starting with a header that holds its
+ * sequence number and erase count. Records are fixed 16-byte slots
+ * filled in order, with probe slots 0-2. They are gathered in RAM and
+ * programmed a 256-byte flash page at a time, or sooner by flush(). A
+ * sector is erased only when the log moves into it, and the log moves
+ * through every sector in turn, so wear is spread evenly.
+ *
+ * The whole partition is memory-mapped. Reads hand out pointers into the
+ * map, so exporting the log over SPP or the console copies nothing.
+ * Records torn by a reset fail their CRC and are skipped.
+ */
+#ifndef __COOK_LOG_HPP__
+#define __COOK_LOG_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+
+#include "telemetry.hpp"
+
+// The partition, see partitions.csv
+#define COOK_LOG_PARTITION_LABEL    "cooklog"
+#define COOK_LOG_PARTITION_SUBTYPE  (0x40)
+
+#define COOK_LOG_MAGIC              (0x474f4c43) // "CLOG"
+#define COOK_LOG_VERSION            (1)
+
+// Flash program page, records are written a page at a time
+#define COOK_LOG_PAGE_SIZE          (256)
+
+#define COOK_LOG_RECORD_SIZE        (16)
+#define COOK_LOG_PAGE_RECORDS       (COOK_LOG_PAGE_SIZE/COOK_LOG_RECORD_SIZE)
+#define COOK_LOG_SECTOR_SLOTS       (SPI_FLASH_SEC_SIZE/COOK_LOG_RECORD_SIZE) // the first one is the sector header
+
+enum cook_log_type : uint8_t {
+    COOK_LOG_SAMPLE = 1, // one pit loop status
+    COOK_LOG_BOOT = 2, // fan_duty holds the esp_reset_reason()
+    COOK_LOG_SET_POINT = 3, // the chamber column holds the new chamber set point
+    COOK_LOG_SHUTDOWN = 4 // emergency shutdown, with the status that caused it
+};
+
+// One log slot, little-endian
+struct __attribute__ ((packed)) cook_log_record {
+    cook_log_type type;
+    uint8_t status; // TELEMETRY_STATUS_* bits
+    uint16_t boot; // counts up every time the MCU starts
+    uint32_t t_s; // uptime
+    int16_t temp_qc[TELEMETRY_LOGGED_PROBES]; // by TELEMETRY_LOGGED_*
+    uint8_t fan_duty;
+    uint8_t crc; // CRC-8 of the bytes before it
+};
+static_assert(sizeof(cook_log_record) == COOK_LOG_RECORD_SIZE, "records must fill the sector slots");
+
+// First slot of every sector
+struct __attribute__ ((packed)) cook_log_sector_header {
+    uint32_t magic;
+    uint32_t seq; // counts up as the log moves into a sector, the first sector is 1
+    uint32_t erase_count;
+    uint16_t version;
+    uint8_t reserved;
+    uint8_t crc; // CRC-8 of the bytes before it
+};
+static_assert(sizeof(cook_log_sector_header) == COOK_LOG_RECORD_SIZE, "the header takes one slot");
+
+// Where a reader is, oldest records first
+struct cook_log_cursor {
+    uint32_t seq {0};
+    uint16_t slot {1};
+};
+
+struct cook_log_stats {
+    uint32_t appended {0}; // since boot
+    uint32_t page_writes {0};
+    uint32_t flushes {0};
+    uint32_t erases {0};
+    uint32_t write_errors {0};
+    uint32_t sectors {0};
+    uint32_t max_erase_count {0};
+    uint16_t boot {0};
+};
+
+class cook_log {
+
+    private:
+
+        std::mutex m_lock;
+        const esp_partition_t* m_partition {nullptr};
+        const uint8_t* m_map {nullptr};
+        spi_flash_mmap_handle_t m_map_handle {0};
+        uint32_t m_sectors {0};
+
+        // The open sector and its next free slot
+        uint32_t m_seq {0};
+        uint16_t m_slot {1};
+
+        // Records not yet programmed, they end at m_slot
+        std::array<cook_log_record, COOK_LOG_PAGE_RECORDS> m_pending {};
+        size_t m_pending_count {0};
+
+        uint16_t m_boot {0};
+        cook_log_stats m_stats {};
+
+        // Sector sequence numbers start at 1 in the first sector and follow the ring
+        inline uint32_t sector_of(const uint32_t seq) const {
+            return (seq - 1) % this->m_sectors;
+        }
+
+        inline const uint8_t* sector_map(const uint32_t seq) const {
+            return this->m_map + this->sector_of(seq)*SPI_FLASH_SEC_SIZE;
+        }
+
+        // Oldest sector still held
+        inline uint32_t first_seq() const {
+            return (this->m_seq > this->m_sectors) ? this->m_seq - this->m_sectors + 1 : 1;
+        }
+
+        // Whether the mapped sector holds a good header for seq
+        bool sector_valid(uint32_t seq) const;
+
+        // Erases the sector for seq and writes its header
+        bool open_sector(uint32_t seq);
+
+        // Programs the pending records, they never cross a page
+        void write_pending();
+
+        // Adds one record, the lock must be held
+        void append_locked(cook_log_record record);
+
+    public:
+
+        // Finds and maps the partition, picks up where the last boot stopped and logs this boot
+        bool init(uint32_t t_s, uint8_t reset_reason);
+
+        inline bool ready() const {
+            return this->m_map != nullptr;
+        }
+
+        // Adds a record, it reaches flash when its page fills or on flush()
+        void append(cook_log_type type, uint32_t t_s, const telemetry_sample& sample);
+
+        // Programs the records gathered so far, the page is finished by later writes
+        void flush();
+
+        // Cursor at the oldest record held
+        cook_log_cursor begin();
+
+        // Points records at up to max_records good records that follow each other in the map, and moves the cursor past them
+        // Returns how many, 0 once the cursor reaches the last record programmed
+        size_t read(cook_log_cursor& cursor, const cook_log_record*& records, size_t max_records);
+
+        cook_log_stats stats();
+};
+
+// CRC-8, polynomial 0x07
+uint8_t cook_log_crc8(const uint8_t* data, size_t len);
+
+// Whether a record read from flash is whole
+bool cook_log_record_valid(const cook_log_record& record);
+
+#endif /* __COOK_LOG_HPP__ */
@@ -0,0 +1,118 @@
+#include "damper.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "sys_clock.hpp"
+
+// Sixteenth steps from the closed stop for a position in percent, clamped to 0-100% and rounded
+// to a whole step of DAMPER_STEP_MODE
+int32_t damper_pct_to_steps(const float pct) {
+    if (!(pct > 0))
+        return 0;
+    const int32_t whole_steps = static_cast<int32_t>(DAMPER_TRAVEL_STEPS)/DAMPER_STEP_MICROSTEPS;
+    return static_cast<int32_t>(std::lround(std::min(pct, 100.0f)*whole_steps/100))*DAMPER_STEP_MICROSTEPS;
+}
+
+// Position in percent for sixteenth steps from the closed stop, rounded
+uint8_t damper_steps_to_pct(const int32_t steps) {
+    const int32_t clamped = std::clamp<int32_t>(steps, 0, DAMPER_TRAVEL_STEPS);
+    return static_cast<uint8_t>((clamped*100 + DAMPER_TRAVEL_STEPS/2)/DAMPER_TRAVEL_STEPS);
+}
+
+// Homes the damper before the next move
+void damper::home() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    this->m_home_requested = true;
+    this->m_wake.notify_one();
+}
+
+// Moves the damper to a position from 0 closed to 100 fully open, the latest target wins
+void damper::target_pct(const float pct) {
+    const int32_t steps = damper_pct_to_steps(pct);
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (this->m_target_steps >= 0 && this->m_target_steps != steps)
+        this->m_stats.replaced++;
+    this->m_target_steps = steps;
+    this->m_last_target_steps = steps;
+    this->m_wake.notify_one();
+}
+
+// Drives the motor a number of sixteenth steps one way, returns the ones it took
+uint32_t damper::step(const int dir, const uint32_t steps) {
+    this->m_motor->set_dir(dir);
+    this->m_motor->set_not_en(0);
+    const uint32_t taken = this->m_motor->turn(steps, DAMPER_MAX_STEP_DEG);
+    this->m_motor->set_not_en(1);
+    return taken;
+}
+
+// Damper thread, takes the latest command and moves forever
+void damper::run() {
+    sys_clock::name_task("Damper");
+    while (true) {
+        bool home {false};
+        int32_t target {-1};
+        {
+            std::unique_lock<std::mutex> lock(this->m_lock);
+            if (!this->m_home_requested && this->m_target_steps < 0) {
+                sys_clock::waiting();
+                this->m_wake.wait(lock, [this]() {return this->m_home_requested || this->m_target_steps >= 0;});
+                sys_clock::resumed();
+            }
+            // A target is only reachable from a known position
+            home = this->m_home_requested || this->m_position_steps < 0;
+            this->m_home_requested = false;
+            target = this->m_target_steps;
+            this->m_target_steps = -1;
+        }
+        this->m_moving = true;
+
+        if (home) {
+            std::cout << "Homing damper.\n\n";
+            const uint32_t taken = this->step(DAMPER_DIR_CLOSE, a4988_degrees_to_microsteps(DAMPER_TRAVEL_DEG + DAMPER_HOME_EXTRA_DEG));
+            this->m_position_steps = 0;
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            this->m_stats.homes++;
+            this->m_stats.steps += taken;
+        }
+
+        const int32_t position = this->m_position_steps;
+        if (target >= 0 && target != position) {
+            const int32_t delta = target - position;
+            std::cout << "Moving damper to " << static_cast<int>(damper_steps_to_pct(target)) << "%.\n\n";
+            const uint32_t taken = this->step(delta > 0 ? DAMPER_DIR_OPEN : DAMPER_DIR_CLOSE, std::abs(delta));
+            // A move stopped by stop_motor() ramps down without losing steps, so the position stays known
+            this->m_position_steps = position + (delta > 0 ? 1 : -1)*static_cast<int32_t>(taken);
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            this->m_stats.moves++;
+            this->m_stats.steps += taken;
+        }
+        else if (target >= 0) {
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            this->m_stats.unmoved++;
+        }
+
+        this->m_moving = false;
+        if (this->m_on_moved)
+            this->m_on_moved(this->position_pct());
+    }
+}
+
+// Position in percent, 0 until homed
+uint8_t damper::position_pct() {
+    return damper_steps_to_pct(this->m_position_steps);
+}
+
+// Position the latest target asks for in percent, the current one if there has been none
+uint8_t damper::target_pct() {
+    const int32_t target = this->m_last_target_steps;
+    return damper_steps_to_pct(target >= 0 ? target : this->m_position_steps.load());
+}
+
+damper_stats damper::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_stats;
+}
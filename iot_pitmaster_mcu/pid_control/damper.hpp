@@ -0,0 +1,129 @@
+/**
+ * @file damper.hpp
+ * @brief Damper on a stepper, positioned in absolute sixteenth steps from its closed stop
+ *
+ * The stepper has no sensor, so the damper is homed by driving it closed
+ * past its full travel against the stop, which makes that position 0.
+ * From there every move covers only the distance from where it is to
+ * where it is asked to be. A new target replaces one that has not
+ * started yet, so a burst of commands is at most one move behind and
+ * asking for where the damper already is costs nothing. The move in
+ * progress always finishes, so the position is never lost. Positions are
+ * kept in sixteenth steps but targets are rounded to whole steps of
+ * DAMPER_STEP_MODE, so from the closed stop every move is whole quarter
+ * steps and the driver can turn it in quarter steps, the finest the
+ * damper needs, whatever the auger runs in.
+ */
+#ifndef __DAMPER_HPP__
+#define __DAMPER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "a4988_driver.hpp"
+
+// Shaft angle from the closed stop to fully open
+#define DAMPER_TRAVEL_DEG (33.75f)
+// Angle driven past full travel when homing, so it ends on the stop from anywhere
+#define DAMPER_HOME_EXTRA_DEG (11.25f)
+// Step mode the damper is turned in and its targets rounded to, quarter steps of 0.45 degrees
+#define DAMPER_STEP_MODE (STEP_MODE_QUARTER)
+#define DAMPER_MAX_STEP_DEG (a4988_step_deg(DAMPER_STEP_MODE))
+#define DAMPER_STEP_MICROSTEPS (static_cast<int32_t>(a4988_microsteps_per_pulse(DAMPER_STEP_MODE)))
+// Sixteenth steps from the closed stop to fully open
+#define DAMPER_TRAVEL_STEPS (a4988_degrees_to_microsteps(DAMPER_TRAVEL_DEG))
+// Direction levels, DIR low opens
+#define DAMPER_DIR_OPEN (0)
+#define DAMPER_DIR_CLOSE (1)
+
+// Moves and steps since boot
+struct damper_stats {
+    uint32_t homes {0};
+    uint32_t moves {0};
+    uint32_t steps {0}; // sixteenth steps
+    uint32_t replaced {0}; // targets replaced by a newer one before they were started
+    uint32_t unmoved {0}; // targets taken where the damper already was
+};
+
+class damper {
+
+    private:
+
+        a4988_driver* m_motor;
+
+        // Called with the position in percent after every move
+        std::function<void(uint8_t)> m_on_moved;
+
+        // The command slot, any thread posts and the damper thread takes
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        int32_t m_target_steps {-1}; // -1 while there is none
+        bool m_home_requested {false};
+        damper_stats m_stats {};
+
+        // Where the damper is, written by the damper thread only, -1 until homed
+        std::atomic<int32_t> m_position_steps {-1};
+        std::atomic<int32_t> m_last_target_steps {-1};
+        std::atomic<bool> m_moving {false};
+
+        // Drives the motor a number of sixteenth steps one way, returns the ones it took
+        uint32_t step(int dir, uint32_t steps);
+
+    public:
+
+        inline damper(a4988_driver& motor, std::function<void(uint8_t)> on_moved = nullptr) {
+            this->m_motor = &motor;
+            this->m_on_moved = on_moved;
+        }
+
+        damper(const damper&) = delete;
+        damper& operator=(const damper&) = delete;
+
+        // Homes the damper before the next move
+        void home();
+
+        // Moves the damper to a position from 0 closed to 100 fully open, the latest target wins
+        void target_pct(float pct);
+
+        // Damper thread, takes the latest command and moves forever
+        void run();
+
+        // Creates the damper thread
+        inline std::thread start() {
+            return std::thread([this]() {this->run();});
+        }
+
+        inline bool homed() {
+            return this->m_position_steps >= 0;
+        }
+
+        inline bool is_moving() {
+            return this->m_moving;
+        }
+
+        // Position in sixteenth steps from the closed stop, -1 until homed
+        inline int32_t position_steps() {
+            return this->m_position_steps;
+        }
+
+        // Position in percent, 0 until homed
+        uint8_t position_pct();
+
+        // Position the latest target asks for in percent, the current one if there has been none
+        uint8_t target_pct();
+
+        damper_stats stats();
+};
+
+// Sixteenth steps from the closed stop for a position in percent, clamped to 0-100% and rounded
+// to a whole step of DAMPER_STEP_MODE
+int32_t damper_pct_to_steps(float pct);
+
+// Position in percent for sixteenth steps from the closed stop, rounded
+uint8_t damper_steps_to_pct(int32_t steps);
+
+#endif /* __DAMPER_HPP__ */
@@ -0,0 +1,54 @@
+#include "fuel_feeder.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+// Pit loop, steps the commanded rate, returns the auger sixteenth steps to feed now, 0 for none
+uint32_t fuel_feeder::tick(const float command_g_per_min, const float dt) {
+    // A rise is slew limited, a drop is taken at once, less fuel is always safe
+    const float command = std::clamp(command_g_per_min, 0.0f, FUEL_MAX_G_PER_MIN);
+    this->m_rate_g_per_min = std::min(command, this->m_rate_g_per_min + FUEL_RISE_G_PER_MIN_PER_S*dt);
+    this->m_commanded_g_per_min.store(this->m_rate_g_per_min, std::memory_order_relaxed);
+
+    // What builds up while a dose waits out the dwell is held to one dose, so it never comes out as a burst
+    const float dose_g = FUEL_G_PER_REV*FUEL_DOSE_REVS;
+    const float owed_g = this->m_rate_g_per_min*dt/60;
+    this->m_owed_g = std::min(this->m_owed_g + owed_g, dose_g);
+    this->m_commanded_g.store(this->m_commanded_g.load(std::memory_order_relaxed) + owed_g, std::memory_order_relaxed);
+    this->m_since_dose_s += dt;
+
+    // Fuel the auger turned since the last tick goes in the current bucket
+    const uint32_t fed = this->m_fed_microsteps.load(std::memory_order_relaxed);
+    const float delivered_g = fuel_microsteps_to_g(fed - this->m_counted_microsteps);
+    this->m_counted_microsteps = fed;
+    this->m_window_g[this->m_bucket] += delivered_g;
+    this->m_delivered_g.store(this->m_delivered_g.load(std::memory_order_relaxed) + delivered_g,
+            std::memory_order_relaxed);
+
+    // The window covers the full buckets and the one filling, at least a minute so the first dose is no spike
+    this->m_bucket_s += dt;
+    this->m_window_s = std::min(this->m_window_s + dt, FUEL_RATE_WINDOW_MIN*60.0f);
+    const float covered_s = std::min(this->m_window_s, (FUEL_RATE_WINDOW_MIN - 1)*60.0f + this->m_bucket_s);
+    const float window_g = std::accumulate(this->m_window_g.begin(), this->m_window_g.end(), 0.0f);
+    this->m_delivered_g_per_min.store(window_g*60/std::max(covered_s, 60.0f), std::memory_order_relaxed);
+    if (this->m_bucket_s >= 60) {
+        this->m_bucket = (this->m_bucket + 1) % FUEL_RATE_WINDOW_MIN;
+        this->m_window_g[this->m_bucket] = 0;
+        this->m_bucket_s -= 60;
+    }
+
+    if (this->m_owed_g < dose_g || this->m_since_dose_s < FUEL_MIN_DWELL_S)
+        return 0;
+    this->m_owed_g = 0;
+    this->m_since_dose_s = 0;
+    this->m_doses.fetch_add(1, std::memory_order_relaxed);
+    return a4988_revs_to_microsteps(FUEL_DOSE_REVS);
+}
+
+fuel_feeder_stats fuel_feeder::stats() const {
+    fuel_feeder_stats stats {};
+    stats.doses = this->m_doses.load(std::memory_order_relaxed);
+    stats.commanded_g = this->m_commanded_g.load(std::memory_order_relaxed);
+    stats.delivered_g = this->m_delivered_g.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file fuel_feeder.hpp
+ * @brief Turns a commanded fuel rate into evenly spaced auger doses
+ *
+ * The control law asks for fuel in grams a minute. The feeder lets the
+ * command rise only so fast and never past FUEL_MAX_G_PER_MIN, and a
+ * drop takes effect at once. The fuel owed at that rate builds up until
+ * it makes a small dose, which goes out once the last one has had
+ * FUEL_MIN_DWELL_S to land, so the fire gets a steady trickle instead
+ * of a pile every few minutes. The hopper thread reports how far the
+ * auger actually turned, and the delivered rate is what that adds up
+ * to over the last FUEL_RATE_WINDOW_MIN minutes.
+ */
+#ifndef __FUEL_FEEDER_HPP__
+#define __FUEL_FEEDER_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "a4988_driver.hpp"
+
+// Pellets the auger moves per revolution, weigh a few turns' worth to calibrate
+#define FUEL_G_PER_REV (24.0f)
+// Auger turns in one dose
+#define FUEL_DOSE_REVS (0.25f)
+// Shortest time from one dose to the next, so the fire takes one before the next lands
+#define FUEL_MIN_DWELL_S (20.0f)
+// Highest rate that can be commanded, and how fast the command may rise
+#define FUEL_MAX_G_PER_MIN (15.0f)
+#define FUEL_RISE_G_PER_MIN_PER_S (0.1f)
+// The delivered rate is averaged over this many one-minute buckets
+#define FUEL_RATE_WINDOW_MIN (10)
+
+// Doses and fuel since boot
+struct fuel_feeder_stats {
+    uint32_t doses {0};
+    float commanded_g {0}; // what the rate asked for
+    float delivered_g {0}; // what the auger turned, doses and manual feeds
+};
+
+class fuel_feeder {
+
+    private:
+
+        // Pit loop only
+        float m_rate_g_per_min {0};
+        float m_owed_g {0};
+        float m_since_dose_s {FUEL_MIN_DWELL_S};
+        std::array<float, FUEL_RATE_WINDOW_MIN> m_window_g {};
+        uint32_t m_bucket {0};
+        float m_bucket_s {0};
+        float m_window_s {0};
+        uint32_t m_counted_microsteps {0};
+
+        // Written by the hopper thread
+        std::atomic<uint32_t> m_fed_microsteps {0};
+
+        // Read by any thread
+        std::atomic<float> m_commanded_g_per_min {0};
+        std::atomic<float> m_delivered_g_per_min {0};
+        std::atomic<uint32_t> m_doses {0};
+        std::atomic<float> m_commanded_g {0};
+        std::atomic<float> m_delivered_g {0};
+
+    public:
+
+        // Pit loop, steps the commanded rate, returns the auger sixteenth steps to feed now, 0 for none
+        uint32_t tick(float command_g_per_min, float dt);
+
+        // Hopper thread, the auger turned this far
+        inline void fed(const uint32_t microsteps) {
+            this->m_fed_microsteps.fetch_add(microsteps, std::memory_order_relaxed);
+        }
+
+        // Rate the doses are spaced for, after the limits
+        inline float commanded_g_per_min() const {
+            return this->m_commanded_g_per_min.load(std::memory_order_relaxed);
+        }
+
+        // Rate the auger actually delivered over the window
+        inline float delivered_g_per_min() const {
+            return this->m_delivered_g_per_min.load(std::memory_order_relaxed);
+        }
+
+        fuel_feeder_stats stats() const;
+};
+
+// Grams the auger moves in a number of sixteenth steps
+inline float fuel_microsteps_to_g(const uint32_t microsteps) {
+    return FUEL_G_PER_REV*microsteps/(A4988_STEPS_PER_REV*A4988_MICROSTEPS);
+}
+
+#endif /* __FUEL_FEEDER_HPP__ */
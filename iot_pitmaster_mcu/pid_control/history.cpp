@@ -0,0 +1,282 @@
+/**
+ * @file history.cpp
+ * @brief Compressed per-second history of the status reports
+ *
+ */
+#include "history.hpp"
+
+#include <cstring>
+
+// Zigzag code of a non-zero value, minus one
+static inline uint32_t zigzag(const int32_t value) {
+    return ((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31)) - 1;
+}
+
+static inline int32_t unzigzag(const uint32_t code) {
+    const uint32_t zz = code + 1;
+    return static_cast<int32_t>(zz >> 1) ^ -static_cast<int32_t>(zz & 1);
+}
+
+// Appends the low bits of value, most significant first
+static inline void put_bits(uint8_t* data, size_t& pos, const uint32_t value, const uint8_t bits) {
+    for (int bit = bits - 1; bit >= 0; bit--) {
+        const uint8_t mask = 0x80 >> (pos & 7);
+        if ((value >> bit) & 1)
+            data[pos >> 3] |= mask;
+        else
+            data[pos >> 3] &= ~mask;
+        pos++;
+    }
+}
+
+// Starts a block with this sample, dropping the oldest block if the log is full
+void history_log::open_block(const uint32_t t_s, const telemetry_sample& sample) {
+    if (this->m_end_seq - this->m_first_seq == HISTORY_BLOCKS) {
+        this->m_stats.held_samples -= this->slot(this->m_first_seq).header.count;
+        this->m_stats.held_bytes -= sizeof(history_block_header) + (this->slot(this->m_first_seq).header.bits + 7)/8;
+        this->m_first_seq++;
+        this->m_stats.dropped_blocks++;
+    }
+
+    block& opened = this->slot(this->m_end_seq++);
+    opened.header.start_s = t_s;
+    opened.header.count = 1;
+    opened.header.bits = 0;
+    for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++)
+        opened.header.temp_qc[i] = sample.logged_qc[i];
+    opened.header.fan_duty = sample.fan_duty;
+    opened.header.status = sample.status;
+    this->m_stats.held_bytes += sizeof(history_block_header);
+
+    this->m_prev_delta_s = 1;
+}
+
+// Adds a sample, t_s must not go backwards
+void history_log::record(const uint32_t t_s, const telemetry_sample& sample) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+
+    block* open = (this->m_end_seq > this->m_first_seq) ? &this->slot(this->m_end_seq - 1) : nullptr;
+    const bool full = open == nullptr || open->header.count == UINT16_MAX ||
+            static_cast<size_t>(open->header.bits) + HISTORY_SAMPLE_MAX_BITS > 8*sizeof(open->data);
+    if (full || t_s < this->m_prev_s) {
+        this->open_block(t_s, sample);
+    }
+    else {
+        const size_t bytes_before = (open->header.bits + 7)/8;
+        size_t pos = open->header.bits;
+
+        const uint32_t delta_s = t_s - this->m_prev_s;
+        const int64_t dod = static_cast<int64_t>(delta_s) - this->m_prev_delta_s;
+        if (dod == 0) {
+            put_bits(open->data, pos, 0b0, 1);
+        }
+        else if (dod >= INT32_MIN && dod <= INT32_MAX && zigzag(dod) < (1u << 7)) {
+            put_bits(open->data, pos, 0b10, 2);
+            put_bits(open->data, pos, zigzag(dod), 7);
+        }
+        else if (dod >= INT32_MIN && dod <= INT32_MAX && zigzag(dod) < (1u << 16)) {
+            put_bits(open->data, pos, 0b110, 3);
+            put_bits(open->data, pos, zigzag(dod), 16);
+        }
+        else {
+            put_bits(open->data, pos, 0b111, 3);
+            put_bits(open->data, pos, delta_s, 32);
+        }
+
+        for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++) {
+            const int32_t delta = sample.logged_qc[i] - this->m_prev.logged_qc[i];
+            if (delta == 0) {
+                put_bits(open->data, pos, 0b0, 1);
+            }
+            else if (delta == 1 || delta == -1) {
+                put_bits(open->data, pos, 0b10, 2);
+                put_bits(open->data, pos, delta < 0, 1);
+            }
+            else if (zigzag(delta) < (1u << 6)) {
+                put_bits(open->data, pos, 0b110, 3);
+                put_bits(open->data, pos, zigzag(delta), 6);
+            }
+            else {
+                put_bits(open->data, pos, 0b111, 3);
+                put_bits(open->data, pos, static_cast<uint16_t>(sample.logged_qc[i]), 16);
+            }
+        }
+
+        if (sample.fan_duty == this->m_prev.fan_duty) {
+            put_bits(open->data, pos, 0b0, 1);
+        }
+        else {
+            put_bits(open->data, pos, 0b1, 1);
+            put_bits(open->data, pos, sample.fan_duty, 7);
+        }
+        if (sample.status == this->m_prev.status) {
+            put_bits(open->data, pos, 0b0, 1);
+        }
+        else {
+            put_bits(open->data, pos, 0b1, 1);
+            put_bits(open->data, pos, sample.status, 5);
+        }
+
+        open->header.bits = pos;
+        open->header.count++;
+        this->m_stats.held_bytes += (pos + 7)/8 - bytes_before;
+        this->m_prev_delta_s = delta_s;
+    }
+
+    this->m_prev_s = t_s;
+    this->m_prev = sample;
+    this->m_stats.samples++;
+    this->m_stats.held_samples++;
+    this->m_stats.newest_s = t_s;
+    this->m_stats.oldest_s = this->slot(this->m_first_seq).header.start_s;
+}
+
+// Copies a block as sent to the phone, returns its size, 0 if it is not held
+size_t history_log::read_block(const uint32_t seq, uint8_t* out, const size_t out_size) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (seq < this->m_first_seq || seq >= this->m_end_seq)
+        return 0;
+
+    const block& held = this->slot(seq);
+    const size_t len = sizeof(history_block_header) + (held.header.bits + 7)/8;
+    if (len > out_size)
+        return 0;
+    std::memcpy(out, &held, len);
+    return len;
+}
+
+// Number of the first block held with samples at or after t_s
+uint32_t history_log::find(const uint32_t t_s) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    // The block before the first one starting after t_s can still hold samples after it
+    uint32_t seq = this->m_first_seq;
+    while (seq + 1 < this->m_end_seq && this->slot(seq + 1).header.start_s <= t_s)
+        seq++;
+    return seq;
+}
+
+uint32_t history_log::first_seq() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_first_seq;
+}
+
+uint32_t history_log::end_seq() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_end_seq;
+}
+
+history_stats history_log::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_stats;
+}
+
+history_block_reader::history_block_reader(const uint8_t* block, const size_t len) {
+    if (len < sizeof(history_block_header))
+        return;
+    std::memcpy(&this->m_header, block, sizeof(history_block_header));
+    if (sizeof(history_block_header) + (this->m_header.bits + 7)/8 > len)
+        return;
+    this->m_data = block + sizeof(history_block_header);
+    this->m_bits = this->m_header.bits;
+    this->m_valid = this->m_header.count > 0;
+}
+
+// Reads the next bits, most significant first, returns false past the end of the block
+bool history_block_reader::take(const uint8_t bits, uint32_t& value) {
+    if (this->m_pos + bits > this->m_bits)
+        return false;
+    value = 0;
+    for (uint8_t bit = 0; bit < bits; bit++) {
+        value = (value << 1) | ((this->m_data[this->m_pos >> 3] >> (7 - (this->m_pos & 7))) & 1);
+        this->m_pos++;
+    }
+    return true;
+}
+
+// Reads a 0, 10, 110 or 111 prefix as 0 to 3
+bool history_block_reader::prefix(uint8_t& code) {
+    uint32_t bit {0};
+    for (code = 0; code < 3; code++) {
+        if (!this->take(1, bit))
+            return false;
+        if (bit == 0)
+            break;
+    }
+    return true;
+}
+
+// Unpacks the next sample, returns false after the last one or if the block is malformed
+bool history_block_reader::next(uint32_t& t_s, telemetry_sample& sample) {
+    if (!this->m_valid || this->m_index >= this->m_header.count)
+        return false;
+
+    if (this->m_index == 0) {
+        this->m_prev_s = this->m_header.start_s;
+        for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++)
+            this->m_prev.logged_qc[i] = this->m_header.temp_qc[i];
+        this->m_prev.fan_duty = this->m_header.fan_duty;
+        this->m_prev.status = this->m_header.status;
+    }
+    else if (!this->unpack()) {
+        this->m_valid = false;
+        return false;
+    }
+
+    t_s = this->m_prev_s;
+    sample = this->m_prev;
+    this->m_index++;
+    return true;
+}
+
+// Applies one packed sample to the previous one
+bool history_block_reader::unpack() {
+    uint8_t code {0};
+    uint32_t value {0};
+
+    if (!this->prefix(code))
+        return false;
+    uint32_t delta_s = this->m_prev_delta_s;
+    if (code == 1 || code == 2) {
+        if (!this->take(code == 1 ? 7 : 16, value))
+            return false;
+        delta_s = this->m_prev_delta_s + unzigzag(value);
+    }
+    else if (code == 3) {
+        if (!this->take(32, value))
+            return false;
+        delta_s = value;
+    }
+    this->m_prev_s += delta_s;
+    this->m_prev_delta_s = delta_s;
+
+    for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++) {
+        if (!this->prefix(code))
+            return false;
+        if (code == 0)
+            continue;
+        if (!this->take(code == 1 ? 1 : (code == 2 ? 6 : 16), value))
+            return false;
+        if (code == 1)
+            this->m_prev.logged_qc[i] = static_cast<int16_t>(this->m_prev.logged_qc[i] + (value ? -1 : 1));
+        else if (code == 3)
+            this->m_prev.logged_qc[i] = static_cast<int16_t>(value);
+        else
+            this->m_prev.logged_qc[i] = static_cast<int16_t>(this->m_prev.logged_qc[i] + unzigzag(value));
+    }
+
+    if (!this->take(1, value))
+        return false;
+    if (value) {
+        if (!this->take(7, value))
+            return false;
+        this->m_prev.fan_duty = value;
+    }
+    if (!this->take(1, value))
+        return false;
+    if (value) {
+        if (!this->take(5, value))
+            return false;
+        this->m_prev.status = value;
+    }
+    return true;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file history.hpp
+ * @brief Compressed per-second history of the status reports
+ *
+ * Samples are packed into fixed-size blocks that each decode on their
+ * own, so the oldest block is dropped when the log is full and any block
+ * can go to the phone as it is. A block starts with a header holding its
+ * first sample in full. Every later sample is bit packed, most
+ * significant bit first, against the one before it:
+ *
+ *   time:   delta-of-delta seconds    0 | 10 zz:7 | 110 zz:16 | 111 delta:32
+ *   temps:  delta quarter-degrees     0 | 10 sign | 110 zz:6  | 111 value:16
+ *   fan:    0 unchanged | 1 duty:7
+ *   status: 0 unchanged | 1 bits:5
+ *
+ * zz is the zigzag code of a non-zero delta, minus one, and sign is 1
+ * for a delta of -1. Sensor noise keeps most temperature deltas within
+ * a quarter-degree, so a steady pit costs about 10 bits per sample and
+ * the default log holds over 6 hours. Only probe slots 0-2 are kept.
+ */
+#ifndef __HISTORY_HPP__
+#define __HISTORY_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "telemetry.hpp"
+
+// Bytes per block, header included, a block fits one MSG_HISTORY frame
+#define HISTORY_BLOCK_SIZE      (240)
+
+// Blocks kept in RAM
+#define HISTORY_BLOCKS          (128)
+
+// Largest packed sample
+#define HISTORY_SAMPLE_MAX_BITS (35 + 3*19 + 8 + 6)
+
+// First sample of a block, sent as is, little-endian
+struct __attribute__ ((packed)) history_block_header {
+    uint32_t start_s; // uptime of the first sample
+    uint16_t count; // samples in the block
+    uint16_t bits; // packed bits after the header
+    int16_t temp_qc[TELEMETRY_LOGGED_PROBES]; // by TELEMETRY_LOGGED_*
+    uint8_t fan_duty;
+    uint8_t status;
+};
+
+struct history_stats {
+    uint32_t samples {0}; // recorded since boot
+    uint32_t dropped_blocks {0}; // oldest blocks overwritten
+    uint32_t held_samples {0};
+    uint32_t held_bytes {0}; // headers and packed bits of the blocks held
+    uint32_t oldest_s {0};
+    uint32_t newest_s {0};
+};
+
+class history_log {
+
+    private:
+
+        struct block {
+            history_block_header header;
+            uint8_t data[HISTORY_BLOCK_SIZE - sizeof(history_block_header)];
+        };
+
+        std::mutex m_lock;
+        std::array<block, HISTORY_BLOCKS> m_blocks;
+
+        // Blocks are numbered from boot, the open one is m_end_seq - 1
+        uint32_t m_first_seq {0};
+        uint32_t m_end_seq {0};
+
+        // Packing state of the open block
+        uint32_t m_prev_s {0};
+        uint32_t m_prev_delta_s {1};
+        telemetry_sample m_prev {};
+
+        history_stats m_stats {};
+
+        inline block& slot(const uint32_t seq) {
+            return this->m_blocks[seq % HISTORY_BLOCKS];
+        }
+
+        // Starts a block with this sample, dropping the oldest block if the log is full
+        void open_block(uint32_t t_s, const telemetry_sample& sample);
+
+    public:
+
+        // Adds a sample, t_s must not go backwards
+        void record(uint32_t t_s, const telemetry_sample& sample);
+
+        // Copies a block as sent to the phone, returns its size, 0 if it is not held
+        size_t read_block(uint32_t seq, uint8_t* out, size_t out_size);
+
+        // Number of the first block held with samples at or after t_s
+        uint32_t find(uint32_t t_s);
+
+        // Blocks held are first_seq() up to, not including, end_seq()
+        uint32_t first_seq();
+        uint32_t end_seq();
+
+        history_stats stats();
+};
+
+// Unpacks one block, as read_block() wrote it
+class history_block_reader {
+
+    private:
+
+        const uint8_t* m_data {nullptr};
+        size_t m_bits {0};
+        size_t m_pos {0};
+        history_block_header m_header {};
+        uint16_t m_index {0};
+        uint32_t m_prev_s {0};
+        uint32_t m_prev_delta_s {1};
+        telemetry_sample m_prev {};
+        bool m_valid {false};
+
+        // Reads the next bits, most significant first, returns false past the end of the block
+        bool take(uint8_t bits, uint32_t& value);
+
+        // Reads a 0, 10, 110 or 111 prefix as 0 to 3
+        bool prefix(uint8_t& code);
+
+        // Applies one packed sample to the previous one
+        bool unpack();
+
+    public:
+
+        history_block_reader(const uint8_t* block, size_t len);
+
+        // False if the block is too short for its header
+        inline bool valid() const {
+            return this->m_valid;
+        }
+
+        inline const history_block_header& header() const {
+            return this->m_header;
+        }
+
+        // Unpacks the next sample, returns false after the last one or if the block is malformed
+        bool next(uint32_t& t_s, telemetry_sample& sample);
+};
+
+#endif /* __HISTORY_HPP__ */
@@ -0,0 +1,127 @@
+/**
+ * @file loop_scheduler.cpp
+ * @brief Fixed-rate control loops on absolute deadlines
+ * 
+ */
+#include "loop_scheduler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "sys_clock.hpp"
+
+uint8_t loop_scheduler::bucket(const uint32_t us) {
+    return std::upper_bound(loop_hist_edges_us.begin(), loop_hist_edges_us.end(), us) - loop_hist_edges_us.begin();
+}
+
+// Adds a loop that calls tick(dt_s) rate_hz times a second, returns its index or -1 if full
+int loop_scheduler::add_loop(const std::string& name, const uint32_t rate_hz, std::function<void(float)> tick) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (this->m_count >= LOOP_SCHEDULER_MAX_LOOPS) {
+        std::cout << "Error: no room for the " << name << " loop.\n\n";
+        return -1;
+    }
+    loop& new_loop = this->m_loops[this->m_count];
+    new_loop.name = name;
+    new_loop.period_us = 1000000 / std::clamp<uint32_t>(rate_hz, LOOP_MIN_HZ, LOOP_MAX_HZ);
+    new_loop.tick = std::move(tick);
+    new_loop.stats.period_us = new_loop.period_us;
+    return this->m_count++;
+}
+
+// Changes a loop's rate from its next tick on, clamped to LOOP_MIN_HZ-LOOP_MAX_HZ
+bool loop_scheduler::rate(const uint8_t idx, const uint32_t rate_hz) {
+    if (idx >= this->m_count) {
+        std::cout << "Error: there is no loop " << static_cast<int>(idx) << ".\n\n";
+        return false;
+    }
+    const uint32_t clamped_hz = std::clamp<uint32_t>(rate_hz, LOOP_MIN_HZ, LOOP_MAX_HZ);
+    if (clamped_hz != rate_hz)
+        std::cout << this->m_loops[idx].name << " loop rate limited to " << clamped_hz << " Hz.\n\n";
+
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    loop& changed = this->m_loops[idx];
+    // Keep the phase of the tick that already ran
+    changed.deadline_us += static_cast<int64_t>(1000000 / clamped_hz) - changed.period_us;
+    changed.period_us = 1000000 / clamped_hz;
+    changed.stats.period_us = changed.period_us;
+    return true;
+}
+
+uint32_t loop_scheduler::rate(const uint8_t idx) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return idx < this->m_count ? 1000000 / this->m_loops[idx].period_us : 0;
+}
+
+// Runs the loops forever
+void loop_scheduler::run() {
+    sys_clock::name_task("Control loops");
+    {
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        const int64_t start_us = sys_clock::now_us();
+        for (uint8_t i = 0; i < this->m_count; i++) {
+            this->m_loops[i].last_start_us = start_us;
+            this->m_loops[i].deadline_us = start_us + this->m_loops[i].period_us;
+        }
+    }
+
+    while (true) {
+        // Earliest deadline first, the first loop added wins a tie
+        uint8_t idx {0};
+        int64_t deadline_us {0};
+        {
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            for (uint8_t i = 1; i < this->m_count; i++) {
+                if (this->m_loops[i].deadline_us < this->m_loops[idx].deadline_us)
+                    idx = i;
+            }
+            deadline_us = this->m_loops[idx].deadline_us;
+        }
+        loop& next = this->m_loops[idx];
+
+        sys_clock::sleep_until(deadline_us);
+
+        const int64_t start_us = sys_clock::now_us();
+        const float dt_s = (start_us - next.last_start_us) / 1e6f;
+        next.last_start_us = start_us;
+        next.tick(dt_s);
+        const int64_t finish_us = sys_clock::now_us();
+
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        loop_stats& stats = next.stats;
+        const uint32_t jitter_us = static_cast<uint32_t>(std::max<int64_t>(start_us - deadline_us, 0));
+        const uint32_t run_us = static_cast<uint32_t>(finish_us - start_us);
+        stats.ticks++;
+        stats.jitter_hist[bucket(jitter_us)]++;
+        stats.max_jitter_us = std::max(stats.max_jitter_us, jitter_us);
+        stats.max_run_us = std::max(stats.max_run_us, run_us);
+        stats.total_run_us += run_us;
+
+        next.deadline_us += next.period_us;
+        if (finish_us > next.deadline_us) {
+            const uint32_t overrun_us = static_cast<uint32_t>(finish_us - next.deadline_us);
+            stats.overruns++;
+            stats.overrun_hist[bucket(overrun_us)]++;
+            stats.max_overrun_us = std::max(stats.max_overrun_us, overrun_us);
+
+            // Drop the deadlines already missed, the grid stays where it was
+            const uint32_t missed = overrun_us / next.period_us + 1;
+            stats.skipped += missed;
+            next.deadline_us += static_cast<int64_t>(missed) * next.period_us;
+        }
+    }
+}
+
+loop_stats loop_scheduler::stats(const uint8_t idx) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return idx < this->m_count ? this->m_loops[idx].stats : loop_stats();
+}
+
+void loop_scheduler::reset_stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    for (uint8_t i = 0; i < this->m_count; i++) {
+        const uint32_t period_us = this->m_loops[i].period_us;
+        this->m_loops[i].stats = {};
+        this->m_loops[i].stats.period_us = period_us;
+    }
+}
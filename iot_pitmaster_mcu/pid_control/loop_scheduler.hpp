@@ -0,0 +1,94 @@
+/**
+ * @file loop_scheduler.hpp
+ * @brief Fixed-rate control loops on absolute deadlines
+ * 
+ * Every loop has its own period and is woken at start + n*period, so the
+ * work done in a tick never stretches the next one. Loops share one
+ * thread and the loop with the earliest deadline runs first. A tick that
+ * finishes after its next deadline counts as an overrun, and deadlines
+ * it ran over are dropped instead of run back to back.
+ */
+#ifndef __LOOP_SCHEDULER_HPP__
+#define __LOOP_SCHEDULER_HPP__
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Most loops one scheduler runs
+#define LOOP_SCHEDULER_MAX_LOOPS (4)
+
+// Loop rate limits, in Hz
+#define LOOP_MIN_HZ (1)
+#define LOOP_MAX_HZ (100)
+
+// Histogram buckets, the last one takes everything above the last edge
+#define LOOP_HIST_BUCKETS (8)
+constexpr std::array<uint32_t, LOOP_HIST_BUCKETS - 1> loop_hist_edges_us {50, 100, 250, 500, 1000, 2500, 10000};
+
+// Timing counters for one loop
+struct loop_stats {
+    uint32_t period_us {0};
+    uint32_t ticks {0};
+    uint32_t overruns {0}; // ticks that finished after their next deadline
+    uint32_t skipped {0}; // deadlines dropped to catch up after an overrun
+    uint32_t max_jitter_us {0};
+    uint32_t max_overrun_us {0};
+    uint32_t max_run_us {0};
+    uint64_t total_run_us {0};
+    std::array<uint32_t, LOOP_HIST_BUCKETS> jitter_hist {}; // wake-up lateness
+    std::array<uint32_t, LOOP_HIST_BUCKETS> overrun_hist {}; // how far past the next deadline an overrun finished
+};
+
+class loop_scheduler {
+
+    private:
+
+        struct loop {
+            std::string name;
+            uint32_t period_us {0};
+            std::function<void(float)> tick;
+            int64_t deadline_us {0};
+            int64_t last_start_us {0};
+            loop_stats stats {};
+        };
+
+        std::mutex m_lock;
+        std::array<loop, LOOP_SCHEDULER_MAX_LOOPS> m_loops;
+        uint8_t m_count {0};
+
+        static uint8_t bucket(uint32_t us);
+
+    public:
+
+        loop_scheduler() = default;
+        loop_scheduler(const loop_scheduler&) = delete;
+        loop_scheduler& operator=(const loop_scheduler&) = delete;
+
+        // Adds a loop that calls tick(dt_s) rate_hz times a second, returns its index or -1 if full
+        // dt_s is the measured time since the loop's previous tick
+        int add_loop(const std::string& name, uint32_t rate_hz, std::function<void(float)> tick);
+
+        // Changes a loop's rate from its next tick on, clamped to LOOP_MIN_HZ-LOOP_MAX_HZ
+        bool rate(uint8_t idx, uint32_t rate_hz);
+        uint32_t rate(uint8_t idx);
+
+        // Runs the loops forever
+        void run();
+
+        // Creates the thread that runs the loops
+        inline std::thread start() {
+            return std::thread([this]() {this->run();});
+        }
+
+        loop_stats stats(uint8_t idx);
+        void reset_stats();
+
+        uint8_t count() {return this->m_count;}
+        const std::string& name(uint8_t idx) {return this->m_loops[idx].name;}
+};
+
+#endif /* __LOOP_SCHEDULER_HPP__ */
@@ -0,0 +1,141 @@
+/**
+ * @file pid.hpp
+ * @brief PID core for float or Q-format fixed point
+ *
+ * pid<T> runs one PID step per tick in T, float on a chip with an FPU
+ * and q16_16 on one without. configure() works the float tuning into
+ * per-tick coefficients, so a step is adds, multiplies and compares in T
+ * with no division and, for fixed point, no soft-float call. The tick
+ * length is the one the loop measured, so retime() works the same tuning
+ * in again whenever it changes: after a rate change, or for a tick that
+ * ran late or early to catch up.
+ *
+ * The derivative is taken on the measurement, so a set point change does
+ * not kick the output, and goes through a first-order low-pass of time
+ * constant d_filter_s. The output is clamped to out_min-out_max and may
+ * move at most rate_per_s a second. When the clamp or the rate limit
+ * holds the output back the integrator is kept from winding up, by
+ * back-calculation with time constant tracking_s, or when that is 0 by
+ * clamping, which stops integrating while the error pushes further into
+ * the limit. The integrator holds the integral term itself, in output
+ * units, so changing Ki never makes the output jump.
+ */
+#ifndef __PID_HPP__
+#define __PID_HPP__
+
+#include <algorithm>
+
+#include "q_format.hpp"
+
+// What a pid is tuned with, turned into per-tick coefficients by configure()
+struct pid_tuning {
+    float kp {0};
+    float ki {0}; // per second
+    float kd {0}; // seconds
+    float out_min {0};
+    float out_max {100};
+    float d_filter_s {0}; // derivative low-pass time constant, 0 for none
+    float rate_per_s {0}; // largest output change a second, 0 for none
+    float tracking_s {0}; // back-calculation time constant, 0 to clamp the integrator instead
+};
+
+template <typename T>
+class pid {
+
+    private:
+
+        // Per-tick coefficients
+        T m_kp {};
+        T m_ki_dt {};
+        T m_kd_dt {};
+        T m_d_alpha {};
+        T m_track_dt {};
+        T m_rate_step {};
+        T m_out_min {};
+        T m_out_max {};
+        bool m_back_calc {false};
+        bool m_rate_limited {false};
+
+        // What the coefficients were worked from
+        pid_tuning m_tuning {};
+        float m_dt_s {0};
+
+        T m_integral {}; // the integral term, output units
+        T m_deriv {}; // the filtered derivative term
+        T m_prev_pv {};
+        T m_output {};
+        bool m_primed {false};
+
+    public:
+
+        // Works the tuning into coefficients for a tick of dt_s, the state carries over
+        void configure(const pid_tuning& tuning, const float dt_s) {
+            this->m_tuning = tuning;
+            this->m_dt_s = dt_s;
+            this->m_kp = T(tuning.kp);
+            this->m_ki_dt = T(tuning.ki*dt_s);
+            this->m_kd_dt = T(tuning.kd/dt_s);
+            this->m_d_alpha = T(dt_s/(tuning.d_filter_s + dt_s));
+            this->m_back_calc = tuning.tracking_s > 0;
+            this->m_track_dt = T(this->m_back_calc ? std::min(dt_s/tuning.tracking_s, 1.0f) : 0.0f);
+            this->m_rate_limited = tuning.rate_per_s > 0;
+            this->m_rate_step = T(tuning.rate_per_s*dt_s);
+            this->m_out_min = T(tuning.out_min);
+            this->m_out_max = T(tuning.out_max);
+            this->m_integral = std::clamp(this->m_integral, this->m_out_min, this->m_out_max);
+        }
+
+        // Works the tuning in again for a tick of dt_s if that is not the tick it was worked for
+        void retime(const float dt_s) {
+            if (dt_s != this->m_dt_s)
+                this->configure(this->m_tuning, dt_s);
+        }
+
+        // One tick, returns the output
+        T step(const T set_point, const T pv) {
+            const T err = set_point - pv;
+
+            // Derivative on the measurement, a rising reading backs the output off
+            if (!this->m_primed) {
+                this->m_prev_pv = pv;
+                this->m_primed = true;
+            }
+            this->m_deriv += (this->m_kd_dt*(this->m_prev_pv - pv) - this->m_deriv)*this->m_d_alpha;
+            this->m_prev_pv = pv;
+
+            const T unlimited = this->m_kp*err + this->m_integral + this->m_deriv;
+            T output = std::clamp(unlimited, this->m_out_min, this->m_out_max);
+            if (this->m_rate_limited)
+                output = std::clamp(output, this->m_output - this->m_rate_step, this->m_output + this->m_rate_step);
+
+            // Anti-windup, the integrator only follows what the output could do
+            if (this->m_back_calc)
+                this->m_integral += this->m_ki_dt*err + (output - unlimited)*this->m_track_dt;
+            else if (output == unlimited || (output < unlimited && err < T()) || (output > unlimited && err > T()))
+                this->m_integral += this->m_ki_dt*err;
+            this->m_integral = std::clamp(this->m_integral, this->m_out_min, this->m_out_max);
+
+            this->m_output = output;
+            return output;
+        }
+
+        // Starts over from a reading and the output in force, while something else has the output
+        void reset(const T pv, const T output) {
+            this->m_integral = T();
+            this->m_deriv = T();
+            this->m_prev_pv = pv;
+            this->m_output = output;
+            this->m_primed = true;
+        }
+
+        T integral() const {return this->m_integral;}
+
+        // Sets the integral term, the next configure or step brings it within the output limits
+        void integral(const T value) {this->m_integral = value;}
+
+        T prev_pv() const {return this->m_prev_pv;}
+        T output() const {return this->m_output;}
+        float dt() const {return this->m_dt_s;}
+};
+
+#endif /* __PID_HPP__ */
@@ -1,203 +1,614 @@
 #include "pid_control.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <thread>
 
+#include "esp_system.h"
+
 #include "a4988_driver.hpp"
 #include "bluetooth.hpp"
 #include "debug.hpp"
 #include "max31855.hpp"
 #include "pwm.hpp"
+#include "sys_clock.hpp"
 
 using namespace std::chrono_literals;
 
-#define DAMPER_OPEN_CLOSE_STEP_COUNT (75)
-#define HOPPER_INPUT_FUEL_STEP_COUNT (1600)
-#define HOPPER_INPUT_FUEL_INTERVAL (500)
+// Auger turns per fuel feed, and the largest step the auger is turned in, full steps feed fastest
+#define HOPPER_INPUT_FUEL_REVS (2.0f)
+#define HOPPER_MAX_STEP_DEG (1.8f)
+
+// Transmit queue slots a backfill or cook log export leaves for status reports and alarms
+#define HISTORY_TX_RESERVE (2)
 
-// PID Algorithm tuner variables
-static float Kp = 1;
-static float Ki = .08;
-static float Kd = .5;
-static float dt = 1;
+// Cook log records per MSG_LOG, one frame
+#define LOG_EXPORT_RECORDS ((BT_FRAME_MAX_PAYLOAD - 1)/sizeof(cook_log_record))
 
-static float integral_err {0};
-static float prev_val {0};
+// Whether gains are finite and from 0 to PID_GAIN_MAX
+static bool valid_gains(const pid_gains& gains) {
+    for (const float gain : {gains.kp, gains.ki, gains.kd}) {
+        if (!std::isfinite(gain) || gain < 0 || gain > PID_GAIN_MAX) {
+            std::cout << "Error: PID gains must be between 0 and " << PID_GAIN_MAX << ".\n\n";
+            return false;
+        }
+    }
+    return true;
+}
 
-// pid_control run function
+// pid_control run function, runs the control loops forever
 void pid_control::pid_control_run() {
-    while (true) {
+    this->m_scheduler.run();
+}
 
-        // Update interval
-        std::this_thread::sleep_for(1s);
+// Applies the commands posted since the last tick, returns the state the tick runs on
+control_state pid_control::apply_commands() {
+    bool new_set_point {false};
+    bool new_gains {false};
+    const control_state state = this->m_state.apply(new_set_point, new_gains);
+    if (new_set_point)
+        this->log_set_point(state.set_point_C);
+    if (new_gains) {
+        this->use_gains(state.gains);
+        // Every phone learns the gains once they are in use
+        this->send_gains();
+    }
+    return state;
+}
 
-        // Get status of thermocouples and motors
-        const out_msg_all_data system_data = this->get_system_status();
+// Fast loop: over-temperature check and the blowfan PID
+void pid_control::fan_tick(const float dt) {
 
-        // Send status to Android app
+    // One view of the controller for the whole tick
+    const control_state state = this->apply_commands();
+
+    // Get status of thermocouples and motors
+    const out_msg_all_data system_data = this->get_system_status(state);
+
+    // Check to make sure the chamber is not on fire, shut down if so
+    // Only active probes count, an inactive slot may still hold an old reading
+    int hottest {-1};
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        if ((system_data.probes_active & (1 << i)) && (hottest < 0 ||
+                system_data.probes[i].thermocouple_C > system_data.probes[hottest].thermocouple_C))
+            hottest = i;
+    }
+    if (hottest >= 0 && system_data.probes[hottest].thermocouple_C > 316) {
+        std::cout << "Entering Emergency Shutdown Mode due to excessive heat.\n\n";
         if (bt::is_bt_connected()) {
-            bt::send_data(system_data);
+            out_msg_alarm alarm {MSG_ALARM, ALARM_OVER_TEMP,
+                    static_cast<int16_t>(system_data.probes[hottest].thermocouple_C),
+                    static_cast<uint8_t>(hottest)};
+            bt::send_data(alarm, BT_TX_RELIABLE);
         }
+        this->emergency_shutdown();
+    }
+
+    // A running autotune has the fan instead
+    const bool tuning = this->autotune_tick(state, system_data.temp_data_chamber);
+
+    // Control law picked by CONTROLLER_POLICY, see controller.hpp
+    // Make sure a temp has been selected and is in autonomous mode
+    if (!tuning && state.cook_started && state.mode_auto) {
+
+        const controller_sample sample {state.set_point_C, system_data.temp_data_chamber.thermocouple_C,
+                state.damper_pct, dt};
+        const float output = this->m_controller.fan_step(sample, this->m_pid);
+        if constexpr (DEBUG_PID)
+            std::cout << "PID output: " << output << ".\n\n";
+
+        // Set the blow fan duty cycle, clamped to 0-100% by the pwm
+        this->blowfan()->set_duty_percent(output);
+    }
+    else if (!system_data.temp_data_chamber.fault) {
+        // Start the algorithm from scratch next time, erase integral history, keep the last good reading
+        this->m_pid.core.reset(controller_value(system_data.temp_data_chamber.thermocouple_C),
+                controller_value(this->blowfan()->get_duty_percent()));
+    }
+}
+
+// Starts, stops and runs the relay autotune, true while it drives the fan
+bool pid_control::autotune_tick(const control_state& state, const max31855_data_t& chamber) {
+    const float now_s = static_cast<float>(sys_clock::now_us()/1e6);
+    const bool stop = this->m_autotune_stop.exchange(false);
+    control_state current = state;
+
+    if (this->m_autotune_requested.exchange(false)) {
+        const float set_point_C = this->m_autotune_set_point;
+        current = this->m_state.update([set_point_C](control_state& next) {
+            next.set_point_C = set_point_C;
+            next.cook_started = true;
+        });
+        this->log_set_point(set_point_C);
+        // Only the fan switches, the damper stays shut as it is around the set point
+        this->set_damper(0);
+        this->m_autotune.start(set_point_C, this->m_autotune_rule, chamber.thermocouple_C, now_s);
+        this->m_autotune_cycles_sent = 0;
+        std::cout << "Starting the autotune at " << set_point_C << " degrees Celsius.\n\n";
+        this->send_autotune_status();
+    }
+    if (!this->m_autotune.running())
+        return false;
 
-        // Check to make sure the chamber is not on fire, shut down if so
-        if (system_data.temp_data_chamber.thermocouple_C > 316 ||
-            system_data.temp_data_meat1.thermocouple_C > 316 ||
-            system_data.temp_data_meat2.thermocouple_C > 316) {
-            std::cout << "Entering Emergency Shutdown Mode due to excessive heat.\n\n";
-            this->emergency_shutdown();
+    // Manual mode or a shutdown ends it too
+    if (stop || !current.mode_auto || !current.cook_started) {
+        this->m_autotune.abort();
+        std::cout << "Autotune stopped.\n\n";
+        this->send_autotune_status();
+        return false;
+    }
+
+    // A faulted reading leaves the relay where it is
+    if (chamber.fault)
+        return true;
+    this->blowfan()->set_duty_percent(this->m_autotune.tick(chamber.thermocouple_C, now_s));
+
+    const autotune_result result = this->m_autotune.result();
+    if (result.state == AUTOTUNE_DONE) {
+        std::cout << "Autotune done: Ku " << result.ku << ", Tu " << result.tu_s << " s, gains Kp " << result.gains.kp <<
+                ", Ki " << result.gains.ki << ", Kd " << result.gains.kd << ".\n\n";
+        // This is the control loop, so the gains go straight into the snapshot
+        const pid_gains gains = result.gains;
+        if (valid_gains(gains)) {
+            this->m_state.update([&gains](control_state& next) {next.gains = gains;});
+            this->use_gains(gains);
         }
+        // The PID starts from the relay's average fan output, so there is no bump
+        this->m_pid.core.reset(controller_value(chamber.thermocouple_C), controller_value(result.bias_pct));
+        this->m_pid.core.integral(controller_value(result.gains.ki > 0 ? result.bias_pct : 0.0f));
+        this->send_gains();
+    }
+    else if (result.state == AUTOTUNE_FAILED) {
+        std::cout << "Error: autotune failed after " << static_cast<int>(result.cycles) << " cycles, keeping the gains.\n\n";
+    }
+    if (result.cycles != this->m_autotune_cycles_sent || !this->m_autotune.running()) {
+        this->m_autotune_cycles_sent = result.cycles;
+        this->send_autotune_status();
+    }
+    return this->m_autotune.running();
+}
 
-        // PID logic
-        // Make sure a temp has been selected and is in autonomous mode
-        if (this->m_cook_started && this->m_mode_auto) {
+// Sends the autotune progress or result to the Android app
+void pid_control::send_autotune_status() {
+    if (!bt::is_bt_connected())
+        return;
+    const autotune_result result = this->m_autotune.result();
+    // Gains only go out once there are some
+    const pid_gains gains = result.state == AUTOTUNE_DONE ? result.gains : pid_gains {0, 0, 0};
+    out_msg_autotune_status msg {MSG_AUTOTUNE_STATUS, result.state, result.rule, result.cycles, result.ku, result.tu_s,
+            result.amplitude_C, gains.kp, gains.ki, gains.kd};
+    bt::send_data(msg, BT_TX_RELIABLE);
+}
 
-            float pv_err = this->m_set_point - system_data.temp_data_chamber.thermocouple_C;
-            integral_err += (this->m_set_point - system_data.temp_data_chamber.thermocouple_C)*dt;
-            float deriv_err = (system_data.temp_data_chamber.thermocouple_C - prev_val)/dt;
+// Slow loop: telemetry, history, cook log, saved state, damper and fuel
+void pid_control::pit_tick(const float dt) {
 
-            float output = Kp*pv_err + Ki*integral_err + Kd*deriv_err;
-            std::cout << "PID output: " << output << ".\n\n";
+    // One view of the controller for the whole tick, the same one the report carries
+    const control_state state = this->apply_commands();
+
+    // Get status of thermocouples and motors
+    const out_msg_all_data system_data = this->get_system_status(state);
+    const telemetry_sample sample = telemetry_sample_from(system_data);
+
+    // Kept whether or not the phone is listening, it can ask for what it missed
+    const uint32_t now_s = static_cast<uint32_t>(sys_clock::now_us()/1000000);
+    this->m_history->record(now_s, sample);
+    this->m_flash_log->append(COOK_LOG_SAMPLE, now_s, sample);
+
+    // Written only when the rate limits allow
+    this->m_store->offer(this->saved_state(state));
+
+    this->check_probe_alarms(system_data);
+
+    // Send status to every phone, only what changed since the last report
+    // The report is encoded once and the same frame goes to each of them
+    if (bt::is_bt_connected()) {
+        // A phone that just connected needs everything, and so does one whose waiting report gets replaced
+        // or whose last report was evicted or failed to write
+        const uint32_t connections = bt::connections();
+        const uint32_t latest_lost = bt::tx_latest_lost();
+        if (connections != this->m_bt_connections || latest_lost != this->m_bt_latest_lost ||
+                bt::tx_waiting(BT_TX_LATEST))
+            this->m_telemetry.force_keyframe();
+        this->m_bt_connections = connections;
+        this->m_bt_latest_lost = latest_lost;
+        uint8_t report[TELEMETRY_MAX_SIZE];
+        const size_t len = this->m_telemetry.encode(sample, report, sizeof(report));
+        // A phone missed this change, make sure the next report brings them all up to date
+        if (len > 0 && !bt::write_uint8_p(report, len, BT_TX_LATEST))
+            this->m_telemetry.force_keyframe();
+    }
+
+    float fuel_g_per_min {0};
+    if (state.cook_started && state.mode_auto) {
+
+        const controller_sample control_sample {state.set_point_C, system_data.temp_data_chamber.thermocouple_C,
+                state.damper_pct, dt, static_cast<float>(system_data.duty_cycle)};
+        const controller_pit_command command = this->m_controller.pit_step(control_sample);
+
+        // Control damper based on current temperature, an autotune keeps it shut
+        // Asking for the position it is already headed to is left out, so nothing piles up behind a move
+        if (!this->m_autotune.running() && command.damper_pct != CONTROLLER_DAMPER_HOLD &&
+                command.damper_pct != this->m_damper.target_pct())
+            this->set_damper(command.damper_pct);
+
+        fuel_g_per_min = command.fuel_g_per_min;
+    }
+
+    // Fuel goes out in doses spaced for the rate the law asks for, none while it is not cooking
+    const uint32_t dose = this->m_feeder.tick(fuel_g_per_min, dt);
+    if (dose > 0)
+        this->task_feed(dose);
+}
 
-            // Set the blow fan duty cycle
-            if (output > 100)
-                this->blowfan()->set_duty_cycle(100);
-            else if (output < 0)
-                this->blowfan()->set_duty_cycle(0);
-            else
-                this->blowfan()->set_duty_cycle(static_cast<int8_t>(output));
-
-            // Control damper based on current temperature
-            // Need to heat up, open damper
-            if (!system_data.position_open && pv_err > 5)
-                this->task_open_damper();
-            // Need to cool down, close damper
-            else if(system_data.position_open && pv_err <= 0)
-                this->task_close_damper();
-
-            static int cycles = 0;
-            if (cycles == HOPPER_INPUT_FUEL_INTERVAL) {
-                this->task_input_fuel();
-                cycles = 0;
-            }
-            cycles++;
+// Raises a probe's alarm when it passes a threshold, and again only once it has come back past the hysteresis
+void pid_control::check_probe_alarms(const out_msg_all_data& system_data) {
+    const tc_probe_table configs = this->m_tc_sampler->configs();
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        const uint8_t bit = 1 << i;
+        const max31855_data_t& probe = system_data.probes[i];
+        // A probe that is off or faulted keeps its alarm state
+        if (!(system_data.probes_active & bit) || probe.fault)
+            continue;
+
+        const int16_t high_C = configs[i].alarm_high_C;
+        if (high_C == TC_ALARM_OFF || probe.thermocouple_C < high_C - PROBE_ALARM_HYSTERESIS_C) {
+            this->m_alarm_high &= ~bit;
         }
-        else {
-            // Start the algorithm from scratch next time, erase integral history
-            integral_err = 0;
+        else if (probe.thermocouple_C > high_C && !(this->m_alarm_high & bit)) {
+            this->m_alarm_high |= bit;
+            this->send_probe_alarm(ALARM_PROBE_HIGH, i, probe.thermocouple_C);
         }
 
-        // Always record the previous temp value
-        if (!system_data.temp_data_chamber.fault) {
-            prev_val = system_data.temp_data_chamber.thermocouple_C;
+        const int16_t low_C = configs[i].alarm_low_C;
+        if (low_C == TC_ALARM_OFF || probe.thermocouple_C > low_C + PROBE_ALARM_HYSTERESIS_C) {
+            this->m_alarm_low &= ~bit;
+        }
+        else if (probe.thermocouple_C < low_C && !(this->m_alarm_low & bit)) {
+            this->m_alarm_low |= bit;
+            this->send_probe_alarm(ALARM_PROBE_LOW, i, probe.thermocouple_C);
         }
     }
 }
 
+// Tells the Android app a probe passed one of its alarms
+void pid_control::send_probe_alarm(const alarm_code code, const uint8_t probe, const float temp_C) {
+    std::cout << "Thermocouple probe " << static_cast<int>(probe) << " is " << (code == ALARM_PROBE_HIGH ?
+            "above" : "below") << " its alarm at " << temp_C << " degrees Celsius.\n\n";
+    if (!bt::is_bt_connected())
+        return;
+    out_msg_alarm alarm {MSG_ALARM, code, static_cast<int16_t>(temp_C), probe};
+    bt::send_data(alarm, BT_TX_RELIABLE);
+}
+
+// Validates, applies and saves one probe's settings
+bool pid_control::configure_probe(const uint8_t probe, const tc_probe_config& config) {
+    if (!this->m_tc_sampler->configure(probe, config))
+        return false;
+    this->m_store->save_probes(this->m_tc_sampler->configs());
+    return true;
+}
+
+// Sends a probe slot's settings to one phone, or to all of them
+void pid_control::send_probe_config(const uint8_t probe, const uint8_t client) {
+    if (!bt::is_bt_connected(client) || probe >= TC_BUS_MAX_PROBES)
+        return;
+    out_msg_probe_config msg {MSG_PROBE_CONFIG, probe, this->m_tc_sampler->configs()[probe]};
+    bt::send_data(msg, BT_TX_RELIABLE, client);
+}
+
+// History loop: streams requested history and cook log while the link has room
+void pid_control::history_tick(const float) {
+    if (this->m_backfill_requested.exchange(false)) {
+        this->m_backfill_next = this->m_history->find(this->m_backfill_from_s);
+        this->m_backfill_client = this->m_backfill_request_client;
+        this->m_backfill_sent = 0;
+        this->m_backfill_active = true;
+    }
+    if (this->m_log_export_requested.exchange(false)) {
+        // Records still in RAM go too
+        this->m_flash_log->flush();
+        this->m_log_export_cursor = this->m_flash_log->begin();
+        this->m_log_export_client = this->m_log_export_request_client;
+        this->m_log_export_sent = 0;
+        this->m_log_export_active = true;
+    }
+    // A stream ends with the phone that asked for it
+    if (!bt::is_bt_connected(this->m_backfill_client))
+        this->m_backfill_active = false;
+    if (!bt::is_bt_connected(this->m_log_export_client))
+        this->m_log_export_active = false;
+
+    // The history catches the phone up, it goes first
+    if (this->m_backfill_active && !this->stream_backfill())
+        return;
+    if (this->m_log_export_active)
+        this->stream_log_export();
+}
+
+// Streams the requested history blocks, returns false while the link is full
+bool pid_control::stream_backfill() {
+    uint8_t msg[BT_FRAME_MAX_PAYLOAD];
+    msg[0] = MSG_HISTORY;
+    while (bt::tx_room(this->m_backfill_client) > HISTORY_TX_RESERVE) {
+        // Blocks dropped since the request started are gone, carry on from the oldest one left
+        this->m_backfill_next = std::max(this->m_backfill_next, this->m_history->first_seq());
+        const size_t len = this->m_history->read_block(this->m_backfill_next, msg + 1, sizeof(msg) - 1);
+        history_block_header header {};
+        if (len > 0)
+            std::memcpy(&header, msg + 1, sizeof(header));
+
+        if (len == 0 || header.start_s > this->m_backfill_to_s) {
+            out_msg_history_end end {MSG_HISTORY_END, this->m_backfill_sent,
+                    static_cast<uint32_t>(sys_clock::now_us()/1000000)};
+            bt::send_data(end, BT_TX_RELIABLE, this->m_backfill_client);
+            this->m_backfill_active = false;
+            return true;
+        }
+
+        if (!bt::write_uint8_p(msg, len + 1, BT_TX_RELIABLE, this->m_backfill_client))
+            return false;
+        this->m_backfill_next++;
+        this->m_backfill_sent++;
+    }
+    return false;
+}
+
+// Streams the requested cook log straight from the flash map, returns false while the link is full
+bool pid_control::stream_log_export() {
+    const uint8_t type {MSG_LOG};
+    while (bt::tx_room(this->m_log_export_client) > HISTORY_TX_RESERVE) {
+        // A cursor that fails to queue its records is put back, so none are lost
+        const cook_log_cursor at = this->m_log_export_cursor;
+        const cook_log_record* records {nullptr};
+        size_t count = this->m_flash_log->read(this->m_log_export_cursor, records, LOG_EXPORT_RECORDS);
+
+        if (count == 0) {
+            out_msg_log_end end {MSG_LOG_END, this->m_log_export_sent, this->m_flash_log->stats().boot};
+            bt::send_data(end, BT_TX_RELIABLE, this->m_log_export_client);
+            this->m_log_export_active = false;
+            return true;
+        }
+
+        // Boots only count up, so the ones asked for follow the ones skipped
+        while (count > 0 && records->boot < this->m_log_export_from_boot) {
+            records++;
+            count--;
+        }
+        if (count == 0)
+            continue;
+
+        if (!bt::write_uint8_p(&type, 1, reinterpret_cast<const uint8_t*>(records),
+                count*sizeof(cook_log_record), BT_TX_RELIABLE, this->m_log_export_client)) {
+            this->m_log_export_cursor = at;
+            return false;
+        }
+        this->m_log_export_sent += count;
+    }
+    return false;
+}
+
+// Logs a new chamber set point to flash
+void pid_control::log_set_point(const float set_point_C) {
+    telemetry_sample set_point {};
+    set_point.logged_qc[TELEMETRY_LOGGED_CHAMBER] = static_cast<int16_t>(set_point_C*4);
+    this->m_flash_log->append(COOK_LOG_SET_POINT, static_cast<uint32_t>(sys_clock::now_us()/1000000), set_point);
+}
+
+// The state kept in NVS
+pid_saved_state pid_control::saved_state(const control_state& state) {
+    pid_saved_state saved {};
+    saved.gains = state.gains;
+    saved.set_point_C = state.set_point_C;
+    saved.integral_pct = static_cast<float>(this->m_pid.core.integral());
+    saved.prev_val_C = static_cast<float>(this->m_pid.core.prev_pv());
+    saved.mode_auto = state.mode_auto;
+    saved.cook_started = state.cook_started;
+    saved.damper_pct = state.damper_pct;
+    return saved;
+}
+
+// Resets that can land in the middle of a cook, a power-on or deep sleep wake starts idle
+static bool warm_reset(const esp_reset_reason_t reason) {
+    switch (reason) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_BROWNOUT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Picks up the saved gains, and the cook too after a reset in the middle of one
+void pid_control::restore_state() {
+    // The stepper does not know where the damper is, it finds the closed stop before any move
+    this->m_damper.home();
+
+    // The probes the app set up replace the board's defaults
+    tc_probe_table probes {};
+    if (this->m_store->load_probes(probes) && !this->m_tc_sampler->configure(probes))
+        std::cout << "Error: the saved probe settings are not valid, some probes keep the board's.\n\n";
+
+    pid_saved_state saved {};
+    if (!this->m_store->load(saved)) {
+        std::cout << "No saved controller state, using the default gains.\n\n";
+        return;
+    }
+    this->use_gains(saved.gains);
+    // The damper goes back where it was through any reset
+    this->set_damper(saved.damper_pct);
+
+    // An emergency shutdown saves the cook as stopped, so it never comes back from one
+    const esp_reset_reason_t reason = esp_reset_reason();
+    const bool resume = saved.cook_started && warm_reset(reason);
+    this->m_state.update([&saved, resume](control_state& next) {
+        next.gains = saved.gains;
+        next.mode_auto = saved.mode_auto;
+        if (resume) {
+            next.set_point_C = saved.set_point_C;
+            next.cook_started = true;
+        }
+    });
+    if (resume) {
+        // Anything past the fan's limits in the integral term is windup, the core brings it back to them
+        this->m_pid.core.reset(controller_value(saved.prev_val_C), controller_value(saved.integral_pct));
+        this->m_pid.core.integral(controller_value(saved.integral_pct));
+        this->log_set_point(saved.set_point_C);
+        std::cout << "Resuming the cook at " << saved.set_point_C << " degrees Celsius after reset reason " <<
+                reason << ".\n\n";
+    }
+}
+
+// Validates and posts new gains, the control loop applies them on its next tick, any thread
+bool pid_control::set_gains(const float kp, const float ki, const float kd) {
+    const pid_gains gains {kp, ki, kd};
+    if (!valid_gains(gains))
+        return false;
+    this->m_state.post_gains(gains);
+    return true;
+}
+
+// Runs the PID with new gains, the integral term carries over, control loop only or before it starts
+void pid_control::use_gains(const pid_gains& gains) {
+    // The core holds the integral term itself, so the fan does not jump when Ki changes
+    if (!(gains.ki > 0))
+        this->m_pid.core.integral(controller_value(0.0f));
+    this->m_pid.gains = gains;
+    this->m_pid.retune = true;
+}
+
+// Sends the gains in use to one phone, or to all of them
+void pid_control::send_gains(const uint8_t client) {
+    if (!bt::is_bt_connected(client))
+        return;
+    const pid_gains gains = this->m_state.load().gains;
+    out_msg_gains msg {MSG_GAINS, gains.kp, gains.ki, gains.kd};
+    bt::send_data(msg, BT_TX_RELIABLE, client);
+}
+
 // Gathers all data to be sent to Android app
 out_msg_all_data pid_control::get_system_status() {
-    // Read data from the thermocouples
-    max31855_data_t chamber_data = this->m_tc_chamber->read();
-    max31855_data_t meat1_data = this->m_tc_meat1->read();
-    max31855_data_t meat2_data = this->m_tc_meat2->read();
+    return this->get_system_status(this->m_state.load());
+}
+
+// Gathers all data to be sent to Android app, with the damper as the given state has it
+out_msg_all_data pid_control::get_system_status(const control_state& state) {
+    // Latest filtered thermocouple data from the sampler, never blocks
+    tc_filtered_set samples = this->m_tc_sampler->latest();
 
     // For testing without a thermocouple available
     if constexpr (DEBUG_SEND_HARDCODED_TEMP) {
-        chamber_data.thermocouple_C = 75;
-        chamber_data.fault = 0;
-        meat1_data.thermocouple_C = 72.25;
-        meat1_data.fault = 0;
-        meat2_data.thermocouple_C = 70.5;
-        meat2_data.fault = 1;
+        samples.active = 0x07;
+        samples.roles[0] = TC_ROLE_CHAMBER;
+        samples.roles[1] = TC_ROLE_MEAT;
+        samples.roles[2] = TC_ROLE_MEAT;
+        samples.probes[0] = {75, false};
+        samples.probes[1] = {72.25, false};
+        samples.probes[2] = {70.5, true};
     }
 
     const int8_t duty_cycle = this->m_blowfan->get_duty_cycle();
     const bool hopper_enabled = this->m_hopper_controller->is_enabled();
-    const bool damper_open = this->m_damper_open;
+    const bool damper_open = state.damper_pct > 0;
 
-    const out_msg_all_data out_data {chamber_data, meat1_data, meat2_data, duty_cycle, hopper_enabled, damper_open};
+    out_msg_all_data out_data {};
+    out_data.temp_data_chamber = tc_chamber_reading(samples);
+    out_data.probes_active = samples.active;
+    for (uint8_t i = 0; i < TC_BUS_MAX_PROBES; i++) {
+        out_data.probe_roles[i] = samples.roles[i];
+        out_data.probes[i] = samples.probes[i];
+    }
+    out_data.duty_cycle = duty_cycle;
+    out_data.input_fuel = hopper_enabled;
+    out_data.position_open = damper_open;
+    out_data.fuel_dg_per_min = static_cast<uint8_t>(std::clamp(std::lround(this->m_feeder.delivered_g_per_min()*10),
+            0l, 255l));
     return out_data;
 }
 
+// Handles every command in a received frame payload, returns how many were handled
+// Commands are packed back to back, each one sized by its type
+// Commands that change the cook are refused unless the client has control, see bt::control_owner()
+size_t pid_control::handle_bt_cmds(const uint8_t* payload, const size_t len, const uint8_t client) {
+    size_t handled {0};
+    size_t pos {0};
+    while (pos < len) {
+        const size_t size = in_msg_size(payload[pos]);
+        // Without a known size the rest of the payload cannot be split
+        if (size == 0 || pos + size > len) {
+            std::cout << "Error: dropping " << len - pos << " bytes of Bluetooth commands at type " <<
+                    static_cast<int>(payload[pos]) << ".\n\n";
+            break;
+        }
+        pos += size;
+        // Only one phone steers the cook at a time, the others watch and read
+        const uint8_t owner = bt::control_owner();
+        if (in_msg_controls(payload[pos - size]) && client != BT_ALL_CLIENTS && client != owner) {
+            std::cout << "Refusing Bluetooth command type " << static_cast<int>(payload[pos - size]) <<
+                    " from phone " << static_cast<int>(client) << ", phone " << static_cast<int>(owner) <<
+                    " has control.\n\n";
+            continue;
+        }
+        this->handle_bt_msg(payload + pos - size, client);
+        handled++;
+    }
+    return handled;
+}
+
 // Creates a task to input fuel and adds it to the hopper task queue
 void pid_control::task_input_fuel() {
-    std::function<void()> input_fuel = [&]() {
-        std::cout << "Inputting fuel.\n\n";
+    std::cout << "Inputting fuel.\n\n";
+    this->task_feed(a4988_revs_to_microsteps(HOPPER_INPUT_FUEL_REVS));
+}
+
+// Creates a task to turn the auger a number of sixteenth steps and adds it to the hopper task queue
+void pid_control::task_feed(const uint32_t microsteps) {
+    std::function<void()> input_fuel = [this, microsteps]() {
         this->m_hopper_controller->set_dir(0);
         this->m_hopper_controller->set_not_en(0);
-        this->m_hopper_controller->run_motor_steps(HOPPER_INPUT_FUEL_STEP_COUNT);
+        this->m_feeder.fed(this->m_hopper_controller->turn(microsteps, HOPPER_MAX_STEP_DEG));
         this->m_hopper_controller->set_not_en(1);
     };
     this->m_hopper_task_queue.push(input_fuel);
 }
 
-// Creates a task to open the damper and adds it to the damper task queue
-void pid_control::task_open_damper() {
-    std::function<void()> open_damper = [&]() {
-        if (!this->m_damper_open) {
-            std::cout << "Opening damper.\n\n";
-            this->m_damper_controller->set_dir(0);
-            this->m_damper_controller->set_not_en(0);
-            this->m_damper_controller->run_motor_steps(DAMPER_OPEN_CLOSE_STEP_COUNT);
-            this->m_damper_controller->set_not_en(1);
-            this->m_damper_open = true;
-        }
-        else {
-            std::cout << "Damper is already open.\n\n";
-        }
-    };
-    this->m_damper_task_queue.push(open_damper);
-}
-
-// Creates a task to close the damper and adds it to the damper task queue
-void pid_control::task_close_damper() {
-    std::function<void()> close_damper = [&]() {
-        if (this->m_damper_open) {
-            std::cout << "Closing damper.\n\n";
-            this->m_damper_controller->set_dir(1);
-            this->m_damper_controller->set_not_en(0);
-            this->m_damper_controller->run_motor_steps(DAMPER_OPEN_CLOSE_STEP_COUNT);
-            this->m_damper_controller->set_not_en(1);
-            this->m_damper_open = false;
-        }
-        else {
-            std::cout << "Damper is already closed.\n\n";
-        }
-    };
-    this->m_damper_task_queue.push(close_damper);
+// Moves the damper to a position from 0 closed to 100 fully open, a newer position replaces one not started
+void pid_control::set_damper(const float position_pct) {
+    this->m_damper.target_pct(position_pct);
 }
 
 // Shutdown all grill operation
 void pid_control::emergency_shutdown() {
-    this->m_ignore_bt = true;
-    this->m_cook_started = false;
+    const control_state state = this->m_state.update([](control_state& next) {
+        next.ignore_bt = true;
+        next.cook_started = false;
+    });
 
-    // Clear task queues
-    this->m_hopper_task_queue = {};
-    this->m_damper_task_queue = {};
+    // A restart after this must not pick the cook back up
+    this->m_store->save(this->saved_state(state));
+
+    // Cancel pending fuel and ramp down a feed in progress
+    this->m_hopper_task_queue.flush();
+    this->m_hopper_controller->stop_motor();
 
     // Adjust grill parts to decrease temperature
-    this->task_close_damper();
+    // Closing the damper replaces whatever position was pending
+    this->set_damper(0);
     this->blowfan()->set_duty_cycle(0);
 
+    // Keep what led up to this through the restart
+    const telemetry_sample sample = telemetry_sample_from(this->get_system_status());
+    this->m_flash_log->append(COOK_LOG_SHUTDOWN, static_cast<uint32_t>(sys_clock::now_us()/1000000), sample);
+    this->m_flash_log->flush();
+
     // Chill for a bit and restart the MCU
-    std::this_thread::sleep_for(5s);
+    sys_clock::sleep_for(5s);
     esp_restart();
 };
-
-// Function that creates a task queue thread (used specifically on the stepper motors)
-std::thread create_task_queue(std::queue<std::function<void()>>& func_queue) {
-
-    std::thread tasker([&]() {
-        while (true) {
-            if(func_queue.empty()) {
-                std::this_thread::sleep_for(100ms);
-            }
-            else {
-                func_queue.front()();
-                func_queue.pop();
-            }
-        }
-    });
-    return tasker;
-}
\ No newline at end of file
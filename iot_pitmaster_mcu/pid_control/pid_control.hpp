@@ -6,169 +6,258 @@
 #ifndef __PID_CONTROL_HPP__
 #define __PID_CONTROL_HPP__
 
+#include <atomic>
 #include <chrono>
 #include <functional>
-#include <queue>
+#include <thread>
 
 #include "a4988_driver.hpp"
+#include "autotune.hpp"
+#include "bt_msg.hpp"
+#include "bt_tx_queue.hpp"
+#include "control_state.hpp"
+#include "controller.hpp"
+#include "cook_log.hpp"
+#include "damper.hpp"
+#include "fuel_feeder.hpp"
+#include "history.hpp"
+#include "loop_scheduler.hpp"
 #include "max31855.hpp"
+#include "pid_store.hpp"
 #include "pwm.hpp"
+#include "task_queue.hpp"
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
+#include "telemetry.hpp"
 
 using namespace std::chrono_literals;
 
-// Function that creates a task queue thread (used specifically on the stepper motors)
-std::thread create_task_queue(std::queue<std::function<void()>>& thread_queue);
-
-// The type of message being sent or received
-enum msg_type : uint8_t {
-    MSG_MODE = 0,
-    MSG_CHAMBER_TEMP = 1,
-    MSG_MEAT1_TEMP = 2,
-    MSG_MEAT2_TEMP = 3,
-    MSG_BLOWFAN = 4,
-    MSG_HOPPER = 5,
-    MSG_DAMPER = 6
-};
+// Control loop rates, the fan loop runs the PID, the pit loop moves the damper, feeds fuel and reports,
+// the history loop streams history and the cook log the phone asked for
+#define PID_FAN_LOOP_HZ (10)
+#define PID_PIT_LOOP_HZ (1)
+#define PID_HISTORY_LOOP_HZ (20)
 
-// Basic message
-struct __attribute__ ((packed)) in_msg_basic {
-    msg_type type;
-};
+// Degrees a probe must come back past its alarm threshold before the alarm can go off again
+#define PROBE_ALARM_HYSTERESIS_C (2)
 
-// MSG_MODE
-struct __attribute__ ((packed)) in_msg_mode {
-    msg_type type;
-    bool mode;
-};
+class pid_control {
 
-// MSG_CHAMBER_TEMP, MSG_MEAT1_TEMP, MSG_MEAT2_TEMP receive
-struct __attribute__ ((packed)) in_msg_temp_C {
-    msg_type type;
-    int16_t temp_C; // temp in Celsius
-};
+    private:
 
-// MSG_BLOWFAN
-struct __attribute__ ((packed)) in_msg_blowfan {
-    msg_type type;
-    int8_t duty_cycle; // duty cycle (0-100)%;
-};
+        // Pointers to important pieces of the system
+        pwm* m_blowfan;
+        a4988_driver* m_hopper_controller;
+        a4988_driver* m_damper_controller;
+        tc_sampler* m_tc_sampler;
+        history_log* m_history;
+        cook_log* m_flash_log;
+        pid_store* m_store;
+
+        // Set point, mode, cook flags and damper position, one snapshot read without a lock by every thread
+        shared_control_state m_state;
+
+        // Control law, fixed at compile time, and its PID gains and state, touched only by the control loop
+        // The gains in use are in the snapshot too, for every other thread
+        controller_policy m_controller {};
+        controller_pid m_pid {};
 
-// MSG_HOPPER
-struct __attribute__ ((packed)) in_msg_hopper {
-    msg_type type;
-    bool input_fuel; // true means input fuel
-};
+        // Probe slots whose high or low alarm has gone off, a bit per slot
+        uint8_t m_alarm_high {0};
+        uint8_t m_alarm_low {0};
 
-// MSG_DAMPER
-struct __attribute__ ((packed)) in_msg_damper {
-    msg_type type;
-    bool position_open; // open is true, closed is false
-};
+        // Task queue for the hopper stepper
+        task_queue m_hopper_task_queue {"Hopper"};
 
-// Struct to send individual temperature data
-// MSG_CHAMBER_TEMP, MSG_MEAT1_TEMP, MSG_MEAT2_TEMP
-struct __attribute__ ((packed)) out_msg_temp_C {
-    msg_type type;
-    max31855_data_t temp_data_chamber;
-};
+        // Spaces the fuel the control law asks for out into small doses
+        fuel_feeder m_feeder;
 
-// Struct to send all temperature and motor data
-struct __attribute__ ((packed)) out_msg_all_data {
-    max31855_data_t temp_data_chamber;
-    max31855_data_t temp_data_meat1;
-    max31855_data_t temp_data_meat2;
-    int8_t duty_cycle; // duty cycle (0-100)%;
-    bool input_fuel; // treat like bool, 1 means input fuel
-    bool position_open; // treat like bool, open is true, closed is false
-};
+        // Damper on its stepper, the latest position asked for wins
+        damper m_damper;
 
+        // Control loops
+        loop_scheduler m_scheduler;
+        int m_fan_loop {-1};
+        int m_pit_loop {-1};
+        int m_history_loop {-1};
 
-class pid_control {
+        // Status reports to the Android app
+        telemetry_encoder m_telemetry;
+        uint32_t m_bt_connections {0};
+        uint32_t m_bt_latest_lost {0};
 
-    private:
+        // History request being streamed back, to the phone that asked for it
+        std::atomic<bool> m_backfill_requested {false};
+        uint32_t m_backfill_from_s {0};
+        uint32_t m_backfill_to_s {0};
+        uint8_t m_backfill_request_client {BT_ALL_CLIENTS};
+        uint8_t m_backfill_client {BT_ALL_CLIENTS};
+        bool m_backfill_active {false};
+        uint32_t m_backfill_next {0};
+        uint16_t m_backfill_sent {0};
 
-        // Pointers to important pieces of the system
-        pwm* m_blowfan;
-        a4988_driver* m_hopper_controller;
-        a4988_driver* m_damper_controller;
-        max31855* m_tc_chamber;
-        max31855* m_tc_meat1;
-        max31855* m_tc_meat2;
+        // Cook log request being streamed back, to the phone that asked for it
+        std::atomic<bool> m_log_export_requested {false};
+        uint16_t m_log_export_from_boot {0};
+        uint8_t m_log_export_request_client {BT_ALL_CLIENTS};
+        uint8_t m_log_export_client {BT_ALL_CLIENTS};
+        bool m_log_export_active {false};
+        cook_log_cursor m_log_export_cursor {};
+        uint32_t m_log_export_sent {0};
 
-        // Status variables
-        float m_set_point {0};
-        bool m_damper_open {false};
+        // Relay autotune, asked for by the Bluetooth handler and run by the fan loop in place of the PID
+        relay_autotune m_autotune;
+        std::atomic<bool> m_autotune_requested {false};
+        std::atomic<bool> m_autotune_stop {false};
+        autotune_rule m_autotune_rule {AUTOTUNE_RULE_ZN_PID};
+        float m_autotune_set_point {0};
+        uint8_t m_autotune_cycles_sent {0};
 
-        // Mode and cook status
-        bool m_mode_auto {true};
-        bool m_cook_started {false};
+        // Applies the commands posted since the last tick, returns the state the tick runs on
+        control_state apply_commands();
 
-        // Emergency ignore BT
-        bool m_ignore_bt {false};
+        // Fast loop: over-temperature check and the blowfan PID
+        void fan_tick(float dt);
 
-        // Task queues for the stepper motors
-        std::queue<std::function<void()>> m_hopper_task_queue;
-        std::queue<std::function<void()>> m_damper_task_queue;
+        // Starts, stops and runs the relay autotune, true while it drives the fan
+        bool autotune_tick(const control_state& state, const max31855_data_t& chamber);
+
+        // Sends the autotune progress or result to the Android app
+        void send_autotune_status();
+
+        // Slow loop: telemetry, history, cook log, damper and fuel
+        void pit_tick(float dt);
+
+        // Raises a probe's alarm when it passes a threshold, and again only once it has come back past the hysteresis
+        void check_probe_alarms(const out_msg_all_data& system_data);
+
+        // Tells the Android app a probe passed one of its alarms
+        void send_probe_alarm(alarm_code code, uint8_t probe, float temp_C);
+
+        // Validates, applies and saves one probe's settings
+        bool configure_probe(uint8_t probe, const tc_probe_config& config);
+
+        // Sends a probe slot's settings to one phone, or to all of them
+        void send_probe_config(uint8_t probe, uint8_t client = BT_ALL_CLIENTS);
+
+        // History loop: streams requested history and cook log while the link has room
+        void history_tick(float dt);
+
+        // Streams the requested history blocks, returns false while the link is full
+        bool stream_backfill();
+
+        // Streams the requested cook log straight from the flash map, returns false while the link is full
+        bool stream_log_export();
+
+        // Logs a new chamber set point to flash
+        void log_set_point(float set_point_C);
+
+        // The state kept in NVS
+        pid_saved_state saved_state(const control_state& state);
+
+        // Picks up the saved gains, and the cook too after a reset in the middle of one
+        void restore_state();
+
+        // Validates and posts new gains, the control loop applies them on its next tick, any thread
+        bool set_gains(float kp, float ki, float kd);
+
+        // Runs the PID with new gains, the integral term carries over, control loop only or before it starts
+        void use_gains(const pid_gains& gains);
+
+        // Sends the gains in use to one phone, or to all of them
+        void send_gains(uint8_t client = BT_ALL_CLIENTS);
 
     public:
 
-        inline pid_control(pwm& blowfan, a4988_driver& hopper_controller, a4988_driver& damper_controller, 
-                max31855& tc_chamber, max31855& tc_meat1, max31855& tc_meat2) {
+        inline pid_control(pwm& blowfan, a4988_driver& hopper_controller, a4988_driver& damper_controller,
+                tc_sampler& thermocouples, history_log& history, cook_log& flash_log, pid_store& store) :
+                m_damper(damper_controller, [this](uint8_t pct) {this->m_state.damper_moved(pct);}) {
             this->m_blowfan = &blowfan;
             this->m_hopper_controller = &hopper_controller;
             this->m_damper_controller = &damper_controller;
-            this->m_tc_chamber = &tc_chamber;
-            this->m_tc_meat1 = &tc_meat1;
-            this->m_tc_meat2 = &tc_meat2;
+            this->m_tc_sampler = &thermocouples;
+            this->m_history = &history;
+            this->m_flash_log = &flash_log;
+            this->m_store = &store;
+            this->restore_state();
 
             // Creates a tasker thread for the hopper task queue
-            std::thread hopper_tasker = create_task_queue(this->m_hopper_task_queue);
+            std::thread hopper_tasker = this->m_hopper_task_queue.start();
             hopper_tasker.detach();
 
-            // Creates a tasker thread for the damper task queue
-            std::thread damper_tasker = create_task_queue(this->m_damper_task_queue);
-            damper_tasker.detach();
+            // Creates the damper thread, it homes the damper first
+            std::thread damper_thread = this->m_damper.start();
+            damper_thread.detach();
+
+            this->m_fan_loop = this->m_scheduler.add_loop("Fan", PID_FAN_LOOP_HZ, [this](float dt) {this->fan_tick(dt);});
+            this->m_pit_loop = this->m_scheduler.add_loop("Pit", PID_PIT_LOOP_HZ, [this](float dt) {this->pit_tick(dt);});
+            this->m_history_loop = this->m_scheduler.add_loop("History", PID_HISTORY_LOOP_HZ,
+                    [this](float dt) {this->history_tick(dt);});
         }
 
         // GETTERS
         pwm* blowfan() {return this->m_blowfan;}
         a4988_driver* hopper_controller() {return this->m_hopper_controller;}
         a4988_driver* damper_controller() {return this->m_damper_controller;}
-        max31855* tc_chamber() {return this->m_tc_chamber;}
-        max31855* tc_meat1() {return this->m_tc_meat1;}
-        max31855* tc_meat2() {return this->m_tc_meat2;}
+        tc_sampler* thermocouples() {return this->m_tc_sampler;}
+        max31855* probe(uint8_t slot) {return this->m_tc_sampler->bus()->probe(slot);}
+        task_queue& hopper_task_queue() {return this->m_hopper_task_queue;}
+        damper& damper_actuator() {return this->m_damper;}
+        fuel_feeder& feeder() {return this->m_feeder;}
+        loop_scheduler& scheduler() {return this->m_scheduler;}
+        const telemetry_stats& telemetry() {return this->m_telemetry.stats();}
+        history_log* history() {return this->m_history;}
+        cook_log* flash_log() {return this->m_flash_log;}
+        pid_store* store() {return this->m_store;}
+        pid_gains gains() {return this->m_state.load().gains;}
+        control_state state() {return this->m_state.load();}
+        float set_point() {return this->m_state.load().set_point_C;}
+        float integral_pct() {return static_cast<float>(this->m_pid.core.integral());}
+        const char* controller_name() {return controller_policy::name;}
+        bool cook_started() {return this->m_state.load().cook_started;}
+        autotune_result autotune() {return this->m_autotune.result();}
+        uint8_t fan_loop() {return this->m_fan_loop;}
+        uint8_t pit_loop() {return this->m_pit_loop;}
+        uint8_t history_loop() {return this->m_history_loop;}
 
         // Creates a task to input fuel and adds it to the hopper task queue
         void task_input_fuel();
 
+        // Creates a task to turn the auger a number of sixteenth steps and adds it to the hopper task queue
+        void task_feed(uint32_t microsteps);
+
         // Shutdown all grill operation
         void emergency_shutdown();
 
-        // Creates a task to open the damper and adds it to the damper task queue
-        void task_open_damper();
-
-        // Creates a task to close the damper and adds it to the damper task queue
-        void task_close_damper();
+        // Moves the damper to a position from 0 closed to 100 fully open, a newer position replaces one not started
+        void set_damper(float position_pct);
 
         // Gathers all data to be sent to Android app
         out_msg_all_data get_system_status();
+        out_msg_all_data get_system_status(const control_state& state);
 
-        // Main pid_control logic function
+        // Main pid_control logic function, runs the control loops forever
         void pid_control_run();
 
-        // Function for handling BT messages received
+        // Handles every command in a received frame payload, returns how many were handled
+        // Commands that change the cook are refused unless the client has control, see bt::control_owner()
+        size_t handle_bt_cmds(const uint8_t* payload, size_t len, uint8_t client = BT_ALL_CLIENTS);
+
+        // Function for handling BT messages received, requests are answered to the client that sent them
         template <typename T>
-        void handle_bt_msg(const T* p_msg) {
+        void handle_bt_msg(const T* p_msg, uint8_t client = BT_ALL_CLIENTS) {
 
             const in_msg_basic* basic_msg = reinterpret_cast<const in_msg_basic*>(p_msg);
+            // Set point and mode are applied by the control loop on its next tick, which checks the shutdown again
+            const bool ignore_bt = this->m_state.load().ignore_bt;
             switch(basic_msg->type) {
 
             // The Android app had a mode change
             case MSG_MODE: {
                 const in_msg_mode* msg = reinterpret_cast<const in_msg_mode*>(p_msg);
                 std::cout << "Received from Android App: change mode to mode " << msg->mode << ".\n\n";
-                if (!this->m_ignore_bt) {
-                    this->m_mode_auto = msg->mode;
+                if (!ignore_bt) {
+                    this->m_state.post_mode(msg->mode);
                 }
                 else {
                     std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
@@ -181,9 +270,10 @@ class pid_control {
                 const in_msg_temp_C* msg = reinterpret_cast<const in_msg_temp_C*>(p_msg);
                 std::cout << "Received from Android App: set the chamber temperature to " <<
                         std::dec << msg->temp_C << " degrees Celsius.\n\n";
-                if (!this->m_ignore_bt) {
-                    this->m_set_point = msg->temp_C;
-                    this->m_cook_started = true;
+                if (!ignore_bt) {
+                    // A new set point ends a tune
+                    this->m_autotune_stop = true;
+                    this->m_state.post_set_point(msg->temp_C);
                 }
                 else {
                     std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
@@ -196,7 +286,7 @@ class pid_control {
                 const in_msg_temp_C* msg = reinterpret_cast<const in_msg_temp_C*>(p_msg);
                 std::cout << "Received from Android App: set meat1 temperature to " <<
                         std::dec << msg->temp_C << " degrees Celsius.\n\n";
-                if (this->m_ignore_bt) {
+                if (ignore_bt) {
                     std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
                 }
                 break;
@@ -207,7 +297,7 @@ class pid_control {
                 const in_msg_temp_C* msg = reinterpret_cast<const in_msg_temp_C*>(p_msg);
                 std::cout << "Received from Android App: set meat2 temperature to " <<
                         std::dec << msg->temp_C << " degrees Celsius.\n\n";
-                if (this->m_ignore_bt) {
+                if (ignore_bt) {
                     std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
                 }
                 break;
@@ -218,7 +308,7 @@ class pid_control {
                 const in_msg_blowfan* msg = reinterpret_cast<const in_msg_blowfan*>(p_msg);
                 std::cout << "Received from Android App: set blowfan duty cycle to " <<
                         std::dec << msg->duty_cycle << "%.\n\n";
-                if (!this->m_ignore_bt) {
+                if (!ignore_bt) {
                     this->m_blowfan->set_duty_cycle(msg->duty_cycle);
                 }
                 else {
@@ -232,7 +322,7 @@ class pid_control {
                 const in_msg_hopper* msg = reinterpret_cast<const in_msg_hopper*>(p_msg);
                 if (msg->input_fuel) {
                     std::cout << "Received from Android App: input more fuel.\n\n";
-                    if (!this->m_ignore_bt) {
+                    if (!ignore_bt) {
                         this->task_input_fuel();
                     }
                     else {
@@ -241,7 +331,7 @@ class pid_control {
                 }
                 else {
                     std::cout << "Received from Android App: don't input more fuel.\n\n";
-                    if (this->m_ignore_bt) {
+                    if (ignore_bt) {
                         std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
                     }
                 }
@@ -253,8 +343,8 @@ class pid_control {
                 const in_msg_damper* msg = reinterpret_cast<const in_msg_damper*>(p_msg);
                 if (msg->position_open) {
                     std::cout << "Received from Android App: open the damper.\n\n";
-                    if (!this->m_ignore_bt) {
-                        this->task_open_damper();
+                    if (!ignore_bt) {
+                        this->set_damper(100);
                     }
                     else {
                         std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
@@ -262,8 +352,8 @@ class pid_control {
                 }
                 else {
                     std::cout << "Received from Android App: close the damper.\n\n";
-                    if (!this->m_ignore_bt) {
-                        this->task_close_damper();
+                    if (!ignore_bt) {
+                        this->set_damper(0);
                     }
                     else {
                         std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
@@ -272,6 +362,120 @@ class pid_control {
                 break;
             }
 
+            // The Android app moved the damper to a position
+            case MSG_DAMPER_POSITION: {
+                const in_msg_damper_position* msg = reinterpret_cast<const in_msg_damper_position*>(p_msg);
+                std::cout << "Received from Android App: move the damper to " << std::dec <<
+                        static_cast<int>(msg->position_pct) << "%.\n\n";
+                if (!ignore_bt) {
+                    this->set_damper(msg->position_pct);
+                }
+                else {
+                    std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
+                }
+                break;
+            }
+
+            // The Android app asked for the history it missed
+            case MSG_HISTORY_REQUEST: {
+                const in_msg_history_request* msg = reinterpret_cast<const in_msg_history_request*>(p_msg);
+                std::cout << "Received from Android App: send history from " << std::dec << msg->from_s <<
+                        " s to " << msg->to_s << " s.\n\n";
+                // A newer request replaces one still being streamed
+                this->m_backfill_from_s = msg->from_s;
+                this->m_backfill_to_s = msg->to_s;
+                this->m_backfill_request_client = client;
+                this->m_backfill_requested = true;
+                break;
+            }
+
+            // The Android app asked for the cook log kept in flash
+            case MSG_LOG_REQUEST: {
+                const in_msg_log_request* msg = reinterpret_cast<const in_msg_log_request*>(p_msg);
+                std::cout << "Received from Android App: send the cook log from boot " << std::dec <<
+                        msg->from_boot << ".\n\n";
+                // A newer request replaces one still being streamed
+                this->m_log_export_from_boot = msg->from_boot;
+                this->m_log_export_request_client = client;
+                this->m_log_export_requested = true;
+                break;
+            }
+
+            // The Android app changed the PID gains
+            case MSG_GAINS: {
+                const in_msg_gains* msg = reinterpret_cast<const in_msg_gains*>(p_msg);
+                std::cout << "Received from Android App: set the gains to Kp " << msg->kp << ", Ki " << msg->ki <<
+                        ", Kd " << msg->kd << ".\n\n";
+                // Either way every phone learns the gains in use, new ones once the control loop runs with them
+                if (!ignore_bt) {
+                    if (!this->set_gains(msg->kp, msg->ki, msg->kd))
+                        this->send_gains();
+                }
+                else {
+                    std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
+                    this->send_gains();
+                }
+                break;
+            }
+
+            // The Android app asked for the PID gains
+            case MSG_GAINS_REQUEST: {
+                std::cout << "Received from Android App: send the gains.\n\n";
+                this->send_gains(client);
+                break;
+            }
+
+            // The Android app started or stopped an autotune
+            case MSG_AUTOTUNE: {
+                const in_msg_autotune* msg = reinterpret_cast<const in_msg_autotune*>(p_msg);
+                if (!msg->start) {
+                    std::cout << "Received from Android App: stop the autotune.\n\n";
+                    this->m_autotune_stop = true;
+                    break;
+                }
+                std::cout << "Received from Android App: autotune at " << std::dec << msg->temp_C <<
+                        " degrees Celsius with rule " << static_cast<int>(msg->rule) << ".\n\n";
+                if (ignore_bt) {
+                    std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
+                }
+                else if (msg->rule >= AUTOTUNE_RULE_COUNT) {
+                    std::cout << "Error: unknown autotune rule " << static_cast<int>(msg->rule) << ".\n\n";
+                }
+                else {
+                    // The fan loop starts it on its next tick
+                    this->m_autotune_rule = static_cast<autotune_rule>(msg->rule);
+                    this->m_autotune_set_point = msg->temp_C;
+                    this->m_autotune_stop = false;
+                    this->m_autotune_requested = true;
+                }
+                break;
+            }
+
+            // The Android app changed a probe's role, rate or alarms
+            case MSG_PROBE_CONFIG: {
+                const in_msg_probe_config* msg = reinterpret_cast<const in_msg_probe_config*>(p_msg);
+                std::cout << "Received from Android App: set probe " << std::dec << static_cast<int>(msg->probe) <<
+                        " to role " << static_cast<int>(msg->config.role) << " at " <<
+                        static_cast<int>(msg->config.rate_hz) << " Hz.\n\n";
+                if (!ignore_bt) {
+                    this->configure_probe(msg->probe, msg->config);
+                }
+                else {
+                    std::cout << "Ignoring command since the system is in Emergency Shutdown Mode.\n\n";
+                }
+                // Either way every phone learns the settings in use
+                this->send_probe_config(msg->probe);
+                break;
+            }
+
+            // The Android app asked for the probe settings
+            case MSG_PROBE_CONFIG_REQUEST: {
+                std::cout << "Received from Android App: send the probe settings.\n\n";
+                for (uint8_t i = 0; i < this->m_tc_sampler->bus()->count(); i++)
+                    this->send_probe_config(i, client);
+                break;
+            }
+
             // Unknown message received
             default: {
                 std::cout << "Received unknown Bluetooth message. Message type = " <<
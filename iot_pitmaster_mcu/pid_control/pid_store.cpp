@@ -0,0 +1,147 @@
+/**
+ * @file pid_store.cpp
+ * @brief Controller state kept in NVS through restarts
+ *
+ */
+#include "pid_store.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "sys_clock.hpp"
+
+// Whether two states differ in anything but the integrator
+bool pid_settings_differ(const pid_saved_state& a, const pid_saved_state& b) {
+    return a.gains.kp != b.gains.kp || a.gains.ki != b.gains.ki || a.gains.kd != b.gains.kd ||
+            a.set_point_C != b.set_point_C || a.mode_auto != b.mode_auto ||
+            a.cook_started != b.cook_started || a.damper_pct != b.damper_pct;
+}
+
+// Writes the state and commits it, the lock must be held
+bool pid_store::write(const pid_saved_state& state) {
+    this->m_written_us = sys_clock::now_us();
+    this->m_change_pending = false;
+    esp_err_t ret = nvs_set_blob(this->m_handle, PID_STORE_KEY, &state, sizeof(state));
+    if (ret == ESP_OK)
+        ret = nvs_commit(this->m_handle);
+    if (ret != ESP_OK) {
+        this->m_stats.write_errors++;
+        std::cout << "Error: unable to save the controller state, error " << std::hex << ret << std::dec << ".\n\n";
+        return false;
+    }
+    this->m_saved = state;
+    this->m_stats.writes++;
+    return true;
+}
+
+// Opens the namespace, NVS must be initialized
+bool pid_store::init() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    const esp_err_t ret = nvs_open(PID_STORE_NAMESPACE, NVS_READWRITE, &this->m_handle);
+    if (ret != ESP_OK) {
+        std::cout << "Error: unable to open NVS namespace \"" << PID_STORE_NAMESPACE << "\", the controller state " <<
+                "will not be kept.\n\n";
+        return false;
+    }
+    this->m_open = true;
+    return true;
+}
+
+// Reads the saved state, returns false if there is none or it is from another version
+bool pid_store::load(pid_saved_state& state) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_open)
+        return false;
+
+    pid_saved_state saved {};
+    size_t len = sizeof(saved);
+    if (nvs_get_blob(this->m_handle, PID_STORE_KEY, &saved, &len) != ESP_OK || len != sizeof(saved) ||
+            saved.version != PID_STORE_VERSION)
+        return false;
+    // Nothing non-finite gets into the controller
+    if (!std::isfinite(saved.gains.kp) || !std::isfinite(saved.gains.ki) || !std::isfinite(saved.gains.kd) ||
+            !std::isfinite(saved.set_point_C) || !std::isfinite(saved.integral_pct) || !std::isfinite(saved.prev_val_C))
+        return false;
+
+    this->m_saved = saved;
+    this->m_written_us = sys_clock::now_us();
+    this->m_stats.loaded = true;
+    state = saved;
+    return true;
+}
+
+// Takes the current state, writes it when the rate limits allow
+void pid_store::offer(const pid_saved_state& state) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_open)
+        return;
+    this->m_stats.offers++;
+    const int64_t now_us = sys_clock::now_us();
+
+    // A settings change waits until it stops changing
+    if (pid_settings_differ(state, this->m_saved)) {
+        if (!this->m_change_pending || pid_settings_differ(state, this->m_changed)) {
+            this->m_changed = state;
+            this->m_changed_us = now_us;
+            this->m_change_pending = true;
+        }
+        if (now_us - this->m_changed_us >= PID_STORE_SETTLE_S*1000000ll)
+            this->write(state);
+        return;
+    }
+    this->m_change_pending = false;
+
+    // The integrator alone only matters while cooking, and only once it has moved
+    if (state.cook_started && now_us - this->m_written_us >= PID_STORE_INTEGRAL_INTERVAL_S*1000000ll &&
+            std::fabs(state.integral_pct - this->m_saved.integral_pct) > PID_STORE_INTEGRAL_EPSILON)
+        this->write(state);
+}
+
+// Writes the state now
+bool pid_store::save(const pid_saved_state& state) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_open)
+        return false;
+    return this->write(state);
+}
+
+// Reads the saved probe table, returns false if there is none or it is from another version
+bool pid_store::load_probes(tc_probe_table& probes) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_open)
+        return false;
+
+    pid_saved_probes saved {};
+    size_t len = sizeof(saved);
+    if (nvs_get_blob(this->m_handle, PID_STORE_PROBES_KEY, &saved, &len) != ESP_OK || len != sizeof(saved) ||
+            saved.version != PID_STORE_PROBES_VERSION)
+        return false;
+    std::copy(saved.probes, saved.probes + TC_BUS_MAX_PROBES, probes.begin());
+    return true;
+}
+
+// Writes the probe table now
+bool pid_store::save_probes(const tc_probe_table& probes) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    if (!this->m_open)
+        return false;
+
+    pid_saved_probes saved {};
+    std::copy(probes.begin(), probes.end(), saved.probes);
+    esp_err_t ret = nvs_set_blob(this->m_handle, PID_STORE_PROBES_KEY, &saved, sizeof(saved));
+    if (ret == ESP_OK)
+        ret = nvs_commit(this->m_handle);
+    if (ret != ESP_OK) {
+        this->m_stats.write_errors++;
+        std::cout << "Error: unable to save the probe settings, error " << std::hex << ret << std::dec << ".\n\n";
+        return false;
+    }
+    this->m_stats.writes++;
+    return true;
+}
+
+pid_store_stats pid_store::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_stats;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file pid_store.hpp
+ * @brief Controller state kept in NVS through restarts
+ *
+ * The gains, set point, mode, damper and integrator go to NVS as one
+ * blob, so a restart costs one write and never leaves half of them
+ * updated. Writes are rate limited: a change to the settings is written
+ * once it has held for PID_STORE_SETTLE_S, so a burst of edits from the
+ * app is one write, and the integrator alone is written at most every
+ * PID_STORE_INTEGRAL_INTERVAL_S while it keeps moving. The probe table
+ * is a blob of its own, written only when the app changes it.
+ */
+#ifndef __PID_STORE_HPP__
+#define __PID_STORE_HPP__
+
+#include <cstdint>
+#include <mutex>
+
+#include "nvs.h"
+
+#include "tc_sampler.hpp"
+
+#define PID_STORE_NAMESPACE             "pid"
+#define PID_STORE_KEY                   "state"
+#define PID_STORE_VERSION               (3)
+#define PID_STORE_PROBES_KEY            "probes"
+#define PID_STORE_PROBES_VERSION        (1)
+
+// Seconds a settings change must hold before it is written
+#define PID_STORE_SETTLE_S              (2)
+
+// Seconds between integrator-only writes, and the change worth one
+#define PID_STORE_INTEGRAL_INTERVAL_S   (60)
+#define PID_STORE_INTEGRAL_EPSILON      (0.5f)
+
+// Largest gain MSG_GAINS or an autotune may set
+#define PID_GAIN_MAX                    (1000)
+
+// PID tuner gains
+struct __attribute__ ((packed)) pid_gains {
+    float kp {1};
+    float ki {.08};
+    float kd {.5};
+};
+
+// Everything the controller needs to carry on where it stopped
+struct __attribute__ ((packed)) pid_saved_state {
+    uint8_t version {PID_STORE_VERSION};
+    pid_gains gains {};
+    float set_point_C {0};
+    float integral_pct {0}; // the integral term, fan percent
+    float prev_val_C {0};
+    uint8_t mode_auto {1};
+    uint8_t cook_started {0};
+    uint8_t damper_pct {0}; // 0 closed to 100 fully open
+};
+
+// Every probe's settings
+struct __attribute__ ((packed)) pid_saved_probes {
+    uint8_t version {PID_STORE_PROBES_VERSION};
+    tc_probe_config probes[TC_BUS_MAX_PROBES] {};
+};
+
+struct pid_store_stats {
+    uint32_t offers {0};
+    uint32_t writes {0};
+    uint32_t write_errors {0};
+    bool loaded {false};
+};
+
+class pid_store {
+
+    private:
+
+        std::mutex m_lock;
+        nvs_handle_t m_handle {0};
+        bool m_open {false};
+
+        // What NVS holds, and the settings change waiting to settle
+        pid_saved_state m_saved {};
+        pid_saved_state m_changed {};
+        bool m_change_pending {false};
+        int64_t m_changed_us {0};
+        int64_t m_written_us {0};
+
+        pid_store_stats m_stats {};
+
+        // Writes the state and commits it, the lock must be held
+        bool write(const pid_saved_state& state);
+
+    public:
+
+        // Opens the namespace, NVS must be initialized
+        bool init();
+
+        // Reads the saved state, returns false if there is none or it is from another version
+        bool load(pid_saved_state& state);
+
+        // Takes the current state, writes it when the rate limits allow
+        void offer(const pid_saved_state& state);
+
+        // Writes the state now
+        bool save(const pid_saved_state& state);
+
+        // Reads the saved probe table, returns false if there is none or it is from another version
+        bool load_probes(tc_probe_table& probes);
+
+        // Writes the probe table now
+        bool save_probes(const tc_probe_table& probes);
+
+        pid_store_stats stats();
+};
+
+// Whether two states differ in anything but the integrator
+bool pid_settings_differ(const pid_saved_state& a, const pid_saved_state& b);
+
+#endif /* __PID_STORE_HPP__ */
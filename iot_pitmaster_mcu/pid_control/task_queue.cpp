@@ -0,0 +1,83 @@
+/**
+ * @file task_queue.cpp
+ * @brief Bounded, blocking work queue for the stepper motor taskers
+ * 
+ */
+#include "task_queue.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "sys_clock.hpp"
+
+// Adds a task and wakes the tasker, returns false if the queue is full
+bool task_queue::push(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        if (this->m_entries.size() >= this->m_capacity) {
+            this->m_stats.rejected++;
+            std::cout << "Error: " << this->m_name << " task queue is full, dropping task.\n\n";
+            return false;
+        }
+        this->m_entries.push_back({std::move(task), sys_clock::now_us()});
+    }
+    this->m_not_empty.notify_one();
+    return true;
+}
+
+// Cancels every pending task, returns how many were removed
+size_t task_queue::flush() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    const size_t removed = this->m_entries.size();
+    this->m_entries.clear();
+    this->m_stats.cancelled += removed;
+    return removed;
+}
+
+// Blocks until a task is available and removes it, oldest first
+task_queue::entry task_queue::pop() {
+    std::unique_lock<std::mutex> lock(this->m_lock);
+    if (this->m_entries.empty()) {
+        sys_clock::waiting();
+        this->m_not_empty.wait(lock, [this]() {return !this->m_entries.empty();});
+        sys_clock::resumed();
+    }
+
+    entry next = std::move(this->m_entries.front());
+    this->m_entries.pop_front();
+    return next;
+}
+
+// Tasker loop, runs tasks one at a time forever
+void task_queue::run() {
+    sys_clock::name_task(this->m_name.c_str());
+    while (true) {
+        entry next = this->pop();
+        const int64_t started_us = sys_clock::now_us();
+        if (next.task)
+            next.task();
+        const int64_t finished_us = sys_clock::now_us();
+
+        const uint32_t wait_us = static_cast<uint32_t>(started_us - next.enqueued_us);
+        const uint32_t run_us = static_cast<uint32_t>(finished_us - started_us);
+
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        this->m_stats.executed++;
+        this->m_stats.total_wait_us += wait_us;
+        this->m_stats.max_wait_us = std::max(this->m_stats.max_wait_us, wait_us);
+        this->m_stats.total_run_us += run_us;
+        this->m_stats.max_run_us = std::max(this->m_stats.max_run_us, run_us);
+    }
+}
+
+size_t task_queue::size() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_entries.size();
+}
+
+task_queue_stats task_queue::stats() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    task_queue_stats stats = this->m_stats;
+    stats.pending = this->m_entries.size();
+    return stats;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file task_queue.hpp
+ * @brief Bounded, blocking work queue for the stepper motor taskers
+ * 
+ */
+#ifndef __TASK_QUEUE_HPP__
+#define __TASK_QUEUE_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Default number of tasks a queue holds before push() starts refusing
+#define TASK_QUEUE_CAPACITY (8)
+
+// Latency and throughput counters for one queue
+struct task_queue_stats {
+    uint32_t executed {0};
+    uint32_t rejected {0}; // push() refused because the queue was full
+    uint32_t cancelled {0}; // removed by flush() before they ran
+    uint32_t pending {0};
+    uint64_t total_wait_us {0}; // enqueue to start
+    uint32_t max_wait_us {0};
+    uint64_t total_run_us {0}; // start to finish
+    uint32_t max_run_us {0};
+};
+
+class task_queue {
+
+    private:
+
+        struct entry {
+            std::function<void()> task;
+            int64_t enqueued_us;
+        };
+
+        // queue name, used for debugging purposes
+        std::string m_name;
+        size_t m_capacity;
+
+        std::mutex m_lock;
+        std::condition_variable m_not_empty;
+        std::deque<entry> m_entries;
+        task_queue_stats m_stats {};
+
+        // Blocks until a task is available and removes it, oldest first
+        entry pop();
+
+    public:
+
+        inline task_queue(const std::string name, const size_t capacity = TASK_QUEUE_CAPACITY) {
+            this->m_name = name;
+            this->m_capacity = capacity;
+        }
+
+        task_queue(const task_queue&) = delete;
+        task_queue& operator=(const task_queue&) = delete;
+
+        // Adds a task and wakes the tasker, returns false if the queue is full
+        bool push(std::function<void()> task);
+
+        // Cancels every pending task, returns how many were removed
+        size_t flush();
+
+        // Tasker loop, runs tasks one at a time forever
+        void run();
+
+        // Creates the tasker thread for this queue
+        inline std::thread start() {
+            return std::thread([this]() {this->run();});
+        }
+
+        size_t size();
+
+        task_queue_stats stats();
+
+        inline const std::string& name() {
+            return this->m_name;
+        }
+};
+
+#endif /* __TASK_QUEUE_HPP__ */
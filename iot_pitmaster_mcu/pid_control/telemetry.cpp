@@ -0,0 +1,179 @@
+/**
+ * @file telemetry.cpp
+ * @brief Compact, change-driven status reports for the Android app
+ * 
+ */
+#include "telemetry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+static int16_t to_quarter_degrees(const float temp_C) {
+    return static_cast<int16_t>(std::clamp<long>(std::lround(temp_C*4), INT16_MIN, INT16_MAX));
+}
+
+// Converts the system status to fixed point
+telemetry_sample telemetry_sample_from(const out_msg_all_data& data) {
+    telemetry_sample sample;
+    sample.probes = data.probes_active;
+
+    // The logged readings and their fault bits go by role, like the controller's chamber reading
+    uint8_t logged_faults = data.temp_data_chamber.fault ? TELEMETRY_STATUS_CHAMBER_FAULT : 0;
+    sample.logged_qc[TELEMETRY_LOGGED_CHAMBER] = to_quarter_degrees(data.temp_data_chamber.thermocouple_C);
+    size_t meat {TELEMETRY_LOGGED_MEAT1};
+    for (size_t i = 0; i < TELEMETRY_PROBES; i++) {
+        if (!(data.probes_active & (1 << i)))
+            continue;
+        sample.temp_qc[i] = to_quarter_degrees(data.probes[i].thermocouple_C);
+        sample.faults |= data.probes[i].fault ? 1 << i : 0;
+        if (data.probe_roles[i] == TC_ROLE_MEAT && meat < TELEMETRY_LOGGED_PROBES) {
+            sample.logged_qc[meat] = sample.temp_qc[i];
+            logged_faults |= data.probes[i].fault ? 1 << meat : 0;
+            meat++;
+        }
+    }
+    sample.fan_duty = static_cast<uint8_t>(std::clamp<int>(data.duty_cycle, 0, 100));
+    sample.status = logged_faults |
+            (data.input_fuel ? TELEMETRY_STATUS_HOPPER_ON : 0) |
+            (data.position_open ? TELEMETRY_STATUS_DAMPER_OPEN : 0);
+    sample.fuel_dg_per_min = data.fuel_dg_per_min;
+    return sample;
+}
+
+// Encodes the report for this sample into out, returns its size, 0 if nothing needs sending
+size_t telemetry_encoder::encode(const telemetry_sample& sample, uint8_t* out, const size_t out_size) {
+    if (out_size < TELEMETRY_MAX_SIZE)
+        return 0;
+
+    // The phone learns which probes are active from a keyframe
+    const bool keyframe = this->m_keyframe_due || this->m_since_keyframe + 1 >= TELEMETRY_KEYFRAME_INTERVAL ||
+            sample.probes != this->m_sent.probes;
+    uint8_t channels {TELEMETRY_CH_ALL};
+    uint8_t probes {sample.probes};
+    if (!keyframe) {
+        channels = 0;
+        probes = 0;
+        for (size_t i = 0; i < TELEMETRY_PROBES; i++) {
+            if ((sample.probes & (1 << i)) &&
+                    std::abs(sample.temp_qc[i] - this->m_sent.temp_qc[i]) >= TELEMETRY_TEMP_DEADBAND_QC)
+                probes |= 1 << i;
+        }
+        if (probes != 0)
+            channels |= TELEMETRY_CH_PROBES;
+        if (sample.fan_duty != this->m_sent.fan_duty)
+            channels |= TELEMETRY_CH_FAN;
+        if (sample.status != this->m_sent.status)
+            channels |= TELEMETRY_CH_STATUS;
+        if (sample.faults != this->m_sent.faults)
+            channels |= TELEMETRY_CH_FAULTS;
+        if (sample.fuel_dg_per_min != this->m_sent.fuel_dg_per_min)
+            channels |= TELEMETRY_CH_FUEL;
+    }
+
+    this->m_since_keyframe++;
+    if (channels == 0) {
+        this->m_stats.suppressed++;
+        return 0;
+    }
+
+    size_t len {0};
+    out[len++] = MSG_TELEMETRY;
+    out[len++] = channels | (keyframe ? TELEMETRY_KEYFRAME : 0);
+    if (channels & TELEMETRY_CH_PROBES) {
+        out[len++] = probes;
+        for (size_t i = 0; i < TELEMETRY_PROBES; i++) {
+            if (probes & (1 << i)) {
+                const uint16_t value = static_cast<uint16_t>(sample.temp_qc[i]);
+                out[len++] = value & 0xff;
+                out[len++] = value >> 8;
+                this->m_sent.temp_qc[i] = sample.temp_qc[i];
+            }
+        }
+        if (keyframe)
+            this->m_sent.probes = sample.probes;
+    }
+    if (channels & TELEMETRY_CH_FAN) {
+        out[len++] = sample.fan_duty;
+        this->m_sent.fan_duty = sample.fan_duty;
+    }
+    if (channels & TELEMETRY_CH_STATUS) {
+        out[len++] = sample.status;
+        this->m_sent.status = sample.status;
+    }
+    if (channels & TELEMETRY_CH_FAULTS) {
+        out[len++] = sample.faults;
+        this->m_sent.faults = sample.faults;
+    }
+    if (channels & TELEMETRY_CH_FUEL) {
+        out[len++] = sample.fuel_dg_per_min;
+        this->m_sent.fuel_dg_per_min = sample.fuel_dg_per_min;
+    }
+
+    if (keyframe) {
+        this->m_keyframe_due = false;
+        this->m_since_keyframe = 0;
+        this->m_stats.keyframes++;
+    }
+    else {
+        this->m_stats.deltas++;
+    }
+    this->m_stats.bytes += len;
+    return len;
+}
+
+// Applies one MSG_TELEMETRY payload, returns false if it is malformed or a delta arrives before any keyframe
+bool telemetry_decoder::decode(const uint8_t* payload, const size_t len) {
+    if (len < 2 || payload[0] != MSG_TELEMETRY)
+        return false;
+
+    const uint8_t header = payload[1];
+    const uint8_t channels = header & TELEMETRY_CH_ALL;
+    const bool keyframe = header & TELEMETRY_KEYFRAME;
+    if ((header & ~(TELEMETRY_CH_ALL | TELEMETRY_KEYFRAME)) || (keyframe && channels != TELEMETRY_CH_ALL))
+        return false;
+    if (!keyframe && !this->m_synced)
+        return false;
+
+    size_t pos {2};
+    uint8_t probes {0};
+    if (channels & TELEMETRY_CH_PROBES) {
+        if (len < pos + 1)
+            return false;
+        probes = payload[pos++];
+        // A delta only moves probes the last keyframe named
+        if (!keyframe && (probes & ~this->m_state.probes))
+            return false;
+    }
+    size_t expected {pos};
+    for (size_t i = 0; i < TELEMETRY_PROBES; i++)
+        expected += (probes & (1 << i)) ? 2 : 0;
+    expected += (channels & TELEMETRY_CH_FAN) ? 1 : 0;
+    expected += (channels & TELEMETRY_CH_STATUS) ? 1 : 0;
+    expected += (channels & TELEMETRY_CH_FAULTS) ? 1 : 0;
+    expected += (channels & TELEMETRY_CH_FUEL) ? 1 : 0;
+    if (len != expected)
+        return false;
+
+    if (keyframe) {
+        this->m_state.probes = probes;
+        this->m_state.temp_qc.fill(0);
+    }
+    for (size_t i = 0; i < TELEMETRY_PROBES; i++) {
+        if (probes & (1 << i)) {
+            this->m_state.temp_qc[i] = static_cast<int16_t>(payload[pos] | (payload[pos + 1] << 8));
+            pos += 2;
+        }
+    }
+    if (channels & TELEMETRY_CH_FAN)
+        this->m_state.fan_duty = payload[pos++];
+    if (channels & TELEMETRY_CH_STATUS)
+        this->m_state.status = payload[pos++];
+    if (channels & TELEMETRY_CH_FAULTS)
+        this->m_state.faults = payload[pos++];
+    if (channels & TELEMETRY_CH_FUEL)
+        this->m_state.fuel_dg_per_min = payload[pos++];
+
+    this->m_synced = this->m_synced || keyframe;
+    return true;
+}
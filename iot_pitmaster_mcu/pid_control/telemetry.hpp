@@ -0,0 +1,133 @@
+/**
+ * @file telemetry.hpp
+ * @brief Compact, change-driven status reports for the Android app
+ * 
+ * Temperatures go out as int16 quarter-degrees, the MAX31855 resolution,
+ * and only for the probes in use, so a report grows with the probes and
+ * not with the bus. A keyframe carries every channel and names the
+ * active probes. In between, a delta carries only the channels and
+ * probes that changed, and nothing is sent if none did. Deltas hold
+ * absolute values, so a lost one costs that one update and not the ones
+ * after it, and a change to the active probes always goes as a keyframe.
+ * 
+ *   MSG_TELEMETRY | header | [probe mask | int16 per probe in mask] | [fan] | [status] | [faults] | [fuel]
+ * 
+ *   header bit 7: keyframe, bits 0-4: channels present
+ *   probe mask: a bit per probe slot, little-endian int16s follow in slot order
+ */
+#ifndef __TELEMETRY_HPP__
+#define __TELEMETRY_HPP__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "bt_msg.hpp"
+
+// Channels
+#define TELEMETRY_CH_PROBES     (0x01) // uint8 probe mask, then int16 quarter-degrees C for each probe in it
+#define TELEMETRY_CH_FAN        (0x02) // uint8 duty cycle, 0-100%
+#define TELEMETRY_CH_STATUS     (0x04) // uint8, TELEMETRY_STATUS_* bits
+#define TELEMETRY_CH_FAULTS     (0x08) // uint8, a bit per faulted probe slot
+#define TELEMETRY_CH_FUEL       (0x10) // uint8 fuel rate the auger delivered, tenths of a gram a minute
+#define TELEMETRY_CH_ALL        (0x1f)
+#define TELEMETRY_KEYFRAME      (0x80)
+
+// Status byte, the fault bits go with the readings the history and the cook log keep, by role
+#define TELEMETRY_STATUS_CHAMBER_FAULT  (0x01) // no chamber probe has a good reading
+#define TELEMETRY_STATUS_MEAT1_FAULT    (0x02)
+#define TELEMETRY_STATUS_MEAT2_FAULT    (0x04)
+#define TELEMETRY_STATUS_HOPPER_ON      (0x08)
+#define TELEMETRY_STATUS_DAMPER_OPEN    (0x10)
+
+// Probe slots a report can carry
+#define TELEMETRY_PROBES        (TC_BUS_MAX_PROBES)
+
+// Readings the history and the cook log keep: the chamber as the controller holds it, then the
+// first two meat probes in slot order, whichever slots have those roles
+#define TELEMETRY_LOGGED_CHAMBER    (0)
+#define TELEMETRY_LOGGED_MEAT1      (1)
+#define TELEMETRY_LOGGED_MEAT2      (2)
+#define TELEMETRY_LOGGED_PROBES     (3)
+
+// Largest encoded report, a keyframe with every probe active
+#define TELEMETRY_MAX_SIZE      (2 + 1 + TELEMETRY_PROBES*sizeof(int16_t) + 4)
+
+// Reports between keyframes
+#define TELEMETRY_KEYFRAME_INTERVAL     (10)
+
+// A temperature must move this many quarter-degrees to go out in a delta
+#define TELEMETRY_TEMP_DEADBAND_QC      (2)
+
+// One status report in fixed point
+struct telemetry_sample {
+    std::array<int16_t, TELEMETRY_PROBES> temp_qc {}; // by probe slot, 0 for a probe that is off
+    std::array<int16_t, TELEMETRY_LOGGED_PROBES> logged_qc {}; // by TELEMETRY_LOGGED_*, 0 for no such probe
+    uint8_t probes {0}; // active probe slots
+    uint8_t faults {0}; // faulted probe slots
+    uint8_t fan_duty {0};
+    uint8_t status {0};
+    uint8_t fuel_dg_per_min {0}; // not kept by the history or the cook log
+};
+
+// Converts the system status to fixed point
+telemetry_sample telemetry_sample_from(const out_msg_all_data& data);
+
+inline float telemetry_temp_C(const int16_t temp_qc) {
+    return 0.25f*temp_qc;
+}
+
+struct telemetry_stats {
+    uint32_t keyframes {0};
+    uint32_t deltas {0};
+    uint32_t suppressed {0}; // nothing had changed
+    uint32_t bytes {0};
+};
+
+class telemetry_encoder {
+
+    private:
+
+        telemetry_sample m_sent {};
+        bool m_keyframe_due {true};
+        uint32_t m_since_keyframe {0};
+        telemetry_stats m_stats {};
+
+    public:
+
+        // Encodes the report for this sample into out, returns its size, 0 if nothing needs sending
+        size_t encode(const telemetry_sample& sample, uint8_t* out, size_t out_size);
+
+        // Makes the next report a keyframe, e.g. for a phone that just connected
+        inline void force_keyframe() {
+            this->m_keyframe_due = true;
+        }
+
+        inline const telemetry_stats& stats() const {
+            return this->m_stats;
+        }
+};
+
+class telemetry_decoder {
+
+    private:
+
+        telemetry_sample m_state {};
+        bool m_synced {false};
+
+    public:
+
+        // Applies one MSG_TELEMETRY payload, returns false if it is malformed or a delta arrives before any keyframe
+        bool decode(const uint8_t* payload, size_t len);
+
+        // The state as of the last report, valid once synced() is true
+        inline const telemetry_sample& state() const {
+            return this->m_state;
+        }
+
+        inline bool synced() const {
+            return this->m_synced;
+        }
+};
+
+#endif /* __TELEMETRY_HPP__ */
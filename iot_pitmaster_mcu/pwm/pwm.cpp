@@ -5,34 +5,135 @@
  */
 #include "pwm.hpp"
 
-#include <chrono>
+#include <algorithm>
 #include <iostream>
-#include <thread>
+#include <mutex>
 
 #include "driver/gpio.h"
+#include "driver/ledc.h"
 
-void pwm::pwm_run() {
-    if (this->m_gpio != GPIO_NUM_NC) {
-        // pwm GPIO setup
-        gpio_reset_pin(this->m_gpio);
-        gpio_set_direction(this->m_gpio, GPIO_MODE_OUTPUT);
-        gpio_set_level(this->m_gpio, 0);
-
-        while (true) {
-            // on part of cycle
-            if (this->m_duty_cycle > 0) {
-                gpio_set_level(this->m_gpio, 1);
-                std::this_thread::sleep_for(std::chrono::milliseconds(this->m_duty_cycle));
-            }
-
-            // off part of cycle
-            if (this->m_duty_cycle < 100) {
-                gpio_set_level(this->m_gpio, 0);
-                std::this_thread::sleep_for(std::chrono::milliseconds(100 - this->m_duty_cycle));
-            }
-        }
-    }
-    else {
+// The fade service is shared by every LEDC channel and may only be installed once
+static std::once_flag ledc_fade_installed;
+
+// Highest duty resolution the LEDC divider can reach at a frequency
+static ledc_timer_bit_t duty_resolution_for(const uint32_t freq_hz) {
+    int bits = PWM_MAX_DUTY_RESOLUTION;
+    while (bits > LEDC_TIMER_1_BIT && (static_cast<uint64_t>(freq_hz) << bits) > PWM_SRC_CLK_HZ)
+        bits--;
+    return static_cast<ledc_timer_bit_t>(bits);
+}
+
+// Converts a percent to hundredths of a percent, clamped to 0-100%
+static int16_t to_duty_hundredths(const float duty_percent) {
+    const float clamped = std::clamp(duty_percent, 0.0f, 100.0f);
+    return static_cast<int16_t>(clamped*100.0f + 0.5f);
+}
+
+// Sets up the LEDC timer and channel for the current frequency
+bool pwm::configure_ledc() {
+    if (this->m_gpio == GPIO_NUM_NC) {
         std::cout << "Error: This signal is not assigned to a valid GPIO.\n\n";
+        return false;
+    }
+
+    if (this->m_freq_hz < PWM_MIN_FREQ_HZ || this->m_freq_hz > PWM_MAX_FREQ_HZ) {
+        std::cout << "Error: pwm frequency must be between " << PWM_MIN_FREQ_HZ << " and " <<
+                PWM_MAX_FREQ_HZ << " Hz.\n\n";
+        return false;
+    }
+
+    this->m_duty_resolution = duty_resolution_for(this->m_freq_hz);
+
+    ledc_timer_config_t timer_cfg {};
+    timer_cfg.speed_mode = this->m_speed_mode;
+    timer_cfg.duty_resolution = this->m_duty_resolution;
+    timer_cfg.timer_num = this->m_timer;
+    timer_cfg.freq_hz = this->m_freq_hz;
+    timer_cfg.clk_cfg = LEDC_USE_APB_CLK;
+    if (ledc_timer_config(&timer_cfg) != ESP_OK) {
+        std::cout << "Error: configure pwm timer failed.\n\n";
+        return false;
+    }
+
+    ledc_channel_config_t channel_cfg {};
+    channel_cfg.gpio_num = this->m_gpio;
+    channel_cfg.speed_mode = this->m_speed_mode;
+    channel_cfg.channel = this->m_channel;
+    channel_cfg.intr_type = LEDC_INTR_DISABLE;
+    channel_cfg.timer_sel = this->m_timer;
+    channel_cfg.duty = this->to_duty_ticks(this->m_duty_hundredths);
+    channel_cfg.hpoint = 0;
+    if (ledc_channel_config(&channel_cfg) != ESP_OK) {
+        std::cout << "Error: configure pwm channel failed.\n\n";
+        return false;
+    }
+
+    // Needed for hardware fades, and makes duty updates thread safe
+    std::call_once(ledc_fade_installed, []() {ledc_fade_func_install(0);});
+
+    this->m_configured = true;
+    return true;
+}
+
+// Sets the duty cycle with sub-percent resolution, clamped to 0-100%
+bool pwm::set_duty_percent(const float duty_percent) {
+    const int16_t duty_hundredths = to_duty_hundredths(duty_percent);
+
+    std::lock_guard<std::mutex> lock(this->m_ledc_lock);
+    if (!this->m_configured)
+        return false;
+
+    if (ledc_set_duty_and_update(this->m_speed_mode, this->m_channel, this->to_duty_ticks(duty_hundredths), 0) != ESP_OK) {
+        std::cout << "Error: set pwm duty cycle failed.\n\n";
+        return false;
+    }
+    this->m_duty_hundredths = duty_hundredths;
+    this->m_pm_lock.hold(duty_hundredths > 0);
+
+    if constexpr (DEBUG_PWM)
+        std::cout << "Set pwm duty cycle to " << duty_hundredths / 100.0f << "%.\n\n";
+    return true;
+}
+
+// Ramps the duty cycle to duty_percent in hardware over fade_ms, returns immediately
+bool pwm::fade_to(const float duty_percent, const uint32_t fade_ms) {
+    const int16_t duty_hundredths = to_duty_hundredths(duty_percent);
+
+    std::lock_guard<std::mutex> lock(this->m_ledc_lock);
+    if (!this->m_configured)
+        return false;
+
+    if (ledc_set_fade_time_and_start(this->m_speed_mode, this->m_channel, this->to_duty_ticks(duty_hundredths),
+            fade_ms, LEDC_FADE_NO_WAIT) != ESP_OK) {
+        std::cout << "Error: start pwm fade failed.\n\n";
+        return false;
     }
-}
\ No newline at end of file
+    this->m_duty_hundredths = duty_hundredths;
+    // A fade down to 0 still needs the clock, the next set releases it
+    if (duty_hundredths > 0)
+        this->m_pm_lock.hold(true);
+
+    if constexpr (DEBUG_PWM)
+        std::cout << "Fading pwm duty cycle to " << duty_hundredths / 100.0f << "% over " << fade_ms << " ms.\n\n";
+    return true;
+}
+
+// Changes the pwm frequency, keeping the same duty cycle
+bool pwm::set_frequency(const uint32_t freq_hz) {
+    std::lock_guard<std::mutex> lock(this->m_ledc_lock);
+
+    const uint32_t old_freq_hz = this->m_freq_hz;
+    this->m_freq_hz = freq_hz;
+
+    // The duty resolution depends on the frequency, so the timer is reconfigured
+    if (!this->configure_ledc()) {
+        this->m_freq_hz = old_freq_hz;
+        this->configure_ledc();
+        return false;
+    }
+
+    if constexpr (DEBUG_PWM)
+        std::cout << "Set pwm frequency to " << freq_hz << " Hz with " << (1u << this->m_duty_resolution) <<
+                " duty steps.\n\n";
+    return true;
+}
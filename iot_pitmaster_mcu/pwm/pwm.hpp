@@ -9,30 +9,71 @@
 
 #include <atomic>
 #include <iostream>
+#include <mutex>
 
 #include "driver/gpio.h"
+#include "driver/ledc.h"
 
 #include "debug.hpp"
+#include "power.hpp"
+
+// Default blowfan pwm frequency, above the audible range so the fan does not whine
+#define PWM_DEFAULT_FREQ_HZ (25000)
+// Frequency range accepted by set_frequency
+#define PWM_MIN_FREQ_HZ (100)
+#define PWM_MAX_FREQ_HZ (40000)
+// Highest duty resolution used, even when the frequency would allow more
+#define PWM_MAX_DUTY_RESOLUTION (LEDC_TIMER_14_BIT)
+// LEDC source clock (APB)
+#define PWM_SRC_CLK_HZ (80*1000*1000)
 
 class pwm {
 
     private:
-        // The duty cycle of the pwm (0-100)%
-        std::atomic<int8_t> m_duty_cycle {0};
+        // The duty cycle of the pwm in hundredths of a percent (0-10000)
+        std::atomic<int16_t> m_duty_hundredths {0};
         // The gpio pin being used
         gpio_num_t m_gpio;
 
+        // LEDC peripheral resources driving the pin
+        ledc_timer_t m_timer;
+        ledc_channel_t m_channel;
+        static constexpr ledc_mode_t m_speed_mode {LEDC_HIGH_SPEED_MODE};
+
+        // PWM frequency and the duty resolution it allows
+        uint32_t m_freq_hz;
+        ledc_timer_bit_t m_duty_resolution {LEDC_TIMER_10_BIT};
+        bool m_configured {false};
+
+        // Serializes LEDC reconfiguration against duty updates
+        std::mutex m_ledc_lock;
+
+        // Keeps the APB clock the LEDC timer counts at full speed while the output is on
+        pm_lock m_pm_lock {ESP_PM_APB_FREQ_MAX, "pwm"};
+
+        // Sets up the LEDC timer and channel for the current frequency
+        bool configure_ledc();
+
+        // Converts hundredths of a percent to LEDC duty ticks
+        inline uint32_t to_duty_ticks(const int16_t duty_hundredths) const {
+            return (static_cast<uint32_t>(duty_hundredths) << this->m_duty_resolution) / 10000;
+        }
+
     public:
-        inline pwm(const gpio_num_t gpio, const int8_t duty_cycle) {
+        inline pwm(const gpio_num_t gpio, const int8_t duty_cycle, const uint32_t freq_hz = PWM_DEFAULT_FREQ_HZ,
+                const ledc_timer_t timer = LEDC_TIMER_0, const ledc_channel_t channel = LEDC_CHANNEL_0) {
             this->m_gpio = gpio;
-            this->m_duty_cycle = duty_cycle;
+            this->m_freq_hz = freq_hz;
+            this->m_timer = timer;
+            this->m_channel = channel;
+
+            this->configure_ledc();
+            this->set_duty_cycle(duty_cycle);
         }
 
         inline void set_duty_cycle(const int8_t duty_cycle) {
             if (duty_cycle >= 0 && duty_cycle <= 100) {
-                this->m_duty_cycle = duty_cycle;
-                if constexpr (DEBUG_PWM)
-                    std::cout << "Set pwm duty cycle to " << static_cast<int>(duty_cycle) << "%.\n\n";
+                this->set_duty_percent(duty_cycle);
             }
             else {
                 std::cout << "Duty cycle can only be set 0-100.\n\n";
@@ -40,11 +81,32 @@ class pwm {
         }
 
         inline int8_t get_duty_cycle() {
-            return this->m_duty_cycle;
+            return static_cast<int8_t>((this->m_duty_hundredths + 50) / 100);
         }
 
-        // Main pwm logic function
-        void pwm_run();
+        // Sets the duty cycle with sub-percent resolution, clamped to 0-100%
+        bool set_duty_percent(float duty_percent);
+
+        inline float get_duty_percent() {
+            return this->m_duty_hundredths / 100.0f;
+        }
+
+        // Ramps the duty cycle to duty_percent in hardware over fade_ms, returns immediately
+        bool fade_to(float duty_percent, uint32_t fade_ms);
+
+        // Changes the pwm frequency, keeping the same duty cycle
+        bool set_frequency(uint32_t freq_hz);
+
+        inline uint32_t get_frequency() {
+            std::lock_guard<std::mutex> lock(this->m_ledc_lock);
+            return this->m_freq_hz;
+        }
+
+        // Number of duty steps available at the current frequency
+        inline uint32_t duty_steps() {
+            std::lock_guard<std::mutex> lock(this->m_ledc_lock);
+            return 1u << this->m_duty_resolution;
+        }
 };
 
-#endif /* __PWM_HPP__ */
\ No newline at end of file
+#endif /* __PWM_HPP__ */
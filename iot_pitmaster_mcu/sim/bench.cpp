@@ -0,0 +1,1286 @@
+/**
+ * @file bench.cpp
+ * @brief Microbenchmarks for the firmware hot paths, built for the PC
+ *
+ * Each benchmark is timed in batches until it has run for at least the
+ * minimum time, and the median of several such runs is reported as
+ * ns/op and, on x86, TSC cycles/op together with the heap allocations
+ * the benchmark thread made per op. Results can be saved as JSON and
+ * later runs compared against them.
+ *
+ * The HAL calls land in sim/hal, so paths that touch a peripheral
+ * measure the firmware plus a cheap stand-in, not the ESP32 driver.
+ * socket/ benchmarks go through the kernel and measure wall time.
+ */
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "esp_partition.h"
+#include "esp_spp_api.h"
+#include "esp_system.h"
+#include "sim_clock.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "a4988_driver.hpp"
+#include "board.hpp"
+#include "bluetooth.hpp"
+#include "bt_frame.hpp"
+#include "bt_tx_queue.hpp"
+#include "control_state.hpp"
+#include "controller.hpp"
+#include "cook_log.hpp"
+#include "fuel_feeder.hpp"
+#include "history.hpp"
+#include "max31855.hpp"
+#include "pid.hpp"
+#include "pid_control.hpp"
+#include "pid_store.hpp"
+#include "pwm.hpp"
+#include "socket_transport.hpp"
+#include "sys_clock.hpp"
+#include "task_queue.hpp"
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
+#include "telemetry.hpp"
+
+// Default time each timed run lasts at least
+#define BENCH_DEFAULT_MIN_MS (100)
+// Timed runs per benchmark, the median is reported
+#define BENCH_RUNS (5)
+// Default slowdown allowed by --compare before it fails, in percent
+#define BENCH_DEFAULT_THRESHOLD_PCT (15)
+// Length of the made-up cook used when no --history-trace is given
+#define BENCH_HISTORY_SYNTHETIC_S (6*3600)
+// Bytes of one sample kept uncompressed: uptime, three temperatures, fan and status
+#define BENCH_HISTORY_RAW_BYTES (4 + 3*2 + 1 + 1)
+// Snapshots the control state check publishes before it stops, and the reads each reader keeps to check
+#define BENCH_STATE_VERSIONS (1 << 18)
+#define BENCH_STATE_READS (1 << 20)
+// Longest the control state check runs
+#define BENCH_STATE_STRESS_MS (500)
+// Step pin of the stepper the pulse check drives, no board signal uses it
+#define BENCH_STEP_GPIO (GPIO_NUM_31)
+// Steps of the pulse check's move, and the step its stopped move is stopped at
+#define BENCH_STEP_MOVE (1000)
+#define BENCH_STEP_STOP_AT (400)
+// Refused moves chained from on_done, more than the move dispatcher queue holds
+#define BENCH_STEP_REFUSALS (32u)
+// Pin of the pwm the LEDC check drives, no board signal uses it
+#define BENCH_PWM_GPIO (GPIO_NUM_30)
+// Seconds a control law runs at each rate when the fan loop rate changes under it
+#define BENCH_RATE_PHASE_S (20)
+
+// Heap allocations made by the current thread
+static thread_local uint64_t thread_allocs {0};
+
+void* operator new(const size_t size) {
+    thread_allocs++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](const size_t size) {
+    thread_allocs++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete[](void* p) noexcept {std::free(p);}
+void operator delete(void* p, size_t) noexcept {std::free(p);}
+void operator delete[](void* p, size_t) noexcept {std::free(p);}
+
+// Stops the compiler from dropping a result that is never used
+template <typename T>
+static inline void bench_keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// CPU cycle counter, the TSC on x86 and none elsewhere
+static inline uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct bench_result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double cycles_per_op;
+};
+
+// One benchmark: op() is timed batch times in a row, between() runs untimed after every batch
+struct bench_case {
+    std::string name;
+    uint32_t batch;
+    std::function<void()> op;
+    std::function<void()> between;
+};
+
+class bench_runner {
+
+    private:
+
+        std::vector<bench_case> m_cases;
+        std::chrono::nanoseconds m_min_time;
+        std::string m_filter;
+
+        // Times one run of at least m_min_time, returns ns/op, allocs/op and cycles/op
+        bench_result run_once(const bench_case& c, uint64_t& batches) {
+            using clock = std::chrono::steady_clock;
+            std::chrono::nanoseconds elapsed {0};
+            uint64_t allocs {0};
+            uint64_t cycles {0};
+            uint64_t done {0};
+
+            while (elapsed < this->m_min_time || done < batches) {
+                const uint64_t allocs_before = thread_allocs;
+                const clock::time_point start = clock::now();
+                const uint64_t cycles_before = bench_cycles();
+                for (uint32_t i = 0; i < c.batch; i++)
+                    c.op();
+                cycles += bench_cycles() - cycles_before;
+                elapsed += clock::now() - start;
+                allocs += thread_allocs - allocs_before;
+                done++;
+                if (c.between)
+                    c.between();
+            }
+            batches = done;
+
+            const uint64_t ops = done*c.batch;
+            return {c.name, ops, static_cast<double>(elapsed.count())/ops, static_cast<double>(allocs)/ops,
+                    static_cast<double>(cycles)/ops};
+        }
+
+    public:
+
+        inline bench_runner(const std::chrono::milliseconds min_time, const std::string& filter) {
+            this->m_min_time = min_time;
+            this->m_filter = filter;
+        }
+
+        void add(const std::string& name, std::function<void()> op, const uint32_t batch = 1,
+                std::function<void()> between = nullptr) {
+            this->m_cases.push_back({name, batch, std::move(op), std::move(between)});
+        }
+
+        // Runs every benchmark that matches the filter
+        std::vector<bench_result> run() {
+            std::vector<bench_result> results;
+            for (const bench_case& c : this->m_cases) {
+                if (!this->m_filter.empty() && c.name.find(this->m_filter) == std::string::npos)
+                    continue;
+
+                // Warm up, and find how many batches fill the minimum time
+                uint64_t batches {1};
+                this->run_once(c, batches);
+
+                std::vector<bench_result> runs;
+                for (int i = 0; i < BENCH_RUNS; i++)
+                    runs.push_back(this->run_once(c, batches));
+                std::sort(runs.begin(), runs.end(), [](const bench_result& a, const bench_result& b) {
+                    return a.ns_per_op < b.ns_per_op;
+                });
+                results.push_back(runs[BENCH_RUNS/2]);
+
+                const bench_result& r = results.back();
+                std::printf("%-36s %12llu %12.1f %12.0f %10.2f\n", r.name.c_str(),
+                        static_cast<unsigned long long>(r.iterations), r.ns_per_op, r.cycles_per_op, r.allocs_per_op);
+                std::fflush(stdout);
+            }
+            return results;
+        }
+};
+
+// Swallows the firmware's console output
+class null_buffer : public std::streambuf {
+    protected:
+        int overflow(int c) override {return c;}
+};
+
+static bool write_json(const std::string& path, const std::vector<bench_result>& results) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+                "\"cycles_per_op\": %.1f}%s\n",
+                results[i].name.c_str(), static_cast<unsigned long long>(results[i].iterations),
+                results[i].ns_per_op, results[i].allocs_per_op, results[i].cycles_per_op,
+                i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+// Reads a file written by write_json(), one benchmark object per line
+static bool read_json(const std::string& path, std::map<std::string, bench_result>& results) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    auto field = [](const std::string& line, const std::string& key) -> std::string {
+        const std::string tag = "\"" + key + "\":";
+        const size_t at = line.find(tag);
+        if (at == std::string::npos)
+            return "";
+        size_t begin = line.find_first_not_of(" \"", at + tag.size());
+        size_t end = line.find_first_of("\",}", begin);
+        return begin == std::string::npos ? "" : line.substr(begin, end - begin);
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string name = field(line, "name");
+        if (name.empty())
+            continue;
+        bench_result r {name, 0, 0, 0, 0};
+        r.iterations = std::stoull(field(line, "iterations"));
+        r.ns_per_op = std::stod(field(line, "ns_per_op"));
+        r.allocs_per_op = std::stod(field(line, "allocs_per_op"));
+        // Baselines from before the cycle counter have none
+        const std::string cycles = field(line, "cycles_per_op");
+        r.cycles_per_op = cycles.empty() ? 0 : std::stod(cycles);
+        results[name] = r;
+    }
+    return true;
+}
+
+// Prints the change against a baseline, returns false if anything regressed
+static bool compare(const std::vector<bench_result>& results, const std::map<std::string, bench_result>& baseline,
+        const double threshold_pct) {
+    bool passed {true};
+    std::printf("\n%-36s %12s %12s %8s %10s\n", "benchmark", "base ns/op", "ns/op", "change", "allocs");
+    for (const bench_result& r : results) {
+        auto base = baseline.find(r.name);
+        if (base == baseline.end()) {
+            std::printf("%-36s %12s %12.1f %8s %10.2f  new\n", r.name.c_str(), "-", r.ns_per_op, "-", r.allocs_per_op);
+            continue;
+        }
+        const double change_pct = 100.0*(r.ns_per_op - base->second.ns_per_op)/base->second.ns_per_op;
+        const bool slower = change_pct > threshold_pct;
+        // Allocation counts are exact, any increase is a regression
+        const bool more_allocs = r.allocs_per_op > base->second.allocs_per_op + 0.005;
+        std::printf("%-36s %12.1f %12.1f %+7.1f%% %10.2f%s%s\n", r.name.c_str(), base->second.ns_per_op, r.ns_per_op,
+                change_pct, r.allocs_per_op, slower ? "  SLOWER" : "", more_allocs ? "  MORE ALLOCS" : "");
+        passed = passed && !slower && !more_allocs;
+    }
+    return passed;
+}
+
+struct history_point {
+    uint32_t t_s;
+    telemetry_sample sample;
+};
+
+// Reads the probes, fan and damper columns of a sim CSV trace, recorded with --trace-s 1
+static bool read_history_trace(const std::string& path, std::vector<history_point>& points) {
+    std::ifstream in(path);
+    std::string line;
+    if (!in || !std::getline(in, line))
+        return false;
+
+    std::vector<std::string> columns;
+    std::stringstream header(line);
+    for (std::string column; std::getline(header, column, ',');)
+        columns.push_back(column);
+    auto index = [&columns](const std::string& name) {
+        return static_cast<size_t>(std::find(columns.begin(), columns.end(), name) - columns.begin());
+    };
+    const size_t time_col = index("time_s");
+    const size_t temp_cols[TELEMETRY_LOGGED_PROBES] {index("chamber_read_C"), index("meat1_C"), index("meat2_C")};
+    const size_t fan_col = index("fan_pct");
+    const size_t damper_col = index("damper_pct");
+    if (std::max({time_col, temp_cols[0], temp_cols[1], temp_cols[2], fan_col, damper_col}) >= columns.size())
+        return false;
+
+    while (std::getline(in, line)) {
+        std::vector<double> values;
+        std::stringstream row(line);
+        for (std::string value; std::getline(row, value, ',');)
+            values.push_back(std::atof(value.c_str()));
+        if (values.size() < columns.size())
+            continue;
+        history_point point;
+        point.t_s = static_cast<uint32_t>(values[time_col]);
+        for (size_t i = 0; i < TELEMETRY_LOGGED_PROBES; i++)
+            point.sample.logged_qc[i] = static_cast<int16_t>(std::lround(values[temp_cols[i]]*4));
+        point.sample.fan_duty = static_cast<uint8_t>(std::lround(values[fan_col]));
+        point.sample.status = values[damper_col] > 50 ? TELEMETRY_STATUS_DAMPER_OPEN : 0;
+        points.push_back(point);
+    }
+    return !points.empty();
+}
+
+// A made-up cook: the pit heats up and holds, the meat follows, every probe reads with a little noise
+static std::vector<history_point> synthetic_history_trace() {
+    std::vector<history_point> points;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0, 0.1f);
+    float chamber_C {20};
+    float meat_C[2] {5, 5};
+    for (uint32_t t_s = 0; t_s < BENCH_HISTORY_SYNTHETIC_S; t_s++) {
+        chamber_C += (110 - chamber_C)/600;
+        meat_C[0] += (chamber_C - meat_C[0])/9000;
+        meat_C[1] += (chamber_C - meat_C[1])/12000;
+        history_point point {t_s, {}};
+        point.sample.logged_qc[TELEMETRY_LOGGED_CHAMBER] = static_cast<int16_t>(std::lround((chamber_C + noise(rng))*4));
+        point.sample.logged_qc[TELEMETRY_LOGGED_MEAT1] = static_cast<int16_t>(std::lround((meat_C[0] + noise(rng))*4));
+        point.sample.logged_qc[TELEMETRY_LOGGED_MEAT2] = static_cast<int16_t>(std::lround((meat_C[1] + noise(rng))*4));
+        point.sample.fan_duty = chamber_C < 105 ? 100 : 20;
+        point.sample.status = (t_s % 500 < 30 ? TELEMETRY_STATUS_HOPPER_ON : 0) | TELEMETRY_STATUS_DAMPER_OPEN;
+        points.push_back(point);
+    }
+    return points;
+}
+
+// Records a whole trace, decodes what the log held on to and checks it came back exactly
+static bool check_history(const std::vector<history_point>& points) {
+    static history_log log;
+    for (const history_point& point : points)
+        log.record(point.t_s, point.sample);
+
+    const history_stats stats = log.stats();
+    size_t expected = points.size() - stats.held_samples;
+    size_t mismatches {0};
+    uint8_t block[HISTORY_BLOCK_SIZE];
+    for (uint32_t seq = log.first_seq(); seq < log.end_seq(); seq++) {
+        history_block_reader reader(block, log.read_block(seq, block, sizeof(block)));
+        uint32_t t_s {0};
+        telemetry_sample sample;
+        while (reader.next(t_s, sample)) {
+            const history_point& point = points[expected++];
+            if (t_s != point.t_s || sample.logged_qc != point.sample.logged_qc ||
+                    sample.fan_duty != point.sample.fan_duty || sample.status != point.sample.status)
+                mismatches++;
+        }
+        if (!reader.valid())
+            mismatches++;
+    }
+    if (expected != points.size())
+        mismatches++;
+
+    const double bits = 8.0*stats.held_bytes/std::max<uint32_t>(stats.held_samples, 1);
+    std::printf("history: %zu samples, %u held in %u bytes, %.2f bits/sample, %.1f:1 against %d-byte samples, %s\n\n",
+            points.size(), stats.held_samples, stats.held_bytes, bits, 8*BENCH_HISTORY_RAW_BYTES/bits,
+            BENCH_HISTORY_RAW_BYTES, mismatches == 0 ? "round trip exact" : "ROUND TRIP MISMATCH");
+    return mismatches == 0;
+}
+
+// Posts commands from four threads while a control loop thread applies them and two readers copy snapshots
+// Every copy read has to be one the control loop published whole, and the last command of each kind has to be applied
+static bool check_control_state() {
+    shared_control_state shared;
+    std::vector<control_state> published(BENCH_STATE_VERSIONS);
+    std::atomic<bool> running {true};
+
+    // Bluetooth handler, console, autotune and damper tasker, each the only writer of its own field
+    // The writers yield after every command so the control loop gets a turn even on a single core
+    float last_set_point_C {0};
+    bool last_mode_auto {true};
+    pid_gains last_gains {};
+    uint8_t last_damper_pct {0};
+    std::thread bt_thread([&]() {
+        for (uint32_t i = 0; running.load(std::memory_order_relaxed); i++) {
+            last_set_point_C = 100.0f + 0.25f*(i % 800);
+            shared.post_set_point(last_set_point_C);
+            std::this_thread::yield();
+        }
+    });
+    std::thread console_thread([&]() {
+        for (uint32_t i = 0; running.load(std::memory_order_relaxed); i++) {
+            last_mode_auto = i & 1;
+            shared.post_mode(last_mode_auto);
+            std::this_thread::yield();
+        }
+    });
+    // All three gains come from the same i, so a snapshot mixing two posts shows up as torn
+    std::thread gains_thread([&]() {
+        for (uint32_t i = 0; running.load(std::memory_order_relaxed); i++) {
+            last_gains = {1.0f + (i % 500), 0.01f*(i % 500), 0.5f*(i % 500)};
+            shared.post_gains(last_gains);
+            std::this_thread::yield();
+        }
+    });
+    std::thread damper_thread([&]() {
+        for (uint32_t i = 0; running.load(std::memory_order_relaxed); i++) {
+            last_damper_pct = i % 101;
+            shared.damper_moved(last_damper_pct);
+            std::this_thread::yield();
+        }
+    });
+
+    // The control loop records every snapshot it publishes, by version
+    std::thread control_thread([&]() {
+        bool new_set_point {false};
+        bool new_gains {false};
+        control_state state {};
+        while (running.load(std::memory_order_relaxed) && state.version + 1 < BENCH_STATE_VERSIONS) {
+            state = shared.apply(new_set_point, new_gains);
+            published[state.version] = state;
+        }
+        running = false;
+    });
+
+    std::array<std::vector<control_state>, 2> seen;
+    std::vector<std::thread> readers;
+    for (std::vector<control_state>& reads : seen) {
+        reads.reserve(BENCH_STATE_READS);
+        readers.emplace_back([&running, &shared, &reads]() {
+            while (running.load(std::memory_order_relaxed) && reads.size() < BENCH_STATE_READS)
+                reads.push_back(shared.load());
+        });
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(BENCH_STATE_STRESS_MS);
+    while (running && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    running = false;
+    for (std::thread* thread : {&bt_thread, &console_thread, &gains_thread, &damper_thread, &control_thread})
+        thread->join();
+    for (std::thread& reader : readers)
+        reader.join();
+
+    // Gains that are neither the defaults nor one post's set
+    const pid_gains defaults {};
+    const auto mixed = [&defaults](const pid_gains& gains) {
+        const float i = gains.kp - 1.0f;
+        return !(gains.kp == defaults.kp && gains.ki == defaults.ki && gains.kd == defaults.kd) &&
+                !(gains.ki == 0.01f*i && gains.kd == 0.5f*i);
+    };
+
+    // A read matches the snapshot published under its version, and versions never go back
+    size_t reads {0};
+    size_t torn {0};
+    for (const std::vector<control_state>& reads_seen : seen) {
+        uint32_t last_version {0};
+        for (const control_state& state : reads_seen) {
+            const control_state& expected = published[state.version];
+            if (state.version < last_version || state.set_point_C != expected.set_point_C ||
+                    state.mode_auto != expected.mode_auto || state.cook_started != expected.cook_started ||
+                    state.ignore_bt != expected.ignore_bt || state.damper_pct != expected.damper_pct ||
+                    state.gains.kp != expected.gains.kp || state.gains.ki != expected.gains.ki ||
+                    state.gains.kd != expected.gains.kd || mixed(state.gains))
+                torn++;
+            last_version = state.version;
+        }
+        reads += reads_seen.size();
+    }
+
+    // The writers have stopped, so this thread is the control loop now
+    bool new_set_point {false};
+    bool new_gains {false};
+    const control_state last = shared.apply(new_set_point, new_gains);
+    bool latest = last.set_point_C == last_set_point_C && last.mode_auto == last_mode_auto &&
+            last.damper_pct == last_damper_pct && last.cook_started && last.gains.kp == last_gains.kp &&
+            last.gains.ki == last_gains.ki && last.gains.kd == last_gains.kd;
+    // Nothing from the app gets through after an emergency shutdown
+    shared.update([](control_state& next) {next.ignore_bt = true;});
+    shared.post_set_point(last_set_point_C + 1);
+    shared.post_mode(!last_mode_auto);
+    shared.post_gains({2, 0, 0});
+    const control_state shut_down = shared.apply(new_set_point, new_gains);
+    latest = latest && !new_set_point && !new_gains && shut_down.set_point_C == last_set_point_C &&
+            shut_down.mode_auto == last_mode_auto && shut_down.gains.kp == last_gains.kp;
+
+    std::printf("control state: %u snapshots published, %zu reads checked, %zu torn, %s\n\n", last.version, reads, torn,
+            latest ? "latest commands applied" : "LATEST COMMANDS LOST");
+    return torn == 0 && latest;
+}
+
+// Counts a task's sleeps and wakeups in virtual time, first by hand and then through sys_clock
+// Time only moves when the test moves it, so every count has to come out exact
+static bool check_activity() {
+    // Three ticks of 2 ms awake and 8 ms asleep, the clock driven from this thread
+    activity_monitor monitor;
+    const int task = monitor.add_task("bench", sys_clock::now_us());
+    for (uint32_t i = 0; i < 3; i++) {
+        sim_hal::vclock_advance_us(2000 + 1000*i);
+        monitor.sleeping(task, sys_clock::now_us());
+        sim_hal::vclock_advance_us(8000);
+        monitor.woke(task, sys_clock::now_us());
+    }
+    const activity_stats hand = monitor.stats(task);
+    const bool hand_exact = hand.wakeups == 3 && hand.awake_us == 9000 && hand.asleep_us == 24000 &&
+            hand.max_awake_us == 4000 && monitor.count() == 1;
+
+    // A thread sleeping through sys_clock alone, so the virtual clock jumps straight to each deadline
+    std::thread sleeper([]() {
+        sys_clock::name_task("Bench sleeper");
+        for (uint32_t i = 0; i < 10; i++)
+            sys_clock::sleep_for(std::chrono::milliseconds(5));
+        sim_hal::vclock_detach();
+    });
+    sleeper.join();
+    activity_stats slept {};
+    for (uint8_t i = 0; i < sys_clock::activity.count(); i++) {
+        if (std::string(sys_clock::activity.stats(i).name) == "Bench sleeper")
+            slept = sys_clock::activity.stats(i);
+    }
+    const bool slept_exact = slept.wakeups == 10 && slept.asleep_us == 50000 && slept.awake_us == 0;
+
+    std::printf("activity: by hand %u wakeups, %llu us awake, %llu us asleep; through sys_clock %u wakeups, "
+            "%llu us asleep, %s\n\n", hand.wakeups, static_cast<unsigned long long>(hand.awake_us),
+            static_cast<unsigned long long>(hand.asleep_us), slept.wakeups,
+            static_cast<unsigned long long>(slept.asleep_us), hand_exact && slept_exact ? "exact" : "MISCOUNTED");
+    return hand_exact && slept_exact;
+}
+
+// Runs a move on the step timer stand-in one virtual microsecond at a time and returns when each
+// step pulse rose, stop_at > 0 calls stop_motor() once that many have
+static std::vector<uint64_t> step_edges(a4988_driver& driver, const uint32_t num_steps, const uint32_t stop_at,
+        uint32_t& steps_taken) {
+    std::vector<uint64_t> edges;
+    uint64_t counted = sim_hal::gpio_rising_edges(BENCH_STEP_GPIO);
+    std::future<uint32_t> done = driver.move(num_steps, step_profile());
+    // The dispatcher thread completes the move in real time once the ISR has stopped the timer
+    for (uint32_t us = 0; us < 10000000 && done.wait_for(std::chrono::seconds(0)) != std::future_status::ready; us++) {
+        sim_hal::vclock_advance_us(1);
+        const uint64_t rising = sim_hal::gpio_rising_edges(BENCH_STEP_GPIO);
+        if (rising != counted) {
+            counted = rising;
+            edges.push_back(sys_clock::now_us());
+            if (edges.size() == stop_at)
+                driver.stop_motor();
+        }
+    }
+    steps_taken = done.wait_for(std::chrono::seconds(1)) == std::future_status::ready ? done.get() : 0;
+    return edges;
+}
+
+// Whether the intervals between edges from..to never get shorter (rising) or never get longer
+static bool monotonic(const std::vector<uint64_t>& edges, const size_t from, const size_t to, const bool rising) {
+    for (size_t i = from + 2; i <= to && i < edges.size(); i++) {
+        const uint64_t last = edges[i - 1] - edges[i - 2];
+        const uint64_t next = edges[i] - edges[i - 1];
+        if (rising ? next < last : next > last)
+            return false;
+    }
+    return true;
+}
+
+// Drives a stepper through the timer and GPIO stand-ins and checks the pulses it makes:
+// one per step, accelerating from the start rate to exactly the cruise rate and back, and a stop
+// that ramps down the same way instead of cutting the motor off at speed
+static bool check_stepper() {
+    a4988_driver stepper("Bench stepper", GPIO_NUM_NC, GPIO_NUM_NC, GPIO_NUM_NC, GPIO_NUM_NC, GPIO_NUM_NC, GPIO_NUM_NC,
+            BENCH_STEP_GPIO, GPIO_NUM_NC, TIMER_GROUP_0, TIMER_0);
+    const step_profile profile {};
+    const uint64_t cruise_us = STEP_TIMER_TICKS_PER_S / profile.cruise_rate;
+    const uint64_t start_us = STEP_TIMER_TICKS_PER_S / profile.start_rate;
+    // Steps the ramp from start to cruise rate takes, v^2 = v0^2 + 2as
+    const uint32_t ramp_steps = (profile.cruise_rate*profile.cruise_rate - profile.start_rate*profile.start_rate) /
+            (2*profile.accel);
+
+    // A whole move, the ramps end where cruise begins and the move takes as long as the profile says
+    uint32_t taken {0};
+    const std::vector<uint64_t> edges = step_edges(stepper, BENCH_STEP_MOVE, 0, taken);
+    size_t cruise_from {0};
+    size_t cruise_to {0};
+    uint64_t shortest_us {UINT64_MAX};
+    for (size_t i = 1; i < edges.size(); i++) {
+        shortest_us = std::min(shortest_us, edges[i] - edges[i - 1]);
+        if (edges[i] - edges[i - 1] == cruise_us) {
+            cruise_from = cruise_from == 0 ? i : cruise_from;
+            cruise_to = i;
+        }
+    }
+    const double ideal_s = 2.0*(profile.cruise_rate - profile.start_rate)/profile.accel +
+            static_cast<double>(BENCH_STEP_MOVE - 2*ramp_steps)/profile.cruise_rate;
+    const double moved_s = edges.size() > 1 ? (edges.back() - edges.front())/1e6 : 0;
+    const uint32_t accel_steps = static_cast<uint32_t>(cruise_from);
+    const uint32_t decel_steps = static_cast<uint32_t>(edges.size() - 1 - cruise_to);
+    const bool move_ok = edges.size() == BENCH_STEP_MOVE && taken == BENCH_STEP_MOVE && shortest_us == cruise_us &&
+            edges[1] - edges[0] <= start_us && edges.back() - edges[edges.size() - 2] <= start_us &&
+            monotonic(edges, 0, cruise_from, false) && monotonic(edges, cruise_to, edges.size() - 1, true) &&
+            std::abs(static_cast<int>(accel_steps) - static_cast<int>(ramp_steps)) <= 2 &&
+            std::abs(static_cast<int>(decel_steps) - static_cast<int>(ramp_steps)) <= 2 &&
+            std::abs(moved_s - ideal_s) < 0.02*ideal_s;
+
+    // Stopped at cruise, it slows down over the same ramp and every pulse is counted as a step
+    uint32_t stop_taken {0};
+    const std::vector<uint64_t> stopped = step_edges(stepper, BENCH_STEP_MOVE, BENCH_STEP_STOP_AT, stop_taken);
+    const uint32_t after_stop = static_cast<uint32_t>(stopped.size() - std::min<size_t>(stopped.size(), BENCH_STEP_STOP_AT));
+    const bool stop_ok = stop_taken == stopped.size() && stopped.size() < BENCH_STEP_MOVE &&
+            std::abs(static_cast<int>(after_stop) - static_cast<int>(ramp_steps)) <= 2 &&
+            monotonic(stopped, BENCH_STEP_STOP_AT - 1, stopped.size() - 1, true) &&
+            stopped.back() - stopped[stopped.size() - 2] <= start_us &&
+            stopped.back() - stopped[stopped.size() - 2] > 2*cruise_us;
+
+    // Refused moves asked for from on_done, on the dispatcher thread, more of them than the queue holds
+    std::atomic<uint32_t> refusals {0};
+    const std::function<void(uint32_t)> count_refusal = [&](uint32_t) {refusals++;};
+    stepper.move(0, profile, [&](uint32_t) {
+        refusals++;
+        for (uint32_t i = 1; i < BENCH_STEP_REFUSALS; i++)
+            stepper.move(0, profile, count_refusal);
+    });
+    for (int waited_ms = 0; refusals < BENCH_STEP_REFUSALS && waited_ms < 1000; waited_ms++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const bool refused_ok = refusals == BENCH_STEP_REFUSALS;
+
+    std::printf("stepper: %zu pulses, %u ramp up, %u at %llu us, %u ramp down, %.3f s against %.3f s; "
+            "stopped at %u, %u more to ramp down, %s; %u of %u refusals chained from on_done reported\n\n",
+            edges.size(), accel_steps, static_cast<uint32_t>(cruise_to - cruise_from + 1),
+            static_cast<unsigned long long>(cruise_us), decel_steps, moved_s, ideal_s, BENCH_STEP_STOP_AT, after_stop,
+            move_ok && stop_ok ? "as profiled" : "OFF PROFILE", refusals.load(), BENCH_STEP_REFUSALS);
+    return move_ok && stop_ok && refused_ok;
+}
+
+// Drives a pwm through the LEDC stand-in: frequencies outside PWM_MIN_FREQ_HZ-PWM_MAX_FREQ_HZ are refused
+// and the old one kept, each frequency gets the finest duty resolution the APB clock allows, every
+// hundredth of a percent comes back as set and lands on the duty ticks it should, and a fade ends on its target
+static bool check_pwm() {
+    pwm output(BENCH_PWM_GPIO, 0, PWM_DEFAULT_FREQ_HZ, LEDC_TIMER_1, LEDC_CHANNEL_1);
+
+    // 25 kHz leaves 3200 APB ticks a period, so 11 bits, 100 Hz is held to PWM_MAX_DUTY_RESOLUTION, 40 kHz gets 10 bits
+    const std::array<std::pair<uint32_t, uint32_t>, 3> resolutions {{
+            {PWM_DEFAULT_FREQ_HZ, 11}, {PWM_MIN_FREQ_HZ, PWM_MAX_DUTY_RESOLUTION}, {PWM_MAX_FREQ_HZ, 10}}};
+    bool resolution_ok {true};
+    for (const auto& [freq_hz, bits] : resolutions) {
+        const bool set = output.set_frequency(freq_hz);
+        const sim_hal::ledc_timer_state timer = sim_hal::ledc_timer(LEDC_HIGH_SPEED_MODE, LEDC_TIMER_1);
+        resolution_ok = resolution_ok && set && output.get_frequency() == freq_hz && timer.freq_hz == freq_hz &&
+                timer.duty_resolution == bits && output.duty_steps() == (1u << bits);
+    }
+    // The refusals print an error each, which is expected here
+    null_buffer discard;
+    std::streambuf* console = std::cout.rdbuf(&discard);
+    const bool refused = !output.set_frequency(PWM_MIN_FREQ_HZ - 1) && !output.set_frequency(PWM_MAX_FREQ_HZ + 1);
+    std::cout.rdbuf(console);
+    const bool limits_ok = refused &&
+            output.get_frequency() == PWM_MAX_FREQ_HZ &&
+            sim_hal::ledc_timer(LEDC_HIGH_SPEED_MODE, LEDC_TIMER_1).freq_hz == PWM_MAX_FREQ_HZ;
+
+    output.set_frequency(PWM_DEFAULT_FREQ_HZ);
+    uint32_t duty_misses {0};
+    for (uint32_t hundredths = 0; hundredths <= 10000; hundredths++) {
+        const bool set = output.set_duty_percent(hundredths / 100.0f);
+        const uint32_t ticks = sim_hal::ledc_channel(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_1).duty;
+        if (!set || std::lround(output.get_duty_percent()*100) != static_cast<long>(hundredths) ||
+                ticks != (hundredths << 11) / 10000)
+            duty_misses++;
+    }
+    const bool clamped = output.set_duty_percent(150) && output.get_duty_percent() == 100 &&
+            output.set_duty_percent(-5) && output.get_duty_percent() == 0;
+
+    const bool faded = output.fade_to(37.5f, 500);
+    const sim_hal::ledc_channel_state channel = sim_hal::ledc_channel(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_1);
+    const uint32_t target_ticks = (3750u << 11) / 10000;
+    const bool fade_ok = faded && output.get_duty_percent() == 37.5f && channel.fade_target == target_ticks &&
+            channel.duty == target_ticks && channel.fade_time_ms == 500;
+    output.set_duty_percent(0);
+
+    std::printf("pwm: duty resolution by frequency %s, out of range frequencies %s, %u of 10001 duty steps off, "
+            "duty %s, fade %s\n\n", resolution_ok ? "as expected" : "WRONG", limits_ok ? "refused" : "ACCEPTED",
+            duty_misses, clamped ? "clamped to 0-100%" : "NOT CLAMPED", fade_ok ? "reached its target" : "MISSED");
+    return resolution_ok && limits_ok && duty_misses == 0 && clamped && fade_ok;
+}
+
+// Probes in slots other than 0-2: the history and the cook log keep the chamber reading and the first two
+// meat probes by role, and the status fault bits follow them
+static bool check_logged_roles() {
+    out_msg_all_data data {};
+    data.temp_data_chamber = {110.25f, false};
+    data.probes_active = 0x6d; // slots 0, 2, 3, 5 and 6
+    data.probe_roles[0] = TC_ROLE_MEAT;
+    data.probe_roles[2] = TC_ROLE_CHAMBER;
+    data.probe_roles[3] = TC_ROLE_CHAMBER;
+    data.probe_roles[5] = TC_ROLE_MEAT;
+    data.probe_roles[6] = TC_ROLE_MEAT;
+    data.probes[0] = {60.5f, false};
+    data.probes[2] = {110.0f, true};
+    data.probes[3] = {110.25f, false};
+    data.probes[5] = {70.75f, true};
+    data.probes[6] = {80.0f, false};
+    const telemetry_sample sample = telemetry_sample_from(data);
+    const bool logged_ok = sample.logged_qc[TELEMETRY_LOGGED_CHAMBER] == 441 &&
+            sample.logged_qc[TELEMETRY_LOGGED_MEAT1] == 242 && sample.logged_qc[TELEMETRY_LOGGED_MEAT2] == 283 &&
+            sample.status == TELEMETRY_STATUS_MEAT2_FAULT;
+
+    // With every chamber probe faulted the controller has no good reading
+    data.temp_data_chamber.fault = true;
+    const bool chamber_ok = telemetry_sample_from(data).status ==
+            (TELEMETRY_STATUS_CHAMBER_FAULT | TELEMETRY_STATUS_MEAT2_FAULT);
+
+    std::printf("logged probes: chamber, meat 1 and meat 2 %s\n\n",
+            logged_ok && chamber_ok ? "found by role" : "NOT BY ROLE");
+    return logged_ok && chamber_ok;
+}
+
+// Runs a control law at 10 Hz and then at 20 Hz with no retune between: a constant error has to
+// integrate by the second and a falling reading differentiate to the same term at both rates
+template <typename policy_type>
+static bool rate_change_exact(policy_type& law) {
+    constexpr float err_C {1.0f};
+    constexpr float fall_C_per_s {0.5f};
+    constexpr pid_gains integral_gains {0.0f, 0.1f, 0.0f};
+    constexpr pid_gains derivative_gains {0.0f, 0.0f, 10.0f};
+
+    controller_pid integral_state {integral_gains};
+    controller_pid derivative_state {derivative_gains};
+    float chamber_C {CONTROLLER_SCHEDULE_REF_C};
+    float derivative_10hz {0};
+    for (const float hz : {10.0f, 20.0f}) {
+        for (int tick = 0; tick < BENCH_RATE_PHASE_S*hz; tick++) {
+            law.fan_step({CONTROLLER_SCHEDULE_REF_C, CONTROLLER_SCHEDULE_REF_C - err_C, 0, 1.0f/hz}, integral_state);
+            chamber_C -= fall_C_per_s/hz;
+            law.fan_step({CONTROLLER_SCHEDULE_REF_C, chamber_C, 0, 1.0f/hz}, derivative_state);
+        }
+        if (hz == 10.0f)
+            derivative_10hz = static_cast<float>(derivative_state.core.output());
+    }
+
+    const float integral = static_cast<float>(integral_state.core.integral());
+    const float derivative = static_cast<float>(derivative_state.core.output());
+    const float expected_integral = integral_gains.ki*err_C*2*BENCH_RATE_PHASE_S;
+    const float expected_derivative = derivative_gains.kd*fall_C_per_s;
+    return std::fabs(integral - expected_integral) < 0.01f*expected_integral &&
+            std::fabs(derivative_10hz - expected_derivative) < 0.01f*expected_derivative &&
+            std::fabs(derivative - expected_derivative) < 0.01f*expected_derivative;
+}
+
+// The fan loop rate can change under a law, from the console or for a late tick, and every law keeps
+// its gains per second rather than per tick
+static bool check_rate_change() {
+    pid_policy pid_law;
+    scheduled_pid_policy scheduled_law;
+    feedforward_pid_policy feedforward_law;
+    const bool pid_ok = rate_change_exact(pid_law);
+    const bool scheduled_ok = rate_change_exact(scheduled_law);
+    const bool feedforward_ok = rate_change_exact(feedforward_law);
+
+    std::printf("rate change: 10 Hz to 20 Hz, pid %s, scheduled %s, feedforward %s\n\n",
+            pid_ok ? "holds its gains" : "OFF", scheduled_ok ? "holds its gains" : "OFF",
+            feedforward_ok ? "holds its gains" : "OFF");
+    return pid_ok && scheduled_ok && feedforward_ok;
+}
+
+static void print_usage(const char* name) {
+    std::printf("Usage: %s [options]\n"
+                "  --filter TEXT        only run benchmarks whose name contains TEXT\n"
+                "  --min-ms MS          minimum time per timed run (%d)\n"
+                "  --json PATH          save the results\n"
+                "  --compare PATH       compare against saved results, exit 1 on a regression\n"
+                "  --threshold PCT      slowdown allowed by --compare (%d)\n"
+                "  --history-trace CSV  sim trace for the history checks, a made-up cook if not given\n",
+                name, BENCH_DEFAULT_MIN_MS, BENCH_DEFAULT_THRESHOLD_PCT);
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string json_path;
+    std::string compare_path;
+    std::string history_trace_path;
+    int min_ms {BENCH_DEFAULT_MIN_MS};
+    double threshold_pct {BENCH_DEFAULT_THRESHOLD_PCT};
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value)
+            filter = argv[++i];
+        else if (arg == "--min-ms" && has_value)
+            min_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--json" && has_value)
+            json_path = argv[++i];
+        else if (arg == "--compare" && has_value)
+            compare_path = argv[++i];
+        else if (arg == "--threshold" && has_value)
+            threshold_pct = std::stod(argv[++i]);
+        else if (arg == "--history-trace" && has_value)
+            history_trace_path = argv[++i];
+        else {
+            print_usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::map<std::string, bench_result> baseline;
+    if (!compare_path.empty() && !read_json(compare_path, baseline)) {
+        std::printf("Error: could not read %s\n", compare_path.c_str());
+        return 1;
+    }
+
+    std::vector<history_point> history_points;
+    if (history_trace_path.empty()) {
+        history_points = synthetic_history_trace();
+    }
+    else if (!read_history_trace(history_trace_path, history_points)) {
+        std::printf("Error: could not read a trace from %s\n", history_trace_path.c_str());
+        return 1;
+    }
+    const bool history_exact = check_history(history_points);
+    const bool state_consistent = check_control_state();
+    const bool activity_exact = check_activity();
+    const bool steps_profiled = check_stepper();
+    const bool pwm_exact = check_pwm();
+    const bool rate_exact = check_rate_change();
+    const bool roles_logged = check_logged_roles();
+
+    null_buffer discard;
+    std::cout.rdbuf(&discard);
+
+    // The firmware as app_main() builds it, without the control loop or sampler threads running
+    bt::init_bluetooth();
+    pwm blowfan(gpio_blowfan, 0);
+    a4988_driver hopper_controller("Hopper Motor", gpio_hopper_not_en, gpio_hopper_ms1,
+                                   gpio_hopper_ms2, gpio_hopper_ms3,
+                                   gpio_hopper_not_rst, gpio_hopper_not_slp,
+                                   gpio_hopper_step, gpio_hopper_dir,
+                                   TIMER_GROUP_1, TIMER_0);
+    a4988_driver damper_controller("Damper Motor", gpio_damper_not_en, gpio_damper_ms1,
+                                   gpio_damper_ms2, gpio_damper_ms3,
+                                   gpio_damper_not_rst, gpio_damper_not_slp,
+                                   gpio_damper_step, gpio_damper_dir,
+                                   TIMER_GROUP_1, TIMER_1);
+    std::vector<max31855> probes;
+    probes.reserve(board_probe_count);
+    for (const board_probe& wired : board_probes)
+        probes.emplace_back(gpio_clk, gpio_signal_out, wired.chip_select);
+    tc_bus thermocouples(HSPI_HOST, spi_bus_cfg);
+    thermocouples.init();
+    for (max31855& probe : probes)
+        thermocouples.add_probe(probe);
+    tc_sampler thermocouple_sampler(thermocouples);
+    for (uint8_t i = 0; i < thermocouples.count(); i++) {
+        tc_probe_config config {};
+        config.role = board_probes[i].role;
+        thermocouple_sampler.configure(i, config);
+    }
+    thermocouple_sampler.sample_once();
+    static history_log cook_history;
+    sim_hal::partition_add(COOK_LOG_PARTITION_LABEL, COOK_LOG_PARTITION_SUBTYPE, 64*SPI_FLASH_SEC_SIZE);
+    static cook_log flash_log;
+    flash_log.init(0, ESP_RST_POWERON);
+    static pid_store controller_store;
+    controller_store.init();
+    pid_control main_pid_control(blowfan, hopper_controller, damper_controller, thermocouple_sampler, cook_history,
+                                 flash_log, controller_store);
+    bt::set_bt_msg_dest(&main_pid_control);
+
+    // 107.25 C, 25 C, -10 C and an open circuit, as the chip sends them
+    const std::array<uint32_t, 4> frame_words {0x06b41880, 0x01901900, 0xff601780, 0x00011881};
+    std::array<std::array<uint8_t, 4>, 4> frames {};
+    for (size_t i = 0; i < frames.size(); i++) {
+        for (size_t b = 0; b < 4; b++)
+            frames[i][b] = static_cast<uint8_t>(frame_words[i] >> (24 - 8*b));
+    }
+    size_t spi_frame_idx {0};
+    for (const board_probe& wired : board_probes)
+        sim_hal::spi_set_frame_source(wired.chip_select, [&]() {return frame_words[spi_frame_idx++ & 3];});
+
+    // A full bus on the other SPI host, to show the acquisition cost per probe
+    const std::array<gpio_num_t, TC_BUS_MAX_PROBES> full_bus_chip_selects {GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_12,
+            GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15, GPIO_NUM_16, GPIO_NUM_17};
+    std::vector<max31855> full_bus_probes;
+    full_bus_probes.reserve(TC_BUS_MAX_PROBES);
+    tc_bus full_bus(VSPI_HOST, spi_bus_cfg);
+    full_bus.init();
+    for (const gpio_num_t cs : full_bus_chip_selects) {
+        full_bus_probes.emplace_back(gpio_clk, gpio_signal_out, cs);
+        full_bus.add_probe(full_bus_probes.back());
+        sim_hal::spi_set_frame_source(cs, [&]() {return frame_words[spi_frame_idx++ & 3];});
+    }
+
+    sim_hal::spp_wait_idle();
+    const uint32_t phone = sim_hal::spp_connect();
+    sim_hal::spp_wait_idle();
+
+    bench_runner runner(std::chrono::milliseconds(min_ms), filter);
+
+    // MAX31855
+    size_t frame_idx {0};
+    runner.add("max31855/decode", [&]() {
+        bench_keep(probes[0].decode(frames[frame_idx++ & 3].data()));
+    });
+    runner.add("max31855/read", [&]() {
+        bench_keep(probes[0].read());
+    });
+    runner.add("tc_bus/acquire", [&]() {
+        bench_keep(thermocouples.acquire());
+    });
+    // Only the probes in use are read, so this should grow by the same step per probe
+    for (const uint8_t count : {1, 2, 4, 8}) {
+        const uint8_t mask = static_cast<uint8_t>((1u << count) - 1);
+        runner.add("tc_bus/acquire_" + std::to_string(count) + "_probes", [&full_bus, mask]() {
+            bench_keep(full_bus.acquire(mask));
+        });
+    }
+    runner.add("tc_sampler/sample_once", [&]() {
+        thermocouple_sampler.sample_once();
+    });
+
+    // Bluetooth message dispatch, per message type
+    const in_msg_mode msg_mode {MSG_MODE, true};
+    const in_msg_temp_C msg_chamber {MSG_CHAMBER_TEMP, 110};
+    const in_msg_temp_C msg_meat1 {MSG_MEAT1_TEMP, 95};
+    const in_msg_temp_C msg_meat2 {MSG_MEAT2_TEMP, 90};
+    const in_msg_blowfan msg_blowfan {MSG_BLOWFAN, 40};
+    const in_msg_hopper msg_hopper {MSG_HOPPER, true};
+    const in_msg_damper msg_damper {MSG_DAMPER, true};
+    const uint8_t msg_unknown[2] {0x7f, 0};
+    auto dispatch = [&](const void* msg) {
+        main_pid_control.handle_bt_msg(static_cast<const char*>(msg));
+    };
+    runner.add("handle_bt_msg/mode", [&]() {dispatch(&msg_mode);});
+    runner.add("handle_bt_msg/chamber_temp", [&]() {dispatch(&msg_chamber);});
+    runner.add("handle_bt_msg/meat1_temp", [&]() {dispatch(&msg_meat1);});
+    runner.add("handle_bt_msg/meat2_temp", [&]() {dispatch(&msg_meat2);});
+    runner.add("handle_bt_msg/blowfan", [&]() {dispatch(&msg_blowfan);});
+    // Fuel commands queue work, the queue is emptied between batches so pushes are not refused
+    // A damper command only replaces the damper's target
+    runner.add("handle_bt_msg/hopper", [&]() {dispatch(&msg_hopper);}, TASK_QUEUE_CAPACITY - 1,
+            [&]() {main_pid_control.hopper_task_queue().flush();});
+    runner.add("handle_bt_msg/damper", [&]() {dispatch(&msg_damper);});
+    runner.add("handle_bt_msg/unknown", [&]() {dispatch(msg_unknown);});
+
+    // Controller state, a snapshot read and a command through to the published snapshot
+    shared_control_state bench_state;
+    bool bench_new_set_point {false};
+    bool bench_new_gains {false};
+    uint32_t bench_set_point {0};
+    runner.add("control_state/load", [&]() {
+        bench_keep(bench_state.load());
+    });
+    runner.add("control_state/post_apply", [&]() {
+        bench_state.post_set_point(100.0f + (bench_set_point++ & 0xff));
+        bench_keep(bench_state.apply(bench_new_set_point, bench_new_gains));
+    });
+
+    // Status packing
+    runner.add("pid_control/get_system_status", [&]() {
+        bench_keep(main_pid_control.get_system_status());
+    });
+
+    // PID core on its own, one step in float and in Q16.16 with the reading walking around the set point
+    pid<float> core_float;
+    pid<q16_16> core_fixed;
+    core_float.configure(controller_tuning(pid_gains {}), 1.0f/PID_FAN_LOOP_HZ);
+    core_fixed.configure(controller_tuning(pid_gains {}), 1.0f/PID_FAN_LOOP_HZ);
+    uint32_t core_tick {0};
+    runner.add("pid/float", [&]() {
+        const float pv = 108.5f + 0.01f*(core_tick++ & 0xff);
+        bench_keep(core_float.step(110.0f, pv));
+    });
+    const q16_16 core_set_point {110.0f};
+    const q16_16 core_base {108.5f};
+    runner.add("pid/q16_16", [&]() {
+        const q16_16 pv = core_base + q16_16::from_raw(655*(core_tick++ & 0xff));
+        bench_keep(core_fixed.step(core_set_point, pv));
+    });
+
+    // Control laws, one fan loop step each, called directly as pid_control calls the one it is built with
+    controller_pid pid_law_state {};
+    controller_pid scheduled_law_state {};
+    controller_pid feedforward_law_state {};
+    controller_sample law_sample {110, 108.5f, false, 1.0f/PID_FAN_LOOP_HZ};
+    pid_policy pid_law;
+    scheduled_pid_policy scheduled_law;
+    feedforward_pid_policy feedforward_law;
+    runner.add("controller/pid", [&]() {
+        law_sample.chamber_C = 108.5f + 0.01f*(core_tick++ & 0xff);
+        bench_keep(pid_law.fan_step(law_sample, pid_law_state));
+    });
+    runner.add("controller/scheduled", [&]() {
+        law_sample.chamber_C = 108.5f + 0.01f*(core_tick++ & 0xff);
+        bench_keep(scheduled_law.fan_step(law_sample, scheduled_law_state));
+    });
+    runner.add("controller/feedforward", [&]() {
+        law_sample.chamber_C = 108.5f + 0.01f*(core_tick++ & 0xff);
+        bench_keep(feedforward_law.fan_step(law_sample, feedforward_law_state));
+    });
+
+    // Fuel feeder, one pit loop tick with the auger reporting a dose now and then
+    fuel_feeder bench_feeder;
+    uint32_t feeder_tick {0};
+    runner.add("fuel_feeder/tick", [&]() {
+        if ((feeder_tick++ & 0x3f) == 0)
+            bench_feeder.fed(a4988_revs_to_microsteps(FUEL_DOSE_REVS));
+        bench_keep(bench_feeder.tick(CONTROLLER_FUEL_IDLE_G_PER_MIN + 0.01f*(feeder_tick & 0xff), 1.0f/PID_PIT_LOOP_HZ));
+    });
+
+    // Saved state, the pit loop's offer when the rate limits hold the write back
+    pid_saved_state offered {};
+    runner.add("pid_store/offer", [&]() {
+        offered.integral_pct += 0.001f;
+        controller_store.offer(offered);
+    });
+
+    // Task queue, push into a queue without a tasker, and a full round trip through one
+    task_queue idle_queue("Bench idle");
+    runner.add("task_queue/push", [&]() {
+        idle_queue.push([]() {});
+    }, TASK_QUEUE_CAPACITY, [&]() {idle_queue.flush();});
+
+    task_queue live_queue("Bench live");
+    std::thread live_tasker = live_queue.start();
+    live_tasker.detach();
+    std::atomic<bool> ran {false};
+    runner.add("task_queue/push_to_run", [&]() {
+        ran.store(false, std::memory_order_relaxed);
+        live_queue.push([&]() {ran.store(true, std::memory_order_release);});
+        while (!ran.load(std::memory_order_acquire)) {}
+    });
+
+    // Framing on its own, every frame gets the next sequence number so none is dropped as a repeat
+    std::array<std::array<uint8_t, BT_FRAME_MAX_SIZE>, 256> cmd_frames {};
+    std::array<std::array<uint8_t, BT_FRAME_MAX_SIZE>, 256> batch_frames {};
+    uint8_t batch[sizeof(in_msg_mode) + sizeof(in_msg_temp_C) + sizeof(in_msg_temp_C) + sizeof(in_msg_blowfan)];
+    std::memcpy(batch, &msg_mode, sizeof(msg_mode));
+    std::memcpy(batch + sizeof(msg_mode), &msg_chamber, sizeof(msg_chamber));
+    std::memcpy(batch + sizeof(msg_mode) + sizeof(msg_chamber), &msg_meat1, sizeof(msg_meat1));
+    std::memcpy(batch + sizeof(msg_mode) + 2*sizeof(msg_chamber), &msg_blowfan, sizeof(msg_blowfan));
+    size_t cmd_frame_len {0};
+    size_t batch_frame_len {0};
+    for (size_t i = 0; i < 256; i++) {
+        cmd_frame_len = bt_frame_encode(i, reinterpret_cast<const uint8_t*>(&msg_chamber), sizeof(msg_chamber),
+                cmd_frames[i].data(), BT_FRAME_MAX_SIZE);
+        batch_frame_len = bt_frame_encode(i, batch, sizeof(batch), batch_frames[i].data(), BT_FRAME_MAX_SIZE);
+    }
+
+    uint8_t encoded[BT_FRAME_MAX_SIZE];
+    uint8_t encode_sequence {0};
+    runner.add("bt_frame/encode_all_data", [&]() {
+        const out_msg_all_data data = main_pid_control.get_system_status();
+        bench_keep(bt_frame_encode(encode_sequence++, reinterpret_cast<const uint8_t*>(&data), sizeof(data),
+                encoded, sizeof(encoded)));
+    });
+
+    bt_frame_parser parser;
+    size_t parsed_bytes {0};
+    auto count_frame = [&](uint8_t, const uint8_t*, uint8_t len) {parsed_bytes += len;};
+    uint8_t parse_sequence {0};
+    runner.add("bt_frame/parse_whole", [&]() {
+        parser.feed(cmd_frames[parse_sequence++].data(), cmd_frame_len, count_frame);
+    });
+    runner.add("bt_frame/parse_split", [&]() {
+        const uint8_t* frame = cmd_frames[parse_sequence++].data();
+        parser.feed(frame, 3, count_frame);
+        parser.feed(frame + 3, cmd_frame_len - 3, count_frame);
+    });
+    uint8_t garbage[32];
+    for (size_t i = 0; i < sizeof(garbage); i++)
+        garbage[i] = static_cast<uint8_t>(i*37 + 1);
+    runner.add("bt_frame/reject_garbage_32B", [&]() {
+        parser.feed(garbage, sizeof(garbage), count_frame);
+    });
+
+    // Status reports, a keyframe, a one-channel delta and the phone's decode
+    telemetry_encoder telemetry;
+    telemetry_sample report_sample = telemetry_sample_from(main_pid_control.get_system_status());
+    uint8_t report[TELEMETRY_MAX_SIZE];
+    runner.add("telemetry/encode_keyframe", [&]() {
+        telemetry.force_keyframe();
+        bench_keep(telemetry.encode(report_sample, report, sizeof(report)));
+    });
+    runner.add("telemetry/encode_delta", [&]() {
+        report_sample.temp_qc[0] ^= 4;
+        bench_keep(telemetry.encode(report_sample, report, sizeof(report)));
+    });
+    telemetry_decoder phone_decoder;
+    uint8_t keyframe[TELEMETRY_MAX_SIZE];
+    telemetry.force_keyframe();
+    const size_t keyframe_len = telemetry.encode(report_sample, keyframe, sizeof(keyframe));
+    runner.add("telemetry/decode_keyframe", [&]() {
+        bench_keep(phone_decoder.decode(keyframe, keyframe_len));
+    });
+    // Every probe slot in use, the largest report
+    telemetry_encoder full_telemetry;
+    telemetry_sample full_sample = report_sample;
+    full_sample.probes = 0xff;
+    for (size_t i = 0; i < TELEMETRY_PROBES; i++)
+        full_sample.temp_qc[i] = static_cast<int16_t>(400 + 8*i);
+    runner.add("telemetry/encode_keyframe_8_probes", [&]() {
+        full_telemetry.force_keyframe();
+        bench_keep(full_telemetry.encode(full_sample, report, sizeof(report)));
+    });
+
+    // History, one sample recorded and one full block unpacked
+    static history_log bench_history;
+    for (const history_point& point : history_points)
+        bench_history.record(point.t_s, point.sample);
+    size_t history_idx {0};
+    uint32_t history_s = history_points.back().t_s + 1;
+    runner.add("history/record", [&]() {
+        bench_history.record(history_s++, history_points[history_idx].sample);
+        history_idx = (history_idx + 1) % history_points.size();
+    });
+    uint8_t history_block[HISTORY_BLOCK_SIZE];
+    const size_t history_block_len = bench_history.read_block(bench_history.end_seq() - 2, history_block, sizeof(history_block));
+    runner.add("history/decode_block", [&]() {
+        history_block_reader reader(history_block, history_block_len);
+        uint32_t t_s {0};
+        telemetry_sample sample;
+        while (reader.next(t_s, sample))
+            bench_keep(sample);
+    });
+
+    // Cook log, one record appended, erases and page writes included, and one MSG_LOG queued from the map
+    size_t log_idx {0};
+    uint32_t log_s {0};
+    runner.add("cook_log/append", [&]() {
+        flash_log.append(COOK_LOG_SAMPLE, log_s++, history_points[log_idx].sample);
+        log_idx = (log_idx + 1) % history_points.size();
+    });
+    flash_log.flush();
+    bt_frame_pool bench_pool;
+    bt_tx_queue log_queue(bench_pool);
+    size_t log_frame_len {0};
+    const uint8_t log_type {MSG_LOG};
+    cook_log_cursor log_cursor = flash_log.begin();
+    runner.add("cook_log/export_msg", [&]() {
+        const cook_log_record* records {nullptr};
+        size_t count = flash_log.read(log_cursor, records, (BT_FRAME_MAX_PAYLOAD - 1)/sizeof(cook_log_record));
+        if (count == 0) {
+            log_cursor = flash_log.begin();
+            count = flash_log.read(log_cursor, records, (BT_FRAME_MAX_PAYLOAD - 1)/sizeof(cook_log_record));
+        }
+        log_queue.push(&log_type, 1, reinterpret_cast<const uint8_t*>(records), count*sizeof(cook_log_record),
+                BT_TX_RELIABLE);
+        bench_keep(log_queue.next(log_frame_len));
+        log_queue.write_done(true, false);
+    });
+
+    // SPP, the receive path as Bluedroid calls it and the status write
+    const esp_spp_cb_t spp_callback = sim_hal::spp.callback;
+    esp_spp_cb_param_t rx_param {};
+    rx_param.data_ind.handle = phone;
+    uint8_t rx_sequence {0};
+    runner.add("spp/rx_data_ind", [&]() {
+        rx_param.data_ind.len = cmd_frame_len;
+        rx_param.data_ind.data = cmd_frames[rx_sequence++].data();
+        spp_callback(ESP_SPP_DATA_IND_EVT, &rx_param);
+    });
+    runner.add("spp/rx_data_ind_batch4", [&]() {
+        rx_param.data_ind.len = batch_frame_len;
+        rx_param.data_ind.data = batch_frames[rx_sequence++].data();
+        spp_callback(ESP_SPP_DATA_IND_EVT, &rx_param);
+    });
+
+    // Reliable frames queue up to the queue depth, latest-wins ones coalesce while one is being written
+    out_msg_all_data status = main_pid_control.get_system_status();
+    runner.add("spp/tx_all_data", [&]() {
+        bt::send_data(status);
+    }, BT_TX_QUEUE_DEPTH, [&]() {
+        sim_hal::spp_wait_idle();
+        sim_hal::spp_take_tx();
+    });
+    runner.add("spp/tx_telemetry_latest", [&]() {
+        bt::write_uint8_p(keyframe, keyframe_len, BT_TX_LATEST);
+    }, 64, [&]() {
+        sim_hal::spp_wait_idle();
+        sim_hal::spp_take_tx();
+    });
+
+    // The queue alone, one frame through push, claim and completion
+    bt_tx_queue tx_queue(bench_pool);
+    size_t tx_frame_len {0};
+    runner.add("bt_tx_queue/push_next_done", [&]() {
+        tx_queue.push(keyframe, keyframe_len, BT_TX_RELIABLE);
+        bench_keep(tx_queue.next(tx_frame_len));
+        tx_queue.write_done(true, false);
+    });
+
+    // One report to every client, framed once and shared by their queues
+    std::array<bt_tx_queue, BT_MAX_CLIENTS> fan_out_queues {bt_tx_queue(bench_pool), bt_tx_queue(bench_pool),
+            bt_tx_queue(bench_pool)};
+    runner.add("bt_tx_queue/fan_out_3_clients", [&]() {
+        bt_shared_frame* frame = bench_pool.encode(keyframe, keyframe_len, nullptr, 0);
+        for (bt_tx_queue& queue : fan_out_queues) {
+            queue.push(frame, BT_TX_LATEST);
+            bench_keep(queue.next(tx_frame_len));
+            queue.write_done(true, false);
+        }
+        bench_pool.release(frame);
+    });
+
+    // A host tool's request through the socket transport, the frame parser and the handler, and the reply back
+    // The tool connects on the first op, so the benchmarks before this one see only the SPP phone
+    const std::string host_socket_path = "/tmp/pitmaster_bench_" + std::to_string(getpid()) + ".sock";
+    socket_transport host_link(host_socket_path);
+    int host_fd {-1};
+    bt_frame_parser host_parser;
+    // A frame per sequence number, the parser drops repeats
+    const in_msg_basic gains_request {MSG_GAINS_REQUEST};
+    std::array<std::array<uint8_t, BT_FRAME_MAX_SIZE>, 256> gains_request_frames {};
+    size_t gains_request_len {0};
+    for (size_t i = 0; i < gains_request_frames.size(); i++)
+        gains_request_len = bt_frame_encode(i, reinterpret_cast<const uint8_t*>(&gains_request), sizeof(gains_request),
+                gains_request_frames[i].data(), BT_FRAME_MAX_SIZE);
+    uint8_t host_sequence {0};
+    uint8_t host_chunk[512];
+    runner.add("socket/gains_round_trip", [&]() {
+        if (host_fd < 0) {
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, host_socket_path.c_str(), sizeof(addr.sun_path) - 1);
+            host_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (!bt::add_transport(host_link) || connect(host_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                std::printf("Error: could not connect to %s\n", host_socket_path.c_str());
+                std::_Exit(1);
+            }
+        }
+        (void)!send(host_fd, gains_request_frames[host_sequence++].data(), gains_request_len, MSG_NOSIGNAL);
+        bool replied {false};
+        while (!replied) {
+            const ssize_t len = recv(host_fd, host_chunk, sizeof(host_chunk), 0);
+            if (len <= 0)
+                break;
+            host_parser.feed(host_chunk, static_cast<size_t>(len), [&](uint8_t, const uint8_t* payload, size_t payload_len) {
+                replied = replied || (payload_len == sizeof(out_msg_gains) && payload[0] == MSG_GAINS);
+            });
+        }
+    });
+
+    std::printf("%-36s %12s %12s %12s %10s\n", "benchmark", "iterations", "ns/op", "cycles/op", "allocs/op");
+    const std::vector<bench_result> results = runner.run();
+
+    bool passed {history_exact && state_consistent && activity_exact && steps_profiled && pwm_exact && rate_exact && roles_logged};
+    if (!json_path.empty() && !write_json(json_path, results)) {
+        std::printf("Error: could not write %s\n", json_path.c_str());
+        passed = false;
+    }
+    if (!compare_path.empty())
+        passed = compare(results, baseline, threshold_pct) && passed;
+
+    unlink(host_socket_path.c_str());
+
+    // Tasker and Bluetooth threads never return, leave without unwinding them
+    std::fflush(stdout);
+    std::_Exit(passed ? 0 : 1);
+}
@@ -0,0 +1,64 @@
+# Runs the simulator built with each control law, and the PID in fixed point, through the same cooks and
+# tabulates settling time, overshoot, error and fuel burnt
+#   cmake -DSIM_DIR=build-sim -P compare_controllers.cmake
+# COMPARE_SET_POINTS and COMPARE_HOURS change the cooks
+
+if(NOT SIM_DIR)
+    message(FATAL_ERROR "SIM_DIR must name the directory holding the simulators")
+endif()
+if(NOT COMPARE_SET_POINTS)
+    set(COMPARE_SET_POINTS 110 160)
+endif()
+if(NOT COMPARE_HOURS)
+    set(COMPARE_HOURS 4)
+endif()
+
+set(POLICIES pid scheduled feedforward pid_q16)
+set(SIM_pid ${SIM_DIR}/pitmaster_sim)
+set(SIM_scheduled ${SIM_DIR}/pitmaster_sim_scheduled)
+set(SIM_feedforward ${SIM_DIR}/pitmaster_sim_feedforward)
+set(SIM_pid_q16 ${SIM_DIR}/pitmaster_sim_fixed)
+
+message("controller    set point   in band    settled   overshoot   rms error   fuel burnt")
+foreach(set_point ${COMPARE_SET_POINTS})
+    foreach(policy ${POLICIES})
+        execute_process(
+            COMMAND ${SIM_${policy}} --hours ${COMPARE_HOURS} --set-point ${set_point} --csv compare_${policy}_${set_point}.csv
+            OUTPUT_VARIABLE output
+            RESULT_VARIABLE result)
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "${SIM_${policy}} failed:\n${output}")
+        endif()
+
+        set(in_band "-")
+        set(settled "-")
+        set(overshoot "-")
+        set(rms "-")
+        if(output MATCHES "within 5 C of set point after ([0-9]+) s, (settled after [0-9]+ s|never settled), max overshoot ([-0-9.]+) C, rms error ([0-9.]+) C")
+            set(in_band "${CMAKE_MATCH_1} s")
+            set(settled "${CMAKE_MATCH_2}")
+            set(overshoot "${CMAKE_MATCH_3} C")
+            set(rms "${CMAKE_MATCH_4} C")
+            string(REGEX REPLACE "^settled after " "" settled "${settled}")
+        endif()
+        set(burnt "-")
+        if(output MATCHES "([0-9]+) g burnt")
+            set(burnt "${CMAKE_MATCH_1} g")
+        endif()
+
+        # Pads each cell out to its column
+        set(row "")
+        foreach(cell "${policy}:14" "${set_point} C:12" "${in_band}:11" "${settled}:10" "${overshoot}:12" "${rms}:12" "${burnt}:0")
+            string(REGEX MATCH "^(.*):([0-9]+)$" _ "${cell}")
+            set(text "${CMAKE_MATCH_1}")
+            set(width ${CMAKE_MATCH_2})
+            string(LENGTH "${text}" len)
+            while(len LESS width)
+                string(APPEND text " ")
+                math(EXPR len "${len} + 1")
+            endwhile()
+            string(APPEND row "${text}")
+        endforeach()
+        message("${row}")
+    endforeach()
+endforeach()
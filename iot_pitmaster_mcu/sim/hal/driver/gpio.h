@@ -0,0 +1,145 @@
+/**
+ * @file gpio.h
+ * @brief Host stand-in for the ESP-IDF GPIO driver
+ * 
+ * Every pin is a plain variable. Rising edges are counted so step pulses
+ * can be checked without a logic analyzer, and a watched stepper's pulses
+ * are counted in sixteenth steps from its MS pins, the way the a4988 moves.
+ */
+#ifndef __SIM_DRIVER_GPIO_H__
+#define __SIM_DRIVER_GPIO_H__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef enum {
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5,
+    GPIO_NUM_6, GPIO_NUM_7, GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11,
+    GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15, GPIO_NUM_16, GPIO_NUM_17,
+    GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23,
+    GPIO_NUM_24, GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_27, GPIO_NUM_28, GPIO_NUM_29,
+    GPIO_NUM_30, GPIO_NUM_31, GPIO_NUM_32, GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35,
+    GPIO_NUM_36, GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39,
+    GPIO_NUM_MAX
+} gpio_num_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT
+} gpio_mode_t;
+
+namespace sim_hal {
+
+struct gpio_pin_state {
+    std::atomic<int> level {0};
+    std::atomic<gpio_mode_t> mode {GPIO_MODE_DISABLE};
+    std::atomic<uint64_t> rising_edges {0};
+};
+
+inline std::array<gpio_pin_state, GPIO_NUM_MAX> gpio_pins {};
+
+// Steppers that can be watched
+#define SIM_GPIO_STEPPERS (2)
+
+// An a4988's pins and how far its shaft has turned
+struct gpio_stepper {
+    gpio_num_t step {GPIO_NUM_NC};
+    gpio_num_t dir {GPIO_NUM_NC};
+    gpio_num_t ms1 {GPIO_NUM_NC};
+    gpio_num_t ms2 {GPIO_NUM_NC};
+    gpio_num_t ms3 {GPIO_NUM_NC};
+    std::atomic<int64_t> microsteps {0}; // sixteenth steps, DIR low counts up
+};
+
+inline std::array<gpio_stepper, SIM_GPIO_STEPPERS> gpio_steppers {};
+inline std::atomic<int> gpio_stepper_count {0};
+
+inline bool gpio_valid(const gpio_num_t gpio) {
+    return gpio >= 0 && gpio < GPIO_NUM_MAX;
+}
+
+// Number of low-to-high transitions seen on a pin since the last reset
+inline uint64_t gpio_rising_edges(const gpio_num_t gpio) {
+    return gpio_valid(gpio) ? gpio_pins[gpio].rising_edges.load() : 0;
+}
+
+// Counts a stepper's pulses from now on, before anything steps it, returns its slot or -1
+inline int gpio_watch_stepper(const gpio_num_t step, const gpio_num_t dir,
+        const gpio_num_t ms1, const gpio_num_t ms2, const gpio_num_t ms3) {
+    const int slot = gpio_stepper_count.load();
+    if (slot >= SIM_GPIO_STEPPERS || !gpio_valid(step))
+        return -1;
+    gpio_stepper& stepper = gpio_steppers[slot];
+    stepper.step = step;
+    stepper.dir = dir;
+    stepper.ms1 = ms1;
+    stepper.ms2 = ms2;
+    stepper.ms3 = ms3;
+    stepper.microsteps = 0;
+    gpio_stepper_count = slot + 1;
+    return slot;
+}
+
+// Sixteenth steps a watched stepper has turned, DIR low counts up
+inline int64_t gpio_stepper_microsteps(const int slot) {
+    return slot >= 0 && slot < gpio_stepper_count ? gpio_steppers[slot].microsteps.load() : 0;
+}
+
+inline int gpio_level(const gpio_num_t gpio) {
+    return gpio_valid(gpio) ? gpio_pins[gpio].level.load() : 0;
+}
+
+// Moves the steppers a step pin drives, by what one pulse is worth in their MS pins' mode
+inline void gpio_step_edge(const gpio_num_t gpio) {
+    // Indexed by MS1 + 2*MS2 + 4*MS3, the combinations the a4988 leaves undefined count as sixteenths
+    static constexpr int64_t microsteps_per_pulse[8] = {16, 8, 4, 2, 1, 1, 1, 1};
+    const int count = gpio_stepper_count.load();
+    for (int i = 0; i < count; i++) {
+        gpio_stepper& stepper = gpio_steppers[i];
+        if (stepper.step != gpio)
+            continue;
+        const int64_t pulse = microsteps_per_pulse[gpio_level(stepper.ms1) + 2*gpio_level(stepper.ms2) +
+                4*gpio_level(stepper.ms3)];
+        stepper.microsteps += gpio_level(stepper.dir) ? -pulse : pulse;
+    }
+}
+
+}
+
+inline esp_err_t gpio_reset_pin(const gpio_num_t gpio) {
+    if (!sim_hal::gpio_valid(gpio))
+        return ESP_ERR_INVALID_ARG;
+    sim_hal::gpio_pins[gpio].level = 0;
+    sim_hal::gpio_pins[gpio].mode = GPIO_MODE_DISABLE;
+    sim_hal::gpio_pins[gpio].rising_edges = 0;
+    return ESP_OK;
+}
+
+inline esp_err_t gpio_set_direction(const gpio_num_t gpio, const gpio_mode_t mode) {
+    if (!sim_hal::gpio_valid(gpio))
+        return ESP_ERR_INVALID_ARG;
+    sim_hal::gpio_pins[gpio].mode = mode;
+    return ESP_OK;
+}
+
+inline esp_err_t gpio_set_level(const gpio_num_t gpio, const uint32_t level) {
+    if (!sim_hal::gpio_valid(gpio))
+        return ESP_ERR_INVALID_ARG;
+    const int old_level = sim_hal::gpio_pins[gpio].level.exchange(level ? 1 : 0);
+    if (!old_level && level) {
+        sim_hal::gpio_pins[gpio].rising_edges++;
+        sim_hal::gpio_step_edge(gpio);
+    }
+    return ESP_OK;
+}
+
+inline int gpio_get_level(const gpio_num_t gpio) {
+    return sim_hal::gpio_valid(gpio) ? sim_hal::gpio_pins[gpio].level.load() : 0;
+}
+
+#endif /* __SIM_DRIVER_GPIO_H__ */
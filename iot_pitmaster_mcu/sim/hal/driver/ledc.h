@@ -0,0 +1,263 @@
+/**
+ * @file ledc.h
+ * @brief Host stand-in for the ESP-IDF LED Control (LEDC) driver
+ * 
+ * Only the calls used by the pwm class are provided. Each timer and channel
+ * is kept as plain state that can be inspected through sim_hal::ledc_*,
+ * so duty and frequency changes can be checked on Linux.
+ */
+#ifndef __SIM_DRIVER_LEDC_H__
+#define __SIM_DRIVER_LEDC_H__
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+#include "esp_err.h"
+
+#define LEDC_APB_CLK_HZ (80*1000*1000)
+
+typedef enum {
+    LEDC_HIGH_SPEED_MODE = 0,
+    LEDC_LOW_SPEED_MODE,
+    LEDC_SPEED_MODE_MAX
+} ledc_mode_t;
+
+typedef enum {
+    LEDC_INTR_DISABLE = 0,
+    LEDC_INTR_FADE_END
+} ledc_intr_type_t;
+
+typedef enum {
+    LEDC_TIMER_0 = 0,
+    LEDC_TIMER_1,
+    LEDC_TIMER_2,
+    LEDC_TIMER_3,
+    LEDC_TIMER_MAX
+} ledc_timer_t;
+
+typedef enum {
+    LEDC_CHANNEL_0 = 0,
+    LEDC_CHANNEL_1,
+    LEDC_CHANNEL_2,
+    LEDC_CHANNEL_3,
+    LEDC_CHANNEL_4,
+    LEDC_CHANNEL_5,
+    LEDC_CHANNEL_6,
+    LEDC_CHANNEL_7,
+    LEDC_CHANNEL_MAX
+} ledc_channel_t;
+
+typedef enum {
+    LEDC_TIMER_1_BIT = 1, LEDC_TIMER_2_BIT, LEDC_TIMER_3_BIT, LEDC_TIMER_4_BIT,
+    LEDC_TIMER_5_BIT, LEDC_TIMER_6_BIT, LEDC_TIMER_7_BIT, LEDC_TIMER_8_BIT,
+    LEDC_TIMER_9_BIT, LEDC_TIMER_10_BIT, LEDC_TIMER_11_BIT, LEDC_TIMER_12_BIT,
+    LEDC_TIMER_13_BIT, LEDC_TIMER_14_BIT, LEDC_TIMER_15_BIT, LEDC_TIMER_16_BIT,
+    LEDC_TIMER_17_BIT, LEDC_TIMER_18_BIT, LEDC_TIMER_19_BIT, LEDC_TIMER_20_BIT,
+    LEDC_TIMER_BIT_MAX
+} ledc_timer_bit_t;
+
+typedef enum {
+    LEDC_FADE_NO_WAIT = 0,
+    LEDC_FADE_WAIT_DONE,
+    LEDC_FADE_MAX
+} ledc_fade_mode_t;
+
+typedef enum {
+    LEDC_AUTO_CLK = 0,
+    LEDC_USE_REF_TICK,
+    LEDC_USE_APB_CLK,
+    LEDC_USE_RTC8M_CLK
+} ledc_clk_cfg_t;
+
+typedef struct {
+    ledc_mode_t speed_mode;
+    ledc_timer_bit_t duty_resolution;
+    ledc_timer_t timer_num;
+    uint32_t freq_hz;
+    ledc_clk_cfg_t clk_cfg;
+} ledc_timer_config_t;
+
+typedef struct {
+    int gpio_num;
+    ledc_mode_t speed_mode;
+    ledc_channel_t channel;
+    ledc_intr_type_t intr_type;
+    ledc_timer_t timer_sel;
+    uint32_t duty;
+    int hpoint;
+    struct {
+        unsigned int output_invert: 1;
+    } flags;
+} ledc_channel_config_t;
+
+namespace sim_hal {
+
+struct ledc_timer_state {
+    bool configured {false};
+    uint32_t freq_hz {0};
+    uint32_t duty_resolution {0};
+};
+
+struct ledc_channel_state {
+    bool configured {false};
+    int gpio_num {-1};
+    ledc_timer_t timer_sel {LEDC_TIMER_0};
+    uint32_t duty {0};
+    // Last hardware fade that was started
+    uint32_t fade_target {0};
+    uint32_t fade_time_ms {0};
+    uint32_t fade_count {0};
+    uint32_t update_count {0};
+    bool stopped {false};
+};
+
+inline std::mutex ledc_lock;
+inline bool ledc_fade_installed {false};
+inline std::array<std::array<ledc_timer_state, LEDC_TIMER_MAX>, LEDC_SPEED_MODE_MAX> ledc_timers {};
+inline std::array<std::array<ledc_channel_state, LEDC_CHANNEL_MAX>, LEDC_SPEED_MODE_MAX> ledc_channels {};
+
+// Copy of a channel's state, for checking from host code
+inline ledc_channel_state ledc_channel(const ledc_mode_t mode, const ledc_channel_t channel) {
+    std::lock_guard<std::mutex> lock(ledc_lock);
+    return ledc_channels[mode][channel];
+}
+
+// Copy of a timer's state, for checking from host code
+inline ledc_timer_state ledc_timer(const ledc_mode_t mode, const ledc_timer_t timer) {
+    std::lock_guard<std::mutex> lock(ledc_lock);
+    return ledc_timers[mode][timer];
+}
+
+// The hardware divider only works if freq * 2^resolution fits in the APB clock
+inline bool ledc_freq_fits(const uint32_t freq_hz, const uint32_t duty_resolution) {
+    return freq_hz > 0 && duty_resolution > 0 && duty_resolution < LEDC_TIMER_BIT_MAX &&
+            (static_cast<uint64_t>(freq_hz) << duty_resolution) <= LEDC_APB_CLK_HZ;
+}
+
+// Clears every timer and channel back to power-on state
+inline void ledc_reset() {
+    std::lock_guard<std::mutex> lock(ledc_lock);
+    ledc_fade_installed = false;
+    ledc_timers = {};
+    ledc_channels = {};
+}
+
+}
+
+inline esp_err_t ledc_timer_config(const ledc_timer_config_t* timer_conf) {
+    if (timer_conf == nullptr || timer_conf->speed_mode >= LEDC_SPEED_MODE_MAX ||
+            timer_conf->timer_num >= LEDC_TIMER_MAX)
+        return ESP_ERR_INVALID_ARG;
+    if (!sim_hal::ledc_freq_fits(timer_conf->freq_hz, timer_conf->duty_resolution))
+        return ESP_FAIL;
+
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_timer_state& timer = sim_hal::ledc_timers[timer_conf->speed_mode][timer_conf->timer_num];
+    timer.configured = true;
+    timer.freq_hz = timer_conf->freq_hz;
+    timer.duty_resolution = timer_conf->duty_resolution;
+    return ESP_OK;
+}
+
+inline esp_err_t ledc_channel_config(const ledc_channel_config_t* ledc_conf) {
+    if (ledc_conf == nullptr || ledc_conf->speed_mode >= LEDC_SPEED_MODE_MAX ||
+            ledc_conf->channel >= LEDC_CHANNEL_MAX || ledc_conf->timer_sel >= LEDC_TIMER_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_channel_state& channel = sim_hal::ledc_channels[ledc_conf->speed_mode][ledc_conf->channel];
+    channel.configured = true;
+    channel.gpio_num = ledc_conf->gpio_num;
+    channel.timer_sel = ledc_conf->timer_sel;
+    channel.duty = ledc_conf->duty;
+    channel.stopped = false;
+    return ESP_OK;
+}
+
+inline esp_err_t ledc_set_freq(const ledc_mode_t speed_mode, const ledc_timer_t timer_num, const uint32_t freq_hz) {
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || timer_num >= LEDC_TIMER_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_timer_state& timer = sim_hal::ledc_timers[speed_mode][timer_num];
+    if (!timer.configured)
+        return ESP_ERR_INVALID_STATE;
+    if (!sim_hal::ledc_freq_fits(freq_hz, timer.duty_resolution))
+        return ESP_FAIL;
+    timer.freq_hz = freq_hz;
+    return ESP_OK;
+}
+
+inline uint32_t ledc_get_freq(const ledc_mode_t speed_mode, const ledc_timer_t timer_num) {
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || timer_num >= LEDC_TIMER_MAX)
+        return 0;
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    return sim_hal::ledc_timers[speed_mode][timer_num].freq_hz;
+}
+
+inline esp_err_t ledc_set_duty_and_update(const ledc_mode_t speed_mode, const ledc_channel_t channel,
+        const uint32_t duty, const uint32_t hpoint) {
+    (void)hpoint;
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_channel_state& state = sim_hal::ledc_channels[speed_mode][channel];
+    if (!state.configured || !sim_hal::ledc_fade_installed)
+        return ESP_ERR_INVALID_STATE;
+    if (duty > (1u << sim_hal::ledc_timers[speed_mode][state.timer_sel].duty_resolution))
+        return ESP_ERR_INVALID_ARG;
+    state.duty = duty;
+    state.update_count++;
+    state.stopped = false;
+    return ESP_OK;
+}
+
+inline uint32_t ledc_get_duty(const ledc_mode_t speed_mode, const ledc_channel_t channel) {
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || channel >= LEDC_CHANNEL_MAX)
+        return 0;
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    return sim_hal::ledc_channels[speed_mode][channel].duty;
+}
+
+inline esp_err_t ledc_fade_func_install(const int intr_alloc_flags) {
+    (void)intr_alloc_flags;
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    if (sim_hal::ledc_fade_installed)
+        return ESP_ERR_INVALID_STATE;
+    sim_hal::ledc_fade_installed = true;
+    return ESP_OK;
+}
+
+// The fade completes instantly on the host, only the request is recorded
+inline esp_err_t ledc_set_fade_time_and_start(const ledc_mode_t speed_mode, const ledc_channel_t channel,
+        const uint32_t target_duty, const uint32_t max_fade_time_ms, const ledc_fade_mode_t fade_mode) {
+    (void)fade_mode;
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_channel_state& state = sim_hal::ledc_channels[speed_mode][channel];
+    if (!state.configured || !sim_hal::ledc_fade_installed)
+        return ESP_ERR_INVALID_STATE;
+    if (target_duty > (1u << sim_hal::ledc_timers[speed_mode][state.timer_sel].duty_resolution))
+        return ESP_ERR_INVALID_ARG;
+    state.fade_target = target_duty;
+    state.fade_time_ms = max_fade_time_ms;
+    state.fade_count++;
+    state.duty = target_duty;
+    state.stopped = false;
+    return ESP_OK;
+}
+
+inline esp_err_t ledc_stop(const ledc_mode_t speed_mode, const ledc_channel_t channel, const uint32_t idle_level) {
+    (void)idle_level;
+    if (speed_mode >= LEDC_SPEED_MODE_MAX || channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(sim_hal::ledc_lock);
+    sim_hal::ledc_channels[speed_mode][channel].stopped = true;
+    return ESP_OK;
+}
+
+#endif /* __SIM_DRIVER_LEDC_H__ */
@@ -0,0 +1,38 @@
+/**
+ * @file spi_common.h
+ * @brief Host stand-in for the ESP-IDF SPI bus definitions
+ * 
+ */
+#ifndef __SIM_DRIVER_SPI_COMMON_H__
+#define __SIM_DRIVER_SPI_COMMON_H__
+
+#include <cstdint>
+
+typedef enum {
+    SPI1_HOST = 0,
+    SPI2_HOST = 1,
+    SPI3_HOST = 2,
+    SPI_HOST_MAX
+} spi_host_device_t;
+
+#define HSPI_HOST (SPI2_HOST)
+#define VSPI_HOST (SPI3_HOST)
+
+#define SPICOMMON_BUSFLAG_SLAVE     (0)
+#define SPICOMMON_BUSFLAG_MASTER    (1<<0)
+#define SPICOMMON_BUSFLAG_SCLK      (1<<3)
+#define SPICOMMON_BUSFLAG_MISO      (1<<4)
+#define SPICOMMON_BUSFLAG_MOSI      (1<<5)
+
+typedef struct {
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+    uint32_t flags;
+    int intr_flags;
+} spi_bus_config_t;
+
+#endif /* __SIM_DRIVER_SPI_COMMON_H__ */
@@ -0,0 +1,210 @@
+/**
+ * @file spi_master.h
+ * @brief Host stand-in for the ESP-IDF SPI master driver
+ * 
+ * Each device added to a bus answers transactions from a frame source
+ * keyed by its chip select pin. Polled and queued transactions, and the
+ * interrupts the queued path would take, are counted so bus access
+ * patterns can be compared and benchmarked on Linux.
+ */
+#ifndef __SIM_DRIVER_SPI_MASTER_H__
+#define __SIM_DRIVER_SPI_MASTER_H__
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "driver/spi_common.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define SPI_TRANS_USE_RXDATA (1<<2)
+#define SPI_TRANS_USE_TXDATA (1<<3)
+
+typedef void (*transaction_cb_t)(struct spi_transaction_t* trans);
+
+typedef struct {
+    uint8_t command_bits;
+    uint8_t address_bits;
+    uint8_t dummy_bits;
+    uint8_t mode;
+    uint16_t duty_cycle_pos;
+    uint16_t cs_ena_pretrans;
+    uint8_t cs_ena_posttrans;
+    int clock_speed_hz;
+    int input_delay_ns;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+
+struct spi_transaction_t {
+    uint32_t flags;
+    uint16_t cmd;
+    uint64_t addr;
+    size_t length;
+    size_t rxlength;
+    void* user;
+    union {
+        const void* tx_buffer;
+        uint8_t tx_data[4];
+    };
+    union {
+        void* rx_buffer;
+        uint8_t rx_data[4];
+    };
+};
+
+namespace sim_hal {
+
+struct spi_device {
+    spi_host_device_t host;
+    spi_device_interface_config_t cfg;
+    std::deque<spi_transaction_t*> queued;
+    bool acquired {false};
+};
+
+struct spi_counters {
+    uint64_t transactions {0};
+    uint64_t polled {0};
+    uint64_t queued {0};
+    uint64_t interrupts {0}; // one per queued transaction on the real driver
+    uint64_t bits {0};
+};
+
+inline std::recursive_mutex spi_lock;
+inline std::array<bool, SPI_HOST_MAX> spi_bus_ready {};
+inline std::vector<std::unique_ptr<spi_device>> spi_devices;
+inline std::map<int, std::function<uint32_t()>> spi_frame_sources;
+inline spi_counters spi_stats {};
+
+// Sets what a device answers, keyed by its chip select pin
+inline void spi_set_frame_source(const int cs_pin, std::function<uint32_t()> source) {
+    std::lock_guard<std::recursive_mutex> lock(spi_lock);
+    spi_frame_sources[cs_pin] = std::move(source);
+}
+
+inline spi_counters spi_counters_snapshot() {
+    std::lock_guard<std::recursive_mutex> lock(spi_lock);
+    return spi_stats;
+}
+
+// Removes every bus and device, frame sources are kept
+inline void spi_reset() {
+    std::lock_guard<std::recursive_mutex> lock(spi_lock);
+    spi_bus_ready = {};
+    spi_devices.clear();
+    spi_stats = {};
+}
+
+// Clocks one transaction, the frame is returned most significant byte first like the wire
+inline void spi_exchange(spi_device* dev, spi_transaction_t* trans) {
+    uint32_t frame {0};
+    auto source = spi_frame_sources.find(dev->cfg.spics_io_num);
+    if (source != spi_frame_sources.end() && source->second)
+        frame = source->second();
+
+    const size_t bits = trans->rxlength ? trans->rxlength : trans->length;
+    uint8_t* rx = (trans->flags & SPI_TRANS_USE_RXDATA) ? trans->rx_data : static_cast<uint8_t*>(trans->rx_buffer);
+    if (rx != nullptr) {
+        for (size_t i = 0; i < (bits + 7) / 8 && i < 4; i++)
+            rx[i] = static_cast<uint8_t>(frame >> (24 - 8*i));
+    }
+    spi_stats.transactions++;
+    spi_stats.bits += bits;
+}
+
+}
+
+typedef sim_hal::spi_device* spi_device_handle_t;
+
+inline esp_err_t spi_bus_initialize(const spi_host_device_t host, const spi_bus_config_t* bus_config, const int dma_chan) {
+    (void)dma_chan;
+    if (host >= SPI_HOST_MAX || bus_config == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    if (sim_hal::spi_bus_ready[host])
+        return ESP_ERR_INVALID_STATE;
+    sim_hal::spi_bus_ready[host] = true;
+    return ESP_OK;
+}
+
+inline esp_err_t spi_bus_add_device(const spi_host_device_t host, const spi_device_interface_config_t* dev_config,
+        spi_device_handle_t* handle) {
+    if (host >= SPI_HOST_MAX || dev_config == nullptr || handle == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    if (!sim_hal::spi_bus_ready[host])
+        return ESP_ERR_INVALID_STATE;
+    sim_hal::spi_devices.push_back(std::make_unique<sim_hal::spi_device>());
+    sim_hal::spi_devices.back()->host = host;
+    sim_hal::spi_devices.back()->cfg = *dev_config;
+    *handle = sim_hal::spi_devices.back().get();
+    return ESP_OK;
+}
+
+inline esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t* trans) {
+    if (handle == nullptr || trans == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    sim_hal::spi_exchange(handle, trans);
+    sim_hal::spi_stats.polled++;
+    return ESP_OK;
+}
+
+inline esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t* trans, const TickType_t ticks_to_wait) {
+    (void)ticks_to_wait;
+    if (handle == nullptr || trans == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    if (static_cast<int>(handle->queued.size()) >= handle->cfg.queue_size)
+        return ESP_ERR_TIMEOUT;
+    handle->queued.push_back(trans);
+    sim_hal::spi_stats.queued++;
+    return ESP_OK;
+}
+
+inline esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t** trans_desc,
+        const TickType_t ticks_to_wait) {
+    (void)ticks_to_wait;
+    if (handle == nullptr || trans_desc == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    if (handle->queued.empty())
+        return ESP_ERR_TIMEOUT;
+    spi_transaction_t* trans = handle->queued.front();
+    handle->queued.pop_front();
+    sim_hal::spi_exchange(handle, trans);
+    sim_hal::spi_stats.interrupts++;
+    *trans_desc = trans;
+    return ESP_OK;
+}
+
+inline esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t* trans) {
+    esp_err_t ret = spi_device_queue_trans(handle, trans, portMAX_DELAY);
+    if (ret != ESP_OK)
+        return ret;
+    spi_transaction_t* done {nullptr};
+    return spi_device_get_trans_result(handle, &done, portMAX_DELAY);
+}
+
+inline esp_err_t spi_device_acquire_bus(spi_device_handle_t handle, const TickType_t wait) {
+    (void)wait;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    handle->acquired = true;
+    return ESP_OK;
+}
+
+inline void spi_device_release_bus(spi_device_handle_t handle) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::spi_lock);
+    handle->acquired = false;
+}
+
+#endif /* __SIM_DRIVER_SPI_MASTER_H__ */
@@ -0,0 +1,270 @@
+/**
+ * @file timer.h
+ * @brief Host stand-in for the ESP-IDF timer group driver
+ * 
+ * Timers count against a virtual APB clock that only moves when
+ * sim_hal::timer_advance_us() is called. Alarms that fall inside the
+ * advanced window call the registered ISR in time order, so pulse counts
+ * and intervals come out exactly as programmed.
+ */
+#ifndef __SIM_DRIVER_TIMER_H__
+#define __SIM_DRIVER_TIMER_H__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+#include "esp_err.h"
+
+#define TIMER_BASE_CLK (80*1000*1000)
+
+typedef enum {
+    TIMER_GROUP_0 = 0,
+    TIMER_GROUP_1 = 1,
+    TIMER_GROUP_MAX
+} timer_group_t;
+
+typedef enum {
+    TIMER_0 = 0,
+    TIMER_1 = 1,
+    TIMER_MAX
+} timer_idx_t;
+
+typedef enum {
+    TIMER_COUNT_DOWN = 0,
+    TIMER_COUNT_UP = 1,
+    TIMER_COUNT_MAX
+} timer_count_dir_t;
+
+typedef enum {
+    TIMER_PAUSE = 0,
+    TIMER_START = 1
+} timer_start_t;
+
+typedef enum {
+    TIMER_ALARM_DIS = 0,
+    TIMER_ALARM_EN = 1,
+    TIMER_ALARM_MAX
+} timer_alarm_t;
+
+typedef enum {
+    TIMER_INTR_LEVEL = 0,
+    TIMER_INTR_MAX
+} timer_intr_mode_t;
+
+typedef enum {
+    TIMER_AUTORELOAD_DIS = 0,
+    TIMER_AUTORELOAD_EN = 1,
+    TIMER_AUTORELOAD_MAX
+} timer_autoreload_t;
+
+typedef struct {
+    timer_alarm_t alarm_en;
+    timer_start_t counter_en;
+    timer_intr_mode_t intr_type;
+    timer_count_dir_t counter_dir;
+    timer_autoreload_t auto_reload;
+    uint32_t divider;
+} timer_config_t;
+
+typedef bool (*timer_isr_t)(void*);
+
+namespace sim_hal {
+
+struct timer_state {
+    bool initialized {false};
+    bool running {false};
+    bool alarm_en {false};
+    bool auto_reload {false};
+    bool intr_en {false};
+    uint32_t divider {2};
+    uint64_t alarm {0};
+    // Counter value at start_cycle, the counter moves on from there while running
+    uint64_t counter_at_start {0};
+    uint64_t start_cycle {0};
+    timer_isr_t isr {nullptr};
+    void* isr_arg {nullptr};
+    uint64_t alarm_count {0};
+};
+
+// Virtual time, in APB clock cycles (12.5 ns)
+inline uint64_t timer_now_cycles {0};
+inline std::recursive_mutex timer_lock;
+inline std::array<std::array<timer_state, TIMER_MAX>, TIMER_GROUP_MAX> timers {};
+
+inline timer_state& timer_get(const timer_group_t group, const timer_idx_t idx) {
+    return timers[group][idx];
+}
+
+inline uint64_t timer_counter(const timer_state& t) {
+    if (!t.running)
+        return t.counter_at_start;
+    return t.counter_at_start + (timer_now_cycles - t.start_cycle) / t.divider;
+}
+
+// Freezes the counter at its current value so the timer can be changed
+inline void timer_rebase(timer_state& t) {
+    t.counter_at_start = timer_counter(t);
+    t.start_cycle = timer_now_cycles;
+}
+
+// Cycle at which the timer's alarm fires, or UINT64_MAX if it never will
+inline uint64_t timer_next_alarm_cycle(const timer_state& t) {
+    if (!t.running || !t.alarm_en || !t.intr_en || t.isr == nullptr)
+        return UINT64_MAX;
+    if (t.alarm <= t.counter_at_start)
+        return t.start_cycle;
+    return t.start_cycle + (t.alarm - t.counter_at_start)*t.divider;
+}
+
+inline uint64_t timer_now_us() {
+    std::lock_guard<std::recursive_mutex> lock(timer_lock);
+    return timer_now_cycles / (TIMER_BASE_CLK / 1000000);
+}
+
+// Moves virtual time forward, firing every alarm that falls inside the window
+inline void timer_advance_us(const uint64_t us) {
+    std::lock_guard<std::recursive_mutex> lock(timer_lock);
+    const uint64_t target = timer_now_cycles + us*(TIMER_BASE_CLK / 1000000);
+
+    while (true) {
+        timer_state* next = nullptr;
+        uint64_t next_cycle = UINT64_MAX;
+        for (auto& group : timers) {
+            for (auto& t : group) {
+                // An alarm already behind the counter fires as soon as it is enabled
+                const uint64_t cycle = std::max(timer_next_alarm_cycle(t), timer_now_cycles);
+                if (timer_next_alarm_cycle(t) != UINT64_MAX && cycle < next_cycle) {
+                    next_cycle = cycle;
+                    next = &t;
+                }
+            }
+        }
+        if (next == nullptr || next_cycle > target)
+            break;
+
+        timer_now_cycles = next_cycle;
+        next->alarm_count++;
+        // The hardware clears the alarm enable when it fires, and reloads the counter if asked
+        next->alarm_en = false;
+        if (next->auto_reload) {
+            next->counter_at_start = 0;
+            next->start_cycle = timer_now_cycles;
+        }
+        else {
+            timer_rebase(*next);
+        }
+        next->isr(next->isr_arg);
+    }
+    timer_now_cycles = target;
+}
+
+// Clears every timer back to power-on state, virtual time is kept
+inline void timer_reset() {
+    std::lock_guard<std::recursive_mutex> lock(timer_lock);
+    timers = {};
+}
+
+}
+
+inline esp_err_t timer_init(const timer_group_t group, const timer_idx_t idx, const timer_config_t* config) {
+    if (group >= TIMER_GROUP_MAX || idx >= TIMER_MAX || config == nullptr || config->divider < 2)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_state& t = sim_hal::timer_get(group, idx);
+    t.initialized = true;
+    t.divider = config->divider;
+    t.alarm_en = config->alarm_en == TIMER_ALARM_EN;
+    t.auto_reload = config->auto_reload == TIMER_AUTORELOAD_EN;
+    t.running = config->counter_en == TIMER_START;
+    t.start_cycle = sim_hal::timer_now_cycles;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_set_counter_value(const timer_group_t group, const timer_idx_t idx, const uint64_t load_val) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_state& t = sim_hal::timer_get(group, idx);
+    t.counter_at_start = load_val;
+    t.start_cycle = sim_hal::timer_now_cycles;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_get_counter_value(const timer_group_t group, const timer_idx_t idx, uint64_t* value) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    *value = sim_hal::timer_counter(sim_hal::timer_get(group, idx));
+    return ESP_OK;
+}
+
+inline esp_err_t timer_set_alarm_value(const timer_group_t group, const timer_idx_t idx, const uint64_t alarm_value) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_get(group, idx).alarm = alarm_value;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_set_alarm(const timer_group_t group, const timer_idx_t idx, const timer_alarm_t alarm_en) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_get(group, idx).alarm_en = alarm_en == TIMER_ALARM_EN;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_enable_intr(const timer_group_t group, const timer_idx_t idx) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_get(group, idx).intr_en = true;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_disable_intr(const timer_group_t group, const timer_idx_t idx) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_get(group, idx).intr_en = false;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_isr_callback_add(const timer_group_t group, const timer_idx_t idx,
+        const timer_isr_t isr_handler, void* arg, const int intr_alloc_flags) {
+    (void)intr_alloc_flags;
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_state& t = sim_hal::timer_get(group, idx);
+    t.isr = isr_handler;
+    t.isr_arg = arg;
+    t.intr_en = true;
+    return ESP_OK;
+}
+
+inline esp_err_t timer_start(const timer_group_t group, const timer_idx_t idx) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_state& t = sim_hal::timer_get(group, idx);
+    if (!t.initialized)
+        return ESP_ERR_INVALID_STATE;
+    if (!t.running) {
+        t.running = true;
+        t.start_cycle = sim_hal::timer_now_cycles;
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t timer_pause(const timer_group_t group, const timer_idx_t idx) {
+    std::lock_guard<std::recursive_mutex> lock(sim_hal::timer_lock);
+    sim_hal::timer_state& t = sim_hal::timer_get(group, idx);
+    sim_hal::timer_rebase(t);
+    t.running = false;
+    return ESP_OK;
+}
+
+inline void timer_group_set_alarm_value_in_isr(const timer_group_t group, const timer_idx_t idx, const uint64_t alarm_val) {
+    timer_set_alarm_value(group, idx, alarm_val);
+}
+
+inline void timer_group_enable_alarm_in_isr(const timer_group_t group, const timer_idx_t idx) {
+    timer_set_alarm(group, idx, TIMER_ALARM_EN);
+}
+
+inline void timer_group_set_counter_enable_in_isr(const timer_group_t group, const timer_idx_t idx,
+        const timer_start_t counter_en) {
+    if (counter_en == TIMER_START)
+        timer_start(group, idx);
+    else
+        timer_pause(group, idx);
+}
+
+#endif /* __SIM_DRIVER_TIMER_H__ */
@@ -0,0 +1,161 @@
+/**
+ * @file uart.h
+ * @brief Host stand-in for the ESP-IDF UART driver
+ * 
+ * Each port is a pair of byte queues. The simulator plays the far end
+ * of the wire through the sim_hal:: calls: send bytes to the MCU and
+ * collect what it wrote.
+ */
+#ifndef __SIM_DRIVER_UART_H__
+#define __SIM_DRIVER_UART_H__
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+#define UART_NUM_0          (0)
+#define UART_NUM_1          (1)
+#define UART_NUM_2          (2)
+#define UART_NUM_MAX        (3)
+
+typedef enum {
+    UART_DATA_5_BITS = 0,
+    UART_DATA_6_BITS,
+    UART_DATA_7_BITS,
+    UART_DATA_8_BITS
+} uart_word_length_t;
+
+typedef enum {
+    UART_PARITY_DISABLE = 0,
+    UART_PARITY_EVEN = 2,
+    UART_PARITY_ODD = 3
+} uart_parity_t;
+
+typedef enum {
+    UART_STOP_BITS_1 = 1,
+    UART_STOP_BITS_1_5,
+    UART_STOP_BITS_2
+} uart_stop_bits_t;
+
+typedef enum {
+    UART_HW_FLOWCTRL_DISABLE = 0,
+    UART_HW_FLOWCTRL_RTS,
+    UART_HW_FLOWCTRL_CTS,
+    UART_HW_FLOWCTRL_CTS_RTS
+} uart_hw_flowcontrol_t;
+
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+} uart_config_t;
+
+#define UART_PIN_NO_CHANGE  (-1)
+
+namespace sim_hal {
+
+struct uart_state {
+    std::mutex lock;
+    std::condition_variable received;
+    bool installed {false};
+    int baud_rate {0};
+    std::deque<uint8_t> rx;
+    std::vector<uint8_t> tx;
+};
+
+inline std::array<uart_state, UART_NUM_MAX> uarts;
+
+// The far end sends bytes to the MCU
+inline void uart_host_send(const uart_port_t port, const uint8_t* data, const size_t len) {
+    uart_state& uart = uarts[port];
+    std::lock_guard<std::mutex> lock(uart.lock);
+    uart.rx.insert(uart.rx.end(), data, data + len);
+    uart.received.notify_all();
+}
+
+// Everything the MCU wrote since the last call
+inline std::vector<uint8_t> uart_take_tx(const uart_port_t port) {
+    uart_state& uart = uarts[port];
+    std::lock_guard<std::mutex> lock(uart.lock);
+    std::vector<uint8_t> tx;
+    tx.swap(uart.tx);
+    return tx;
+}
+
+}
+
+inline esp_err_t uart_param_config(const uart_port_t port, const uart_config_t* config) {
+    if (port < 0 || port >= UART_NUM_MAX || config == nullptr || config->baud_rate <= 0)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(sim_hal::uarts[port].lock);
+    sim_hal::uarts[port].baud_rate = config->baud_rate;
+    return ESP_OK;
+}
+
+inline esp_err_t uart_set_pin(const uart_port_t port, const int tx_pin, const int rx_pin, const int rts_pin,
+        const int cts_pin) {
+    (void)tx_pin;
+    (void)rx_pin;
+    (void)rts_pin;
+    (void)cts_pin;
+    return port >= 0 && port < UART_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+inline esp_err_t uart_driver_install(const uart_port_t port, const int rx_buffer_size, const int tx_buffer_size,
+        const int queue_size, void* uart_queue, const int intr_alloc_flags) {
+    (void)tx_buffer_size;
+    (void)queue_size;
+    (void)uart_queue;
+    (void)intr_alloc_flags;
+    if (port < 0 || port >= UART_NUM_MAX || rx_buffer_size <= 0)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(sim_hal::uarts[port].lock);
+    if (sim_hal::uarts[port].installed)
+        return ESP_FAIL;
+    sim_hal::uarts[port].installed = true;
+    return ESP_OK;
+}
+
+// Waits in wall time, the reader is not one of the threads the virtual clock waits for
+inline int uart_read_bytes(const uart_port_t port, uint8_t* buf, const uint32_t length, const TickType_t ticks) {
+    sim_hal::uart_state& uart = sim_hal::uarts[port];
+    std::unique_lock<std::mutex> lock(uart.lock);
+    if (!uart.installed)
+        return -1;
+    const auto timeout = std::chrono::milliseconds(static_cast<uint64_t>(ticks)*portTICK_PERIOD_MS);
+    uart.received.wait_for(lock, timeout, [&uart] { return !uart.rx.empty(); });
+    const size_t len = std::min<size_t>(length, uart.rx.size());
+    std::copy(uart.rx.begin(), uart.rx.begin() + len, buf);
+    uart.rx.erase(uart.rx.begin(), uart.rx.begin() + len);
+    return static_cast<int>(len);
+}
+
+inline int uart_write_bytes(const uart_port_t port, const char* src, const size_t size) {
+    sim_hal::uart_state& uart = sim_hal::uarts[port];
+    std::lock_guard<std::mutex> lock(uart.lock);
+    if (!uart.installed)
+        return -1;
+    uart.tx.insert(uart.tx.end(), src, src + size);
+    return static_cast<int>(size);
+}
+
+inline esp_err_t uart_flush_input(const uart_port_t port) {
+    std::lock_guard<std::mutex> lock(sim_hal::uarts[port].lock);
+    sim_hal::uarts[port].rx.clear();
+    return ESP_OK;
+}
+
+#endif /* __SIM_DRIVER_UART_H__ */
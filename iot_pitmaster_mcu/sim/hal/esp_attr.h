@@ -0,0 +1,15 @@
+/**
+ * @file esp_attr.h
+ * @brief Host stand-in for the ESP-IDF section attributes
+ * 
+ */
+#ifndef __SIM_ESP_ATTR_H__
+#define __SIM_ESP_ATTR_H__
+
+// Code and data placement has no meaning on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif /* __SIM_ESP_ATTR_H__ */
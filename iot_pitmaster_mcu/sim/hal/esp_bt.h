@@ -0,0 +1,56 @@
+/**
+ * @file esp_bt.h
+ * @brief Host stand-in for the ESP-IDF Bluetooth controller API
+ * 
+ */
+#ifndef __SIM_ESP_BT_H__
+#define __SIM_ESP_BT_H__
+
+#include <cstdint>
+
+#include "esp_err.h"
+#include "esp_system.h"
+
+typedef enum {
+    ESP_BT_MODE_IDLE       = 0x00,
+    ESP_BT_MODE_BLE        = 0x01,
+    ESP_BT_MODE_CLASSIC_BT = 0x02,
+    ESP_BT_MODE_BTDM       = 0x03
+} esp_bt_mode_t;
+
+typedef enum {
+    ESP_PWR_LVL_N12 = 0,
+    ESP_PWR_LVL_N9  = 1,
+    ESP_PWR_LVL_N6  = 2,
+    ESP_PWR_LVL_N3  = 3,
+    ESP_PWR_LVL_N0  = 4,
+    ESP_PWR_LVL_P3  = 5,
+    ESP_PWR_LVL_P6  = 6,
+    ESP_PWR_LVL_P9  = 7
+} esp_power_level_t;
+
+typedef struct {
+    uint8_t mode;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() {ESP_BT_MODE_CLASSIC_BT}
+
+inline esp_err_t esp_bt_controller_mem_release(const esp_bt_mode_t mode) {
+    (void)mode;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_bt_controller_init(esp_bt_controller_config_t* cfg) {
+    return cfg == nullptr ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+inline esp_err_t esp_bt_controller_enable(const esp_bt_mode_t mode) {
+    (void)mode;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_bredr_tx_power_set(const esp_power_level_t min_power_level, const esp_power_level_t max_power_level) {
+    return min_power_level <= max_power_level ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+#endif /* __SIM_ESP_BT_H__ */
@@ -0,0 +1,26 @@
+/**
+ * @file esp_bt_device.h
+ * @brief Host stand-in for the ESP-IDF Bluetooth device calls
+ * 
+ */
+#ifndef __SIM_ESP_BT_DEVICE_H__
+#define __SIM_ESP_BT_DEVICE_H__
+
+#include <string>
+
+#include "esp_err.h"
+
+namespace sim_hal {
+
+inline std::string bt_device_name;
+
+}
+
+inline esp_err_t esp_bt_dev_set_device_name(const char* name) {
+    if (name == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    sim_hal::bt_device_name = name;
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_BT_DEVICE_H__ */
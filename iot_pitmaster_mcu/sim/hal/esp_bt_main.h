@@ -0,0 +1,19 @@
+/**
+ * @file esp_bt_main.h
+ * @brief Host stand-in for the ESP-IDF Bluedroid init calls
+ * 
+ */
+#ifndef __SIM_ESP_BT_MAIN_H__
+#define __SIM_ESP_BT_MAIN_H__
+
+#include "esp_err.h"
+
+inline esp_err_t esp_bluedroid_init() {
+    return ESP_OK;
+}
+
+inline esp_err_t esp_bluedroid_enable() {
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_BT_MAIN_H__ */
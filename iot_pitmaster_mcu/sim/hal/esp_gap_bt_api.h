@@ -0,0 +1,71 @@
+/**
+ * @file esp_gap_bt_api.h
+ * @brief Host stand-in for the ESP-IDF Classic Bluetooth GAP API
+ * 
+ */
+#ifndef __SIM_ESP_GAP_BT_API_H__
+#define __SIM_ESP_GAP_BT_API_H__
+
+#include <cstdint>
+
+#include "esp_err.h"
+
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef enum {
+    ESP_BT_NON_CONNECTABLE,
+    ESP_BT_CONNECTABLE
+} esp_bt_connection_mode_t;
+
+typedef enum {
+    ESP_BT_NON_DISCOVERABLE,
+    ESP_BT_LIMITED_DISCOVERABLE,
+    ESP_BT_GENERAL_DISCOVERABLE
+} esp_bt_discovery_mode_t;
+
+typedef enum {
+    ESP_BT_GAP_DISC_RES_EVT = 0,
+    ESP_BT_GAP_DISC_STATE_CHANGED_EVT,
+    ESP_BT_GAP_RMT_SRVCS_EVT,
+    ESP_BT_GAP_RMT_SRVC_REC_EVT,
+    ESP_BT_GAP_AUTH_CMPL_EVT,
+    ESP_BT_GAP_PIN_REQ_EVT,
+    ESP_BT_GAP_CFM_REQ_EVT,
+    ESP_BT_GAP_KEY_NOTIF_EVT,
+    ESP_BT_GAP_KEY_REQ_EVT,
+    ESP_BT_GAP_READ_RSSI_DELTA_EVT,
+    ESP_BT_GAP_CONFIG_EIR_DATA_EVT,
+    ESP_BT_GAP_SET_AFH_CHANNELS_EVT,
+    ESP_BT_GAP_READ_REMOTE_NAME_EVT,
+    ESP_BT_GAP_MODE_CHG_EVT
+} esp_bt_gap_cb_event_t;
+
+typedef union {
+    struct mode_chg_param {
+        esp_bd_addr_t bda;
+        uint8_t mode;
+    } mode_chg;
+} esp_bt_gap_cb_param_t;
+
+typedef void (*esp_bt_gap_cb_t)(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t* param);
+
+namespace sim_hal {
+
+inline esp_bt_gap_cb_t gap_callback {nullptr};
+inline esp_bt_connection_mode_t gap_connection_mode {ESP_BT_NON_CONNECTABLE};
+inline esp_bt_discovery_mode_t gap_discovery_mode {ESP_BT_NON_DISCOVERABLE};
+
+}
+
+inline esp_err_t esp_bt_gap_register_callback(const esp_bt_gap_cb_t callback) {
+    sim_hal::gap_callback = callback;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_bt_gap_set_scan_mode(const esp_bt_connection_mode_t c_mode, const esp_bt_discovery_mode_t d_mode) {
+    sim_hal::gap_connection_mode = c_mode;
+    sim_hal::gap_discovery_mode = d_mode;
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_GAP_BT_API_H__ */
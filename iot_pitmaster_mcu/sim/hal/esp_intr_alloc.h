@@ -0,0 +1,13 @@
+/**
+ * @file esp_intr_alloc.h
+ * @brief Host stand-in for the ESP-IDF interrupt allocation flags
+ * 
+ */
+#ifndef __SIM_ESP_INTR_ALLOC_H__
+#define __SIM_ESP_INTR_ALLOC_H__
+
+// Interrupts have no flash cache to wait for on the host, the flags are only passed along
+#define ESP_INTR_FLAG_LEVEL1 (1<<1)
+#define ESP_INTR_FLAG_IRAM   (1<<10)
+
+#endif /* __SIM_ESP_INTR_ALLOC_H__ */
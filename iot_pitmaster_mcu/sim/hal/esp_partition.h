@@ -0,0 +1,201 @@
+/**
+ * @file esp_partition.h
+ * @brief Host stand-in for the ESP-IDF partition API
+ *
+ * A partition is a memory-mapped file, or anonymous memory if no path
+ * is given, registered by the simulator before the firmware looks for
+ * it. Writes behave like NOR flash: they can only clear bits, and only
+ * an erase of whole sectors sets them again. Erases are counted per
+ * sector so wear can be checked.
+ */
+#ifndef __SIM_ESP_PARTITION_H__
+#define __SIM_ESP_PARTITION_H__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_spi_flash.h"
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+
+typedef struct {
+    void* flash_chip;
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+namespace sim_hal {
+
+struct partition_state {
+    esp_partition_t partition;
+    uint8_t* data;
+    std::vector<uint32_t> erase_counts;
+};
+
+struct partition_table {
+    std::mutex lock;
+    std::deque<partition_state> partitions;
+    uint32_t next_address {0x130000};
+};
+
+inline partition_table partitions;
+
+// Registers a data partition backed by the file at path, created erased if it is new, or by memory if path is empty
+// Returns false if the file could not be mapped
+inline bool partition_add(const char* label, const uint8_t subtype, const uint32_t size, const std::string& path = "") {
+    if (size == 0 || size % SPI_FLASH_SEC_SIZE != 0)
+        return false;
+
+    void* data {MAP_FAILED};
+    if (path.empty()) {
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data != MAP_FAILED)
+            std::memset(data, 0xff, size);
+    }
+    else {
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+        const off_t existing = lseek(fd, 0, SEEK_END);
+        if (existing < static_cast<off_t>(size)) {
+            // New space reads as erased flash
+            std::vector<uint8_t> erased(size - existing, 0xff);
+            if (pwrite(fd, erased.data(), erased.size(), existing) != static_cast<ssize_t>(erased.size())) {
+                close(fd);
+                return false;
+            }
+        }
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (data == MAP_FAILED)
+        return false;
+
+    std::lock_guard<std::mutex> lock(partitions.lock);
+    partition_state state {};
+    state.partition.type = ESP_PARTITION_TYPE_DATA;
+    state.partition.subtype = static_cast<esp_partition_subtype_t>(subtype);
+    state.partition.address = partitions.next_address;
+    state.partition.size = size;
+    std::strncpy(state.partition.label, label, sizeof(state.partition.label) - 1);
+    state.data = static_cast<uint8_t*>(data);
+    state.erase_counts.assign(size / SPI_FLASH_SEC_SIZE, 0);
+    partitions.next_address += size;
+    partitions.partitions.push_back(std::move(state));
+    return true;
+}
+
+inline partition_state* partition_find(const esp_partition_t* partition) {
+    for (partition_state& state : partitions.partitions) {
+        if (&state.partition == partition)
+            return &state;
+    }
+    return nullptr;
+}
+
+// Erases of every sector so far, in sector order
+inline std::vector<uint32_t> partition_erase_counts(const char* label) {
+    std::lock_guard<std::mutex> lock(partitions.lock);
+    for (partition_state& state : partitions.partitions) {
+        if (std::strcmp(state.partition.label, label) == 0)
+            return state.erase_counts;
+    }
+    return {};
+}
+
+}
+
+inline const esp_partition_t* esp_partition_find_first(const esp_partition_type_t type,
+        const esp_partition_subtype_t subtype, const char* label) {
+    std::lock_guard<std::mutex> lock(sim_hal::partitions.lock);
+    for (sim_hal::partition_state& state : sim_hal::partitions.partitions) {
+        if (state.partition.type != type)
+            continue;
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && state.partition.subtype != subtype)
+            continue;
+        if (label != nullptr && std::strcmp(state.partition.label, label) != 0)
+            continue;
+        return &state.partition;
+    }
+    return nullptr;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, const size_t src_offset, void* dst,
+        const size_t size) {
+    std::lock_guard<std::mutex> lock(sim_hal::partitions.lock);
+    sim_hal::partition_state* state = sim_hal::partition_find(partition);
+    if (state == nullptr || dst == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (src_offset > partition->size || size > partition->size - src_offset)
+        return ESP_ERR_INVALID_SIZE;
+    std::memcpy(dst, state->data + src_offset, size);
+    return ESP_OK;
+}
+
+// Programming can only clear bits, like NOR flash
+inline esp_err_t esp_partition_write(const esp_partition_t* partition, const size_t dst_offset, const void* src,
+        const size_t size) {
+    std::lock_guard<std::mutex> lock(sim_hal::partitions.lock);
+    sim_hal::partition_state* state = sim_hal::partition_find(partition);
+    if (state == nullptr || src == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (dst_offset > partition->size || size > partition->size - dst_offset)
+        return ESP_ERR_INVALID_SIZE;
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++)
+        state->data[dst_offset + i] &= bytes[i];
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, const size_t offset, const size_t size) {
+    std::lock_guard<std::mutex> lock(sim_hal::partitions.lock);
+    sim_hal::partition_state* state = sim_hal::partition_find(partition);
+    if (state == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (offset > partition->size || size > partition->size - offset)
+        return ESP_ERR_INVALID_SIZE;
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+        return ESP_ERR_INVALID_SIZE;
+    std::memset(state->data + offset, 0xff, size);
+    for (size_t sector = offset / SPI_FLASH_SEC_SIZE; sector < (offset + size) / SPI_FLASH_SEC_SIZE; sector++)
+        state->erase_counts[sector]++;
+    return ESP_OK;
+}
+
+// The mapping is the backing memory itself, so reads see every write at once, like the flash cache after a flush
+inline esp_err_t esp_partition_mmap(const esp_partition_t* partition, const size_t offset, const size_t size,
+        const spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle) {
+    (void)memory;
+    std::lock_guard<std::mutex> lock(sim_hal::partitions.lock);
+    sim_hal::partition_state* state = sim_hal::partition_find(partition);
+    if (state == nullptr || out_ptr == nullptr || out_handle == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    if (offset > partition->size || size > partition->size - offset)
+        return ESP_ERR_INVALID_ARG;
+    *out_ptr = state->data + offset;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_PARTITION_H__ */
@@ -0,0 +1,107 @@
+/**
+ * @file esp_pm.h
+ * @brief Host stand-in for the ESP-IDF power management locks
+ * 
+ * Locks are counted like on the board, and the time each was held is
+ * kept in virtual time, so a simulated cook shows how long the fan and
+ * the steppers would have kept the chip out of light sleep.
+ */
+#ifndef __SIM_ESP_PM_H__
+#define __SIM_ESP_PM_H__
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "driver/timer.h"
+#include "esp_err.h"
+
+typedef enum {
+    ESP_PM_CPU_FREQ_MAX,
+    ESP_PM_APB_FREQ_MAX,
+    ESP_PM_NO_LIGHT_SLEEP
+} esp_pm_lock_type_t;
+
+typedef struct {
+    int max_freq_mhz;
+    int min_freq_mhz;
+    bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+namespace sim_hal {
+
+struct pm_lock_state {
+    esp_pm_lock_type_t type;
+    const char* name;
+    uint32_t count {0};
+    uint64_t since_us {0};
+    uint64_t held_us {0};
+};
+
+inline std::mutex pm_mutex;
+inline std::list<pm_lock_state> pm_locks;
+inline uint32_t pm_held {0};
+inline uint64_t pm_blocked_since_us {0};
+inline uint64_t pm_blocked_us_total {0};
+inline esp_pm_config_esp32_t pm_config {160, 160, false};
+
+// Time any lock was held, the chip could not have been in light sleep
+inline uint64_t pm_blocked_us() {
+    std::lock_guard<std::mutex> lock(pm_mutex);
+    return pm_blocked_us_total + (pm_held > 0 ? timer_now_us() - pm_blocked_since_us : 0);
+}
+
+// Time one lock was held, by the name it was created with
+inline uint64_t pm_lock_held_us(const char* name) {
+    std::lock_guard<std::mutex> lock(pm_mutex);
+    uint64_t held_us {0};
+    for (const pm_lock_state& state : pm_locks) {
+        if (std::string(state.name) == name)
+            held_us += state.held_us + (state.count > 0 ? timer_now_us() - state.since_us : 0);
+    }
+    return held_us;
+}
+
+}
+
+typedef sim_hal::pm_lock_state* esp_pm_lock_handle_t;
+
+inline esp_err_t esp_pm_lock_create(const esp_pm_lock_type_t lock_type, const int arg, const char* name,
+        esp_pm_lock_handle_t* out_handle) {
+    (void)arg;
+    std::lock_guard<std::mutex> lock(sim_hal::pm_mutex);
+    sim_hal::pm_locks.push_back({lock_type, name != nullptr ? name : ""});
+    *out_handle = &sim_hal::pm_locks.back();
+    return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_acquire(const esp_pm_lock_handle_t handle) {
+    std::lock_guard<std::mutex> lock(sim_hal::pm_mutex);
+    const uint64_t now = sim_hal::timer_now_us();
+    if (handle->count++ == 0)
+        handle->since_us = now;
+    if (sim_hal::pm_held++ == 0)
+        sim_hal::pm_blocked_since_us = now;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_release(const esp_pm_lock_handle_t handle) {
+    std::lock_guard<std::mutex> lock(sim_hal::pm_mutex);
+    if (handle->count == 0)
+        return ESP_ERR_INVALID_STATE;
+    const uint64_t now = sim_hal::timer_now_us();
+    if (--handle->count == 0)
+        handle->held_us += now - handle->since_us;
+    if (--sim_hal::pm_held == 0)
+        sim_hal::pm_blocked_us_total += now - sim_hal::pm_blocked_since_us;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_pm_configure(const void* config) {
+    std::lock_guard<std::mutex> lock(sim_hal::pm_mutex);
+    sim_hal::pm_config = *static_cast<const esp_pm_config_esp32_t*>(config);
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_PM_H__ */
@@ -0,0 +1,32 @@
+/**
+ * @file esp_spi_flash.h
+ * @brief Host stand-in for the ESP-IDF SPI flash constants and mmap handles
+ *
+ */
+#ifndef __SIM_ESP_SPI_FLASH_H__
+#define __SIM_ESP_SPI_FLASH_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE  (4096)
+
+typedef enum {
+    SPI_FLASH_MMAP_DATA,
+    SPI_FLASH_MMAP_INST
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+// Host mappings are the partition file's own, there is nothing to release
+inline void spi_flash_munmap(const spi_flash_mmap_handle_t handle) {
+    (void)handle;
+}
+
+inline size_t spi_flash_get_chip_size() {
+    return 2*1024*1024;
+}
+
+#endif /* __SIM_ESP_SPI_FLASH_H__ */
@@ -0,0 +1,369 @@
+/**
+ * @file esp_spp_api.h
+ * @brief Host stand-in for the ESP-IDF Serial Port Profile API
+ * 
+ * Callbacks are delivered one at a time from a dedicated thread, like
+ * the Bluedroid BTC task does on the board. The simulator plays the
+ * phones through the sim_hal:: calls: connect, send bytes to the MCU,
+ * collect what the MCU wrote, and toggle link congestion, each by
+ * connection handle.
+ */
+#ifndef __SIM_ESP_SPP_API_H__
+#define __SIM_ESP_SPP_API_H__
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_gap_bt_api.h"
+
+#define ESP_SPP_MAX_MTU     (3*330)
+#define ESP_SPP_MAX_SCN     (31)
+
+typedef enum {
+    ESP_SPP_SUCCESS   = 0,
+    ESP_SPP_FAILURE,
+    ESP_SPP_BUSY,
+    ESP_SPP_NO_DATA,
+    ESP_SPP_NO_RESOURCE,
+    ESP_SPP_NEED_INIT,
+    ESP_SPP_NEED_DEINIT,
+    ESP_SPP_NO_CONNECTION,
+    ESP_SPP_NO_SERVER
+} esp_spp_status_t;
+
+typedef enum {
+    ESP_SPP_MODE_CB  = 0,
+    ESP_SPP_MODE_VFS = 1
+} esp_spp_mode_t;
+
+typedef uint16_t esp_spp_sec_t;
+#define ESP_SPP_SEC_NONE            (0x0000)
+#define ESP_SPP_SEC_AUTHORIZE       (0x0001)
+#define ESP_SPP_SEC_AUTHENTICATE    (0x0012)
+
+typedef enum {
+    ESP_SPP_ROLE_MASTER = 0,
+    ESP_SPP_ROLE_SLAVE  = 1
+} esp_spp_role_t;
+
+typedef enum {
+    ESP_SPP_INIT_EVT           = 0,
+    ESP_SPP_UNINIT_EVT         = 1,
+    ESP_SPP_DISCOVERY_COMP_EVT = 8,
+    ESP_SPP_OPEN_EVT           = 26,
+    ESP_SPP_CLOSE_EVT          = 27,
+    ESP_SPP_START_EVT          = 28,
+    ESP_SPP_CL_INIT_EVT        = 29,
+    ESP_SPP_DATA_IND_EVT       = 30,
+    ESP_SPP_CONG_EVT           = 31,
+    ESP_SPP_WRITE_EVT          = 33,
+    ESP_SPP_SRV_OPEN_EVT       = 34,
+    ESP_SPP_SRV_STOP_EVT       = 35
+} esp_spp_cb_event_t;
+
+typedef union {
+    struct spp_init_evt_param {
+        esp_spp_status_t status;
+    } init;
+    struct spp_start_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint8_t sec_id;
+        bool use_co;
+    } start;
+    struct spp_srv_open_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint32_t new_listen_handle;
+        esp_bd_addr_t rem_bda;
+    } srv_open;
+    struct spp_open_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        int fd;
+        esp_bd_addr_t rem_bda;
+    } open;
+    struct spp_close_evt_param {
+        esp_spp_status_t status;
+        uint32_t port_status;
+        uint32_t handle;
+        bool async;
+    } close;
+    struct spp_write_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        int len;
+        bool cong;
+    } write;
+    struct spp_data_ind_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint16_t len;
+        uint8_t* data;
+    } data_ind;
+    struct spp_cong_evt_param {
+        esp_spp_status_t status;
+        uint32_t handle;
+        bool cong;
+    } cong;
+} esp_spp_cb_param_t;
+
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t* param);
+
+namespace sim_hal {
+
+struct spp_event {
+    esp_spp_cb_event_t event;
+    esp_spp_cb_param_t param;
+    std::vector<uint8_t> data;
+};
+
+// One esp_spp_write(), and the connection it went to
+struct spp_tx_frame {
+    uint32_t handle;
+    std::vector<uint8_t> data;
+};
+
+struct spp_counters {
+    uint32_t writes;
+    uint32_t write_bytes;
+    uint32_t received;
+    uint32_t received_bytes;
+};
+
+struct spp_state {
+    std::mutex lock;
+    std::condition_variable changed;
+    esp_spp_cb_t callback {nullptr};
+    bool initialized {false};
+    bool server_started {false};
+    uint32_t next_handle {0x81};
+    std::vector<uint32_t> open_handles;
+    std::vector<uint32_t> congested_handles;
+    std::deque<spp_event> events;
+    bool delivering {false};
+    std::deque<spp_tx_frame> tx_log;
+    spp_counters counters {};
+};
+
+// Frames kept for spp_take_tx(), older ones are dropped
+#define SIM_SPP_TX_LOG_MAX  (4096)
+
+inline spp_state spp;
+
+inline void spp_post(spp_event&& event) {
+    std::lock_guard<std::mutex> lock(spp.lock);
+    spp.events.push_back(std::move(event));
+    spp.changed.notify_all();
+}
+
+// Bluedroid BTC task stand-in
+inline void spp_event_loop() {
+    std::unique_lock<std::mutex> lock(spp.lock);
+    while (true) {
+        spp.changed.wait(lock, [] { return !spp.events.empty(); });
+        spp_event event = std::move(spp.events.front());
+        spp.events.pop_front();
+        spp.delivering = true;
+        const esp_spp_cb_t callback = spp.callback;
+        lock.unlock();
+
+        if (event.event == ESP_SPP_DATA_IND_EVT)
+            event.param.data_ind.data = event.data.data();
+        if (callback != nullptr)
+            callback(event.event, &event.param);
+
+        lock.lock();
+        spp.delivering = false;
+        spp.changed.notify_all();
+    }
+}
+
+// Blocks until every posted event has been handled
+inline void spp_wait_idle() {
+    std::unique_lock<std::mutex> lock(spp.lock);
+    spp.changed.wait(lock, [] { return spp.events.empty() && !spp.delivering; });
+}
+
+// A phone opens the server, returns the new handle or 0 if the server is not up
+inline uint32_t spp_connect() {
+    spp_event event {ESP_SPP_SRV_OPEN_EVT, {}, {}};
+    {
+        std::lock_guard<std::mutex> lock(spp.lock);
+        if (!spp.server_started)
+            return 0;
+        event.param.srv_open.status = ESP_SPP_SUCCESS;
+        event.param.srv_open.handle = spp.next_handle++;
+        spp.open_handles.push_back(event.param.srv_open.handle);
+    }
+    const uint32_t handle = event.param.srv_open.handle;
+    spp_post(std::move(event));
+    return handle;
+}
+
+// The phone, or the MCU through esp_spp_disconnect(), closes a connection
+inline void spp_disconnect(const uint32_t handle) {
+    spp_event event {ESP_SPP_CLOSE_EVT, {}, {}};
+    {
+        std::lock_guard<std::mutex> lock(spp.lock);
+        auto& open = spp.open_handles;
+        open.erase(std::remove(open.begin(), open.end(), handle), open.end());
+        auto& congested = spp.congested_handles;
+        congested.erase(std::remove(congested.begin(), congested.end(), handle), congested.end());
+    }
+    event.param.close.status = ESP_SPP_SUCCESS;
+    event.param.close.handle = handle;
+    event.param.close.async = true;
+    spp_post(std::move(event));
+}
+
+// The phone sends bytes to the MCU
+inline void spp_receive(const uint32_t handle, const void* data, const uint16_t len) {
+    spp_event event {ESP_SPP_DATA_IND_EVT, {}, {}};
+    event.data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+    event.param.data_ind.status = ESP_SPP_SUCCESS;
+    event.param.data_ind.handle = handle;
+    event.param.data_ind.len = len;
+    {
+        std::lock_guard<std::mutex> lock(spp.lock);
+        spp.counters.received++;
+        spp.counters.received_bytes += len;
+    }
+    spp_post(std::move(event));
+}
+
+inline void spp_set_congested(const uint32_t handle, const bool congested) {
+    {
+        std::lock_guard<std::mutex> lock(spp.lock);
+        auto& handles = spp.congested_handles;
+        const bool was_congested = std::find(handles.begin(), handles.end(), handle) != handles.end();
+        if (was_congested == congested)
+            return;
+        if (congested)
+            handles.push_back(handle);
+        else
+            handles.erase(std::remove(handles.begin(), handles.end(), handle), handles.end());
+    }
+    spp_event event {ESP_SPP_CONG_EVT, {}, {}};
+    event.param.cong.status = ESP_SPP_SUCCESS;
+    event.param.cong.handle = handle;
+    event.param.cong.cong = congested;
+    spp_post(std::move(event));
+}
+
+// Everything the MCU wrote to any phone since the last call, one entry per esp_spp_write()
+inline std::vector<std::vector<uint8_t>> spp_take_tx() {
+    std::lock_guard<std::mutex> lock(spp.lock);
+    std::vector<std::vector<uint8_t>> frames;
+    for (spp_tx_frame& frame : spp.tx_log)
+        frames.push_back(std::move(frame.data));
+    spp.tx_log.clear();
+    return frames;
+}
+
+// Everything the MCU wrote to one phone since the last call, what it wrote to the others stays
+inline std::vector<std::vector<uint8_t>> spp_take_tx(const uint32_t handle) {
+    std::lock_guard<std::mutex> lock(spp.lock);
+    std::vector<std::vector<uint8_t>> frames;
+    std::deque<spp_tx_frame> others;
+    for (spp_tx_frame& frame : spp.tx_log) {
+        if (frame.handle == handle)
+            frames.push_back(std::move(frame.data));
+        else
+            others.push_back(std::move(frame));
+    }
+    spp.tx_log.swap(others);
+    return frames;
+}
+
+inline spp_counters spp_counters_snapshot() {
+    std::lock_guard<std::mutex> lock(spp.lock);
+    return spp.counters;
+}
+
+}
+
+inline esp_err_t esp_spp_register_callback(const esp_spp_cb_t callback) {
+    std::lock_guard<std::mutex> lock(sim_hal::spp.lock);
+    sim_hal::spp.callback = callback;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_spp_init(const esp_spp_mode_t mode) {
+    if (mode != ESP_SPP_MODE_CB)
+        return ESP_ERR_NOT_SUPPORTED;
+    {
+        std::lock_guard<std::mutex> lock(sim_hal::spp.lock);
+        if (sim_hal::spp.initialized)
+            return ESP_ERR_INVALID_STATE;
+        sim_hal::spp.initialized = true;
+    }
+    std::thread(sim_hal::spp_event_loop).detach();
+
+    sim_hal::spp_event event {ESP_SPP_INIT_EVT, {}, {}};
+    event.param.init.status = ESP_SPP_SUCCESS;
+    sim_hal::spp_post(std::move(event));
+    return ESP_OK;
+}
+
+inline esp_err_t esp_spp_start_srv(const esp_spp_sec_t sec_mask, const esp_spp_role_t role,
+        const uint8_t local_scn, const char* name) {
+    (void)sec_mask;
+    (void)role;
+    if (local_scn > ESP_SPP_MAX_SCN || name == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    {
+        std::lock_guard<std::mutex> lock(sim_hal::spp.lock);
+        sim_hal::spp.server_started = true;
+    }
+    sim_hal::spp_event event {ESP_SPP_START_EVT, {}, {}};
+    event.param.start.status = ESP_SPP_SUCCESS;
+    event.param.start.handle = 0x80;
+    sim_hal::spp_post(std::move(event));
+    return ESP_OK;
+}
+
+inline esp_err_t esp_spp_write(const uint32_t handle, const int len, uint8_t* p_data) {
+    if (len <= 0 || p_data == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_hal::spp_event event {ESP_SPP_WRITE_EVT, {}, {}};
+    {
+        std::lock_guard<std::mutex> lock(sim_hal::spp.lock);
+        const auto& open = sim_hal::spp.open_handles;
+        if (std::find(open.begin(), open.end(), handle) == open.end())
+            return ESP_FAIL;
+        if (sim_hal::spp.tx_log.size() >= SIM_SPP_TX_LOG_MAX)
+            sim_hal::spp.tx_log.pop_front();
+        sim_hal::spp.tx_log.push_back({handle, std::vector<uint8_t>(p_data, p_data + len)});
+        sim_hal::spp.counters.writes++;
+        sim_hal::spp.counters.write_bytes += len;
+        const auto& congested = sim_hal::spp.congested_handles;
+        event.param.write.cong = std::find(congested.begin(), congested.end(), handle) != congested.end();
+    }
+    event.param.write.status = ESP_SPP_SUCCESS;
+    event.param.write.handle = handle;
+    event.param.write.len = len;
+    sim_hal::spp_post(std::move(event));
+    return ESP_OK;
+}
+
+inline esp_err_t esp_spp_disconnect(const uint32_t handle) {
+    {
+        std::lock_guard<std::mutex> lock(sim_hal::spp.lock);
+        const auto& open = sim_hal::spp.open_handles;
+        if (std::find(open.begin(), open.end(), handle) == open.end())
+            return ESP_FAIL;
+    }
+    sim_hal::spp_disconnect(handle);
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_SPP_API_H__ */
@@ -0,0 +1,77 @@
+/**
+ * @file esp_system.h
+ * @brief Host stand-in for the ESP-IDF system calls
+ * 
+ */
+#ifndef __SIM_ESP_SYSTEM_H__
+#define __SIM_ESP_SYSTEM_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_MAC_WIFI_STA,
+    ESP_MAC_WIFI_SOFTAP,
+    ESP_MAC_BT,
+    ESP_MAC_ETH
+} esp_mac_type_t;
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO
+} esp_reset_reason_t;
+
+namespace sim_hal {
+
+// Called by esp_restart(), the simulator uses it to end the run
+inline std::function<void()> on_restart;
+
+// What esp_reset_reason() reports for this run
+inline esp_reset_reason_t reset_reason {ESP_RST_POWERON};
+
+inline const uint8_t base_mac[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+
+}
+
+[[noreturn]] inline void esp_restart() {
+    if (sim_hal::on_restart)
+        sim_hal::on_restart();
+    std::fflush(stdout);
+    std::_Exit(3);
+}
+
+inline esp_reset_reason_t esp_reset_reason() {
+    return sim_hal::reset_reason;
+}
+
+inline esp_err_t esp_efuse_mac_get_default(uint8_t* mac) {
+    std::memcpy(mac, sim_hal::base_mac, 6);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_base_mac_addr_set(const uint8_t* mac) {
+    (void)mac;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_read_mac(uint8_t* mac, const esp_mac_type_t type) {
+    std::memcpy(mac, sim_hal::base_mac, 6);
+    mac[5] += static_cast<uint8_t>(type);
+    return ESP_OK;
+}
+
+#endif /* __SIM_ESP_SYSTEM_H__ */
@@ -0,0 +1,18 @@
+/**
+ * @file esp_timer.h
+ * @brief Host stand-in for the ESP-IDF high resolution timer
+ * 
+ * Time comes from the same virtual clock as the timer group stand-in.
+ */
+#ifndef __SIM_ESP_TIMER_H__
+#define __SIM_ESP_TIMER_H__
+
+#include <cstdint>
+
+#include "driver/timer.h"
+
+inline int64_t esp_timer_get_time() {
+    return static_cast<int64_t>(sim_hal::timer_now_us());
+}
+
+#endif /* __SIM_ESP_TIMER_H__ */
@@ -0,0 +1,27 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host stand-in for the FreeRTOS base types
+ * 
+ */
+#ifndef __SIM_FREERTOS_H__
+#define __SIM_FREERTOS_H__
+
+#include <cstdint>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE             (0)
+#define pdTRUE              (1)
+#define pdPASS              (pdTRUE)
+#define pdFAIL              (pdFALSE)
+#define portMAX_DELAY       (static_cast<TickType_t>(0xffffffffUL))
+#define configTICK_RATE_HZ  (1000)
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)   (static_cast<TickType_t>(ms) * configTICK_RATE_HZ / 1000)
+
+// There is no scheduler to yield to from a host "ISR"
+#define portYIELD_FROM_ISR(...) do {} while (0)
+
+#endif /* __SIM_FREERTOS_H__ */
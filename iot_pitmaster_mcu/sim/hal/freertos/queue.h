@@ -0,0 +1,78 @@
+/**
+ * @file queue.h
+ * @brief Host stand-in for FreeRTOS queues
+ * 
+ * Items are copied in and out by value like the real queue, on top of a
+ * mutex and condition variable.
+ */
+#ifndef __SIM_FREERTOS_QUEUE_H__
+#define __SIM_FREERTOS_QUEUE_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+
+namespace sim_hal {
+
+struct queue {
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::deque<std::vector<uint8_t>> items;
+    std::mutex lock;
+    std::condition_variable not_empty;
+};
+
+}
+
+typedef sim_hal::queue* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t item_size) {
+    QueueHandle_t q = new sim_hal::queue;
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+inline void vQueueDelete(QueueHandle_t q) {
+    delete q;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, const TickType_t ticks_to_wait) {
+    (void)ticks_to_wait;
+    {
+        std::lock_guard<std::mutex> lock(q->lock);
+        if (q->items.size() >= q->length)
+            return pdFAIL;
+        const uint8_t* bytes = static_cast<const uint8_t*>(item);
+        q->items.emplace_back(bytes, bytes + q->item_size);
+    }
+    q->not_empty.notify_one();
+    return pdPASS;
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* higher_prio_task_woken) {
+    if (higher_prio_task_woken != nullptr)
+        *higher_prio_task_woken = pdFALSE;
+    return xQueueSend(q, item, 0);
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void* item, const TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(q->lock);
+    if (ticks_to_wait == portMAX_DELAY) {
+        q->not_empty.wait(lock, [q]() {return !q->items.empty();});
+    }
+    else if (!q->not_empty.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS),
+            [q]() {return !q->items.empty();})) {
+        return pdFAIL;
+    }
+    std::memcpy(item, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    return pdPASS;
+}
+
+#endif /* __SIM_FREERTOS_QUEUE_H__ */
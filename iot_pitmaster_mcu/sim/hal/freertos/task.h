@@ -0,0 +1,35 @@
+/**
+ * @file task.h
+ * @brief Host stand-in for the FreeRTOS task delay calls
+ * 
+ * Delays sleep on the simulator's virtual clock, one tick is 1 ms like
+ * CONFIG_FREERTOS_HZ=1000 on the board.
+ */
+#ifndef __SIM_FREERTOS_TASK_H__
+#define __SIM_FREERTOS_TASK_H__
+
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+#include "sim_clock.h"
+
+inline TickType_t xTaskGetTickCount() {
+    return static_cast<TickType_t>(sim_hal::vclock_now_us() / (1000 * portTICK_PERIOD_MS));
+}
+
+inline void vTaskDelay(const TickType_t ticks) {
+    if (ticks == 0) {
+        std::this_thread::yield();
+        return;
+    }
+    sim_hal::vclock_sleep_until_us(sim_hal::vclock_now_us() + static_cast<uint64_t>(ticks) * 1000 * portTICK_PERIOD_MS);
+}
+
+inline void vTaskDelayUntil(TickType_t* previous_wake, const TickType_t increment) {
+    *previous_wake += increment;
+    sim_hal::vclock_sleep_until_us(static_cast<uint64_t>(*previous_wake) * 1000 * portTICK_PERIOD_MS);
+}
+
+#define taskYIELD() std::this_thread::yield()
+
+#endif /* __SIM_FREERTOS_TASK_H__ */
@@ -0,0 +1,24 @@
+/**
+ * @file gpio_ll.h
+ * @brief Host stand-in for the ESP-IDF GPIO register layer
+ * 
+ * The register writes an IRAM interrupt makes go to the same pins as
+ * the GPIO driver stand-in, edges counted and all.
+ */
+#ifndef __SIM_HAL_GPIO_LL_H__
+#define __SIM_HAL_GPIO_LL_H__
+
+#include <cstdint>
+
+#include "driver/gpio.h"
+
+typedef struct {} gpio_dev_t;
+
+inline gpio_dev_t GPIO;
+
+inline void gpio_ll_set_level(gpio_dev_t* hw, const gpio_num_t gpio_num, const uint32_t level) {
+    (void)hw;
+    gpio_set_level(gpio_num, level);
+}
+
+#endif /* __SIM_HAL_GPIO_LL_H__ */
@@ -0,0 +1,157 @@
+/**
+ * @file nvs.h
+ * @brief Host stand-in for the ESP-IDF NVS API
+ *
+ * Blobs live in memory, keyed by namespace and key. If the simulator
+ * names a file with nvs_set_file() it is loaded at once and rewritten on
+ * every commit, so state survives from one run to the next like it does
+ * across a restart on the board. Every blob written is counted.
+ */
+#ifndef __SIM_NVS_H__
+#define __SIM_NVS_H__
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nvs_flash.h"
+
+#define ESP_ERR_NVS_NOT_FOUND           (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_INVALID_HANDLE      (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_READ_ONLY           (ESP_ERR_NVS_BASE + 0x08)
+#define ESP_ERR_NVS_INVALID_LENGTH      (ESP_ERR_NVS_BASE + 0x0c)
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+namespace sim_hal {
+
+struct nvs_store {
+    std::mutex lock;
+    std::map<std::string, std::vector<uint8_t>> blobs; // "namespace/key"
+    std::vector<std::string> namespaces; // handle - 1 is the index
+    std::vector<nvs_open_mode_t> modes;
+    std::string path;
+    uint32_t blob_writes {0};
+    uint32_t commits {0};
+};
+
+inline nvs_store nvs;
+
+// Each blob as a length-prefixed key and a length-prefixed value
+inline void nvs_save_file() {
+    if (nvs.path.empty())
+        return;
+    std::ofstream file(nvs.path, std::ios::binary | std::ios::trunc);
+    for (const auto& [key, value] : nvs.blobs) {
+        const uint32_t key_len = key.size();
+        const uint32_t value_len = value.size();
+        file.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
+        file.write(key.data(), key_len);
+        file.write(reinterpret_cast<const char*>(&value_len), sizeof(value_len));
+        file.write(reinterpret_cast<const char*>(value.data()), value_len);
+    }
+}
+
+// Keeps NVS in the file at path, loading what it already holds
+inline void nvs_set_file(const std::string& path) {
+    std::lock_guard<std::mutex> lock(nvs.lock);
+    nvs.path = path;
+    std::ifstream file(path, std::ios::binary);
+    uint32_t key_len {0};
+    while (file.read(reinterpret_cast<char*>(&key_len), sizeof(key_len))) {
+        std::string key(key_len, '\0');
+        uint32_t value_len {0};
+        if (!file.read(key.data(), key_len) || !file.read(reinterpret_cast<char*>(&value_len), sizeof(value_len)))
+            break;
+        std::vector<uint8_t> value(value_len);
+        if (!file.read(reinterpret_cast<char*>(value.data()), value_len))
+            break;
+        nvs.blobs[key] = value;
+    }
+}
+
+inline uint32_t nvs_blob_writes() {
+    std::lock_guard<std::mutex> lock(nvs.lock);
+    return nvs.blob_writes;
+}
+
+inline std::string nvs_key(const nvs_handle_t handle, const char* key) {
+    return nvs.namespaces[handle - 1] + "/" + key;
+}
+
+inline bool nvs_handle_valid(const nvs_handle_t handle) {
+    return handle > 0 && handle <= nvs.namespaces.size();
+}
+
+}
+
+inline esp_err_t nvs_open(const char* name, const nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    if (name == nullptr || out_handle == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(sim_hal::nvs.lock);
+    sim_hal::nvs.namespaces.push_back(name);
+    sim_hal::nvs.modes.push_back(open_mode);
+    *out_handle = sim_hal::nvs.namespaces.size();
+    return ESP_OK;
+}
+
+inline void nvs_close(const nvs_handle_t handle) {
+    (void)handle;
+}
+
+// With out_value null, only the length is returned
+inline esp_err_t nvs_get_blob(const nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    std::lock_guard<std::mutex> lock(sim_hal::nvs.lock);
+    if (!sim_hal::nvs_handle_valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (key == nullptr || length == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    const auto found = sim_hal::nvs.blobs.find(sim_hal::nvs_key(handle, key));
+    if (found == sim_hal::nvs.blobs.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value == nullptr) {
+        *length = found->second.size();
+        return ESP_OK;
+    }
+    if (*length < found->second.size()) {
+        *length = found->second.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    std::memcpy(out_value, found->second.data(), found->second.size());
+    *length = found->second.size();
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_set_blob(const nvs_handle_t handle, const char* key, const void* value, const size_t length) {
+    std::lock_guard<std::mutex> lock(sim_hal::nvs.lock);
+    if (!sim_hal::nvs_handle_valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (sim_hal::nvs.modes[handle - 1] == NVS_READONLY)
+        return ESP_ERR_NVS_READ_ONLY;
+    if (key == nullptr || value == nullptr)
+        return ESP_ERR_INVALID_ARG;
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    sim_hal::nvs.blobs[sim_hal::nvs_key(handle, key)].assign(bytes, bytes + length);
+    sim_hal::nvs.blob_writes++;
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_commit(const nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(sim_hal::nvs.lock);
+    if (!sim_hal::nvs_handle_valid(handle))
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    sim_hal::nvs.commits++;
+    sim_hal::nvs_save_file();
+    return ESP_OK;
+}
+
+#endif /* __SIM_NVS_H__ */
@@ -0,0 +1,23 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host stand-in for the ESP-IDF NVS flash init calls
+ * 
+ */
+#ifndef __SIM_NVS_FLASH_H__
+#define __SIM_NVS_FLASH_H__
+
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE                (0x1100)
+#define ESP_ERR_NVS_NO_FREE_PAGES       (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   (ESP_ERR_NVS_BASE + 0x10)
+
+inline esp_err_t nvs_flash_init() {
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_flash_erase() {
+    return ESP_OK;
+}
+
+#endif /* __SIM_NVS_FLASH_H__ */
@@ -0,0 +1,126 @@
+/**
+ * @file sim_clock.h
+ * @brief Virtual time for the host simulator
+ * 
+ * Any thread that sleeps through FreeRTOS becomes a participant. When
+ * every participant is asleep, time jumps straight to the earliest
+ * deadline, firing timer alarms on the way, and the threads due at that
+ * time are woken together. Time never moves while a participant is
+ * still working on its tick, so a 12 hour cook runs as fast as the code
+ * between sleeps allows.
+ */
+#ifndef __SIM_CLOCK_H__
+#define __SIM_CLOCK_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+
+#include "driver/timer.h"
+
+namespace sim_hal {
+
+struct vclock_sleeper {
+    uint64_t deadline_us;
+    bool woken;
+};
+
+struct vclock_state {
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t participants {0};
+    uint32_t running {0};
+    std::list<vclock_sleeper> sleepers;
+    uint64_t wakeups {0};
+};
+
+inline vclock_state vclock;
+inline thread_local bool vclock_participant {false};
+
+inline uint64_t vclock_now_us() {
+    return timer_now_us();
+}
+
+// Jumps to the earliest deadline and marks everyone due as running again
+// Called with vclock.lock held, once every participant is asleep
+inline void vclock_advance_locked() {
+    uint64_t next = UINT64_MAX;
+    for (const vclock_sleeper& sleeper : vclock.sleepers) {
+        if (!sleeper.woken && sleeper.deadline_us < next)
+            next = sleeper.deadline_us;
+    }
+    if (next == UINT64_MAX)
+        return;
+
+    const uint64_t now = timer_now_us();
+    if (next > now)
+        timer_advance_us(next - now);
+
+    for (vclock_sleeper& sleeper : vclock.sleepers) {
+        if (!sleeper.woken && sleeper.deadline_us <= next) {
+            sleeper.woken = true;
+            vclock.running++;
+            vclock.wakeups++;
+        }
+    }
+    vclock.wake.notify_all();
+}
+
+// Makes the calling thread a participant before its first sleep
+// Time cannot move until it sleeps, so set-up code in it runs at one instant
+inline void vclock_attach() {
+    std::lock_guard<std::mutex> lock(vclock.lock);
+    if (!vclock_participant) {
+        vclock_participant = true;
+        vclock.participants++;
+        vclock.running++;
+    }
+}
+
+// Stops the calling thread being a participant, e.g. a test thread that is done sleeping
+inline void vclock_detach() {
+    std::lock_guard<std::mutex> lock(vclock.lock);
+    if (vclock_participant) {
+        vclock_participant = false;
+        vclock.participants--;
+        vclock.running--;
+        if (vclock.running == 0)
+            vclock_advance_locked();
+    }
+}
+
+// Blocks the calling thread until virtual time reaches deadline_us
+inline void vclock_sleep_until_us(const uint64_t deadline_us) {
+    vclock_attach();
+    std::unique_lock<std::mutex> lock(vclock.lock);
+    auto self = vclock.sleepers.insert(vclock.sleepers.end(), {deadline_us, false});
+    vclock.running--;
+
+    while (!self->woken) {
+        if (vclock.running == 0)
+            vclock_advance_locked();
+        else
+            vclock.wake.wait(lock);
+    }
+    vclock.sleepers.erase(self);
+}
+
+// Moves time forward from a thread that is not a participant, e.g. a test driving the clock by hand
+inline void vclock_advance_us(const uint64_t us) {
+    std::lock_guard<std::mutex> lock(vclock.lock);
+    timer_advance_us(us);
+    const uint64_t now = timer_now_us();
+    for (vclock_sleeper& sleeper : vclock.sleepers) {
+        if (!sleeper.woken && sleeper.deadline_us <= now) {
+            sleeper.woken = true;
+            vclock.running++;
+            vclock.wakeups++;
+        }
+    }
+    vclock.wake.notify_all();
+}
+
+}
+
+#endif /* __SIM_CLOCK_H__ */
@@ -0,0 +1,87 @@
+/**
+ * @file plant.cpp
+ * @brief Lumped thermal model of the smoker for the host simulator
+ * 
+ */
+#include "plant.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Integrates the model over dt_s seconds
+void plant::step(const float dt_s, const plant_inputs& inputs) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    const plant_params& p = this->m_params;
+    plant_state& s = this->m_state;
+
+    const float fed_g = inputs.auger_revs * p.fuel_per_rev_g;
+    s.fuel_g += fed_g;
+    s.fuel_fed_g += fed_g;
+
+    // The fire burns whichever runs out first, fuel or air
+    s.air_g_per_s = p.leak_air_g_per_s + std::clamp(inputs.damper_open, 0.0f, 1.0f)*p.draft_air_g_per_s +
+            std::clamp(inputs.fan_duty, 0.0f, 1.0f)*p.fan_air_g_per_s;
+    const float burn_g_per_s = std::min(s.fuel_g*p.bed_burn_per_s, s.air_g_per_s/p.air_per_fuel_g);
+    const float burnt_g = std::min(s.fuel_g, burn_g_per_s*dt_s);
+    s.fuel_g -= burnt_g;
+    s.fuel_burnt_g += burnt_g;
+    s.heat_W = burnt_g*p.fuel_heat_J_per_g/dt_s;
+
+    const float excess_C = s.chamber_C - p.ambient_C;
+    float chamber_W = s.heat_W - p.wall_loss_W_per_K*excess_C - s.air_g_per_s*p.air_cp_J_per_gK*excess_C;
+
+    for (uint8_t i = 0; i < PLANT_MEATS; i++) {
+        const float into_meat_W = p.meat_W_per_K[i]*(s.chamber_C - s.meat_C[i]);
+        chamber_W -= into_meat_W;
+
+        // Evaporation ramps in as the surface warms and stops once it has dried out
+        float evaporation_W {0};
+        if (s.meat_water_J[i] > 0) {
+            const float wetness = std::clamp((s.meat_C[i] - 50.0f)/20.0f, 0.0f, 1.0f);
+            evaporation_W = std::min(wetness*p.evaporation_W_per_K*(s.chamber_C - s.meat_C[i]), into_meat_W);
+            evaporation_W = std::max(evaporation_W, 0.0f);
+            s.meat_water_J[i] = std::max(0.0f, s.meat_water_J[i] - evaporation_W*dt_s);
+        }
+        s.meat_C[i] += (into_meat_W - evaporation_W)*dt_s/p.meat_J_per_K[i];
+    }
+    s.chamber_C += chamber_W*dt_s/p.chamber_J_per_K;
+}
+
+// Copy of the current state
+plant_state plant::state() {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    return this->m_state;
+}
+
+// Puts the model back in a state taken earlier, to carry a cook across runs
+void plant::restore(const plant_state& state) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    this->m_state = state;
+}
+
+// The 32-bit MAX31855 frame a probe would return right now, probe 0 is the chamber
+uint32_t plant::probe_frame(const uint8_t probe) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    float temp_C = this->m_params.ambient_C;
+    if (probe == 0)
+        temp_C = this->m_state.chamber_C;
+    else if (probe <= PLANT_MEATS)
+        temp_C = this->m_state.meat_C[probe - 1];
+    else
+        return max31855_frame(0, this->m_params.ambient_C, true);
+
+    return max31855_frame(temp_C + this->m_noise(this->m_rng), this->m_params.ambient_C + 5, false);
+}
+
+// Packs a reading the way the MAX31855 puts it on the wire
+uint32_t max31855_frame(const float thermocouple_C, const float cold_junction_C, const bool fault) {
+    // 14-bit thermocouple in quarter degrees and 12-bit cold junction in sixteenths, both two's complement
+    const int32_t tc_quarters = std::clamp<int32_t>(std::lround(thermocouple_C*4), -8192, 8191);
+    const int32_t cj_sixteenths = std::clamp<int32_t>(std::lround(cold_junction_C*16), -2048, 2047);
+
+    uint32_t frame = (static_cast<uint32_t>(tc_quarters) & 0x3fff) << 18;
+    frame |= (static_cast<uint32_t>(cj_sixteenths) & 0x0fff) << 4;
+    if (fault)
+        frame |= (1 << 16) | 1; // open circuit
+    return frame;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file plant.hpp
+ * @brief Lumped thermal model of the smoker for the host simulator
+ * 
+ * One node for the chamber and one for each meat. Pellets fed by the
+ * auger build up a fuel bed that burns as fast as the air allows, and
+ * the air comes from a small leak, the natural draft through the damper,
+ * and the blowfan. Heat leaves through the walls and with the exhaust.
+ * The meats also lose heat to evaporation while their surface is wet,
+ * which gives the familiar stall around 70 degrees.
+ */
+#ifndef __PLANT_HPP__
+#define __PLANT_HPP__
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <random>
+
+// Number of meat probes in the model
+#define PLANT_MEATS (2)
+
+// Physical constants of the model, the defaults are a mid-size pellet cooker
+struct plant_params {
+    float ambient_C {20};
+    float chamber_J_per_K {25000};  // steel, air and grates
+    float wall_loss_W_per_K {6};
+    float air_cp_J_per_gK {1.0f};
+    float leak_air_g_per_s {0.12f};
+    float draft_air_g_per_s {0.5f}; // damper fully open, fan off
+    float fan_air_g_per_s {2.5f};   // fan at 100%
+    float air_per_fuel_g {6};       // air needed to burn a gram of pellets
+    float fuel_heat_J_per_g {18000};
+    float fuel_per_rev_g {24};      // auger delivery per revolution, matches FUEL_G_PER_REV
+    float fuel_initial_g {25};      // lit starter charge
+    float bed_burn_per_s {0.02f};   // most of the bed that can burn per second with unlimited air
+    std::array<float, PLANT_MEATS> meat_J_per_K {5200, 3500};
+    std::array<float, PLANT_MEATS> meat_W_per_K {0.9f, 0.7f};
+    std::array<float, PLANT_MEATS> meat_water_J {0.5e6f, 0.3e6f}; // evaporative heat the surface can take before it dries
+    float evaporation_W_per_K {1.6f};
+    float sensor_noise_C {0.2f};
+    uint32_t seed {1};
+};
+
+// Actuator state read back from the simulated peripherals
+struct plant_inputs {
+    float fan_duty {0};       // 0-1
+    float damper_open {0};    // 0-1
+    float auger_revs {0};     // revolutions fed since the last step() call
+};
+
+// Everything the model tracks, in physical units
+struct plant_state {
+    float chamber_C;
+    std::array<float, PLANT_MEATS> meat_C;
+    std::array<float, PLANT_MEATS> meat_water_J;
+    float fuel_g;
+    float fuel_fed_g;
+    float fuel_burnt_g;
+    float air_g_per_s;
+    float heat_W;
+};
+
+class plant {
+
+    private:
+
+        plant_params m_params;
+        plant_state m_state;
+        std::mutex m_lock;
+        std::mt19937 m_rng;
+        std::normal_distribution<float> m_noise;
+
+    public:
+
+        inline plant(const plant_params& params = plant_params()) : m_rng(params.seed), m_noise(0, params.sensor_noise_C) {
+            this->m_params = params;
+            this->m_state.chamber_C = params.ambient_C;
+            this->m_state.meat_C.fill(params.ambient_C);
+            this->m_state.meat_water_J = params.meat_water_J;
+            this->m_state.fuel_g = params.fuel_initial_g;
+            this->m_state.fuel_fed_g = 0;
+            this->m_state.fuel_burnt_g = 0;
+            this->m_state.air_g_per_s = 0;
+            this->m_state.heat_W = 0;
+        }
+
+        // Integrates the model over dt_s seconds
+        void step(float dt_s, const plant_inputs& inputs);
+
+        // Copy of the current state
+        plant_state state();
+
+        // Puts the model back in a state taken earlier, to carry a cook across runs
+        void restore(const plant_state& state);
+
+        // The 32-bit MAX31855 frame a probe would return right now, probe 0 is the chamber
+        uint32_t probe_frame(uint8_t probe);
+
+        const plant_params& params() const {return this->m_params;}
+};
+
+// Packs a reading the way the MAX31855 puts it on the wire
+uint32_t max31855_frame(float thermocouple_C, float cold_junction_C, bool fault);
+
+#endif /* __PLANT_HPP__ */
@@ -0,0 +1,804 @@
+/**
+ * @file sim_main.cpp
+ * @brief Host simulator, runs the firmware against the smoker model
+ * 
+ * The firmware objects are built exactly as app_main() builds them, on
+ * top of the host stand-ins in sim/hal. A simulated phone connects over
+ * SPP and sets the chamber temperature, then the model is stepped on the
+ * virtual clock and traced to CSV. The phone decodes the status reports
+ * the firmware sends back, so the trace shows what the app would show.
+ * Near the end the phone pulls this boot's cook log out of the flash
+ * partition, which --flash keeps in a file from one run to the next.
+ * --resume keeps NVS and the smoker itself, so the next run starts as
+ * the board does after a brownout in the middle of the cook. --autotune
+ * starts the cook with a relay autotune instead, and the rest of the run
+ * shows how the tuned gains hold the set point. --watchers connects more
+ * phones after the first, each decoding the same reports, and each one
+ * tries to change the set point, which the firmware must refuse since
+ * the first phone has control. --socket or --tcp adds the host socket
+ * transport, the watchers then connect over it instead of SPP, and any
+ * other tool can connect too, --realtime slows the run to wall time for
+ * one that talks at human speed.
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "driver/ledc.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "esp_spp_api.h"
+#include "esp_system.h"
+#include "nvs.h"
+#include "sim_clock.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "a4988_driver.hpp"
+#include "board.hpp"
+#include "bluetooth.hpp"
+#include "bt_frame.hpp"
+#include "cook_log.hpp"
+#include "history.hpp"
+#include "max31855.hpp"
+#include "pid_control.hpp"
+#include "pid_store.hpp"
+#include "plant.hpp"
+#include "power.hpp"
+#include "pwm.hpp"
+#include "socket_transport.hpp"
+#include "sys_clock.hpp"
+#include "tc_bus.hpp"
+#include "tc_sampler.hpp"
+#include "telemetry.hpp"
+
+// Plant integration step
+#define SIM_DEFAULT_STEP_MS (100)
+// Seconds between CSV rows
+#define SIM_DEFAULT_TRACE_S (10)
+// --congest-s holds the link congested for that long out of every period
+#define SIM_CONGESTION_PERIOD_S (300)
+// Damper travel in sixteenth steps between its stops, matches DAMPER_TRAVEL_STEPS
+#define SIM_DAMPER_TRAVEL_STEPS (300)
+// Size of the cook log partition, matches partitions.csv
+#define SIM_COOK_LOG_SIZE (0xf0000)
+// The phone asks for the cook log this long before the end
+#define SIM_LOG_EXPORT_LEAD_S (120)
+
+struct sim_options {
+    float hours {12};
+    int16_t set_point_C {110};
+    float ambient_C {20};
+    uint32_t step_ms {SIM_DEFAULT_STEP_MS};
+    uint32_t trace_s {SIM_DEFAULT_TRACE_S};
+    uint32_t tc_rate_hz {0}; // 0 keeps the firmware default
+    uint32_t seed {1};
+    uint32_t congest_s {0};
+    float dropout_min {0};
+    std::string csv_path {}; // no trace unless --csv names a file
+    std::string flash_path {};
+    std::string resume_prefix {};
+    int autotune_rule {-1}; // -1 starts a plain cook
+    uint32_t watchers {0}; // phones connected after the first one
+    std::string socket_path {}; // Unix socket to listen on as well as SPP
+    int tcp_port {-1}; // 127.0.0.1 port to listen on as well as SPP, 0 lets the kernel pick
+    bool realtime {false};
+    bool verbose {false};
+};
+
+// Summary figures for the end of the run
+struct sim_summary {
+    double first_in_band_s {-1};
+    double settled_s {-1}; // from here on the chamber stayed within 5 C
+    float max_overshoot_C {0};
+    double sq_err_sum {0};
+    uint64_t sq_err_count {0};
+    uint64_t feeds {0};
+    // Error once the autotune is over
+    double tuned_sq_err_sum {0};
+    uint64_t tuned_sq_err_count {0};
+    float tuned_max_err_C {0};
+};
+
+// Follows a watched stepper's position in sixteenth steps
+struct stepper_tracker {
+    int slot;
+    int64_t last_microsteps {0};
+
+    // Sixteenth steps turned since the last call, negative when DIR was high
+    int64_t take() {
+        const int64_t microsteps = sim_hal::gpio_stepper_microsteps(this->slot);
+        const int64_t delta = microsteps - this->last_microsteps;
+        this->last_microsteps = microsteps;
+        return delta;
+    }
+};
+
+// The phone's side of the link, decodes the status reports
+struct sim_phone {
+    uint32_t handle {0}; // on SPP
+    int fd {-1}; // on the socket transport instead
+    bt_frame_parser parser;
+    telemetry_decoder decoder;
+    uint64_t frames {0};
+    uint64_t bytes {0};
+    uint64_t reports {0};
+    uint64_t bad_reports {0};
+    uint64_t alarms {0};
+
+    // Last MSG_CONTROL
+    bool in_control {false};
+    uint64_t control_msgs {0};
+
+    // History asked for after a dropout, and what came back inside that range
+    uint32_t backfill_from_s {0};
+    uint32_t backfill_to_s {0};
+    uint64_t backfill_blocks {0};
+    uint64_t backfill_samples {0};
+    uint64_t backfill_bad_blocks {0};
+    bool backfill_done {false};
+
+    // Cook log pulled from flash
+    uint64_t log_records {0};
+    uint64_t log_bytes {0};
+    uint64_t log_bad_records {0};
+    uint64_t log_samples {0};
+    uint16_t log_first_boot {0};
+    uint16_t log_last_boot {0};
+    bool log_done {false};
+
+    // Last autotune status, and when it stopped running
+    out_msg_autotune_status autotune {};
+    uint64_t autotune_reports {0};
+    double autotune_end_s {-1};
+
+    void log_records_in(const uint8_t* data, const size_t len) {
+        if (len % sizeof(cook_log_record) != 0)
+            this->log_bad_records++;
+        for (size_t pos = 0; pos + sizeof(cook_log_record) <= len; pos += sizeof(cook_log_record)) {
+            cook_log_record record;
+            std::memcpy(&record, data + pos, sizeof(record));
+            if (!cook_log_record_valid(record)) {
+                this->log_bad_records++;
+                continue;
+            }
+            if (this->log_records++ == 0)
+                this->log_first_boot = record.boot;
+            this->log_last_boot = record.boot;
+            if (record.type == COOK_LOG_SAMPLE)
+                this->log_samples++;
+        }
+    }
+
+    void backfill(const uint8_t* block, const size_t len) {
+        history_block_reader reader(block, len);
+        uint32_t t_s {0};
+        telemetry_sample sample;
+        while (reader.next(t_s, sample)) {
+            if (t_s >= this->backfill_from_s && t_s <= this->backfill_to_s)
+                this->backfill_samples++;
+        }
+        this->backfill_blocks++;
+        if (!reader.valid())
+            this->backfill_bad_blocks++;
+    }
+
+    // Sends bytes to the MCU over whichever link the phone is on
+    void send(const uint8_t* data, const size_t len) {
+        if (this->fd >= 0)
+            (void)!::send(this->fd, data, len, MSG_NOSIGNAL);
+        else if (this->handle != 0)
+            sim_hal::spp_receive(this->handle, data, static_cast<uint16_t>(len));
+    }
+
+    // What the MCU wrote since the last call
+    std::vector<std::vector<uint8_t>> take() {
+        if (this->fd < 0)
+            return this->handle != 0 ? sim_hal::spp_take_tx(this->handle) : std::vector<std::vector<uint8_t>> {};
+        std::vector<std::vector<uint8_t>> chunks;
+        uint8_t chunk[1024];
+        ssize_t len {0};
+        while ((len = recv(this->fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0)
+            chunks.emplace_back(chunk, chunk + len);
+        return chunks;
+    }
+
+    void receive() {
+        for (const std::vector<uint8_t>& chunk : this->take()) {
+            this->bytes += chunk.size();
+            this->parser.feed(chunk.data(), chunk.size(), [this](uint8_t, const uint8_t* payload, size_t len) {
+                this->frames++;
+                if (len == sizeof(out_msg_alarm) && payload[0] == MSG_ALARM)
+                    this->alarms++;
+                if (len == sizeof(out_msg_control) && payload[0] == MSG_CONTROL) {
+                    this->in_control = payload[1] != 0;
+                    this->control_msgs++;
+                }
+                if (len > 0 && payload[0] == MSG_HISTORY)
+                    this->backfill(payload + 1, len - 1);
+                if (len == sizeof(out_msg_history_end) && payload[0] == MSG_HISTORY_END)
+                    this->backfill_done = true;
+                if (len > 0 && payload[0] == MSG_LOG) {
+                    this->log_bytes += len + BT_FRAME_OVERHEAD;
+                    this->log_records_in(payload + 1, len - 1);
+                }
+                if (len == sizeof(out_msg_log_end) && payload[0] == MSG_LOG_END)
+                    this->log_done = true;
+                if (len == sizeof(out_msg_autotune_status) && payload[0] == MSG_AUTOTUNE_STATUS) {
+                    std::memcpy(&this->autotune, payload, sizeof(this->autotune));
+                    this->autotune_reports++;
+                    if (this->autotune.state != AUTOTUNE_RUNNING && this->autotune_end_s < 0)
+                        this->autotune_end_s = sys_clock::now_us()/1e6;
+                }
+                if (len == 0 || payload[0] != MSG_TELEMETRY)
+                    return;
+                if (this->decoder.decode(payload, len))
+                    this->reports++;
+                else
+                    this->bad_reports++;
+            });
+        }
+    }
+};
+
+// Swallows the firmware's console output unless --verbose
+class null_buffer : public std::streambuf {
+    protected:
+        int overflow(int c) override {return c;}
+};
+
+static void print_usage(const char* name) {
+    std::printf("Usage: %s [options]\n"
+                "  --hours H         cook length in simulated hours (12)\n"
+                "  --set-point C     chamber temperature sent from the phone (110)\n"
+                "  --ambient C       outside temperature (20)\n"
+                "  --step-ms MS      model integration step (%d)\n"
+                "  --trace-s S       seconds between CSV rows (%d)\n"
+                "  --tc-rate HZ      thermocouple sample rate, 0 keeps the default (0)\n"
+                "  --seed N          sensor noise seed (1)\n"
+                "  --congest-s S     seconds of SPP congestion every %d s (0)\n"
+                "  --dropout-min M   phone out of range for M minutes a third of the way in (0)\n"
+                "  --csv PATH        trace output, none if not given\n"
+                "  --flash PATH      file holding the cook log partition across runs, memory if not given\n"
+                "  --resume PREFIX   keeps NVS and the smoker in PREFIX.nvs and PREFIX.plant, a run that finds\n"
+                "                    them carries on after a brownout\n"
+                "  --autotune RULE   start with a relay autotune, RULE 0 Ziegler-Nichols PID, 1 Ziegler-Nichols PI,\n"
+                "                    2 Tyreus-Luyben, 3 Pessen, 4 some overshoot, 5 no overshoot\n"
+                "  --watchers N      phones connected after the first, up to %d, one more than %d is refused (0)\n"
+                "  --socket PATH     also listen on a Unix socket, the watchers connect over it\n"
+                "  --tcp PORT        also listen on 127.0.0.1:PORT, the watchers connect over it\n"
+                "  --realtime        run at wall clock speed, for a tool connected over --socket or --tcp\n"
+                "  --verbose         keep the firmware console output\n",
+                name, SIM_DEFAULT_STEP_MS, SIM_DEFAULT_TRACE_S, SIM_CONGESTION_PERIOD_S, BT_MAX_CLIENTS,
+                BT_MAX_CLIENTS - 1);
+}
+
+static bool parse_options(const int argc, char** argv, sim_options& opts) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--verbose")
+            opts.verbose = true;
+        else if (arg == "--realtime")
+            opts.realtime = true;
+        else if (arg == "--socket" && has_value)
+            opts.socket_path = argv[++i];
+        else if (arg == "--tcp" && has_value)
+            opts.tcp_port = std::stoi(argv[++i]);
+        else if (arg == "--hours" && has_value)
+            opts.hours = std::stof(argv[++i]);
+        else if (arg == "--set-point" && has_value)
+            opts.set_point_C = static_cast<int16_t>(std::stoi(argv[++i]));
+        else if (arg == "--ambient" && has_value)
+            opts.ambient_C = std::stof(argv[++i]);
+        else if (arg == "--step-ms" && has_value)
+            opts.step_ms = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--trace-s" && has_value)
+            opts.trace_s = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--tc-rate" && has_value)
+            opts.tc_rate_hz = std::stoul(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            opts.seed = std::stoul(argv[++i]);
+        else if (arg == "--congest-s" && has_value)
+            opts.congest_s = std::stoul(argv[++i]);
+        else if (arg == "--dropout-min" && has_value)
+            opts.dropout_min = std::stof(argv[++i]);
+        else if (arg == "--csv" && has_value)
+            opts.csv_path = argv[++i];
+        else if (arg == "--flash" && has_value)
+            opts.flash_path = argv[++i];
+        else if (arg == "--resume" && has_value)
+            opts.resume_prefix = argv[++i];
+        else if (arg == "--autotune" && has_value)
+            opts.autotune_rule = std::stoi(argv[++i]);
+        else if (arg == "--watchers" && has_value)
+            opts.watchers = std::min<uint32_t>(std::stoul(argv[++i]), BT_MAX_CLIENTS);
+        else
+            return false;
+    }
+    return true;
+}
+
+static std::ofstream trace;
+static sim_summary summary;
+static std::chrono::steady_clock::time_point wall_start;
+static pid_control* sim_pid_control {nullptr};
+static sim_phone phone_link;
+static std::array<sim_phone, BT_MAX_CLIENTS> watchers;
+static uint32_t watcher_count {0};
+
+// Connects to the socket transport like a test tool would, -1 if it cannot
+static int connect_socket(const sim_options& opts, const uint16_t port) {
+    int fd {-1};
+    if (!opts.socket_path.empty()) {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, opts.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+            return fd;
+    }
+    else {
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+            return fd;
+    }
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static void receive_all() {
+    phone_link.receive();
+    for (uint32_t i = 0; i < watcher_count; i++)
+        watchers[i].receive();
+}
+
+// The smoker as it stood when the run ended, for --resume
+struct sim_resume_state {
+    plant_state plant;
+    int64_t damper_position;
+};
+
+static bool load_resume_state(const std::string& path, sim_resume_state& state) {
+    std::ifstream file(path, std::ios::binary);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&state), sizeof(state)));
+}
+
+static void save_resume_state(const std::string& path, const sim_resume_state& state) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&state), sizeof(state));
+}
+
+static void print_summary(plant& model, const char* outcome) {
+    const plant_state s = model.state();
+    const double sim_s = sys_clock::now_us() / 1e6;
+    const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    std::printf("%s after %.2f h simulated in %.2f s wall (%.0fx)\n", outcome, sim_s/3600, wall_s, sim_s/std::max(wall_s, 1e-6));
+    if (sim_pid_control != nullptr)
+        std::printf("  controller: %s\n", sim_pid_control->controller_name());
+    char settled[48] {"never settled"};
+    if (summary.settled_s >= 0)
+        std::snprintf(settled, sizeof(settled), "settled after %.0f s", summary.settled_s);
+    if (summary.first_in_band_s >= 0)
+        std::printf("  within 5 C of set point after %.0f s, %s, max overshoot %.1f C, rms error %.2f C\n",
+                summary.first_in_band_s, settled, summary.max_overshoot_C,
+                std::sqrt(summary.sq_err_sum/std::max<uint64_t>(summary.sq_err_count, 1)));
+    else
+        std::printf("  never came within 5 C of the set point\n");
+    std::printf("  chamber %.1f C, meat1 %.1f C, meat2 %.1f C\n", s.chamber_C, s.meat_C[0], s.meat_C[1]);
+    std::printf("  %llu auger feeds, %.0f g fuel fed, %.0f g burnt, %.0f g left in the bed\n",
+            static_cast<unsigned long long>(summary.feeds), s.fuel_fed_g, s.fuel_burnt_g, s.fuel_g);
+    if (sim_pid_control != nullptr) {
+        const damper_stats damper = sim_pid_control->damper_actuator().stats();
+        const fuel_feeder_stats feeder = sim_pid_control->feeder().stats();
+        std::printf("  fuel feeder: %u doses, %.0f g asked for, %.0f g delivered, %.1f g/min over the last %d min\n",
+                feeder.doses, feeder.commanded_g, feeder.delivered_g, sim_pid_control->feeder().delivered_g_per_min(),
+                FUEL_RATE_WINDOW_MIN);
+        std::printf("  damper: %u homes, %u moves, %u sixteenth steps, %u targets replaced, %u already there\n", damper.homes,
+                damper.moves, damper.steps, damper.replaced, damper.unmoved);
+    }
+    // What the old fixed-size status message would have cost, one per pit loop tick
+    const uint64_t raw_bytes = static_cast<uint64_t>(sim_s*PID_PIT_LOOP_HZ)*
+            (sizeof(out_msg_all_data) + BT_FRAME_OVERHEAD);
+    std::printf("  telemetry: %llu reports in %llu bytes, %llu bad, raw status messages would be %llu bytes\n",
+            static_cast<unsigned long long>(phone_link.reports),
+            static_cast<unsigned long long>(phone_link.bytes - phone_link.log_bytes),
+            static_cast<unsigned long long>(phone_link.bad_reports), static_cast<unsigned long long>(raw_bytes));
+    if (sim_pid_control != nullptr) {
+        const telemetry_stats& stats = sim_pid_control->telemetry();
+        std::printf("  telemetry encoder: %u keyframes, %u deltas, %u suppressed\n",
+                stats.keyframes, stats.deltas, stats.suppressed);
+        const bt_tx_stats tx = bt::tx_stats();
+        std::printf("  link transmit: %u sent, %u coalesced, %u evicted, %u dropped, %u reports lost, "
+                "%u congestion events, max depth %u\n", tx.sent, tx.coalesced, tx.evicted, tx.dropped, tx.latest_lost,
+                tx.congestion_events, tx.max_depth);
+        const history_stats history = sim_pid_control->history()->stats();
+        std::printf("  history: %u samples held in %u bytes (%.1f bits/sample), %.1f h of %.1f h\n",
+                history.held_samples, history.held_bytes, 8.0*history.held_bytes/std::max<uint32_t>(history.held_samples, 1),
+                (history.newest_s - history.oldest_s)/3600.0, history.newest_s/3600.0);
+        if (phone_link.backfill_to_s > 0)
+            std::printf("  backfill: %llu of %u dropout samples recovered from %llu blocks, %llu bad blocks%s\n",
+                    static_cast<unsigned long long>(phone_link.backfill_samples),
+                    phone_link.backfill_to_s - phone_link.backfill_from_s + 1,
+                    static_cast<unsigned long long>(phone_link.backfill_blocks),
+                    static_cast<unsigned long long>(phone_link.backfill_bad_blocks),
+                    phone_link.backfill_done ? "" : ", no end marker");
+        const pid_store_stats store = sim_pid_control->store()->stats();
+        const pid_gains gains = sim_pid_control->gains();
+        std::printf("  controller state: %s, %u NVS writes in %u offers, Kp %.3g Ki %.3g Kd %.3g, integral %.1f%%\n",
+                store.loaded ? "restored at boot" : "nothing saved at boot", store.writes, store.offers,
+                gains.kp, gains.ki, gains.kd, sim_pid_control->integral_pct());
+        if (phone_link.autotune_reports > 0) {
+            static const char* const states[] {"idle", "running", "done", "failed", "aborted"};
+            const out_msg_autotune_status& tune = phone_link.autotune;
+            std::printf("  autotune: %s after %u cycles (%.0f s), Ku %.3g Tu %.0f s amplitude %.1f C, tuned Kp %.3g Ki %.3g Kd %.3g\n",
+                    tune.state < 5 ? states[tune.state] : "?", tune.cycles, phone_link.autotune_end_s, tune.ku, tune.tu_s,
+                    tune.amplitude_C, tune.kp, tune.ki, tune.kd);
+            if (summary.tuned_sq_err_count > 0)
+                std::printf("  after the autotune: max error %.1f C, rms error %.2f C\n", summary.tuned_max_err_C,
+                        std::sqrt(summary.tuned_sq_err_sum/summary.tuned_sq_err_count));
+        }
+        const cook_log_stats log = sim_pid_control->flash_log()->stats();
+        std::printf("  cook log: boot %u, %u records in %u page writes, %u flushes, %u erases, most erased sector %u times\n",
+                log.boot, log.appended, log.page_writes, log.flushes, log.erases, log.max_erase_count);
+        if (phone_link.log_records > 0 || phone_link.log_done)
+            std::printf("  cook log export: %llu records (%llu samples) in %llu bytes, boots %u to %u, %llu bad records%s\n",
+                    static_cast<unsigned long long>(phone_link.log_records),
+                    static_cast<unsigned long long>(phone_link.log_samples),
+                    static_cast<unsigned long long>(phone_link.log_bytes), phone_link.log_first_boot,
+                    phone_link.log_last_boot, static_cast<unsigned long long>(phone_link.log_bad_records),
+                    phone_link.log_done ? "" : ", no end marker");
+        if (phone_link.alarms > 0)
+            std::printf("  phone received %llu alarms\n", static_cast<unsigned long long>(phone_link.alarms));
+        if (watcher_count > 0) {
+            std::printf("  phone 0: %s, %llu reports, %llu bad, set point %.0f C\n",
+                    phone_link.in_control ? "in control" : "watching", static_cast<unsigned long long>(phone_link.reports),
+                    static_cast<unsigned long long>(phone_link.bad_reports), sim_pid_control->set_point());
+            const telemetry_sample& shown = phone_link.decoder.state();
+            for (uint32_t i = 0; i < watcher_count; i++) {
+                const sim_phone& watcher = watchers[i];
+                if (watcher.control_msgs == 0) {
+                    std::printf("  phone %u: refused, %llu bytes received\n", i + 1,
+                            static_cast<unsigned long long>(watcher.bytes));
+                    continue;
+                }
+                // Every phone decodes the same frames, so they all end up showing the same thing
+                const telemetry_sample& state = watcher.decoder.state();
+                const bool same = state.probes == shown.probes && state.temp_qc == shown.temp_qc &&
+                        state.fan_duty == shown.fan_duty && state.status == shown.status;
+                std::printf("  phone %u: %s, %llu reports in %llu bytes, %llu bad, %s the first phone\n", i + 1,
+                        watcher.in_control ? "in control" : "watching", static_cast<unsigned long long>(watcher.reports),
+                        static_cast<unsigned long long>(watcher.bytes), static_cast<unsigned long long>(watcher.bad_reports),
+                        same ? "shows the same as" : "differs from");
+            }
+        }
+        loop_scheduler& scheduler = sim_pid_control->scheduler();
+        for (uint8_t i = 0; i < scheduler.count(); i++) {
+            const loop_stats stats = scheduler.stats(i);
+            std::printf("  %s loop: %u ticks at %u Hz, %u overruns, max jitter %u us\n", scheduler.name(i).c_str(),
+                    stats.ticks, 1000000 / stats.period_us, stats.overruns, stats.max_jitter_us);
+        }
+        // Where the wakeups come from, and how long the fan and the steppers kept the chip out of light sleep
+        const double counted_s = std::max((sys_clock::now_us() - sys_clock::activity.start_us()) / 1e6, 1e-6);
+        for (uint8_t i = 0; i < sys_clock::activity.count(); i++) {
+            const activity_stats stats = sys_clock::activity.stats(i);
+            std::printf("  %s task: %u wakeups (%.1f/s), awake %.3f%%, max awake %u us\n", stats.name, stats.wakeups,
+                    stats.wakeups/counted_s, 100.0*stats.awake_us/(counted_s*1e6), stats.max_awake_us);
+        }
+        std::printf("  power: light sleep %s, blocked %.1f%% of the time, fan %.1f%%, steppers %.1f%%\n",
+                sim_hal::pm_config.light_sleep_enable ? "on" : "off", 100.0*sim_hal::pm_blocked_us()/(sim_s*1e6),
+                100.0*sim_hal::pm_lock_held_us("pwm")/(sim_s*1e6), 100.0*sim_hal::pm_lock_held_us("stepper")/(sim_s*1e6));
+    }
+    std::fflush(stdout);
+    trace.flush();
+}
+
+int main(int argc, char** argv) {
+    sim_options opts;
+    if (argc > 1 && std::strcmp(argv[1], "--help") == 0) {
+        print_usage(argv[0]);
+        return 0;
+    }
+    if (!parse_options(argc, argv, opts)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    null_buffer discard;
+    if (!opts.verbose)
+        std::cout.rdbuf(&discard);
+
+    if (!opts.csv_path.empty()) {
+        trace.open(opts.csv_path);
+        if (!trace) {
+            std::printf("Error: could not open %s\n", opts.csv_path.c_str());
+            return 1;
+        }
+        trace << "time_s,set_point_C,chamber_C,chamber_read_C,meat1_C,meat2_C,fan_pct,damper_pct,auger_revs,fuel_bed_g,heat_W,phone_chamber_C\n";
+    }
+
+    // This thread drives the model, it joins the clock first so nothing moves during set-up
+    sim_hal::vclock_attach();
+    wall_start = std::chrono::steady_clock::now();
+
+    plant_params params;
+    params.ambient_C = opts.ambient_C;
+    params.seed = opts.seed;
+    plant model(params);
+
+    for (size_t i = 0; i < board_probe_count; i++)
+        sim_hal::spi_set_frame_source(board_probes[i].chip_select, [&model, i]() {return model.probe_frame(i);});
+    // A run that finds the last one's state starts as the board does after a brownout
+    int64_t damper_position {0};
+    const std::string resume_plant_path = opts.resume_prefix + ".plant";
+    if (!opts.resume_prefix.empty()) {
+        sim_hal::nvs_set_file(opts.resume_prefix + ".nvs");
+        sim_resume_state resumed {};
+        if (load_resume_state(resume_plant_path, resumed)) {
+            model.restore(resumed.plant);
+            damper_position = resumed.damper_position;
+            sim_hal::reset_reason = ESP_RST_BROWNOUT;
+        }
+    }
+    const auto keep_resume_state = [&]() {
+        if (!opts.resume_prefix.empty())
+            save_resume_state(resume_plant_path, {model.state(), damper_position});
+    };
+
+    sim_hal::on_restart = [&]() {
+        receive_all();
+        keep_resume_state();
+        print_summary(model, "Emergency shutdown");
+    };
+
+    // Same construction as app_main()
+    power::configure(POWER_LOW_POWER);
+    bt::init_bluetooth();
+
+    // A link for tools on this PC as well
+    std::unique_ptr<socket_transport> host_link;
+    if (!opts.socket_path.empty())
+        host_link = std::make_unique<socket_transport>(opts.socket_path);
+    else if (opts.tcp_port >= 0)
+        host_link = std::make_unique<socket_transport>(static_cast<uint16_t>(opts.tcp_port));
+    if (host_link && !bt::add_transport(*host_link)) {
+        std::printf("Error: could not start the %s transport\n", host_link->name());
+        return 1;
+    }
+    if (host_link && opts.tcp_port >= 0)
+        std::printf("Listening on 127.0.0.1:%u\n", host_link->port());
+
+    pwm blowfan(gpio_blowfan, 0);
+
+    // Watched from before the damper homes, so the sim knows where it is
+    const int hopper_stepper = sim_hal::gpio_watch_stepper(gpio_hopper_step, gpio_hopper_dir,
+            gpio_hopper_ms1, gpio_hopper_ms2, gpio_hopper_ms3);
+    const int damper_stepper = sim_hal::gpio_watch_stepper(gpio_damper_step, gpio_damper_dir,
+            gpio_damper_ms1, gpio_damper_ms2, gpio_damper_ms3);
+
+    a4988_driver hopper_controller("Hopper Motor", gpio_hopper_not_en, gpio_hopper_ms1,
+                                   gpio_hopper_ms2, gpio_hopper_ms3,
+                                   gpio_hopper_not_rst, gpio_hopper_not_slp,
+                                   gpio_hopper_step, gpio_hopper_dir,
+                                   TIMER_GROUP_1, TIMER_0);
+
+    a4988_driver damper_controller("Damper Motor", gpio_damper_not_en, gpio_damper_ms1,
+                                   gpio_damper_ms2, gpio_damper_ms3,
+                                   gpio_damper_not_rst, gpio_damper_not_slp,
+                                   gpio_damper_step, gpio_damper_dir,
+                                   TIMER_GROUP_1, TIMER_1);
+
+    std::vector<max31855> probes;
+    probes.reserve(board_probe_count);
+    for (const board_probe& wired : board_probes) {
+        probes.emplace_back(gpio_clk, gpio_signal_out, wired.chip_select);
+        probes.back().name(wired.name);
+    }
+
+    tc_bus thermocouples(HSPI_HOST, spi_bus_cfg);
+    if (thermocouples.init()) {
+        for (max31855& probe : probes)
+            thermocouples.add_probe(probe);
+    }
+
+    tc_sampler thermocouple_sampler(thermocouples);
+    for (uint8_t i = 0; i < thermocouples.count(); i++) {
+        tc_probe_config config {};
+        config.role = board_probes[i].role;
+        thermocouple_sampler.configure(i, config);
+    }
+    if (opts.tc_rate_hz != 0)
+        thermocouple_sampler.rate(opts.tc_rate_hz);
+    std::thread sampler_thread = thermocouple_sampler.start();
+    sampler_thread.detach();
+
+    static history_log cook_history;
+
+    // The partition table lives in flash on the board
+    if (!sim_hal::partition_add(COOK_LOG_PARTITION_LABEL, COOK_LOG_PARTITION_SUBTYPE, SIM_COOK_LOG_SIZE, opts.flash_path)) {
+        std::printf("Error: could not map %s as the cook log partition\n", opts.flash_path.c_str());
+        return 1;
+    }
+    static cook_log flash_log;
+    flash_log.init(static_cast<uint32_t>(sys_clock::now_us()/1000000), esp_reset_reason());
+
+    static pid_store controller_store;
+    controller_store.init();
+
+    pid_control main_pid_control(blowfan, hopper_controller, damper_controller, thermocouple_sampler, cook_history,
+                                 flash_log, controller_store);
+    bt::set_bt_msg_dest(&main_pid_control);
+    sim_pid_control = &main_pid_control;
+
+    std::thread pid_control_thread = std::thread([&]() {main_pid_control.pid_control_run();});
+    pid_control_thread.detach();
+
+    // The phone connects and starts the cook, or a tune at the same set point
+    sim_hal::spp_wait_idle();
+    uint32_t phone = sim_hal::spp_connect();
+    const in_msg_temp_C start_cook {MSG_CHAMBER_TEMP, opts.set_point_C};
+    const in_msg_autotune start_tune {MSG_AUTOTUNE, true, static_cast<uint8_t>(opts.autotune_rule), opts.set_point_C};
+    uint8_t frame[BT_FRAME_MAX_SIZE];
+    const size_t frame_len = opts.autotune_rule < 0 ?
+            bt_frame_encode(0, reinterpret_cast<const uint8_t*>(&start_cook), sizeof(start_cook), frame, sizeof(frame)) :
+            bt_frame_encode(0, reinterpret_cast<const uint8_t*>(&start_tune), sizeof(start_tune), frame, sizeof(frame));
+    phone_link.handle = phone;
+    phone_link.send(frame, frame_len);
+    sim_hal::spp_wait_idle();
+
+    // The other phones only watch, their set point must be refused
+    watcher_count = opts.watchers;
+    for (uint32_t i = 0; i < watcher_count; i++) {
+        if (host_link) {
+            watchers[i].fd = connect_socket(opts, host_link->port());
+            if (watchers[i].fd < 0) {
+                std::printf("Error: phone %u could not connect over the %s transport\n", i + 1, host_link->name());
+                return 1;
+            }
+        }
+        else {
+            watchers[i].handle = sim_hal::spp_connect();
+        }
+        const in_msg_temp_C other_cook {MSG_CHAMBER_TEMP, static_cast<int16_t>(opts.set_point_C + 30)};
+        const size_t other_len = bt_frame_encode(0, reinterpret_cast<const uint8_t*>(&other_cook), sizeof(other_cook),
+                frame, sizeof(frame));
+        watchers[i].send(frame, other_len);
+        sim_hal::spp_wait_idle();
+    }
+
+    stepper_tracker hopper_steps {hopper_stepper};
+    stepper_tracker damper_steps {damper_stepper};
+    int64_t auger_total {0};
+    bool auger_was_moving {false};
+
+    const int64_t step_us = opts.step_ms*1000;
+    const int64_t trace_us = static_cast<int64_t>(opts.trace_s)*1000000;
+    const int64_t end_us = static_cast<int64_t>(opts.hours*3600e6);
+    int64_t next_trace_us {0};
+    const int64_t dropout_start_us = opts.dropout_min > 0 ? end_us/3 : end_us;
+    const int64_t dropout_end_us = dropout_start_us + static_cast<int64_t>(opts.dropout_min*60e6);
+    const int64_t log_export_us = std::max<int64_t>(end_us - SIM_LOG_EXPORT_LEAD_S*1000000ll, 0);
+    bool log_requested {false};
+
+    const int64_t start_us = sys_clock::now_us();
+    for (int64_t now_us = start_us; now_us < end_us; now_us += step_us) {
+        // The phone leaves, comes back and asks for what it missed
+        if (phone != 0 && now_us >= dropout_start_us && now_us < dropout_end_us) {
+            phone_link.receive();
+            sim_hal::spp_disconnect(phone);
+            phone = 0;
+            phone_link.backfill_from_s = now_us/1000000;
+        }
+        if (phone == 0 && now_us >= dropout_end_us) {
+            phone = sim_hal::spp_connect();
+            phone_link.handle = phone;
+            phone_link.backfill_to_s = now_us/1000000 - 1;
+            const in_msg_history_request request {MSG_HISTORY_REQUEST, phone_link.backfill_from_s, phone_link.backfill_to_s};
+            const size_t request_len = bt_frame_encode(1, reinterpret_cast<const uint8_t*>(&request), sizeof(request),
+                    frame, sizeof(frame));
+            sim_hal::spp_receive(phone, frame, request_len);
+        }
+
+        // The phone pulls this boot's cook log before the end
+        if (phone != 0 && !log_requested && now_us >= log_export_us) {
+            const in_msg_log_request request {MSG_LOG_REQUEST, flash_log.stats().boot};
+            const size_t request_len = bt_frame_encode(2, reinterpret_cast<const uint8_t*>(&request), sizeof(request),
+                    frame, sizeof(frame));
+            sim_hal::spp_receive(phone, frame, request_len);
+            log_requested = true;
+        }
+
+        // The phone walks out of range now and then
+        if (opts.congest_s > 0)
+            sim_hal::spp_set_congested(phone, now_us/1000000 % SIM_CONGESTION_PERIOD_S < opts.congest_s);
+
+        // Read the actuators back from the peripherals
+        const sim_hal::ledc_channel_state fan = sim_hal::ledc_channel(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_0);
+        const uint32_t fan_bits = sim_hal::ledc_timer(LEDC_HIGH_SPEED_MODE, fan.timer_sel).duty_resolution;
+        const float fan_duty = (fan.configured && !fan.stopped && fan_bits) ?
+                static_cast<float>(fan.duty)/(1u << fan_bits) : 0.0f;
+
+        // DIR low opens the damper and feeds the auger
+        damper_position = std::clamp<int64_t>(damper_position + damper_steps.take(), 0, SIM_DAMPER_TRAVEL_STEPS);
+        const int64_t fed = std::max<int64_t>(hopper_steps.take(), 0);
+        auger_total += fed;
+        if (fed > 0 && !auger_was_moving)
+            summary.feeds++;
+        auger_was_moving = fed > 0;
+
+        plant_inputs inputs;
+        inputs.fan_duty = fan_duty;
+        inputs.damper_open = static_cast<float>(damper_position)/SIM_DAMPER_TRAVEL_STEPS;
+        inputs.auger_revs = static_cast<float>(fed)/(A4988_STEPS_PER_REV*A4988_MICROSTEPS);
+        model.step(opts.step_ms/1000.0f, inputs);
+
+        const plant_state s = model.state();
+        const float err = s.chamber_C - opts.set_point_C;
+        if (summary.first_in_band_s < 0 && std::fabs(err) <= 5)
+            summary.first_in_band_s = now_us/1e6;
+        if (summary.settled_s < 0 && std::fabs(err) <= 5)
+            summary.settled_s = now_us/1e6;
+        else if (std::fabs(err) > 5)
+            summary.settled_s = -1;
+        if (summary.first_in_band_s >= 0) {
+            summary.max_overshoot_C = std::max(summary.max_overshoot_C, err);
+            summary.sq_err_sum += err*err;
+            summary.sq_err_count++;
+        }
+        if (phone_link.autotune_end_s >= 0) {
+            summary.tuned_max_err_C = std::max(summary.tuned_max_err_C, std::fabs(err));
+            summary.tuned_sq_err_sum += err*err;
+            summary.tuned_sq_err_count++;
+        }
+
+        if (now_us >= next_trace_us) {
+            const tc_filtered_set reading = thermocouple_sampler.latest();
+            receive_all();
+            if (trace.is_open()) {
+                char row[256];
+                std::snprintf(row, sizeof(row), "%.1f,%d,%.2f,%.2f,%.2f,%.2f,%.1f,%.0f,%.2f,%.2f,%.0f,%.2f\n",
+                        now_us/1e6, opts.set_point_C, s.chamber_C, tc_chamber_reading(reading).thermocouple_C,
+                        s.meat_C[0], s.meat_C[1], fan_duty*100, inputs.damper_open*100,
+                        static_cast<double>(auger_total)/(A4988_STEPS_PER_REV*A4988_MICROSTEPS), s.fuel_g, s.heat_W,
+                        telemetry_temp_C(phone_link.decoder.state().temp_qc[0]));
+                trace << row;
+            }
+            next_trace_us += trace_us;
+        }
+
+        sys_clock::sleep_until(now_us + step_us);
+        if (opts.realtime)
+            std::this_thread::sleep_until(wall_start + std::chrono::microseconds(now_us + step_us - start_us));
+    }
+
+    // The socket transport finishes its writes in wall time
+    if (host_link)
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    receive_all();
+    keep_resume_state();
+    print_summary(model, "Cook finished");
+
+    // The firmware threads never return, leave without unwinding them
+    std::_Exit(0);
+}
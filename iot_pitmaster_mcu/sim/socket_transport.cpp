@@ -0,0 +1,202 @@
+/**
+ * @file socket_transport.cpp
+ * @brief The app protocol over a Unix domain or loopback TCP socket
+ * 
+ */
+#include "socket_transport.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// Bytes read from a connection at a time
+#define SOCKET_READ_CHUNK   (512)
+
+// Opens the listener and starts the poll thread
+bool socket_transport::start(transport_sink& sink) {
+    if (this->m_path.empty()) {
+        this->m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        const int reuse {1};
+        setsockopt(this->m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(this->m_port);
+        if (this->m_listen_fd < 0 || bind(this->m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::cout << "Error: could not listen on TCP port " << this->m_port << ", " << std::strerror(errno) << ".\n\n";
+            return false;
+        }
+        socklen_t addr_len = sizeof(addr);
+        getsockname(this->m_listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+        this->m_port = ntohs(addr.sin_port);
+    }
+    else {
+        sockaddr_un addr {};
+        if (this->m_path.size() >= sizeof(addr.sun_path)) {
+            std::cout << "Error: socket path " << this->m_path << " is too long.\n\n";
+            return false;
+        }
+        this->m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, this->m_path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(this->m_path.c_str());
+        if (this->m_listen_fd < 0 || bind(this->m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::cout << "Error: could not listen on " << this->m_path << ", " << std::strerror(errno) << ".\n\n";
+            return false;
+        }
+    }
+    if (listen(this->m_listen_fd, 4) != 0 || pipe(this->m_wake_fd) != 0) {
+        std::cout << "Error: could not start the " << this->name() << " transport, " << std::strerror(errno) << ".\n\n";
+        return false;
+    }
+    fcntl(this->m_wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(this->m_wake_fd[1], F_SETFL, O_NONBLOCK);
+
+    this->m_sink = &sink;
+    std::thread([this]() {this->run();}).detach();
+    return true;
+}
+
+void socket_transport::wake() {
+    const uint8_t byte {0};
+    // A full pipe already wakes the thread
+    (void)!::write(this->m_wake_fd[1], &byte, 1);
+}
+
+// Delivers the events writers raised, outside the lock
+void socket_transport::deliver_events() {
+    while (true) {
+        event next {};
+        {
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            if (this->m_events.empty())
+                return;
+            next = this->m_events.front();
+            this->m_events.pop_front();
+        }
+        if (next.type == EVENT_WRITE_DONE)
+            this->m_sink->on_write_done(*this, next.handle, next.ok, next.congested);
+        else
+            this->m_sink->on_congestion(*this, next.handle, next.congested);
+    }
+}
+
+// Poll thread: accepts, reads, finishes writes and delivers every event
+void socket_transport::run() {
+    std::vector<pollfd> fds;
+    std::vector<uint32_t> handles;
+    uint8_t chunk[SOCKET_READ_CHUNK];
+    while (true) {
+        fds.assign({{this->m_listen_fd, POLLIN, 0}, {this->m_wake_fd[0], POLLIN, 0}});
+        handles.assign(2, 0);
+        {
+            std::lock_guard<std::mutex> lock(this->m_lock);
+            for (const auto& [handle, conn] : this->m_connections) {
+                fds.push_back({conn.fd, static_cast<short>(POLLIN | (conn.pending.empty() ? 0 : POLLOUT)), 0});
+                handles.push_back(handle);
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            std::cout << "Error: polling the " << this->name() << " transport failed, " << std::strerror(errno) << ".\n\n";
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            while (read(this->m_wake_fd[0], chunk, sizeof(chunk)) > 0) {}
+        }
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(this->m_listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                if (this->m_path.empty()) {
+                    const int no_delay {1};
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+                }
+                uint32_t handle {0};
+                {
+                    std::lock_guard<std::mutex> lock(this->m_lock);
+                    handle = this->m_next_handle++;
+                    this->m_connections[handle] = {fd, {}};
+                }
+                this->m_sink->on_open(*this, handle);
+            }
+        }
+
+        for (size_t i = 2; i < fds.size(); i++) {
+            const uint32_t handle = handles[i];
+            bool closed = fds[i].revents & (POLLERR | POLLNVAL);
+
+            // The rest of a write, the connection stays congested until it is all out
+            // Queued behind the write's own completion, so the two arrive in order
+            if (!closed && (fds[i].revents & POLLOUT)) {
+                std::lock_guard<std::mutex> lock(this->m_lock);
+                connection& conn = this->m_connections[handle];
+                const ssize_t sent = send(conn.fd, conn.pending.data(), conn.pending.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent > 0)
+                    conn.pending.erase(conn.pending.begin(), conn.pending.begin() + sent);
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    closed = true;
+                if (conn.pending.empty() && !closed)
+                    this->m_events.push_back({EVENT_CONGESTION, handle, true, false});
+            }
+
+            if (!closed && (fds[i].revents & (POLLIN | POLLHUP))) {
+                const ssize_t len = recv(fds[i].fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (len > 0)
+                    this->m_sink->on_data(*this, handle, chunk, static_cast<size_t>(len));
+                else if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    closed = true;
+            }
+
+            if (closed) {
+                {
+                    std::lock_guard<std::mutex> lock(this->m_lock);
+                    close(fds[i].fd);
+                    this->m_connections.erase(handle);
+                }
+                this->m_sink->on_close(*this, handle);
+            }
+        }
+
+        this->deliver_events();
+    }
+}
+
+// Sends what the kernel takes now, the rest goes from the poll thread while the connection reports congestion
+bool socket_transport::write(const uint32_t handle, const uint8_t* data, const size_t len) {
+    {
+        std::lock_guard<std::mutex> lock(this->m_lock);
+        const auto found = this->m_connections.find(handle);
+        // One write at a time, the last one is still going out
+        if (found == this->m_connections.end() || !found->second.pending.empty())
+            return false;
+        connection& conn = found->second;
+        ssize_t sent = send(conn.fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        sent = std::max<ssize_t>(sent, 0);
+        conn.pending.assign(data + sent, data + len);
+        this->m_events.push_back({EVENT_WRITE_DONE, handle, true, !conn.pending.empty()});
+    }
+    this->wake();
+    return true;
+}
+
+// Shuts the connection down, the poll thread closes it and delivers on_close
+void socket_transport::disconnect(const uint32_t handle) {
+    std::lock_guard<std::mutex> lock(this->m_lock);
+    const auto found = this->m_connections.find(handle);
+    if (found != this->m_connections.end())
+        shutdown(found->second.fd, SHUT_RDWR);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file socket_transport.hpp
+ * @brief The app protocol over a Unix domain or loopback TCP socket
+ * 
+ * Host builds only. Listens on a socket path or a 127.0.0.1 port and
+ * treats every accepted connection like a phone, so a test tool on the
+ * PC can drive the firmware with the same frames the app sends. One
+ * thread polls the listener and every connection, and delivers all the
+ * events, like the Bluedroid BTC task does for SPP. A write the kernel
+ * cannot take whole is kept and finished from that thread, and the
+ * connection reports congestion until it is, so a slow reader never
+ * blocks the control loops.
+ */
+#ifndef __SOCKET_TRANSPORT_HPP__
+#define __SOCKET_TRANSPORT_HPP__
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "transport.hpp"
+
+class socket_transport : public transport {
+
+    private:
+
+        struct connection {
+            int fd;
+            std::vector<uint8_t> pending; // the rest of a write the kernel did not take
+        };
+
+        enum event_type {
+            EVENT_WRITE_DONE,
+            EVENT_CONGESTION
+        };
+
+        struct event {
+            event_type type;
+            uint32_t handle;
+            bool ok;
+            bool congested;
+        };
+
+        std::string m_path; // empty for TCP
+        uint16_t m_port {0};
+        transport_sink* m_sink {nullptr};
+        int m_listen_fd {-1};
+        int m_wake_fd[2] {-1, -1}; // written to wake the poll thread
+
+        std::mutex m_lock;
+        std::map<uint32_t, connection> m_connections;
+        std::deque<event> m_events; // raised by writers, delivered by the poll thread
+        uint32_t m_next_handle {1};
+
+        // Poll thread: accepts, reads, finishes writes and delivers every event
+        void run();
+
+        void wake();
+
+        // Delivers the events writers raised, outside the lock
+        void deliver_events();
+
+    public:
+
+        // Listens on a Unix domain socket, replacing a stale one at the path
+        inline explicit socket_transport(const std::string& path) {
+            this->m_path = path;
+        }
+
+        // Listens on 127.0.0.1
+        inline explicit socket_transport(const uint16_t port) {
+            this->m_port = port;
+        }
+
+        socket_transport(const socket_transport&) = delete;
+        socket_transport& operator=(const socket_transport&) = delete;
+
+        inline const char* name() const override {
+            return this->m_path.empty() ? "TCP" : "Unix socket";
+        }
+
+        // Opens the listener and starts the poll thread
+        bool start(transport_sink& sink) override;
+
+        // Sends what the kernel takes now, the rest goes from the poll thread while the connection reports congestion
+        bool write(uint32_t handle, const uint8_t* data, size_t len) override;
+
+        // Shuts the connection down, the poll thread closes it and delivers on_close
+        void disconnect(uint32_t handle) override;
+
+        // The port listened on, the one the kernel picked if 0 was asked for
+        uint16_t port() const {
+            return this->m_port;
+        }
+};
+
+#endif /* __SOCKET_TRANSPORT_HPP__ */
@@ -28,6 +28,9 @@
 // Print line for setting the pwm duty cycle
 #define DEBUG_PWM (0)
 
+// Print the PID output every fan loop tick
+#define DEBUG_PID (0)
+
 
 
 
@@ -36,5 +39,9 @@
 // Always send 315 Celsius (etc.) over Bluetooth
 #define DEBUG_SEND_HARDCODED_TEMP (0)
 
+// Carry the app protocol over the USB UART instead of running the test console
+// The console output shares the port, a host skips it looking for the next frame
+#define DEBUG_LINK_UART (0)
+
 
 #endif /* __DEBUG_HPP__ */
\ No newline at end of file
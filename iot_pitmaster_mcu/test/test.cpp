@@ -1,21 +1,50 @@
+#include <algorithm>
 #include <chrono>
+#include <iomanip>
+#include <iterator>
 #include <sstream>
+#include <string>
 #include <thread>
 
 #include "driver/uart.h"
 #include "esp_vfs_dev.h"
 #include "linenoise/linenoise.h"
+#include "xtensa/hal.h"
 
 #include "a4988_driver.hpp"
 #include "bluetooth.hpp"
+#include "cook_log.hpp"
 #include "max31855.hpp"
+#include "pid.hpp"
 #include "pid_control.hpp"
+#include "power.hpp"
 #include "pwm.hpp"
+#include "sys_clock.hpp"
 
 using namespace std::chrono_literals;
 
+// PID core steps timed by pid_cycles
+#define TEST_PID_CYCLES_STEPS (1000)
+
 namespace test {
 
+// Average CPU cycles of one PID core step in T, with the reading walking around the set point
+template <typename T>
+static uint32_t pid_step_cycles() {
+    // Static, so the steps have somewhere to go and are not optimized out
+    static pid<T> core;
+    core.configure(controller_tuning(pid_gains {}), 1.0f/PID_FAN_LOOP_HZ);
+    const T set_point(110.0f);
+    T pv[64];
+    for (uint32_t i = 0; i < 64; i++)
+        pv[i] = T(108.5f + 0.05f*i);
+
+    const uint32_t start = xthal_get_ccount();
+    for (uint32_t i = 0; i < TEST_PID_CYCLES_STEPS; i++)
+        core.step(set_point, pv[i & 63]);
+    return (xthal_get_ccount() - start)/TEST_PID_CYCLES_STEPS;
+}
+
 void test_a4988_driver(a4988_driver& driver) {
     while(true) {
         driver.set_not_en(0);
@@ -83,6 +112,56 @@ void quick_test_motors(pwm& blowfan, a4988_driver& hopper_controller, a4988_driv
     while(true) {std::this_thread::sleep_for(2s);}
 }
 
+void print_temp(const std::string& name, const max31855_data_t& data) {
+    if (data.fault)
+        std::cout << "Name: " << name << "\nFault\n\n";
+    else
+        std::cout << "Name: " << name << "\nCelsius: " << data.thermocouple_C <<
+                ", Fahrenheit: " << data.thermocouple_C * 1.8f + 32.0f << "\n\n";
+}
+
+void print_loop_stats(loop_scheduler& scheduler) {
+    for (uint8_t i = 0; i < scheduler.count(); i++) {
+        const loop_stats stats = scheduler.stats(i);
+        const uint32_t ticks = stats.ticks > 0 ? stats.ticks : 1;
+        std::cout << scheduler.name(i) << " loop: " << 1000000 / stats.period_us << " Hz, ticks " << stats.ticks <<
+                ", overruns " << stats.overruns << ", skipped " << stats.skipped <<
+                "\n  run avg " << stats.total_run_us / ticks << " us, max " << stats.max_run_us << " us" <<
+                "\n  jitter max " << stats.max_jitter_us << " us, overrun max " << stats.max_overrun_us << " us" <<
+                "\n  bucket (us)   jitter  overrun\n";
+        for (size_t b = 0; b < LOOP_HIST_BUCKETS; b++) {
+            const std::string edge = b < loop_hist_edges_us.size() ? "< " + std::to_string(loop_hist_edges_us[b]) :
+                    ">= " + std::to_string(loop_hist_edges_us.back());
+            std::cout << "  " << std::left << std::setw(10) << edge << std::right << std::setw(9) << stats.jitter_hist[b] <<
+                    std::setw(9) << stats.overrun_hist[b] << "\n";
+        }
+        std::cout << "\n";
+    }
+}
+
+// Prints the cook log from a boot on, straight from the flash map
+void print_cook_log(cook_log& log, const uint16_t from_boot) {
+    static const char* const type_names[] = {"?", "sample", "boot", "set point", "shutdown"};
+    log.flush();
+    cook_log_cursor cursor = log.begin();
+    const cook_log_record* records {nullptr};
+    size_t printed {0};
+    while (const size_t count = log.read(cursor, records, COOK_LOG_SECTOR_SLOTS)) {
+        for (size_t i = 0; i < count; i++) {
+            const cook_log_record& record = records[i];
+            if (record.boot < from_boot)
+                continue;
+            const char* const type_name = record.type < std::size(type_names) ? type_names[record.type] : "?";
+            std::cout << "boot " << record.boot << " " << record.t_s << " s " << type_name << ": " <<
+                    record.temp_qc[0]/4.0 << " " << record.temp_qc[1]/4.0 << " " << record.temp_qc[2]/4.0 <<
+                    " C, fan " << static_cast<int>(record.fan_duty) << ", status 0x" << std::hex <<
+                    static_cast<int>(record.status) << std::dec << "\n";
+            printed++;
+        }
+    }
+    std::cout << printed << " records\n\n";
+}
+
 void debug_print_loop(pid_control& main_pid_control) {
     
     // Necessary magic to make the console function properly
@@ -141,6 +220,170 @@ void debug_print_loop(pid_control& main_pid_control) {
             continue;
         }
 
+        // Print latency stats for the hopper task queue
+        if (signal_name == "task_stats") {
+            task_queue& queue = main_pid_control.hopper_task_queue();
+            const task_queue_stats stats = queue.stats();
+            const uint32_t executed = stats.executed > 0 ? stats.executed : 1;
+            std::cout << queue.name() << " tasks: executed " << stats.executed << ", pending " << stats.pending <<
+                    ", rejected " << stats.rejected << ", cancelled " << stats.cancelled <<
+                    "\n  wait avg " << stats.total_wait_us / executed << " us, max " << stats.max_wait_us << " us" <<
+                    "\n  run avg " << stats.total_run_us / executed << " us, max " << stats.max_run_us << " us\n\n";
+            continue;
+        }
+
+        // Print where the damper is and the moves it made
+        if (signal_name == "damper_state") {
+            damper& actuator = main_pid_control.damper_actuator();
+            const damper_stats stats = actuator.stats();
+            std::cout << "Damper: " << (actuator.homed() ? "" : "not homed, ") << static_cast<int>(actuator.position_pct()) <<
+                    "% (" << actuator.position_steps() << " of " << DAMPER_TRAVEL_STEPS << " sixteenth steps), target " <<
+                    static_cast<int>(actuator.target_pct()) << "%" << (actuator.is_moving() ? ", moving" : "") <<
+                    "\n  " << stats.homes << " homes, " << stats.moves << " moves, " << stats.steps << " sixteenth steps, " <<
+                    stats.replaced << " targets replaced, " << stats.unmoved << " already there\n\n";
+            continue;
+        }
+
+        // Print the fuel rate asked for and delivered
+        if (signal_name == "fuel_state") {
+            const fuel_feeder& feeder = main_pid_control.feeder();
+            const fuel_feeder_stats stats = feeder.stats();
+            std::cout << "Fuel: " << feeder.commanded_g_per_min() << " g/min asked for, " <<
+                    feeder.delivered_g_per_min() << " g/min delivered over " << FUEL_RATE_WINDOW_MIN << " min" <<
+                    "\n  " << stats.doses << " doses, " << stats.commanded_g << " g asked for, " <<
+                    stats.delivered_g << " g delivered\n\n";
+            continue;
+        }
+
+        // Find the damper's closed stop again
+        if (signal_name == "damper_home") {
+            main_pid_control.damper_actuator().home();
+            continue;
+        }
+
+        // Print timing of the control loops
+        if (signal_name == "sched_stats") {
+            print_loop_stats(main_pid_control.scheduler());
+            continue;
+        }
+
+        // Clear the control loop timing
+        if (signal_name == "sched_reset") {
+            main_pid_control.scheduler().reset_stats();
+            continue;
+        }
+
+        // Print how often each task woke and how long it stayed awake
+        if (signal_name == "activity") {
+            const int64_t now_us = sys_clock::now_us();
+            const float counted_s = std::max(now_us - sys_clock::activity.start_us(), int64_t {1}) / 1e6f;
+            std::cout << "Activity over " << counted_s << " s:\n";
+            for (uint8_t i = 0; i < sys_clock::activity.count(); i++) {
+                const activity_stats stats = sys_clock::activity.stats(i);
+                std::cout << "  " << stats.name << ": " << stats.wakeups / counted_s << " wakeups/s, awake " <<
+                        100.0f * stats.awake_us / (counted_s * 1e6f) << "%, asleep " << stats.asleep_us / 1000 <<
+                        " ms, max awake " << stats.max_awake_us << " us\n";
+            }
+            std::cout << "\n";
+            continue;
+        }
+
+        // Clear the activity counters
+        if (signal_name == "activity_reset") {
+            sys_clock::activity.reset(sys_clock::now_us());
+            continue;
+        }
+
+        // Print counters of the received Bluetooth frame stream
+        if (signal_name == "bt_stats") {
+            const bt_rx_stats& stats = bt::rx_stats();
+            std::cout << "BT RX: " << stats.bytes << " bytes, " << stats.frames << " frames (" << stats.zero_copy_frames <<
+                    " zero-copy)\n  sync errors " << stats.sync_errors << ", length errors " << stats.length_errors <<
+                    ", CRC errors " << stats.crc_errors << ", overflow bytes " << stats.overflows <<
+                    "\n  sequence gaps " << stats.sequence_gaps << ", duplicates " << stats.duplicates << "\n\n";
+            const bt_tx_stats tx = bt::tx_stats();
+            std::cout << "BT TX: " << tx.queued << " queued, " << tx.sent << " sent (" << tx.sent_bytes << " bytes)\n" <<
+                    "  coalesced " << tx.coalesced << ", evicted " << tx.evicted << ", dropped " << tx.dropped <<
+                    ", write errors " << tx.write_errors << ", latest lost " << tx.latest_lost <<
+                    "\n  congestion events " << tx.congestion_events <<
+                    ", max depth " << tx.max_depth << "\n\n";
+            continue;
+        }
+
+        if (signal_name == "history_stats") {
+            const history_stats stats = main_pid_control.history()->stats();
+            std::cout << "History: " << stats.held_samples << " samples held in " << stats.held_bytes << " bytes, " <<
+                    stats.oldest_s << " s to " << stats.newest_s << " s\n  " << stats.samples << " recorded, " <<
+                    stats.dropped_blocks << " blocks dropped\n\n";
+            continue;
+        }
+
+        if (signal_name == "log_stats") {
+            const cook_log_stats stats = main_pid_control.flash_log()->stats();
+            std::cout << "Cook log: boot " << stats.boot << ", " << stats.appended << " records appended, " <<
+                    stats.page_writes << " page writes, " << stats.flushes << " flushes\n  " << stats.erases <<
+                    " erases over " << stats.sectors << " sectors, most erased " << stats.max_erase_count <<
+                    " times, write errors " << stats.write_errors << "\n\n";
+            continue;
+        }
+
+        if (signal_name == "pid_state") {
+            const pid_gains gains = main_pid_control.gains();
+            const pid_store_stats stats = main_pid_control.store()->stats();
+            std::cout << "Controller: kp " << gains.kp << ", ki " << gains.ki << ", kd " << gains.kd << ", set point " <<
+                    main_pid_control.set_point() << " C, integral " << main_pid_control.integral_pct() << "%\n  " <<
+                    (stats.loaded ? "restored" : "not restored") << ", " << stats.writes << " NVS writes in " <<
+                    stats.offers << " offers, write errors " << stats.write_errors << "\n\n";
+            continue;
+        }
+
+        // Times the PID core in float and in fixed point, what an FPU-less chip saves shows here
+        if (signal_name == "pid_cycles") {
+            std::cout << "PID step: " << pid_step_cycles<float>() << " cycles in float, " << pid_step_cycles<q16_16>() <<
+                    " cycles in Q16.16\n\n";
+            continue;
+        }
+
+        if (signal_name == "autotune_state") {
+            const autotune_result tune = main_pid_control.autotune();
+            std::cout << "Autotune: state " << static_cast<int>(tune.state) << ", rule " << static_cast<int>(tune.rule) <<
+                    ", " << static_cast<int>(tune.cycles) << " cycles\n  Ku " << tune.ku << ", Tu " << tune.tu_s <<
+                    " s, amplitude " << tune.amplitude_C << " C, fan bias " << tune.bias_pct << "%\n  tuned Kp " <<
+                    tune.gains.kp << ", Ki " << tune.gains.ki << ", Kd " << tune.gains.kd << "\n\n";
+            continue;
+        }
+
+        // Simulate receive stop autotune BT message
+        if (signal_name == "autotune_stop") {
+            in_msg_autotune msg {MSG_AUTOTUNE, false, 0, 0};
+            main_pid_control.handle_bt_msg(&msg);
+            continue;
+        }
+
+        // Print every probe on the bus with its settings and latest filtered sample
+        if (signal_name == "probes") {
+            static const char* const role_names[] = {"off", "chamber", "meat"};
+            const tc_probe_table configs = main_pid_control.thermocouples()->configs();
+            const tc_filtered_set latest = main_pid_control.thermocouples()->latest();
+            for (uint8_t i = 0; i < main_pid_control.thermocouples()->bus()->count(); i++) {
+                const tc_probe_config& config = configs[i];
+                std::cout << "Probe " << static_cast<int>(i) << ": " << role_names[config.role] << ", " <<
+                        static_cast<int>(config.rate_hz) << " Hz, alarms " << config.alarm_low_C << " to " <<
+                        config.alarm_high_C << " C\n";
+                if (latest.active & (1 << i))
+                    print_temp(main_pid_control.probe(i)->name(), latest.probes[i]);
+            }
+            print_temp("Chamber, averaged", tc_chamber_reading(latest));
+            continue;
+        }
+
+        if (signal_name == "telemetry_stats") {
+            const telemetry_stats& stats = main_pid_control.telemetry();
+            std::cout << "Telemetry: " << stats.keyframes << " keyframes, " << stats.deltas << " deltas, " <<
+                    stats.suppressed << " suppressed, " << stats.bytes << " bytes\n\n";
+            continue;
+        }
+
         // Simulate receive input fuel BT message
         if (signal_name == "input_fuel") {
             in_msg_hopper msg {MSG_HOPPER, true}; // true means input fuel
@@ -176,33 +419,6 @@ void debug_print_loop(pid_control& main_pid_control) {
             continue;
         }
 
-        // Test Bluetooth write for chamber
-        if (signal_name == "send_bt_chamber") {
-            // Send some sample data from the chamber thermocouple
-            max31855_data_t test_temp_data = main_pid_control.tc_chamber()->read();
-            out_msg_temp_C out_msg {MSG_CHAMBER_TEMP, test_temp_data};
-            bt::send_data(out_msg);
-            continue;
-        }
-
-        // Test Bluetooth write for meat1
-        if (signal_name == "send_bt_meat1") {
-            // send some sample data from the meat1 thermocouple
-            max31855_data_t test_temp_data = main_pid_control.tc_meat1()->read();
-            out_msg_temp_C out_msg {MSG_CHAMBER_TEMP, test_temp_data};
-            bt::send_data(out_msg);
-            continue;
-        }
-
-        // Test Bluetooth write for meat2
-        if (signal_name == "send_bt_meat2") {
-            // Send some sample data from the meat2 thermocouple
-            max31855_data_t test_temp_data = main_pid_control.tc_meat2()->read();
-            out_msg_temp_C out_msg {MSG_CHAMBER_TEMP, test_temp_data};
-            bt::send_data(out_msg);
-            continue;
-        }
-
         // Everything else needs a level (motor speed, motor on/off status, or thermocouple)
         try{level = std::stoi(level_str);}
         catch(...) {
@@ -220,6 +436,8 @@ void debug_print_loop(pid_control& main_pid_control) {
                 std::cout << "Error: Blowfan duty cycle must be between 0 and 100.\n";
             }
         }
+        else if (signal_name == "pwm_freq")
+            main_pid_control.blowfan()->set_frequency(level);
 
         /* HOPPER MOTOR COMMANDS */
         else if (signal_name == "h_not_en")
@@ -230,6 +448,8 @@ void debug_print_loop(pid_control& main_pid_control) {
             main_pid_control.hopper_controller()->set_ms2(level);
         else if (signal_name == "h_ms3")
             main_pid_control.hopper_controller()->set_ms3(level);
+        else if (signal_name == "h_step_mode") // 0 full to 4 sixteenth steps
+            main_pid_control.hopper_controller()->set_step_mode(static_cast<step_mode>(level));
         else if (signal_name == "h_not_rst")
             main_pid_control.hopper_controller()->set_not_rst(level);
         else if (signal_name == "h_not_slp")
@@ -246,6 +466,8 @@ void debug_print_loop(pid_control& main_pid_control) {
             main_pid_control.damper_controller()->set_ms2(level);
         else if (signal_name == "d_ms3")
             main_pid_control.damper_controller()->set_ms3(level);
+        else if (signal_name == "d_step_mode") // 0 full to 4 sixteenth steps
+            main_pid_control.damper_controller()->set_step_mode(static_cast<step_mode>(level));
         else if (signal_name == "d_not_rst")
             main_pid_control.damper_controller()->set_not_rst(level);
         else if (signal_name == "d_not_slp")
@@ -253,13 +475,66 @@ void debug_print_loop(pid_control& main_pid_control) {
         else if (signal_name == "d_dir")
             main_pid_control.damper_controller()->set_dir(level); // 1 is clockwise, 0 is counterclockwise
 
-        // THERMOCOUPLES
-        else if (signal_name == "chamber" && level == 1)
-            std::future<max31855_data_t> temp = main_pid_control.tc_chamber()->async_read();
-        else if (signal_name == "meat" && level == 1)
-            std::future<max31855_data_t> temp = main_pid_control.tc_meat1()->async_read();
-        else if (signal_name == "meat" && level == 2)
-            std::future<max31855_data_t> temp = main_pid_control.tc_meat2()->async_read();
+        // Simulate receive damper position BT message, 0 closed to 100 fully open
+        else if (signal_name == "damper") {
+            if (level >= 0 && level <= 100) {
+                in_msg_damper_position msg {MSG_DAMPER_POSITION, static_cast<uint8_t>(level)};
+                main_pid_control.handle_bt_msg(&msg);
+            }
+            else {
+                std::cout << "Error: The damper position must be between 0 and 100.\n";
+            }
+        }
+
+        // THERMOCOUPLES, latest filtered sample of a probe slot
+        else if (signal_name == "probe" && main_pid_control.probe(level) != nullptr)
+            print_temp(main_pid_control.probe(level)->name(), main_pid_control.thermocouples()->latest().probes[level]);
+
+        // Test Bluetooth write for a probe slot
+        else if (signal_name == "send_bt_probe" && main_pid_control.probe(level) != nullptr) {
+            // Send some sample data from the probe
+            max31855_data_t test_temp_data = main_pid_control.probe(level)->read();
+            out_msg_temp_C out_msg {MSG_CHAMBER_TEMP, test_temp_data};
+            bt::send_data(out_msg);
+        }
+
+        // Simulate receive probe settings BT message: slot, then role, rate and low and high alarm, "off" for none
+        else if (signal_name == "probe_config") {
+            int values[4] {TC_ROLE_OFF, TC_SAMPLER_DEFAULT_HZ, TC_ALARM_OFF, TC_ALARM_OFF};
+            for (int& value : values) {
+                std::string token;
+                if (!(s >> token))
+                    break;
+                try {value = std::stoi(token);}
+                catch(...) {}
+            }
+            in_msg_probe_config msg {MSG_PROBE_CONFIG, static_cast<uint8_t>(level), {static_cast<uint8_t>(values[0]),
+                    static_cast<uint8_t>(values[1]), static_cast<int16_t>(values[2]), static_cast<int16_t>(values[3])}};
+            main_pid_control.handle_bt_msg(&msg);
+        }
+        else if (signal_name == "tc_rate")
+            main_pid_control.thermocouples()->rate(level);
+
+        // CONTROL LOOPS
+        else if (signal_name == "fan_hz")
+            main_pid_control.scheduler().rate(main_pid_control.fan_loop(), level);
+        else if (signal_name == "pit_hz")
+            main_pid_control.scheduler().rate(main_pid_control.pit_loop(), level);
+
+        // POWER MODE, 1 scales the clock and light sleeps between ticks
+        else if (signal_name == "power")
+            power::configure(level != 0);
+
+        // AUTOTUNE with the given rule, around the set point or 110 C before a cook
+        else if (signal_name == "autotune") {
+            const int16_t temp_C = main_pid_control.cook_started() ? main_pid_control.set_point() : 110;
+            in_msg_autotune msg {MSG_AUTOTUNE, true, static_cast<uint8_t>(level), temp_C};
+            main_pid_control.handle_bt_msg(&msg);
+        }
+
+        // COOK LOG, from the given boot on
+        else if (signal_name == "log_dump")
+            print_cook_log(*main_pid_control.flash_log(), level);
 
         // UNKNOWN
         else {